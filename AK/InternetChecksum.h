@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/Types.h>
+
+namespace AK {
+
+// Adds the data to a running ones' complement sum (RFC 1071). We add up 32-bit words
+// into a 64-bit accumulator and fold at the very end, which gives the same result as
+// adding 16-bit words with end-around carry, but needs far fewer operations.
+// The ones' complement sum doesn't care about byte order, so the sum (and thus the
+// checksum) comes out in network byte order when stored in memory.
+inline u64 internet_checksum_add(const void* ptr, size_t count, u64 sum = 0)
+{
+    auto* bytes = (const u8*)ptr;
+    while (count >= 16) {
+        u32 words[4];
+        __builtin_memcpy(words, bytes, sizeof(words));
+        sum += words[0];
+        sum += words[1];
+        sum += words[2];
+        sum += words[3];
+        bytes += 16;
+        count -= 16;
+    }
+    while (count >= 4) {
+        u32 word;
+        __builtin_memcpy(&word, bytes, sizeof(word));
+        sum += word;
+        bytes += 4;
+        count -= 4;
+    }
+    if (count >= 2) {
+        u16 word;
+        __builtin_memcpy(&word, bytes, sizeof(word));
+        sum += word;
+        bytes += 2;
+        count -= 2;
+    }
+    if (count) {
+        // A trailing odd byte is padded with a zero byte.
+        u16 word = 0;
+        __builtin_memcpy(&word, bytes, 1);
+        sum += word;
+    }
+    return sum;
+}
+
+// Folds a sum from internet_checksum_add() down to 16 bits, in network byte order.
+constexpr u16 internet_checksum_fold(u64 sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return sum;
+}
+
+// Returns the checksum in network byte order, ready to be stored in a packet.
+inline u16 internet_checksum(const void* ptr, size_t count)
+{
+    return ~internet_checksum_fold(internet_checksum_add(ptr, count));
+}
+
+}
+
+using AK::internet_checksum_add;
+using AK::internet_checksum_fold;
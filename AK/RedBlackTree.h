@@ -0,0 +1,464 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/Assertions.h>
+#include <AK/Noncopyable.h>
+#include <AK/Optional.h>
+#include <AK/StdLibExtras.h>
+#include <AK/Types.h>
+
+namespace AK {
+
+template<typename TreeType, typename NodeType, typename ElementType>
+class RedBlackTreeIterator {
+public:
+    RedBlackTreeIterator() = default;
+    bool operator!=(const RedBlackTreeIterator& other) const { return m_node != other.m_node; }
+    bool operator==(const RedBlackTreeIterator& other) const { return m_node == other.m_node; }
+    RedBlackTreeIterator& operator++()
+    {
+        m_node = TreeType::successor(m_node);
+        return *this;
+    }
+    ElementType& operator*() { return m_node->value; }
+    ElementType* operator->() { return &m_node->value; }
+    auto key() const { return m_node->key; }
+    bool is_end() const { return !m_node; }
+
+private:
+    friend TreeType;
+    explicit RedBlackTreeIterator(NodeType* node)
+        : m_node(node)
+    {
+    }
+    NodeType* m_node { nullptr };
+};
+
+// An ordered map from unique keys to values, kept balanced so that lookups,
+// insertions and removals are all O(log n). Besides exact lookups it can find
+// the closest key on either side, which makes it suitable for address-keyed
+// interval lookups.
+template<typename K, typename V>
+class RedBlackTree {
+    AK_MAKE_NONCOPYABLE(RedBlackTree);
+
+private:
+    struct Node {
+        Node(K k, V&& v)
+            : key(k)
+            , value(move(v))
+        {
+        }
+        K key;
+        V value;
+        Node* parent { nullptr };
+        Node* left { nullptr };
+        Node* right { nullptr };
+        bool is_red { true };
+    };
+
+public:
+    RedBlackTree() = default;
+    ~RedBlackTree() { clear(); }
+
+    RedBlackTree(RedBlackTree&& other)
+        : m_root(exchange(other.m_root, nullptr))
+        , m_size(exchange(other.m_size, 0))
+    {
+    }
+
+    RedBlackTree& operator=(RedBlackTree&& other)
+    {
+        if (this != &other) {
+            clear();
+            m_root = exchange(other.m_root, nullptr);
+            m_size = exchange(other.m_size, 0);
+        }
+        return *this;
+    }
+
+    size_t size() const { return m_size; }
+    bool is_empty() const { return !m_root; }
+
+    void clear()
+    {
+        delete_subtree(m_root);
+        m_root = nullptr;
+        m_size = 0;
+    }
+
+    V& insert(K key, V&& value)
+    {
+        Node* parent = nullptr;
+        auto** slot = &m_root;
+        while (*slot) {
+            parent = *slot;
+            ASSERT(parent->key != key);
+            slot = key < parent->key ? &parent->left : &parent->right;
+        }
+        auto* node = new Node(key, move(value));
+        node->parent = parent;
+        *slot = node;
+        ++m_size;
+        insert_fixup(node);
+        return node->value;
+    }
+
+    V* find(K key)
+    {
+        auto* node = find_node(key);
+        return node ? &node->value : nullptr;
+    }
+
+    const V* find(K key) const
+    {
+        auto* node = find_node(key);
+        return node ? &node->value : nullptr;
+    }
+
+    bool contains(K key) const { return find_node(key); }
+
+    // Returns the value with the largest key that is <= key.
+    V* find_largest_not_above(K key)
+    {
+        auto* node = find_largest_not_above_node(key);
+        return node ? &node->value : nullptr;
+    }
+
+    const V* find_largest_not_above(K key) const
+    {
+        auto* node = find_largest_not_above_node(key);
+        return node ? &node->value : nullptr;
+    }
+
+    // Returns the value with the smallest key that is >= key.
+    V* find_smallest_not_below(K key)
+    {
+        auto* node = find_smallest_not_below_node(key);
+        return node ? &node->value : nullptr;
+    }
+
+    const V* find_smallest_not_below(K key) const
+    {
+        auto* node = find_smallest_not_below_node(key);
+        return node ? &node->value : nullptr;
+    }
+
+    bool remove(K key)
+    {
+        auto* node = find_node(key);
+        if (!node)
+            return false;
+        remove_node(node);
+        delete node;
+        return true;
+    }
+
+    Optional<V> take(K key)
+    {
+        auto* node = find_node(key);
+        if (!node)
+            return {};
+        remove_node(node);
+        V value = move(node->value);
+        delete node;
+        return move(value);
+    }
+
+    using Iterator = RedBlackTreeIterator<RedBlackTree, Node, V>;
+    friend Iterator;
+    Iterator begin() { return Iterator(minimum(m_root)); }
+    Iterator end() { return {}; }
+    Iterator find_iterator(K key) { return Iterator(find_node(key)); }
+    Iterator find_smallest_not_below_iterator(K key) { return Iterator(find_smallest_not_below_node(key)); }
+
+    using ConstIterator = RedBlackTreeIterator<const RedBlackTree, const Node, const V>;
+    friend ConstIterator;
+    ConstIterator begin() const { return ConstIterator(minimum(m_root)); }
+    ConstIterator end() const { return {}; }
+
+private:
+    template<typename NodeType>
+    static NodeType* minimum(NodeType* node)
+    {
+        if (!node)
+            return nullptr;
+        while (node->left)
+            node = node->left;
+        return node;
+    }
+
+    template<typename NodeType>
+    static NodeType* successor(NodeType* node)
+    {
+        if (node->right)
+            return minimum(node->right);
+        auto* parent = node->parent;
+        while (parent && node == parent->right) {
+            node = parent;
+            parent = parent->parent;
+        }
+        return parent;
+    }
+
+    static void delete_subtree(Node* node)
+    {
+        while (node) {
+            delete_subtree(node->right);
+            auto* left = node->left;
+            delete node;
+            node = left;
+        }
+    }
+
+    Node* find_node(K key) const
+    {
+        auto* node = m_root;
+        while (node && node->key != key)
+            node = key < node->key ? node->left : node->right;
+        return node;
+    }
+
+    Node* find_largest_not_above_node(K key) const
+    {
+        Node* candidate = nullptr;
+        auto* node = m_root;
+        while (node) {
+            if (node->key == key)
+                return node;
+            if (node->key < key) {
+                candidate = node;
+                node = node->right;
+            } else {
+                node = node->left;
+            }
+        }
+        return candidate;
+    }
+
+    Node* find_smallest_not_below_node(K key) const
+    {
+        Node* candidate = nullptr;
+        auto* node = m_root;
+        while (node) {
+            if (node->key == key)
+                return node;
+            if (key < node->key) {
+                candidate = node;
+                node = node->left;
+            } else {
+                node = node->right;
+            }
+        }
+        return candidate;
+    }
+
+    static bool is_red(const Node* node) { return node && node->is_red; }
+
+    void rotate_left(Node* node)
+    {
+        auto* pivot = node->right;
+        node->right = pivot->left;
+        if (pivot->left)
+            pivot->left->parent = node;
+        replace_child(node, pivot);
+        pivot->left = node;
+        node->parent = pivot;
+    }
+
+    void rotate_right(Node* node)
+    {
+        auto* pivot = node->left;
+        node->left = pivot->right;
+        if (pivot->right)
+            pivot->right->parent = node;
+        replace_child(node, pivot);
+        pivot->right = node;
+        node->parent = pivot;
+    }
+
+    // Puts replacement where node used to hang off its parent.
+    void replace_child(Node* node, Node* replacement)
+    {
+        auto* parent = node->parent;
+        if (!parent)
+            m_root = replacement;
+        else if (node == parent->left)
+            parent->left = replacement;
+        else
+            parent->right = replacement;
+        if (replacement)
+            replacement->parent = parent;
+    }
+
+    void insert_fixup(Node* node)
+    {
+        while (is_red(node->parent)) {
+            auto* parent = node->parent;
+            auto* grandparent = parent->parent;
+            if (parent == grandparent->left) {
+                auto* uncle = grandparent->right;
+                if (is_red(uncle)) {
+                    parent->is_red = false;
+                    uncle->is_red = false;
+                    grandparent->is_red = true;
+                    node = grandparent;
+                    continue;
+                }
+                if (node == parent->right) {
+                    node = parent;
+                    rotate_left(node);
+                    parent = node->parent;
+                }
+                parent->is_red = false;
+                grandparent->is_red = true;
+                rotate_right(grandparent);
+            } else {
+                auto* uncle = grandparent->left;
+                if (is_red(uncle)) {
+                    parent->is_red = false;
+                    uncle->is_red = false;
+                    grandparent->is_red = true;
+                    node = grandparent;
+                    continue;
+                }
+                if (node == parent->left) {
+                    node = parent;
+                    rotate_right(node);
+                    parent = node->parent;
+                }
+                parent->is_red = false;
+                grandparent->is_red = true;
+                rotate_left(grandparent);
+            }
+        }
+        m_root->is_red = false;
+    }
+
+    // Unlinks node from the tree without freeing it.
+    void remove_node(Node* node)
+    {
+        Node* child;
+        Node* child_parent;
+        bool removed_black;
+
+        if (!node->left || !node->right) {
+            child = node->left ? node->left : node->right;
+            child_parent = node->parent;
+            removed_black = !node->is_red;
+            replace_child(node, child);
+        } else {
+            // Splice out the in-order successor and put it where node was.
+            auto* next = minimum(node->right);
+            removed_black = !next->is_red;
+            child = next->right;
+            if (next->parent == node) {
+                child_parent = next;
+            } else {
+                child_parent = next->parent;
+                replace_child(next, next->right);
+                next->right = node->right;
+                next->right->parent = next;
+            }
+            replace_child(node, next);
+            next->left = node->left;
+            next->left->parent = next;
+            next->is_red = node->is_red;
+        }
+        --m_size;
+
+        if (removed_black)
+            remove_fixup(child, child_parent);
+    }
+
+    void remove_fixup(Node* node, Node* parent)
+    {
+        while (node != m_root && !is_red(node)) {
+            if (node == parent->left) {
+                auto* sibling = parent->right;
+                if (is_red(sibling)) {
+                    sibling->is_red = false;
+                    parent->is_red = true;
+                    rotate_left(parent);
+                    sibling = parent->right;
+                }
+                if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                    sibling->is_red = true;
+                    node = parent;
+                    parent = node->parent;
+                    continue;
+                }
+                if (!is_red(sibling->right)) {
+                    sibling->left->is_red = false;
+                    sibling->is_red = true;
+                    rotate_right(sibling);
+                    sibling = parent->right;
+                }
+                sibling->is_red = parent->is_red;
+                parent->is_red = false;
+                sibling->right->is_red = false;
+                rotate_left(parent);
+                node = m_root;
+            } else {
+                auto* sibling = parent->left;
+                if (is_red(sibling)) {
+                    sibling->is_red = false;
+                    parent->is_red = true;
+                    rotate_right(parent);
+                    sibling = parent->left;
+                }
+                if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                    sibling->is_red = true;
+                    node = parent;
+                    parent = node->parent;
+                    continue;
+                }
+                if (!is_red(sibling->left)) {
+                    sibling->right->is_red = false;
+                    sibling->is_red = true;
+                    rotate_left(sibling);
+                    sibling = parent->left;
+                }
+                sibling->is_red = parent->is_red;
+                parent->is_red = false;
+                sibling->left->is_red = false;
+                rotate_right(parent);
+                node = m_root;
+            }
+        }
+        if (node)
+            node->is_red = false;
+    }
+
+    Node* m_root { nullptr };
+    size_t m_size { 0 };
+};
+
+}
+
+using AK::RedBlackTree;
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/TestSuite.h>
+
+#include <AK/InternetChecksum.h>
+
+// The checksum comes out in network byte order, read it back as a number.
+static u16 stored_checksum(u16 checksum)
+{
+    auto* bytes = (const u8*)&checksum;
+    return (bytes[0] << 8) | bytes[1];
+}
+
+// The straightforward RFC 1071 algorithm, 16 bits at a time.
+static u16 reference_checksum(const u8* data, size_t size)
+{
+    u32 sum = 0;
+    for (size_t i = 0; i + 1 < size; i += 2)
+        sum += (data[i] << 8) | data[i + 1];
+    if (size & 1)
+        sum += data[size - 1] << 8;
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum & 0xffff;
+}
+
+TEST_CASE(rfc1071_example)
+{
+    const u8 data[] = { 0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6, 0xf7 };
+    EXPECT_EQ(stored_checksum(internet_checksum_fold(internet_checksum_add(data, sizeof(data)))), 0xddf2);
+    EXPECT_EQ(stored_checksum(AK::internet_checksum(data, sizeof(data))), 0x220d);
+}
+
+TEST_CASE(ipv4_header)
+{
+    const u8 header[] = {
+        0x45, 0x00, 0x00, 0x73, 0x00, 0x00, 0x40, 0x00, 0x40, 0x11,
+        0x00, 0x00, 0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0xc7
+    };
+    EXPECT_EQ(stored_checksum(AK::internet_checksum(header, sizeof(header))), 0xb861);
+}
+
+TEST_CASE(checksum_over_checksummed_data)
+{
+    u8 header[] = {
+        0x45, 0x00, 0x00, 0x73, 0x00, 0x00, 0x40, 0x00, 0x40, 0x11,
+        0x00, 0x00, 0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0xc7
+    };
+    u16 checksum = AK::internet_checksum(header, sizeof(header));
+    __builtin_memcpy(header + 10, &checksum, sizeof(checksum));
+    EXPECT_EQ(internet_checksum_fold(internet_checksum_add(header, sizeof(header))), 0xffff);
+    EXPECT_EQ(AK::internet_checksum(header, sizeof(header)), 0);
+}
+
+TEST_CASE(matches_reference)
+{
+    u8 data[1024 + 3];
+    u32 seed = 0x12345678;
+    for (auto& byte : data) {
+        seed = seed * 1103515245 + 12345;
+        byte = seed >> 16;
+    }
+
+    // Try all the interesting tails of the unrolled loop, at all alignments.
+    for (size_t offset = 0; offset < 4; ++offset) {
+        for (size_t size = 0; size + offset <= sizeof(data); size += (size < 64 ? 1 : 61))
+            EXPECT_EQ(stored_checksum(AK::internet_checksum(data + offset, size)), reference_checksum(data + offset, size));
+    }
+}
+
+TEST_CASE(incremental)
+{
+    u8 data[300];
+    for (size_t i = 0; i < sizeof(data); ++i)
+        data[i] = i * 7;
+
+    // Adding up pieces of even length gives the same sum as adding up everything at once.
+    auto sum = internet_checksum_add(data, 100);
+    sum = internet_checksum_add(data + 100, 38, sum);
+    sum = internet_checksum_add(data + 138, 162, sum);
+    EXPECT_EQ(internet_checksum_fold(sum), internet_checksum_fold(internet_checksum_add(data, sizeof(data))));
+}
+
+TEST_MAIN(InternetChecksum)
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/TestSuite.h>
+
+#include <AK/NonnullOwnPtr.h>
+#include <AK/QuickSort.h>
+#include <AK/RedBlackTree.h>
+#include <AK/String.h>
+#include <AK/Vector.h>
+
+TEST_CASE(construct)
+{
+    RedBlackTree<int, int> empty;
+    EXPECT(empty.is_empty());
+    EXPECT_EQ(empty.size(), 0u);
+    EXPECT(empty.begin() == empty.end());
+}
+
+TEST_CASE(insert_and_find)
+{
+    RedBlackTree<int, String> tree;
+    tree.insert(3, "three");
+    tree.insert(1, "one");
+    tree.insert(2, "two");
+    EXPECT_EQ(tree.size(), 3u);
+    EXPECT_EQ(*tree.find(1), "one");
+    EXPECT_EQ(*tree.find(2), "two");
+    EXPECT_EQ(*tree.find(3), "three");
+    EXPECT(!tree.find(4));
+    EXPECT(tree.contains(2));
+    EXPECT(!tree.contains(0));
+}
+
+TEST_CASE(iterates_in_order)
+{
+    RedBlackTree<int, int> tree;
+    for (int i = 0; i < 100; ++i) {
+        int key = (i * 37) % 100;
+        tree.insert(key, key * 2);
+    }
+    int expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        EXPECT_EQ(it.key(), expected);
+        EXPECT_EQ(*it, expected * 2);
+        ++expected;
+    }
+    EXPECT_EQ(expected, 100);
+}
+
+TEST_CASE(closest_key_lookups)
+{
+    RedBlackTree<u32, u32> tree;
+    tree.insert(0x1000, 1);
+    tree.insert(0x3000, 3);
+    tree.insert(0x5000, 5);
+
+    EXPECT(!tree.find_largest_not_above(0xfff));
+    EXPECT_EQ(*tree.find_largest_not_above(0x1000), 1u);
+    EXPECT_EQ(*tree.find_largest_not_above(0x2fff), 1u);
+    EXPECT_EQ(*tree.find_largest_not_above(0x3000), 3u);
+    EXPECT_EQ(*tree.find_largest_not_above(0xffffffff), 5u);
+
+    EXPECT_EQ(*tree.find_smallest_not_below(0), 1u);
+    EXPECT_EQ(*tree.find_smallest_not_below(0x1001), 3u);
+    EXPECT_EQ(*tree.find_smallest_not_below(0x5000), 5u);
+    EXPECT(!tree.find_smallest_not_below(0x5001));
+}
+
+TEST_CASE(remove_and_take)
+{
+    RedBlackTree<int, NonnullOwnPtr<int>> tree;
+    for (int i = 0; i < 10; ++i)
+        tree.insert(i, make<int>(i));
+
+    EXPECT(tree.remove(4));
+    EXPECT(!tree.remove(4));
+    EXPECT_EQ(tree.size(), 9u);
+
+    auto taken = tree.take(7);
+    EXPECT(taken.has_value());
+    EXPECT_EQ(*taken.value(), 7);
+    EXPECT(!tree.take(7).has_value());
+    EXPECT_EQ(tree.size(), 8u);
+
+    Vector<int> keys;
+    for (auto& value : tree)
+        keys.append(*value);
+    EXPECT_EQ(keys.size(), 8u);
+    EXPECT_EQ(keys[3], 3);
+    EXPECT_EQ(keys[4], 5);
+    EXPECT_EQ(keys[6], 8);
+}
+
+TEST_CASE(move_tree)
+{
+    RedBlackTree<int, int> tree;
+    tree.insert(1, 10);
+    tree.insert(2, 20);
+    RedBlackTree<int, int> other = move(tree);
+    EXPECT(tree.is_empty());
+    EXPECT_EQ(other.size(), 2u);
+    EXPECT_EQ(*other.find(2), 20);
+}
+
+TEST_CASE(randomized_against_sorted_vector)
+{
+    RedBlackTree<u32, u32> tree;
+    Vector<u32> reference;
+    u32 state = 12345;
+    auto next_random = [&] {
+        state = state * 1103515245 + 12345;
+        return (state >> 16) % 2000;
+    };
+
+    for (int i = 0; i < 5000; ++i) {
+        u32 key = next_random();
+        if (tree.contains(key)) {
+            EXPECT(tree.remove(key));
+            reference.remove_first_matching([&](auto& entry) { return entry == key; });
+        } else {
+            tree.insert(key, key + 1);
+            reference.append(key);
+        }
+    }
+
+    quick_sort(reference);
+    EXPECT_EQ(tree.size(), reference.size());
+    size_t index = 0;
+    for (auto it = tree.begin(); it != tree.end(); ++it, ++index) {
+        EXPECT_EQ(it.key(), reference[index]);
+        EXPECT_EQ(*it, reference[index] + 1);
+    }
+    EXPECT_EQ(index, reference.size());
+
+    while (!reference.is_empty()) {
+        auto key = reference.take_last();
+        EXPECT(tree.remove(key));
+    }
+    EXPECT(tree.is_empty());
+}
+
+TEST_MAIN(RedBlackTree)
@@ -37,6 +37,7 @@ constexpr int syscall_vector = 0x82;
 
 extern "C" {
 struct pollfd;
+struct epoll_event;
 struct timeval;
 struct timespec;
 struct sockaddr;
@@ -199,7 +200,12 @@ namespace Kernel {
     S(mremap)                 \
     S(set_coredump_metadata)  \
     S(abort)                  \
-    S(anon_create)
+    S(anon_create)            \
+    S(epoll_create)           \
+    S(epoll_ctl)              \
+    S(epoll_wait)             \
+    S(sendfile)               \
+    S(posix_spawn)
 
 namespace Syscall {
 
@@ -290,6 +296,27 @@ struct SC_poll_params {
     const u32* sigmask;
 };
 
+struct SC_epoll_ctl_params {
+    int epfd;
+    int op;
+    int fd;
+    const struct epoll_event* event;
+};
+
+struct SC_epoll_wait_params {
+    int epfd;
+    struct epoll_event* events;
+    int max_events;
+    const struct timespec* timeout;
+};
+
+struct SC_sendfile_params {
+    int out_fd;
+    int in_fd;
+    ssize_t* offset;
+    size_t count;
+};
+
 struct SC_clock_nanosleep_params {
     int clock_id;
     int flags;
@@ -330,6 +357,9 @@ struct SC_futex_params {
     int futex_op;
     i32 val;
     const timespec* timeout;
+    u32 val2;
+    i32* userspace_address2;
+    i32 val3;
 };
 
 struct SC_setkeymap_params {
@@ -372,6 +402,29 @@ struct SC_execve_params {
     StringListArgument environment;
 };
 
+struct SC_posix_spawn_file_action {
+    enum class Type {
+        Close,
+        Dup2,
+        Open,
+        Chdir,
+        Fchdir,
+    };
+    Type type;
+    int fd;
+    int new_fd;
+    StringArgument path;
+    int options;
+    u16 mode;
+};
+
+struct SC_posix_spawn_params {
+    StringArgument path;
+    StringListArgument arguments;
+    StringListArgument environment;
+    ImmutableBufferArgument<SC_posix_spawn_file_action, size_t> file_actions;
+};
+
 struct SC_readlink_params {
     StringArgument path;
     MutableBufferArgument<char, size_t> buffer;
@@ -225,6 +225,8 @@ extern "C" u8* safe_memset_ins_1;
 extern "C" u8* safe_memset_1_faulted;
 extern "C" u8* safe_memset_ins_2;
 extern "C" u8* safe_memset_2_faulted;
+extern "C" u8* safe_atomic_compare_exchange_relaxed_ins;
+extern "C" u8* safe_atomic_compare_exchange_relaxed_faulted;
 
 bool safe_memcpy(void* dest_ptr, const void* src_ptr, size_t n, void*& fault_at)
 {
@@ -357,10 +359,34 @@ bool safe_memset(void* dest_ptr, int c, size_t n, void*& fault_at)
     return true;
 }
 
+Optional<bool> safe_atomic_compare_exchange_relaxed(volatile u32* var, u32& expected, u32 val)
+{
+    u32 fault_at;
+    bool did_exchange;
+    asm volatile(
+        "xor %%edx, %%edx \n"
+        ".global safe_atomic_compare_exchange_relaxed_ins \n"
+        "safe_atomic_compare_exchange_relaxed_ins: \n"
+        "lock cmpxchgl %[val], %[var] \n"
+        ".global safe_atomic_compare_exchange_relaxed_faulted \n"
+        "safe_atomic_compare_exchange_relaxed_faulted: \n" // handle_safe_access_fault() set edx to the fault address!
+        "setz %[did_exchange] \n"
+        : "+a"(expected),
+          [var] "+m"(*var),
+          "=&d"(fault_at),
+          [did_exchange] "=q"(did_exchange)
+        : [val] "r"(val)
+        : "memory", "cc");
+    if (fault_at != 0)
+        return {};
+    return did_exchange;
+}
+
 static bool handle_safe_access_fault(RegisterState& regs, u32 fault_address)
 {
     // If we detect that the fault happened in safe_memcpy() safe_strnlen(),
-    // or safe_memset() then resume at the appropriate _faulted label
+    // safe_memset() or safe_atomic_compare_exchange_relaxed() then resume
+    // at the appropriate _faulted label
     if (regs.eip == (FlatPtr)&safe_memcpy_ins_1)
         regs.eip = (FlatPtr)&safe_memcpy_1_faulted;
     else if (regs.eip == (FlatPtr)&safe_memcpy_ins_2)
@@ -371,6 +397,8 @@ static bool handle_safe_access_fault(RegisterState& regs, u32 fault_address)
         regs.eip = (FlatPtr)&safe_memset_1_faulted;
     else if (regs.eip == (FlatPtr)&safe_memset_ins_2)
         regs.eip = (FlatPtr)&safe_memset_2_faulted;
+    else if (regs.eip == (FlatPtr)&safe_atomic_compare_exchange_relaxed_ins)
+        regs.eip = (FlatPtr)&safe_atomic_compare_exchange_relaxed_faulted;
     else
         return false;
 
@@ -916,6 +944,10 @@ u32 read_cr3()
 
 void write_cr3(u32 cr3)
 {
+    // Let the other processors know which page directory we're about to use
+    // before we use it, so they won't skip us when shooting down TLB entries.
+    if (Processor::is_initialized())
+        Processor::current().set_current_cr3(cr3);
     // NOTE: If you're here from a GPF crash, it's very likely that a PDPT entry is incorrect, not this!
     asm volatile("movl %%eax, %%cr3" ::"a"(cr3)
                  : "memory");
@@ -1206,6 +1238,7 @@ void Processor::early_initialize(u32 cpu)
     m_info = nullptr;
 
     m_halt_requested = false;
+    m_current_cr3 = read_cr3();
     if (cpu == 0) {
         s_smp_enabled = false;
         atomic_store(&g_total_processors, 1u, AK::MemoryOrder::memory_order_release);
@@ -1438,7 +1471,15 @@ extern "C" void enter_thread_context(Thread* from_thread, Thread* to_thread)
     tls_descriptor.set_base(to_thread->thread_specific_data().as_ptr());
     tls_descriptor.set_limit(to_thread->thread_specific_region_size());
 
-    if (from_tss.cr3 != to_tss.cr3)
+    // Kernel threads only touch kernel memory, which is mapped the same way
+    // in every page directory. Instead of loading their own page directory
+    // (and losing all TLB entries), they keep running on whatever is loaded.
+    // Switching back to the same process afterwards then doesn't need to
+    // touch CR3 at all. We can't do this while a kernel thread is inside a
+    // ProcessPagingScope, since it then needs that specific page directory.
+    auto& to_process = to_thread->process();
+    bool can_borrow_page_directory = to_process.is_kernel_process() && to_tss.cr3 == to_process.page_directory().cr3();
+    if (!can_borrow_page_directory && processor.current_cr3() != to_tss.cr3)
         write_cr3(to_tss.cr3);
 
     to_thread->set_cpu(processor.id());
@@ -1779,6 +1820,13 @@ void Processor::check_invoke_scheduler()
 
 void Processor::flush_tlb_local(VirtualAddress vaddr, size_t page_count)
 {
+    // Past a certain size it's cheaper to reload CR3, which drops all
+    // non-global entries, than to invalidate the pages one by one.
+    // Userspace mappings are never global, so this covers them.
+    if (page_count > 32 && is_user_range(vaddr, page_count * PAGE_SIZE)) {
+        flush_entire_tlb_local();
+        return;
+    }
     auto ptr = vaddr.as_ptr();
     while (page_count > 0) {
         asm volatile("invlpg %0"
@@ -1794,10 +1842,37 @@ void Processor::flush_tlb(const PageDirectory* page_directory, VirtualAddress va
 {
     if (s_smp_enabled)
         smp_broadcast_flush_tlb(page_directory, vaddr, page_count);
-    else
+    else if (!is_user_address(vaddr) || Processor::current().current_cr3() == page_directory->cr3())
         flush_tlb_local(vaddr, page_count);
 }
 
+void Processor::stop_using_page_directory(u32 cr3)
+{
+    // Only kernel threads borrowing the page directory can still have it
+    // loaded at this point. Move them back to their own page directory.
+    auto& cur_proc = Processor::current();
+    if (cur_proc.current_cr3() == cr3) {
+        ASSERT(Thread::current()->tss().cr3 != cr3);
+        write_cr3(Thread::current()->tss().cr3);
+    }
+    if (!s_smp_enabled)
+        return;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for_each(
+        [&](Processor& proc) -> IterationDecision {
+            if (&proc != &cur_proc && proc.current_cr3() == cr3) {
+                smp_unicast(
+                    proc.id(), [](void* data) {
+                        u32 cr3 = (FlatPtr)data;
+                        if (Processor::current().current_cr3() == cr3)
+                            write_cr3(Thread::current()->tss().cr3);
+                    },
+                    (void*)(FlatPtr)cr3, nullptr, false);
+            }
+            return IterationDecision::Continue;
+        });
+}
+
 static volatile ProcessorMessage* s_message_pool;
 
 void Processor::smp_return_to_pool(ProcessorMessage& msg)
@@ -2081,17 +2156,54 @@ void Processor::smp_unicast(u32 cpu, void (*callback)(), bool async)
 
 void Processor::smp_broadcast_flush_tlb(const PageDirectory* page_directory, VirtualAddress vaddr, size_t page_count)
 {
+    auto& cur_proc = Processor::current();
+    // Kernel mappings are shared by all page directories, but userspace ones
+    // only need flushing on processors that currently have this page
+    // directory loaded. All others already dropped their entries for it when
+    // they last switched CR3, and will see the new page tables from now on.
+    bool is_user = is_user_address(vaddr);
+    u32 cr3 = page_directory->cr3();
+
     auto& msg = smp_get_from_pool();
     msg.async = false;
     msg.type = ProcessorMessage::FlushTlb;
     msg.flush_tlb.page_directory = page_directory;
     msg.flush_tlb.ptr = vaddr.as_ptr();
     msg.flush_tlb.page_count = page_count;
-    smp_broadcast_message(msg);
+
+    // Make sure our page table updates are visible before we look at which
+    // page directory the other processors are using (see write_cr3()).
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // Start out as if everybody was a target and count down the ones we
+    // skip, so we only have to look at each processor once.
+    atomic_store(&msg.refs, count() - 1, AK::MemoryOrder::memory_order_release);
+    bool have_targets = false;
+    for_each(
+        [&](Processor& proc) -> IterationDecision {
+            if (&proc == &cur_proc)
+                return IterationDecision::Continue;
+            if (is_user && proc.current_cr3() != cr3) {
+                atomic_fetch_sub(&msg.refs, 1u, AK::MemoryOrder::memory_order_acq_rel);
+                return IterationDecision::Continue;
+            }
+            have_targets = true;
+            if (proc.smp_queue_message(msg))
+                APIC::the().send_ipi(proc.id());
+            return IterationDecision::Continue;
+        });
+
     // While the other processors handle this request, we'll flush ours
-    flush_tlb_local(vaddr, page_count);
-    // Now wait until everybody is done as well
-    smp_broadcast_wait_sync(msg);
+    if (!is_user || cur_proc.current_cr3() == cr3)
+        flush_tlb_local(vaddr, page_count);
+
+    if (have_targets) {
+        // Now wait until everybody is done as well
+        smp_broadcast_wait_sync(msg);
+    } else {
+        smp_cleanup_message(msg);
+        smp_return_to_pool(msg);
+    }
 }
 
 void Processor::smp_broadcast_halt()
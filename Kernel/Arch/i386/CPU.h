@@ -29,11 +29,13 @@
 #include <AK/Atomic.h>
 #include <AK/Badge.h>
 #include <AK/Noncopyable.h>
+#include <AK/Optional.h>
 #include <AK/Vector.h>
 #include <Kernel/PhysicalAddress.h>
 #include <Kernel/VirtualAddress.h>
 
 #define PAGE_SIZE 4096
+#define HUGE_PAGE_SIZE 0x200000 // 2 MiB, since we're using PAE
 #define GENERIC_INTERRUPT_HANDLERS_COUNT (256 - IRQ_VECTOR_BASE)
 #define PAGE_MASK ((FlatPtr)0xfffff000u)
 
@@ -145,6 +147,9 @@ public:
         m_raw |= value & 0xfffff000;
     }
 
+    // With the Huge bit set, the entry maps a 2 MiB page directly instead of pointing to a page table.
+    u32 huge_page_base() const { return m_raw & 0xffe00000u; }
+
     bool is_null() const { return m_raw == 0; }
     void clear() { m_raw = 0; }
 
@@ -287,6 +292,7 @@ void handle_crash(RegisterState&, const char* description, int signal, bool out_
 [[nodiscard]] bool safe_memcpy(void* dest_ptr, const void* src_ptr, size_t n, void*& fault_at);
 [[nodiscard]] ssize_t safe_strnlen(const char* str, size_t max_n, void*& fault_at);
 [[nodiscard]] bool safe_memset(void* dest_ptr, int c, size_t n, void*& fault_at);
+[[nodiscard]] Optional<bool> safe_atomic_compare_exchange_relaxed(volatile u32* var, u32& expected, u32 val);
 
 #define LSW(x) ((u32)(x)&0xFFFF)
 #define MSW(x) (((u32)(x) >> 16) & 0xFFFF)
@@ -726,6 +732,11 @@ class Processor {
     Thread* m_current_thread;
     Thread* m_idle_thread;
 
+    // The page directory that is currently loaded into CR3. Kernel threads
+    // keep running on whatever page directory was loaded before them, so
+    // this isn't necessarily the one of the current thread.
+    Atomic<u32> m_current_cr3;
+
     volatile ProcessorMessageEntry* m_message_queue; // atomic, LIFO
 
     bool m_invoke_scheduler_async;
@@ -790,6 +801,12 @@ public:
     static void flush_tlb_local(VirtualAddress vaddr, size_t page_count);
     static void flush_tlb(const PageDirectory*, VirtualAddress, size_t);
 
+    ALWAYS_INLINE u32 current_cr3() const { return m_current_cr3.load(AK::MemoryOrder::memory_order_acquire); }
+    ALWAYS_INLINE void set_current_cr3(u32 cr3) { m_current_cr3.store(cr3, AK::MemoryOrder::memory_order_seq_cst); }
+
+    // Makes sure no processor still has the given page directory loaded, so it can be freed.
+    static void stop_using_page_directory(u32 cr3);
+
     Descriptor& get_gdt_entry(u16 selector);
     void flush_gdt();
     const DescriptorTablePointer& get_gdtr();
@@ -58,6 +58,9 @@ AsyncDeviceRequest::~AsyncDeviceRequest()
 
 void AsyncDeviceRequest::request_finished()
 {
+    // The device may drop its reference to us when processing the next request.
+    NonnullRefPtr<AsyncDeviceRequest> protector(*this);
+
     if (m_parent_request)
         m_parent_request->sub_request_finished(*this);
 
@@ -91,15 +94,13 @@ void AsyncDeviceRequest::add_sub_request(NonnullRefPtr<AsyncDeviceRequest> sub_r
     ASSERT(sub_request->m_parent_request == nullptr);
     sub_request->m_parent_request = this;
 
-    bool should_start;
     {
         ScopedSpinLock lock(m_lock);
-        ASSERT(!is_completed_result(m_result));
+        ASSERT(m_result == Started);
         m_sub_requests_pending.append(sub_request);
-        should_start = (m_result == Started);
     }
-    if (should_start)
-        sub_request->do_start();
+    // The sub-request is started by its device once it's its turn.
+    sub_request->m_device.queue_request(move(sub_request));
 }
 
 void AsyncDeviceRequest::sub_request_finished(AsyncDeviceRequest& sub_request)
@@ -83,6 +83,19 @@ public:
         do_start();
     }
 
+    // Marks the request as started without calling start(). This is used when
+    // the device carries out this request as part of a merged request.
+    [[nodiscard]] bool set_started(Badge<Device>)
+    {
+        ScopedSpinLock lock(m_lock);
+        if (is_completed_result(m_result))
+            return false;
+        m_result = Started;
+        return true;
+    }
+
+    RequestResult get_request_result() const;
+
     void complete(RequestResult result);
 
     void set_private(void* priv)
@@ -131,8 +144,6 @@ public:
 protected:
     AsyncDeviceRequest(Device&);
 
-    RequestResult get_request_result() const;
-
 private:
     void sub_request_finished(AsyncDeviceRequest&);
     void request_finished();
@@ -25,6 +25,9 @@
  */
 
 #include <Kernel/Devices/BlockDevice.h>
+#include <Kernel/Time/TimeManagement.h>
+
+//#define BLOCK_DEVICE_QUEUE_DEBUG
 
 namespace Kernel {
 
@@ -48,6 +51,176 @@ BlockDevice::~BlockDevice()
 {
 }
 
+void BlockDevice::enable_request_merging(size_t max_blocks)
+{
+    ASSERT(max_blocks > 0);
+    m_merge_buffer = KBuffer::try_create_with_size(max_blocks * block_size(), Region::Access::Read | Region::Access::Write, "BlockDevice merge buffer", AllocationStrategy::AllocateNow);
+    if (!m_merge_buffer) {
+        dbgln("BlockDevice: Could not allocate merge buffer, not merging requests");
+        return;
+    }
+    m_max_merged_blocks = max_blocks;
+}
+
+void BlockDevice::queue_request(NonnullRefPtr<AsyncDeviceRequest> request)
+{
+    auto& block_request = static_cast<AsyncBlockDeviceRequest&>(*request);
+    u64 deadline = TimeManagement::the().uptime_ms();
+    deadline += block_request.request_type() == AsyncBlockDeviceRequest::Read ? read_deadline_ms : write_deadline_ms;
+
+    {
+        ScopedSpinLock lock(m_queue_lock);
+        // Keep the queue sorted by block index, requests for the same block are served in FIFO order.
+        size_t index = m_pending_requests.size();
+        while (index > 0 && m_pending_requests[index - 1].request->block_index() > block_request.block_index())
+            --index;
+        m_pending_requests.insert(index, { block_request, deadline });
+    }
+
+    dispatch_next_request();
+}
+
+void BlockDevice::process_next_queued_request(Badge<AsyncDeviceRequest>, const AsyncDeviceRequest& completed_request)
+{
+    NonnullRefPtrVector<AsyncBlockDeviceRequest> merged_requests;
+    bool was_active_request;
+    {
+        ScopedSpinLock lock(m_queue_lock);
+        was_active_request = m_active_request.ptr() == &completed_request;
+        if (was_active_request)
+            merged_requests = m_active_merged_requests;
+    }
+
+    // If this is not the active request, it was carried out as part of a merged
+    // request and is being completed by complete_merged_requests() below.
+    if (was_active_request) {
+        if (!merged_requests.is_empty())
+            complete_merged_requests(completed_request.get_request_result(), merged_requests);
+
+        {
+            ScopedSpinLock lock(m_queue_lock);
+            m_active_request = nullptr;
+            m_active_merged_requests.clear();
+        }
+        dispatch_next_request();
+    }
+
+    evaluate_block_conditions();
+}
+
+size_t BlockDevice::pick_next_request_index() const
+{
+    ASSERT(m_queue_lock.is_locked());
+    ASSERT(!m_pending_requests.is_empty());
+
+    // Requests that have missed their deadline are served first, oldest first.
+    auto now = TimeManagement::the().uptime_ms();
+    Optional<size_t> expired_index;
+    for (size_t i = 0; i < m_pending_requests.size(); ++i) {
+        auto deadline = m_pending_requests[i].deadline;
+        if (deadline <= now && (!expired_index.has_value() || deadline < m_pending_requests[expired_index.value()].deadline))
+            expired_index = i;
+    }
+    if (expired_index.has_value())
+        return expired_index.value();
+
+    // Otherwise keep sweeping towards higher block indices, and start over
+    // at the lowest one once we've reached the end (C-LOOK).
+    for (size_t i = 0; i < m_pending_requests.size(); ++i) {
+        if (m_pending_requests[i].request->block_index() >= m_head_block_index)
+            return i;
+    }
+    return 0;
+}
+
+bool BlockDevice::can_merge(const AsyncBlockDeviceRequest& first, const AsyncBlockDeviceRequest& second, size_t merged_block_count) const
+{
+    if (first.request_type() != second.request_type())
+        return false;
+    if (first.block_index() + first.block_count() != second.block_index())
+        return false;
+    // Merged requests go through m_merge_buffer, so we need to be able to copy
+    // from and to the original buffers from any context.
+    if (!first.buffer().is_kernel_buffer() || !second.buffer().is_kernel_buffer())
+        return false;
+    return merged_block_count <= m_max_merged_blocks;
+}
+
+void BlockDevice::dispatch_next_request()
+{
+    RefPtr<AsyncBlockDeviceRequest> request_to_start;
+    NonnullRefPtrVector<AsyncBlockDeviceRequest> merged_requests;
+    {
+        ScopedSpinLock lock(m_queue_lock);
+        if (m_active_request || m_pending_requests.is_empty())
+            return;
+
+        size_t first = pick_next_request_index();
+        size_t last = first;
+        size_t block_count = m_pending_requests[first].request->block_count();
+        if (m_merge_buffer) {
+            while (last + 1 < m_pending_requests.size()) {
+                auto& next = *m_pending_requests[last + 1].request;
+                if (!can_merge(*m_pending_requests[last].request, next, block_count + next.block_count()))
+                    break;
+                block_count += next.block_count();
+                ++last;
+            }
+            while (first > 0) {
+                auto& previous = *m_pending_requests[first - 1].request;
+                if (!can_merge(previous, *m_pending_requests[first].request, block_count + previous.block_count()))
+                    break;
+                block_count += previous.block_count();
+                --first;
+            }
+        }
+
+        if (first == last) {
+            request_to_start = m_pending_requests.take(first).request;
+        } else {
+            auto request_type = m_pending_requests[first].request->request_type();
+            u32 block_index = m_pending_requests[first].request->block_index();
+            for (size_t i = first; i <= last; ++i)
+                merged_requests.append(m_pending_requests.take(first).request);
+            request_to_start = adopt(*new AsyncBlockDeviceRequest(*this, request_type, block_index, block_count, UserOrKernelBuffer::for_kernel_buffer(m_merge_buffer->data()), block_count * block_size()));
+#ifdef BLOCK_DEVICE_QUEUE_DEBUG
+            dbgln("BlockDevice: Merged {} requests into {} blocks @ {}", merged_requests.size(), block_count, block_index);
+#endif
+        }
+
+        m_active_request = request_to_start;
+        m_active_merged_requests = merged_requests;
+        m_head_block_index = request_to_start->block_index() + request_to_start->block_count();
+    }
+
+    size_t offset = 0;
+    for (auto& request : merged_requests) {
+        size_t size = request.block_count() * block_size();
+        if (!set_queued_request_started(request))
+            ASSERT_NOT_REACHED();
+        if (request.request_type() == AsyncBlockDeviceRequest::Write && !request.buffer().read(m_merge_buffer->data() + offset, size))
+            ASSERT_NOT_REACHED();
+        offset += size;
+    }
+
+    start_queued_request(*request_to_start);
+}
+
+void BlockDevice::complete_merged_requests(AsyncDeviceRequest::RequestResult result, NonnullRefPtrVector<AsyncBlockDeviceRequest>& requests)
+{
+    size_t offset = 0;
+    for (auto& request : requests) {
+        size_t size = request.block_count() * block_size();
+        auto request_result = result;
+        if (result == AsyncDeviceRequest::Success && request.request_type() == AsyncBlockDeviceRequest::Read) {
+            if (!request.buffer().write(m_merge_buffer->data() + offset, size))
+                request_result = AsyncDeviceRequest::MemoryFault;
+        }
+        request.complete(request_result);
+        offset += size;
+    }
+}
+
 bool BlockDevice::read_block(unsigned index, UserOrKernelBuffer& buffer)
 {
     auto read_request = make_request<AsyncBlockDeviceRequest>(AsyncBlockDeviceRequest::Read, index, 1, buffer, 512);
@@ -26,7 +26,11 @@
 
 #pragma once
 
+#include <AK/NonnullRefPtrVector.h>
+#include <AK/OwnPtr.h>
+#include <AK/Vector.h>
 #include <Kernel/Devices/Device.h>
+#include <Kernel/KBuffer.h>
 
 namespace Kernel {
 
@@ -82,6 +86,10 @@ public:
 
     virtual void start_request(AsyncBlockDeviceRequest&) = 0;
 
+    // ^Device
+    virtual void queue_request(NonnullRefPtr<AsyncDeviceRequest>) override;
+    virtual void process_next_queued_request(Badge<AsyncDeviceRequest>, const AsyncDeviceRequest&) override;
+
 protected:
     BlockDevice(unsigned major, unsigned minor, size_t block_size = PAGE_SIZE)
         : Device(major, minor)
@@ -89,10 +97,38 @@ protected:
     {
     }
 
+    // Allows adjacent queued requests to be merged into a single request of up to max_blocks blocks.
+    void enable_request_merging(size_t max_blocks);
+
 private:
     virtual bool is_block_device() const final { return true; }
 
+    // How long a request may be passed over by the elevator before it's served regardless.
+    static constexpr u64 read_deadline_ms = 500;
+    static constexpr u64 write_deadline_ms = 5000;
+
+    struct QueuedRequest {
+        NonnullRefPtr<AsyncBlockDeviceRequest> request;
+        u64 deadline;
+    };
+
+    void dispatch_next_request();
+    size_t pick_next_request_index() const;
+    bool can_merge(const AsyncBlockDeviceRequest& first, const AsyncBlockDeviceRequest& second, size_t merged_block_count) const;
+    void complete_merged_requests(AsyncDeviceRequest::RequestResult, NonnullRefPtrVector<AsyncBlockDeviceRequest>&);
+
     size_t m_block_size { 0 };
+
+    SpinLock<u8> m_queue_lock;
+    // Pending requests, sorted by block index.
+    Vector<QueuedRequest> m_pending_requests;
+    RefPtr<AsyncBlockDeviceRequest> m_active_request;
+    // The requests carried out by m_active_request if it's a merged request.
+    NonnullRefPtrVector<AsyncBlockDeviceRequest> m_active_merged_requests;
+    u32 m_head_block_index { 0 };
+
+    size_t m_max_merged_blocks { 1 };
+    OwnPtr<KBuffer> m_merge_buffer;
 };
 
 }
@@ -80,6 +80,18 @@ String Device::absolute_path(const FileDescription&) const
     return absolute_path();
 }
 
+void Device::queue_request(NonnullRefPtr<AsyncDeviceRequest> request)
+{
+    bool was_empty;
+    {
+        ScopedSpinLock lock(m_requests_lock);
+        was_empty = m_requests.is_empty();
+        m_requests.append(request);
+    }
+    if (was_empty)
+        request->do_start({});
+}
+
 void Device::process_next_queued_request(Badge<AsyncDeviceRequest>, const AsyncDeviceRequest& completed_request)
 {
     AsyncDeviceRequest* next_request = nullptr;
@@ -94,7 +106,7 @@ void Device::process_next_queued_request(Badge<AsyncDeviceRequest>, const AsyncD
     }
 
     if (next_request)
-        next_request->start();
+        next_request->do_start({});
 
     evaluate_block_conditions();
 }
@@ -65,25 +65,22 @@ public:
     static void for_each(Function<void(Device&)>);
     static Device* get_device(unsigned major, unsigned minor);
 
-    void process_next_queued_request(Badge<AsyncDeviceRequest>, const AsyncDeviceRequest&);
+    virtual void queue_request(NonnullRefPtr<AsyncDeviceRequest>);
+    virtual void process_next_queued_request(Badge<AsyncDeviceRequest>, const AsyncDeviceRequest&);
 
     template<typename AsyncRequestType, typename... Args>
     NonnullRefPtr<AsyncRequestType> make_request(Args&&... args)
     {
         auto request = adopt(*new AsyncRequestType(*this, forward<Args>(args)...));
-        bool was_empty;
-        {
-            ScopedSpinLock lock(m_requests_lock);
-            was_empty = m_requests.is_empty();
-            m_requests.append(request);
-        }
-        if (was_empty)
-            request->do_start({});
+        queue_request(request);
         return request;
     }
 
 protected:
     Device(unsigned major, unsigned minor);
+
+    static void start_queued_request(AsyncDeviceRequest& request) { request.do_start({}); }
+    [[nodiscard]] static bool set_queued_request_started(AsyncDeviceRequest& request) { return request.set_started({}); }
     void set_uid(uid_t uid) { m_uid = uid; }
     void set_gid(gid_t gid) { m_gid = gid; }
 
@@ -25,113 +25,278 @@
  */
 
 #include <AK/IntrusiveList.h>
+#include <AK/QuickSort.h>
+#include <Kernel/Devices/BlockDevice.h>
 #include <Kernel/FileSystem/BlockBasedFileSystem.h>
 #include <Kernel/Process.h>
+#include <Kernel/Tasks/SyncTask.h>
+#include <Kernel/VM/MemoryManager.h>
 
 //#define BBFS_DEBUG
 
 namespace Kernel {
 
 struct CacheEntry {
+    // Which of the 2Q queues the entry belongs to. Dirty entries are kept on the
+    // dirty list instead and return to their queue once they've been written back.
+    enum class Queue : u8 {
+        Free,
+        Recent,
+        Frequent,
+    };
+
     IntrusiveListNode list_node;
     u32 block_index { 0 };
+    u32 dirty_generation { 0 };
     u8* data { nullptr };
+    Queue queue { Queue::Free };
     bool has_data { false };
+    bool is_dirty { false };
 };
 
-class DiskCache {
+// The cache is split into shards by block index, each with its own lock. Each
+// shard uses the simplified 2Q replacement policy: blocks enter a FIFO of
+// recently used blocks, and only move to the LRU of frequently used blocks when
+// they're used again shortly after being evicted. This keeps large sequential
+// scans from pushing out the frequently used metadata blocks.
+class DiskCacheShard {
+    AK_MAKE_NONCOPYABLE(DiskCacheShard);
+    AK_MAKE_NONMOVABLE(DiskCacheShard);
+
 public:
-    explicit DiskCache(BlockBasedFS& fs)
-        : m_fs(fs)
-        , m_cached_block_data(KBuffer::create_with_size(m_entry_count * m_fs.block_size()))
-        , m_entries(KBuffer::create_with_size(m_entry_count * sizeof(CacheEntry)))
+    DiskCacheShard() { }
+
+    void initialize(BlockBasedFS& fs, CacheEntry* entries, size_t entry_count)
     {
-        for (size_t i = 0; i < m_entry_count; ++i) {
-            entries()[i].data = m_cached_block_data.data() + i * m_fs.block_size();
-            m_clean_list.append(entries()[i]);
-        }
+        m_fs = &fs;
+        m_entry_count = entry_count;
+        m_max_recent_count = max<size_t>(entry_count / 4, 1);
+        m_max_ghost_count = max<size_t>(entry_count / 2, 1);
+        for (size_t i = 0; i < entry_count; ++i)
+            m_free_list.append(entries[i]);
     }
 
-    ~DiskCache() { }
+    Lock& lock() { return m_lock; }
 
-    bool is_dirty() const { return m_dirty; }
-    void set_dirty(bool b) { m_dirty = b; }
+    size_t entry_count() const { return m_entry_count; }
+    size_t dirty_count() const { return m_dirty_count; }
 
-    void mark_all_clean()
+    CacheEntry* find(u32 block_index)
     {
-        while (auto* entry = m_dirty_list.first())
-            m_clean_list.prepend(*entry);
-        m_dirty = false;
+        ASSERT(m_lock.is_locked());
+        auto it = m_hash.find(block_index);
+        if (it == m_hash.end())
+            return nullptr;
+        ASSERT(it->value->block_index == block_index);
+        return it->value;
+    }
+
+    CacheEntry& get(u32 block_index)
+    {
+        ASSERT(m_lock.is_locked());
+        if (auto* entry = find(block_index)) {
+            // Hits in the recent queue don't count, they're most likely correlated references.
+            if (entry->queue == CacheEntry::Queue::Frequent && !entry->is_dirty)
+                m_frequent_list.prepend(*entry);
+            return *entry;
+        }
+
+        auto* new_entry = m_free_list.take_first();
+        if (!new_entry)
+            new_entry = evict();
+        if (!new_entry) {
+            // Not a single clean entry! Write back our dirty entries and try again.
+            flush();
+            new_entry = evict();
+        }
+        ASSERT(new_entry);
+
+        new_entry->block_index = block_index;
+        new_entry->has_data = false;
+        if (m_ghosts.remove(block_index)) {
+            new_entry->queue = CacheEntry::Queue::Frequent;
+            m_frequent_list.prepend(*new_entry);
+        } else {
+            new_entry->queue = CacheEntry::Queue::Recent;
+            m_recent_list.prepend(*new_entry);
+            ++m_recent_count;
+        }
+        m_hash.set(block_index, new_entry);
+        return *new_entry;
     }
 
     void mark_dirty(CacheEntry& entry)
     {
+        ASSERT(m_lock.is_locked());
+        ++entry.dirty_generation;
+        if (entry.is_dirty)
+            return;
+        if (entry.queue == CacheEntry::Queue::Recent)
+            --m_recent_count;
+        entry.is_dirty = true;
         m_dirty_list.prepend(entry);
-        m_dirty = true;
+        ++m_dirty_count;
     }
 
-    void mark_clean(CacheEntry& entry)
+    // Marks the entry clean, unless it has been written to again since its data was written back.
+    void mark_clean(CacheEntry& entry, u32 dirty_generation)
     {
-        m_clean_list.prepend(entry);
+        ASSERT(m_lock.is_locked());
+        if (!entry.is_dirty || entry.dirty_generation != dirty_generation)
+            return;
+        entry.is_dirty = false;
+        --m_dirty_count;
+        if (entry.queue == CacheEntry::Queue::Frequent) {
+            m_frequent_list.prepend(entry);
+        } else {
+            m_recent_list.prepend(entry);
+            ++m_recent_count;
+        }
     }
 
-    CacheEntry& get(u32 block_index) const
+    void invalidate(CacheEntry& entry)
     {
-        if (auto it = m_hash.find(block_index); it != m_hash.end()) {
-            auto& entry = const_cast<CacheEntry&>(*it->value);
-            ASSERT(entry.block_index == block_index);
-            return entry;
+        ASSERT(m_lock.is_locked());
+        ASSERT(!entry.is_dirty);
+        if (entry.queue == CacheEntry::Queue::Recent)
+            --m_recent_count;
+        m_hash.remove(entry.block_index);
+        entry.queue = CacheEntry::Queue::Free;
+        entry.has_data = false;
+        m_free_list.append(entry);
+    }
+
+    template<typename Callback>
+    void for_each_dirty_entry(Callback callback)
+    {
+        ASSERT(m_lock.is_locked());
+        for (auto& entry : m_dirty_list)
+            callback(entry);
+    }
+
+    // Writes back all dirty entries of this shard, one by one.
+    void flush()
+    {
+        ASSERT(m_lock.is_locked());
+        Vector<CacheEntry*> dirty_entries;
+        for_each_dirty_entry([&](auto& entry) { dirty_entries.append(&entry); });
+        quick_sort(dirty_entries, [](auto* a, auto* b) { return a->block_index < b->block_index; });
+        for (auto* entry : dirty_entries) {
+            auto entry_data_buffer = UserOrKernelBuffer::for_kernel_buffer(entry->data);
+            // FIXME: Should this error path be surfaced somehow?
+            if (m_fs->write_to_device(entry->block_index, 1, entry_data_buffer).is_error())
+                continue;
+            mark_clean(*entry, entry->dirty_generation);
         }
+    }
 
-        if (m_clean_list.is_empty()) {
-            // Not a single clean entry! Flush writes and try again.
-            // NOTE: We want to make sure we only call FileBackedFS flush here,
-            //       not some FileBackedFS subclass flush!
-            m_fs.flush_writes_impl();
-            return get(block_index);
+private:
+    CacheEntry* evict()
+    {
+        // Only take from the frequently used blocks once the recently used ones are down to their share.
+        CacheEntry* victim = nullptr;
+        if (m_recent_count > m_max_recent_count || m_frequent_list.is_empty())
+            victim = m_recent_list.take_last();
+        if (!victim)
+            victim = m_frequent_list.take_last();
+        if (!victim)
+            return nullptr;
+
+        ASSERT(!victim->is_dirty);
+        if (victim->queue == CacheEntry::Queue::Recent) {
+            --m_recent_count;
+            remember_evicted_block(victim->block_index);
         }
+        m_hash.remove(victim->block_index);
+        return victim;
+    }
 
-        ASSERT(m_clean_list.last());
-        auto& new_entry = *m_clean_list.last();
-        m_clean_list.prepend(new_entry);
+    void remember_evicted_block(u32 block_index)
+    {
+        // The ghost list is a ring of block indices, and m_ghosts maps each block to its slot.
+        size_t slot = m_next_ghost_slot;
+        m_next_ghost_slot = (m_next_ghost_slot + 1) % m_max_ghost_count;
+        if (slot < m_ghost_ring.size()) {
+            auto oldest = m_ghost_ring[slot];
+            if (auto it = m_ghosts.find(oldest); it != m_ghosts.end() && it->value == slot)
+                m_ghosts.remove(it);
+            m_ghost_ring[slot] = block_index;
+        } else {
+            m_ghost_ring.append(block_index);
+        }
+        m_ghosts.set(block_index, slot);
+    }
 
-        m_hash.remove(new_entry.block_index);
-        m_hash.set(block_index, &new_entry);
+    BlockBasedFS* m_fs { nullptr };
+    Lock m_lock { "DiskCacheShard" };
+    size_t m_entry_count { 0 };
+    HashMap<u32, CacheEntry*> m_hash;
+    IntrusiveList<CacheEntry, &CacheEntry::list_node> m_free_list;
+    IntrusiveList<CacheEntry, &CacheEntry::list_node> m_recent_list;
+    IntrusiveList<CacheEntry, &CacheEntry::list_node> m_frequent_list;
+    IntrusiveList<CacheEntry, &CacheEntry::list_node> m_dirty_list;
+    size_t m_recent_count { 0 };
+    size_t m_max_recent_count { 0 };
+    size_t m_dirty_count { 0 };
+    HashMap<u32, size_t> m_ghosts;
+    Vector<u32> m_ghost_ring;
+    size_t m_next_ghost_slot { 0 };
+    size_t m_max_ghost_count { 0 };
+};
 
-        new_entry.block_index = block_index;
-        new_entry.has_data = false;
+class DiskCache {
+public:
+    static constexpr size_t shard_count = 16;
 
-        return new_entry;
+    explicit DiskCache(BlockBasedFS& fs)
+        : m_entry_count(entry_count_for(fs.block_size()))
+        , m_cached_block_data(KBuffer::create_with_size(m_entry_count * fs.block_size()))
+        , m_entries(KBuffer::create_with_size(m_entry_count * sizeof(CacheEntry)))
+    {
+        for (size_t i = 0; i < m_entry_count; ++i) {
+            new (&entries()[i]) CacheEntry;
+            entries()[i].data = m_cached_block_data.data() + i * fs.block_size();
+        }
+        size_t entries_per_shard = m_entry_count / shard_count;
+        for (size_t i = 0; i < shard_count; ++i)
+            m_shards[i].initialize(fs, &entries()[i * entries_per_shard], entries_per_shard);
+        dbgln("DiskCache: {} entries of {} bytes", m_entry_count, fs.block_size());
     }
 
-    const CacheEntry* entries() const { return (const CacheEntry*)m_entries.data(); }
-    CacheEntry* entries() { return (CacheEntry*)m_entries.data(); }
+    ~DiskCache() { }
+
+    DiskCacheShard& shard_for(u32 block_index) { return m_shards[block_index % shard_count]; }
 
     template<typename Callback>
-    void for_each_clean_entry(Callback callback)
+    void for_each_shard(Callback callback)
     {
-        for (auto& entry : m_clean_list)
-            callback(entry);
+        for (auto& shard : m_shards)
+            callback(shard);
     }
 
-    template<typename Callback>
-    void for_each_dirty_entry(Callback callback)
+private:
+    static size_t entry_count_for(size_t block_size)
     {
-        for (auto& entry : m_dirty_list)
-            callback(entry);
+        // Use about 1/16th of physical memory, within reason.
+        size_t cache_size = (size_t)MM.user_physical_pages() * PAGE_SIZE / 16;
+        cache_size = clamp<size_t>(cache_size, 1 * MiB, 64 * MiB);
+        return max<size_t>(cache_size / block_size, shard_count * 16) / shard_count * shard_count;
     }
 
-private:
-    BlockBasedFS& m_fs;
-    size_t m_entry_count { 10000 };
-    mutable HashMap<u32, CacheEntry*> m_hash;
-    mutable IntrusiveList<CacheEntry, &CacheEntry::list_node> m_clean_list;
-    mutable IntrusiveList<CacheEntry, &CacheEntry::list_node> m_dirty_list;
+    CacheEntry* entries() { return (CacheEntry*)m_entries.data(); }
+
+    size_t m_entry_count { 0 };
     KBuffer m_cached_block_data;
     KBuffer m_entries;
-    bool m_dirty { false };
+    DiskCacheShard m_shards[shard_count];
 };
 
+static bool readahead_request_has_finished(const AsyncBlockDeviceRequest& request)
+{
+    auto result = request.get_request_result();
+    return result != AsyncDeviceRequest::Pending && result != AsyncDeviceRequest::Started;
+}
+
 BlockBasedFS::BlockBasedFS(FileDescription& file_description)
     : FileBackedFS(file_description)
 {
@@ -140,6 +305,13 @@ BlockBasedFS::BlockBasedFS(FileDescription& file_description)
 
 BlockBasedFS::~BlockBasedFS()
 {
+    // The device may still be reading into our readahead buffers.
+    for (auto& readahead : m_pending_readaheads) {
+        if (!readahead.request)
+            continue;
+        while (!readahead_request_has_finished(*readahead.request))
+            (void)readahead.request->wait();
+    }
 }
 
 int BlockBasedFS::write_block(unsigned index, const UserOrKernelBuffer& data, size_t count, size_t offset, bool allow_cache)
@@ -150,27 +322,40 @@ int BlockBasedFS::write_block(unsigned index, const UserOrKernelBuffer& data, si
     klog() << "BlockBasedFileSystem::write_block " << index << ", size=" << count;
 #endif
 
+    // NOTE: Readaheads are invalidated only once the new data is in the cache or on the
+    //       device, see read_ahead() for why that ordering matters.
     if (!allow_cache) {
-        flush_specific_block_if_needed(index);
+        uncache_block(index);
         u32 base_offset = static_cast<u32>(index) * static_cast<u32>(block_size()) + offset;
-        file_description().seek(base_offset, SEEK_SET);
-        auto nwritten = file_description().write(data, count);
+        auto nwritten = file().write(file_description(), base_offset, data, count);
+        invalidate_readahead(index, 1);
         if (nwritten.is_error())
             return -EIO; // TODO: Return error code as-is, could be -EFAULT!
         ASSERT(nwritten.value() == count);
         return 0;
     }
 
-    auto& entry = cache().get(index);
-    if (count < block_size()) {
-        // Fill the cache first.
-        read_block(index, nullptr, block_size());
+    auto& shard = cache().shard_for(index);
+    {
+        LOCKER(shard.lock());
+        auto& entry = shard.get(index);
+        if (count < block_size() && !entry.has_data) {
+            // Fill the cache first.
+            auto entry_data_buffer = UserOrKernelBuffer::for_kernel_buffer(entry.data);
+            if (read_from_device(index, 1, entry_data_buffer).is_error())
+                return -EIO;
+            entry.has_data = true;
+        }
+        if (!data.read(entry.data + offset, count))
+            return -EFAULT;
+        entry.has_data = true;
+        shard.mark_dirty(entry);
     }
-    if (!data.read(entry.data + offset, count))
-        return -EFAULT;
+    invalidate_readahead(index, 1);
 
-    cache().mark_dirty(entry);
-    entry.has_data = true;
+    // Have the dirty blocks written back in the background before we run out of clean ones.
+    if (shard.dirty_count() > shard.entry_count() / 4)
+        SyncTask::wake();
     return 0;
 }
 
@@ -188,6 +373,7 @@ bool BlockBasedFS::raw_write(unsigned index, const UserOrKernelBuffer& buffer)
     u32 base_offset = static_cast<u32>(index) * static_cast<u32>(m_logical_block_size);
     file_description().seek(base_offset, SEEK_SET);
     auto nwritten = file_description().write(buffer, m_logical_block_size);
+    invalidate_readahead(index * m_logical_block_size / block_size(), 1);
     ASSERT(!nwritten.is_error());
     ASSERT(nwritten.value() == m_logical_block_size);
     return true;
@@ -234,25 +420,28 @@ int BlockBasedFS::read_block(unsigned index, UserOrKernelBuffer* buffer, size_t
 #endif
 
     if (!allow_cache) {
-        const_cast<BlockBasedFS*>(this)->flush_specific_block_if_needed(index);
+        flush_specific_block_if_needed(index);
+        if (offset == 0 && count == block_size()) {
+            auto result = read_from_device(index, 1, *buffer);
+            if (result.is_error())
+                return result.error() == -EFAULT ? -EFAULT : -EIO;
+            return 0;
+        }
         u32 base_offset = static_cast<u32>(index) * static_cast<u32>(block_size()) + static_cast<u32>(offset);
-        file_description().seek(base_offset, SEEK_SET);
-        auto nread = file_description().read(*buffer, count);
+        auto nread = file_description().file().read(file_description(), base_offset, *buffer, count);
         if (nread.is_error())
             return -EIO;
         ASSERT(nread.value() == count);
         return 0;
     }
 
-    auto& entry = cache().get(index);
+    auto& shard = cache().shard_for(index);
+    LOCKER(shard.lock());
+    auto& entry = shard.get(index);
     if (!entry.has_data) {
-        u32 base_offset = static_cast<u32>(index) * static_cast<u32>(block_size());
-        file_description().seek(base_offset, SEEK_SET);
         auto entry_data_buffer = UserOrKernelBuffer::for_kernel_buffer(entry.data);
-        auto nread = file_description().read(entry_data_buffer, block_size());
-        if (nread.is_error())
+        if (read_from_device(index, 1, entry_data_buffer).is_error())
             return -EIO;
-        ASSERT(nread.value() == block_size());
         entry.has_data = true;
     }
     if (buffer && !buffer->write(entry.data + offset, count))
@@ -260,6 +449,176 @@ int BlockBasedFS::read_block(unsigned index, UserOrKernelBuffer* buffer, size_t
     return 0;
 }
 
+KResult BlockBasedFS::read_from_device(unsigned index, unsigned count, UserOrKernelBuffer& buffer) const
+{
+    if (read_from_readahead(index, count, buffer))
+        return KSuccess;
+
+    size_t size = count * block_size();
+    size_t base_offset = static_cast<size_t>(index) * block_size();
+    // NOTE: The device may split large transfers, so keep going until we have everything.
+    size_t nread = 0;
+    while (nread < size) {
+        auto out = buffer.offset(nread);
+        auto result = file_description().file().read(file_description(), base_offset + nread, out, size - nread);
+        if (result.is_error())
+            return result.error();
+        if (result.value() == 0)
+            return KResult(-EIO);
+        nread += result.value();
+    }
+    return KSuccess;
+}
+
+void BlockBasedFS::read_ahead(unsigned index, unsigned count) const
+{
+    ASSERT(m_logical_block_size);
+    if (!file().is_block_device())
+        return;
+    auto& device = static_cast<BlockDevice&>(const_cast<File&>(file()));
+    if (block_size() % device.block_size() != 0)
+        return;
+    size_t device_blocks_per_block = block_size() / device.block_size();
+    size_t max_blocks_per_readahead = max_readahead_size / block_size();
+    if (!count || !max_blocks_per_readahead)
+        return;
+
+#ifdef BBFS_DEBUG
+    klog() << "BlockBasedFileSystem::read_ahead " << index << " x" << count;
+#endif
+
+    // Claim the slots first, so that a write landing from here on invalidates them. Only
+    // then write back dirty blocks (the read goes around the cache, so the device must have
+    // the latest contents) and start the reads. Writes that happened before the claim are
+    // in the cache by then and get flushed, and write_block() invalidates after updating
+    // the cache, so either way we can't end up with stale data in a readahead.
+    Vector<PendingReadahead*, max_pending_readaheads> claimed_slots;
+    {
+        LOCKER(m_readahead_lock);
+        for (unsigned chunk_length; count; index += chunk_length, count -= chunk_length) {
+            chunk_length = min(count, max_blocks_per_readahead);
+            bool is_pending = false;
+            for (auto& readahead : m_pending_readaheads) {
+                if (readahead.is_valid && index >= readahead.index && index + chunk_length <= readahead.index + readahead.count)
+                    is_pending = true;
+            }
+            if (is_pending)
+                continue;
+
+            // We can only reuse a slot once the device is done with its buffer.
+            PendingReadahead* slot = nullptr;
+            for (size_t i = 0; i < max_pending_readaheads; ++i) {
+                auto& candidate = m_pending_readaheads[(m_next_readahead_slot + i) % max_pending_readaheads];
+                if (!candidate.pin_count && (!candidate.request || readahead_request_has_finished(*candidate.request))) {
+                    slot = &candidate;
+                    m_next_readahead_slot = (m_next_readahead_slot + i + 1) % max_pending_readaheads;
+                    break;
+                }
+            }
+            if (!slot)
+                break;
+
+            if (!slot->buffer) {
+                slot->buffer = KBuffer::try_create_with_size(max_readahead_size, Region::Access::Read | Region::Access::Write, "BlockBasedFS readahead", AllocationStrategy::AllocateNow);
+                if (!slot->buffer)
+                    break;
+            }
+
+            slot->index = index;
+            slot->count = chunk_length;
+            if (!slot->is_valid)
+                ++m_valid_readahead_count;
+            slot->is_valid = true;
+            // Readers ignore the slot until it has a request, and the pin keeps it ours.
+            slot->request = nullptr;
+            ++slot->pin_count;
+            claimed_slots.append(slot);
+        }
+    }
+
+    for (auto* slot : claimed_slots) {
+        for (unsigned i = 0; i < slot->count; ++i)
+            flush_specific_block_if_needed(slot->index + i);
+    }
+
+    LOCKER(m_readahead_lock);
+    for (auto* slot : claimed_slots) {
+        --slot->pin_count;
+        if (!slot->is_valid)
+            continue;
+        auto buffer = UserOrKernelBuffer::for_kernel_buffer(slot->buffer->data());
+        slot->request = device.make_request<AsyncBlockDeviceRequest>(AsyncBlockDeviceRequest::Read,
+            slot->index * device_blocks_per_block, slot->count * device_blocks_per_block, buffer, slot->count * block_size());
+    }
+}
+
+bool BlockBasedFS::read_from_readahead(unsigned index, unsigned count, UserOrKernelBuffer& buffer) const
+{
+    if (!m_valid_readahead_count.load(AK::MemoryOrder::memory_order_relaxed))
+        return false;
+
+    // Find and pin a matching readahead under the lock, but don't hold the lock while
+    // waiting for the device. Otherwise every read on this filesystem would queue up
+    // behind a single outstanding readahead.
+    PendingReadahead* readahead = nullptr;
+    RefPtr<AsyncBlockDeviceRequest> request;
+    {
+        LOCKER(m_readahead_lock);
+        for (auto& candidate : m_pending_readaheads) {
+            if (!candidate.is_valid || !candidate.request || index < candidate.index || index + count > candidate.index + candidate.count)
+                continue;
+            readahead = &candidate;
+            request = candidate.request;
+            ++candidate.pin_count;
+            break;
+        }
+    }
+    if (!readahead)
+        return false;
+
+    auto result = request->wait();
+    bool device_succeeded = result.request_result() == AsyncDeviceRequest::Success;
+    bool success = device_succeeded && buffer.write(readahead->buffer->data() + (index - readahead->index) * block_size(), count * block_size());
+
+    LOCKER(m_readahead_lock);
+    --readahead->pin_count;
+    if (!device_succeeded && readahead->is_valid && readahead_request_has_finished(*request)) {
+        readahead->is_valid = false;
+        --m_valid_readahead_count;
+    }
+    // If a write invalidated the readahead while we were copying, what we got may be stale.
+    return success && readahead->is_valid;
+}
+
+void BlockBasedFS::invalidate_readahead(unsigned index, unsigned count) const
+{
+    if (!m_valid_readahead_count.load(AK::MemoryOrder::memory_order_relaxed))
+        return;
+    LOCKER(m_readahead_lock);
+    for (auto& readahead : m_pending_readaheads) {
+        if (readahead.is_valid && index < readahead.index + readahead.count && readahead.index < index + count) {
+            readahead.is_valid = false;
+            --m_valid_readahead_count;
+        }
+    }
+}
+
+KResult BlockBasedFS::write_to_device(unsigned index, unsigned count, const UserOrKernelBuffer& buffer) const
+{
+    size_t size = count * block_size();
+    size_t base_offset = static_cast<size_t>(index) * block_size();
+    size_t nwritten = 0;
+    while (nwritten < size) {
+        auto result = file_description().file().write(file_description(), base_offset + nwritten, buffer.offset(nwritten), size - nwritten);
+        if (result.is_error())
+            return result.error();
+        if (result.value() == 0)
+            return KResult(-EIO);
+        nwritten += result.value();
+    }
+    return KSuccess;
+}
+
 int BlockBasedFS::read_blocks(unsigned index, unsigned count, UserOrKernelBuffer& buffer, bool allow_cache) const
 {
     ASSERT(m_logical_block_size);
@@ -267,55 +626,164 @@ int BlockBasedFS::read_blocks(unsigned index, unsigned count, UserOrKernelBuffer
         return false;
     if (count == 1)
         return read_block(index, &buffer, block_size(), 0, allow_cache);
-    auto out = buffer;
-    for (unsigned i = 0; i < count; ++i) {
-        auto err = read_block(index + i, &out, block_size(), 0, allow_cache);
-        if (err < 0)
-            return err;
-        out = out.offset(block_size());
+
+    if (!allow_cache) {
+        for (unsigned i = 0; i < count; ++i)
+            flush_specific_block_if_needed(index + i);
+        auto result = read_from_device(index, count, buffer);
+        if (result.is_error())
+            return result.error() == -EFAULT ? -EFAULT : -EIO;
+        return 0;
+    }
+
+#ifdef BBFS_DEBUG
+    klog() << "BlockBasedFileSystem::read_blocks " << index << " x" << count;
+#endif
+
+    auto is_cached = [&](unsigned block_index) {
+        auto& shard = cache().shard_for(block_index);
+        LOCKER(shard.lock());
+        auto* entry = shard.find(block_index);
+        return entry && entry->has_data;
+    };
+
+    // Uncached runs are read into a kernel bounce buffer first. Reading them straight into
+    // the caller's buffer would let another thread change the data before it lands in the
+    // cache, where every other reader of these blocks would see it.
+    size_t max_run_length = max(max_read_run_size / block_size(), (size_t)1);
+    OwnPtr<KBuffer> bounce_buffer;
+
+    for (unsigned i = 0; i < count;) {
+        unsigned run_length = 0;
+        while (i + run_length < count && run_length < max_run_length && !is_cached(index + i + run_length))
+            ++run_length;
+
+        if (run_length > 1 && !bounce_buffer)
+            bounce_buffer = KBuffer::try_create_with_size(max_run_length * block_size(), Region::Access::Read | Region::Access::Write, "BlockBasedFS read");
+
+        if (run_length <= 1 || !bounce_buffer) {
+            // read_block() fills the cache entry itself before copying out.
+            auto out = buffer.offset(i * block_size());
+            auto err = read_block(index + i, &out, block_size());
+            if (err < 0)
+                return err;
+            ++i;
+            continue;
+        }
+
+        auto bounce = UserOrKernelBuffer::for_kernel_buffer(bounce_buffer->data());
+        auto result = read_from_device(index + i, run_length, bounce);
+        if (result.is_error())
+            return -EIO;
+
+        for (unsigned j = 0; j < run_length; ++j) {
+            auto& shard = cache().shard_for(index + i + j);
+            LOCKER(shard.lock());
+            auto& entry = shard.get(index + i + j);
+            // If someone else read or wrote the block in the meantime, the cache has the latest data.
+            if (!entry.has_data) {
+                memcpy(entry.data, bounce_buffer->data() + j * block_size(), block_size());
+                entry.has_data = true;
+            }
+            if (!buffer.write(entry.data, (i + j) * block_size(), block_size()))
+                return -EFAULT;
+        }
+        i += run_length;
     }
 
     return 0;
 }
 
-void BlockBasedFS::flush_specific_block_if_needed(unsigned index)
+void BlockBasedFS::flush_specific_block_if_needed(unsigned index) const
 {
-    LOCKER(m_lock);
-    if (!cache().is_dirty())
+    auto& shard = cache().shard_for(index);
+    LOCKER(shard.lock());
+    auto* entry = shard.find(index);
+    if (!entry || !entry->is_dirty)
         return;
-    Vector<CacheEntry*, 32> cleaned_entries;
-    cache().for_each_dirty_entry([&](CacheEntry& entry) {
-        if (entry.block_index != index) {
-            u32 base_offset = static_cast<u32>(entry.block_index) * static_cast<u32>(block_size());
-            file_description().seek(base_offset, SEEK_SET);
-            // FIXME: Should this error path be surfaced somehow?
-            auto entry_data_buffer = UserOrKernelBuffer::for_kernel_buffer(entry.data);
-            [[maybe_unused]] auto rc = file_description().write(entry_data_buffer, block_size());
-            cleaned_entries.append(&entry);
-        }
-    });
-    // NOTE: We make a separate pass to mark entries clean since marking them clean
-    //       moves them out of the dirty list which would disturb the iteration above.
-    for (auto* entry : cleaned_entries)
-        cache().mark_clean(*entry);
+    auto entry_data_buffer = UserOrKernelBuffer::for_kernel_buffer(entry->data);
+    // FIXME: Should this error path be surfaced somehow?
+    if (write_to_device(index, 1, entry_data_buffer).is_error())
+        return;
+    shard.mark_clean(*entry, entry->dirty_generation);
+}
+
+void BlockBasedFS::uncache_block(unsigned index)
+{
+    auto& shard = cache().shard_for(index);
+    LOCKER(shard.lock());
+    flush_specific_block_if_needed(index);
+    auto* entry = shard.find(index);
+    if (entry && !entry->is_dirty)
+        shard.invalidate(*entry);
 }
 
 void BlockBasedFS::flush_writes_impl()
 {
     LOCKER(m_lock);
-    if (!cache().is_dirty())
+    Vector<u32> dirty_blocks;
+    cache().for_each_shard([&](auto& shard) {
+        LOCKER(shard.lock());
+        shard.for_each_dirty_entry([&](auto& entry) { dirty_blocks.append(entry.block_index); });
+    });
+    if (dirty_blocks.is_empty())
+        return;
+    quick_sort(dirty_blocks);
+
+    // Write out runs of consecutive blocks with a single write each. We gather
+    // the blocks of a run into a bounce buffer since cache entries aren't
+    // contiguous in memory.
+    size_t max_run_length = max_flush_run_size / block_size();
+    auto bounce_buffer = KBuffer::try_create_with_size(max_run_length * block_size(), Region::Access::Read | Region::Access::Write, "BlockBasedFS flush");
+    if (!bounce_buffer) {
+        cache().for_each_shard([&](auto& shard) {
+            LOCKER(shard.lock());
+            shard.flush();
+        });
         return;
-    u32 count = 0;
-    cache().for_each_dirty_entry([&](CacheEntry& entry) {
-        u32 base_offset = static_cast<u32>(entry.block_index) * static_cast<u32>(block_size());
-        file_description().seek(base_offset, SEEK_SET);
+    }
+
+    Vector<u32> dirty_generations;
+    size_t flushed_count = 0;
+    for (size_t i = 0; i < dirty_blocks.size();) {
+        // NOTE: The entries stay dirty until they've been written, so they can't be evicted meanwhile.
+        size_t run_length = 0;
+        dirty_generations.clear();
+        while (i + run_length < dirty_blocks.size() && run_length < max_run_length) {
+            u32 block_index = dirty_blocks[i + run_length];
+            if (block_index != dirty_blocks[i] + run_length)
+                break;
+            auto& shard = cache().shard_for(block_index);
+            LOCKER(shard.lock());
+            auto* entry = shard.find(block_index);
+            if (!entry || !entry->is_dirty)
+                break;
+            memcpy(bounce_buffer->data() + run_length * block_size(), entry->data, block_size());
+            dirty_generations.append(entry->dirty_generation);
+            ++run_length;
+        }
+
+        if (run_length == 0) {
+            // Someone else wrote this one back already.
+            ++i;
+            continue;
+        }
+
+        auto data_buffer = UserOrKernelBuffer::for_kernel_buffer(bounce_buffer->data());
         // FIXME: Should this error path be surfaced somehow?
-        auto entry_data_buffer = UserOrKernelBuffer::for_kernel_buffer(entry.data);
-        [[maybe_unused]] auto rc = file_description().write(entry_data_buffer, block_size());
-        ++count;
-    });
-    cache().mark_all_clean();
-    dbgln("{}: Flushed {} blocks to disk", class_name(), count);
+        if (!write_to_device(dirty_blocks[i], run_length, data_buffer).is_error()) {
+            for (size_t j = 0; j < run_length; ++j) {
+                auto& shard = cache().shard_for(dirty_blocks[i + j]);
+                LOCKER(shard.lock());
+                if (auto* entry = shard.find(dirty_blocks[i + j]))
+                    shard.mark_clean(*entry, dirty_generations[j]);
+            }
+            flushed_count += run_length;
+        }
+        i += run_length;
+    }
+
+    dbgln("{}: Flushed {} blocks to disk", class_name(), flushed_count);
 }
 
 void BlockBasedFS::flush_writes()
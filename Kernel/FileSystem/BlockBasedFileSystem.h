@@ -54,13 +54,53 @@ protected:
     int write_block(unsigned index, const UserOrKernelBuffer& buffer, size_t count, size_t offset = 0, bool allow_cache = true);
     int write_blocks(unsigned index, unsigned count, const UserOrKernelBuffer&, bool allow_cache = true);
 
+    // Starts reading the given blocks from the device in the background, without waiting for them.
+    // Later reads of these blocks (cached or not) are then served from the readahead buffer.
+    void read_ahead(unsigned index, unsigned count) const;
+
     size_t m_logical_block_size { 512 };
 
 private:
+    friend class DiskCacheShard;
+
+    // The largest run of consecutive dirty blocks we write to the device at once when flushing.
+    static constexpr size_t max_flush_run_size = 64 * KiB;
+
+    // The largest run of consecutive uncached blocks we read from the device at once.
+    static constexpr size_t max_read_run_size = 64 * KiB;
+
+    // The number of background reads we keep track of, and the most each of them can cover.
+    static constexpr size_t max_pending_readaheads = 16;
+    static constexpr size_t max_readahead_size = 64 * KiB;
+
+    struct PendingReadahead {
+        unsigned index { 0 };
+        unsigned count { 0 };
+        bool is_valid { false };
+        // Readers copying out of the buffer keep the slot from being reused.
+        unsigned pin_count { 0 };
+        OwnPtr<KBuffer> buffer;
+        RefPtr<AsyncBlockDeviceRequest> request;
+    };
+
+    KResult read_from_device(unsigned index, unsigned count, UserOrKernelBuffer&) const;
+    KResult write_to_device(unsigned index, unsigned count, const UserOrKernelBuffer&) const;
+
+    bool read_from_readahead(unsigned index, unsigned count, UserOrKernelBuffer&) const;
+    void invalidate_readahead(unsigned index, unsigned count) const;
+
     DiskCache& cache() const;
-    void flush_specific_block_if_needed(unsigned index);
+    void flush_specific_block_if_needed(unsigned index) const;
+    // Writes the block back if it's dirty and drops it from the cache, before we bypass the cache.
+    void uncache_block(unsigned index);
 
     mutable OwnPtr<DiskCache> m_cache;
+
+    mutable Lock m_readahead_lock { "BlockBasedFSReadahead" };
+    mutable PendingReadahead m_pending_readaheads[max_pending_readaheads];
+    mutable size_t m_next_readahead_slot { 0 };
+    // Lets reads and writes skip m_readahead_lock while there are no readaheads to look at.
+    mutable Atomic<u32> m_valid_readahead_count { 0 };
 };
 
 }
@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Kernel/FileSystem/EventPoll.h>
+#include <Kernel/FileSystem/FileDescription.h>
+#include <Kernel/Process.h>
+
+//#define EVENTPOLL_DEBUG
+
+namespace Kernel {
+
+static Thread::FileBlocker::BlockFlags block_flags_for(u32 events)
+{
+    u32 block_flags = (u32)Thread::FileBlocker::BlockFlags::None;
+    if (events & EPOLLIN)
+        block_flags |= (u32)Thread::FileBlocker::BlockFlags::Read;
+    if (events & EPOLLOUT)
+        block_flags |= (u32)Thread::FileBlocker::BlockFlags::Write;
+    if (events & EPOLLPRI)
+        block_flags |= (u32)Thread::FileBlocker::BlockFlags::ReadPriority;
+    return (Thread::FileBlocker::BlockFlags)block_flags;
+}
+
+static u32 epoll_events_for(Thread::FileBlocker::BlockFlags block_flags)
+{
+    u32 events = 0;
+    if ((u32)block_flags & (u32)Thread::FileBlocker::BlockFlags::Read)
+        events |= EPOLLIN;
+    if ((u32)block_flags & (u32)Thread::FileBlocker::BlockFlags::Write)
+        events |= EPOLLOUT;
+    if ((u32)block_flags & (u32)Thread::FileBlocker::BlockFlags::ReadPriority)
+        events |= EPOLLPRI;
+    return events;
+}
+
+EventPoll::Watch::Watch(EventPoll& event_poll, int fd, FileDescription& description, const epoll_event& event)
+    : m_event(event)
+    , m_event_poll(event_poll)
+    , m_fd(fd)
+    , m_file(description.file())
+    , m_description(&description)
+{
+    // unblock() never asks to be removed, so this always succeeds.
+    bool was_added = m_file->block_condition().add_blocker(*this, nullptr);
+    ASSERT(was_added);
+}
+
+EventPoll::Watch::~Watch()
+{
+    // Once we're out of the block condition, nobody else can queue us up.
+    m_file->block_condition().remove_blocker(*this, nullptr);
+    ScopedSpinLock lock(m_event_poll.m_ready_lock);
+    if (m_queued)
+        m_event_poll.m_ready_list.remove(*this);
+}
+
+RefPtr<FileDescription> EventPoll::Watch::description() const
+{
+    ScopedSpinLock lock(m_description_lock);
+    // The description may already be on its way out, waiting for us to let go
+    // of the lock in description_will_be_destroyed().
+    if (!m_description || !m_description->try_ref())
+        return nullptr;
+    return adopt(*m_description);
+}
+
+bool EventPoll::Watch::refers_to(const FileDescription& description) const
+{
+    ScopedSpinLock lock(m_description_lock);
+    return m_description == &description;
+}
+
+bool EventPoll::Watch::unblock(bool, void*)
+{
+    u32 events;
+    {
+        ScopedSpinLock lock(m_event_poll.m_ready_lock);
+        if (!m_enabled || m_queued)
+            return false;
+        events = m_event.events;
+    }
+
+    bool is_ready;
+    {
+        // The description can't finish being destroyed while we hold the lock.
+        ScopedSpinLock lock(m_description_lock);
+        is_ready = m_description && m_description->should_unblock(block_flags_for(events)) != BlockFlags::None;
+    }
+    if (is_ready)
+        m_event_poll.enqueue(*this);
+
+    // Stay in the block condition, we want to hear about every state change.
+    return false;
+}
+
+bool EventPoll::Watch::description_will_be_destroyed(FileDescription& description)
+{
+    {
+        ScopedSpinLock lock(m_description_lock);
+        if (m_description != &description)
+            return false;
+        m_description = nullptr;
+    }
+    // Get the next wait() to drop us from the set.
+    m_event_poll.enqueue(*this);
+    return true;
+}
+
+NonnullRefPtr<EventPoll> EventPoll::create()
+{
+    return adopt(*new EventPoll);
+}
+
+EventPoll::EventPoll()
+{
+}
+
+EventPoll::~EventPoll()
+{
+    // The watches touch the ready list on their way out, so get rid of
+    // them before our members go away.
+    m_watches.clear();
+}
+
+bool EventPoll::enqueue_locked(Watch& watch)
+{
+    ASSERT(m_ready_lock.is_locked());
+    if (!watch.m_enabled || watch.m_queued)
+        return false;
+    watch.m_queued = true;
+    m_ready_list.append(watch);
+    return true;
+}
+
+void EventPoll::enqueue(Watch& watch)
+{
+    {
+        ScopedSpinLock lock(m_ready_lock);
+        if (!enqueue_locked(watch))
+            return;
+    }
+#ifdef EVENTPOLL_DEBUG
+    dbgln("EventPoll @ {}: fd {} is ready", this, watch.fd());
+#endif
+    m_wait_queue.wake_all();
+    evaluate_block_conditions();
+}
+
+KResult EventPoll::add(int fd, FileDescription& description, const epoll_event& event)
+{
+    LOCKER(m_lock);
+    auto it = m_watches.find(fd);
+    if (it != m_watches.end()) {
+        if (it->value->refers_to(description))
+            return KResult(-EEXIST);
+        // The fd was closed and reused without being removed from the set.
+        m_watches.remove(it);
+    }
+    m_watches.set(fd, make<Watch>(*this, fd, description, event));
+    return KSuccess;
+}
+
+KResult EventPoll::modify(int fd, FileDescription& description, const epoll_event& event)
+{
+    LOCKER(m_lock);
+    auto it = m_watches.find(fd);
+    if (it == m_watches.end() || !it->value->refers_to(description))
+        return KResult(-ENOENT);
+    auto& watch = *it->value;
+    {
+        ScopedSpinLock lock(m_ready_lock);
+        watch.m_event = event;
+        watch.m_enabled = true;
+    }
+    // The new event mask may already be satisfied.
+    watch.unblock(false, nullptr);
+    return KSuccess;
+}
+
+KResult EventPoll::remove(int fd)
+{
+    LOCKER(m_lock);
+    if (!m_watches.remove(fd))
+        return KResult(-ENOENT);
+    return KSuccess;
+}
+
+void EventPoll::collect_events(Vector<epoll_event>& events, size_t max_events)
+{
+    LOCKER(m_lock);
+    u32 generation = ++m_generation;
+    Vector<Watch*, 32> watches_to_requeue;
+    Vector<int> stale_fds;
+
+    while (events.size() < max_events) {
+        Watch* watch;
+        epoll_event event;
+        {
+            ScopedSpinLock lock(m_ready_lock);
+            watch = m_ready_list.take_first();
+            if (!watch)
+                break;
+            watch->m_queued = false;
+            event = watch->m_event;
+            if (watch->m_last_reported_generation == generation) {
+                // A level-triggered watch that got queued up again while we
+                // were busy; don't report it twice in one go.
+                watches_to_requeue.append(watch);
+                continue;
+            }
+        }
+
+        auto description = watch->description();
+        if (!description) {
+            // The description was closed without being removed from the set.
+            stale_fds.append(watch->fd());
+            continue;
+        }
+
+        // Readiness may have been consumed since the watch was queued.
+        auto unblocked_flags = description->should_unblock(block_flags_for(event.events));
+        if (unblocked_flags == Thread::FileBlocker::BlockFlags::None)
+            continue;
+
+        events.append({ epoll_events_for(unblocked_flags), event.data });
+
+        bool should_requeue = false;
+        {
+            ScopedSpinLock lock(m_ready_lock);
+            watch->m_last_reported_generation = generation;
+            if (event.events & EPOLLONESHOT)
+                watch->m_enabled = false;
+            else if (!(event.events & EPOLLET))
+                should_requeue = true;
+        }
+        // Level-triggered watches go back on the ready list, the next
+        // wait() drops them once they're no longer ready.
+        if (should_requeue)
+            watches_to_requeue.append(watch);
+    }
+
+    if (!watches_to_requeue.is_empty()) {
+        ScopedSpinLock lock(m_ready_lock);
+        for (auto* watch : watches_to_requeue)
+            enqueue_locked(*watch);
+    }
+
+    for (int fd : stale_fds) {
+#ifdef EVENTPOLL_DEBUG
+        dbgln("EventPoll @ {}: dropping stale watch for fd {}", this, fd);
+#endif
+        m_watches.remove(fd);
+    }
+}
+
+KResultOr<size_t> EventPoll::wait(Vector<epoll_event>& events, size_t max_events, const Thread::BlockTimeout& timeout)
+{
+    ASSERT(max_events > 0);
+    for (;;) {
+        collect_events(events, max_events);
+        if (!events.is_empty() || !timeout.should_block())
+            return events.size();
+
+        // If something gets queued before we start waiting, the wait queue
+        // remembers the wake and we won't block.
+        auto result = m_wait_queue.wait_on(timeout, "EventPoll");
+        if (result == Thread::BlockResult::InterruptedByTimeout)
+            return 0;
+        if (result.was_interrupted())
+            return KResult(-EINTR);
+    }
+}
+
+bool EventPoll::can_read(const FileDescription&, size_t) const
+{
+    ScopedSpinLock lock(m_ready_lock);
+    return !m_ready_list.is_empty();
+}
+
+KResultOr<size_t> EventPoll::read(FileDescription&, size_t, UserOrKernelBuffer&, size_t)
+{
+    return KResult(-EINVAL);
+}
+
+KResultOr<size_t> EventPoll::write(FileDescription&, size_t, const UserOrKernelBuffer&, size_t)
+{
+    return KResult(-EINVAL);
+}
+
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/HashMap.h>
+#include <AK/IntrusiveList.h>
+#include <AK/NonnullOwnPtr.h>
+#include <AK/Vector.h>
+#include <Kernel/FileSystem/File.h>
+#include <Kernel/Lock.h>
+#include <Kernel/SpinLock.h>
+#include <Kernel/UnixTypes.h>
+#include <Kernel/WaitQueue.h>
+
+namespace Kernel {
+
+// EventPoll keeps a persistent set of watched file descriptions. Every watch
+// stays registered in its File's block condition, so a readiness change pushes
+// the watch onto the ready list, and waiting only has to look at the watches
+// that were pushed instead of re-checking the whole set.
+// Like on Linux, watching a description doesn't keep it open. Once the last fd
+// referring to it is closed, the watch goes away with it.
+class EventPoll final : public File {
+public:
+    static NonnullRefPtr<EventPoll> create();
+    virtual ~EventPoll() override;
+
+    KResult add(int fd, FileDescription&, const epoll_event&);
+    KResult modify(int fd, FileDescription&, const epoll_event&);
+    KResult remove(int fd);
+    KResultOr<size_t> wait(Vector<epoll_event>&, size_t max_events, const Thread::BlockTimeout&);
+
+    virtual bool is_event_poll() const override { return true; }
+    virtual bool can_read(const FileDescription&, size_t) const override;
+    virtual bool can_write(const FileDescription&, size_t) const override { return false; }
+    virtual KResultOr<size_t> read(FileDescription&, size_t, UserOrKernelBuffer&, size_t) override;
+    virtual KResultOr<size_t> write(FileDescription&, size_t, const UserOrKernelBuffer&, size_t) override;
+    virtual String absolute_path(const FileDescription&) const override { return "EventPoll"; }
+    virtual const char* class_name() const override { return "EventPoll"; }
+
+private:
+    class Watch final : public Thread::FileBlocker {
+    public:
+        Watch(EventPoll&, int fd, FileDescription&, const epoll_event&);
+        virtual ~Watch() override;
+
+        virtual const char* state_string() const override { return "EventPoll"; }
+        virtual void not_blocking(bool) override { }
+        virtual bool unblock(bool, void*) override;
+        virtual bool description_will_be_destroyed(FileDescription&) override;
+
+        int fd() const { return m_fd; }
+        // Returns null once the description is gone.
+        RefPtr<FileDescription> description() const;
+        bool refers_to(const FileDescription&) const;
+
+        IntrusiveListNode m_ready_list_node;
+
+        // These are protected by the owning EventPoll's m_ready_lock.
+        epoll_event m_event;
+        u32 m_last_reported_generation { 0 };
+        bool m_enabled { true };
+        bool m_queued { false };
+
+    private:
+        EventPoll& m_event_poll;
+        const int m_fd;
+        NonnullRefPtr<File> m_file;
+        // Not a reference, see description_will_be_destroyed().
+        mutable SpinLock<u8> m_description_lock;
+        FileDescription* m_description { nullptr };
+    };
+
+    EventPoll();
+
+    void enqueue(Watch&);
+    bool enqueue_locked(Watch&);
+    void collect_events(Vector<epoll_event>&, size_t max_events);
+
+    Lock m_lock { "EventPoll" };
+    HashMap<int, NonnullOwnPtr<Watch>> m_watches;
+    u32 m_generation { 0 };
+
+    mutable SpinLock<u8> m_ready_lock;
+    IntrusiveList<Watch, &Watch::m_ready_list_node> m_ready_list;
+    WaitQueue m_wait_queue;
+};
+
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Kernel/FileSystem/Ext2FSBlockMap.h>
+
+namespace Kernel {
+
+size_t Ext2FSBlockMap::extent_index_for(size_t logical_index) const
+{
+    ASSERT(logical_index < m_block_count);
+    size_t low = 0;
+    size_t high = m_extents.size();
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (m_extent_starts[middle] <= logical_index)
+            low = middle;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+u32 Ext2FSBlockMap::operator[](size_t logical_index) const
+{
+    size_t extent_index = extent_index_for(logical_index);
+    auto& extent = m_extents[extent_index];
+    if (!extent.first_block)
+        return 0;
+    return extent.first_block + (logical_index - m_extent_starts[extent_index]);
+}
+
+u32 Ext2FSBlockMap::last() const
+{
+    ASSERT(!is_empty());
+    auto& extent = m_extents.last();
+    if (!extent.first_block)
+        return 0;
+    return extent.first_block + extent.block_count - 1;
+}
+
+size_t Ext2FSBlockMap::contiguous_blocks_at(size_t logical_index) const
+{
+    size_t extent_index = extent_index_for(logical_index);
+    return m_extents[extent_index].block_count - (logical_index - m_extent_starts[extent_index]);
+}
+
+void Ext2FSBlockMap::append(u32 block_index)
+{
+    if (!m_extents.is_empty()) {
+        auto& extent = m_extents.last();
+        bool continues_hole = !extent.first_block && !block_index;
+        bool continues_extent = extent.first_block && block_index == extent.first_block + extent.block_count;
+        if (continues_hole || continues_extent) {
+            ++extent.block_count;
+            ++m_block_count;
+            return;
+        }
+    }
+    m_extents.append({ block_index, 1 });
+    m_extent_starts.append(m_block_count);
+    ++m_block_count;
+}
+
+void Ext2FSBlockMap::append(const Vector<u32>& block_indices)
+{
+    for (auto block_index : block_indices)
+        append(block_index);
+}
+
+Vector<u32> Ext2FSBlockMap::to_block_list() const
+{
+    Vector<u32> block_list;
+    block_list.ensure_capacity(m_block_count);
+    for (auto& extent : m_extents) {
+        for (u32 i = 0; i < extent.block_count; ++i)
+            block_list.unchecked_append(extent.first_block ? extent.first_block + i : 0);
+    }
+    return block_list;
+}
+
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/Types.h>
+#include <AK/Vector.h>
+
+namespace Kernel {
+
+// An inode's block list, kept as runs of physically contiguous blocks.
+// Holes in sparse files are runs of block 0.
+class Ext2FSBlockMap {
+public:
+    struct Extent {
+        u32 first_block { 0 };
+        u32 block_count { 0 };
+    };
+
+    bool is_empty() const { return m_block_count == 0; }
+    size_t size() const { return m_block_count; }
+    const Vector<Extent>& extents() const { return m_extents; }
+
+    u32 operator[](size_t logical_index) const;
+    u32 last() const;
+
+    // Returns how many physically contiguous blocks there are starting at the given logical index.
+    size_t contiguous_blocks_at(size_t logical_index) const;
+
+    void append(u32 block_index);
+    void append(const Vector<u32>& block_indices);
+
+    // Drops everything past new_size, and calls the callback with each run of blocks that was dropped.
+    template<typename Callback>
+    void shrink(size_t new_size, Callback callback)
+    {
+        while (m_block_count > new_size) {
+            auto& extent = m_extents.last();
+            size_t blocks_to_drop = min(static_cast<size_t>(extent.block_count), m_block_count - new_size);
+            extent.block_count -= blocks_to_drop;
+            m_block_count -= blocks_to_drop;
+            if (extent.first_block)
+                callback(extent.first_block + extent.block_count, blocks_to_drop);
+            if (!extent.block_count) {
+                m_extents.take_last();
+                m_extent_starts.take_last();
+            }
+        }
+    }
+
+    Vector<u32> to_block_list() const;
+
+private:
+    size_t extent_index_for(size_t logical_index) const;
+
+    Vector<Extent> m_extents;
+    // The logical index of the first block of each extent, so we can binary search.
+    Vector<size_t> m_extent_starts;
+    size_t m_block_count { 0 };
+};
+
+}
@@ -27,6 +27,8 @@
 #include <AK/Bitmap.h>
 #include <AK/HashMap.h>
 #include <AK/MemoryStream.h>
+#include <AK/NonnullRefPtrVector.h>
+#include <AK/QuickSort.h>
 #include <AK/StdLibExtras.h>
 #include <AK/StringView.h>
 #include <Kernel/Devices/BlockDevice.h>
@@ -35,6 +37,8 @@
 #include <Kernel/FileSystem/ext2_fs.h>
 #include <Kernel/Process.h>
 #include <Kernel/UnixTypes.h>
+#include <Kernel/VM/MemoryManager.h>
+#include <Kernel/VM/SharedInodeVMObject.h>
 #include <LibC/errno_numbers.h>
 
 //#define EXT2_DEBUG
@@ -45,6 +49,9 @@ namespace Kernel {
 static const size_t max_link_count = 65535;
 static const size_t max_block_size = 4096;
 static const ssize_t max_inline_symlink_length = 60;
+static const size_t block_reservation_window_size = 64 * KiB;
+static const size_t min_readahead_window = 16 * KiB;
+static const size_t max_readahead_window = 128 * KiB;
 
 struct Ext2FSDirectoryEntry {
     String name;
@@ -133,6 +140,7 @@ bool Ext2FS::initialize()
     ASSERT(block_size() <= (int)max_block_size);
 
     m_block_group_count = ceil_div(super_block.s_blocks_count, super_block.s_blocks_per_group);
+    m_reserved_blocks = Bitmap::create(super_block.s_blocks_count, false);
 
     if (m_block_group_count == 0) {
         klog() << "ext2fs: no block groups :(";
@@ -247,7 +255,10 @@ bool Ext2FS::write_block_list_for_inode(InodeIndex inode_index, ext2_inode& e2in
 
     Vector<BlockIndex> new_meta_blocks;
     if (new_shape.meta_blocks > old_shape.meta_blocks) {
-        new_meta_blocks = allocate_blocks(group_index_from_inode(inode_index), new_shape.meta_blocks - old_shape.meta_blocks);
+        auto new_meta_blocks_or_error = allocate_blocks(group_index_from_inode(inode_index), new_shape.meta_blocks - old_shape.meta_blocks);
+        if (new_meta_blocks_or_error.is_error())
+            return false;
+        new_meta_blocks = new_meta_blocks_or_error.release_value();
     }
 
     e2inode.i_blocks = (blocks.size() + new_shape.meta_blocks) * (block_size() / 512);
@@ -426,13 +437,28 @@ bool Ext2FS::write_block_list_for_inode(InodeIndex inode_index, ext2_inode& e2in
 
 Vector<Ext2FS::BlockIndex> Ext2FS::block_list_for_inode(const ext2_inode& e2inode, bool include_block_list_blocks) const
 {
-    auto block_list = block_list_for_inode_impl(e2inode, include_block_list_blocks);
+    Vector<BlockIndex> block_list;
+    block_list_for_inode_impl(e2inode, include_block_list_blocks, [&](BlockIndex block_index) {
+        block_list.append(block_index);
+    });
     while (!block_list.is_empty() && block_list.last() == 0)
         block_list.take_last();
     return block_list;
 }
 
-Vector<Ext2FS::BlockIndex> Ext2FS::block_list_for_inode_impl(const ext2_inode& e2inode, bool include_block_list_blocks) const
+Ext2FSBlockMap Ext2FS::block_map_for_inode(const ext2_inode& e2inode) const
+{
+    Ext2FSBlockMap block_map;
+    block_list_for_inode_impl(e2inode, false, [&](BlockIndex block_index) {
+        block_map.append(block_index);
+    });
+    // Like block_list_for_inode(), don't include trailing holes.
+    if (!block_map.is_empty() && block_map.last() == 0)
+        block_map.shrink(block_map.size() - block_map.extents().last().block_count, [](auto, auto) {});
+    return block_map;
+}
+
+void Ext2FS::block_list_for_inode_impl(const ext2_inode& e2inode, bool include_block_list_blocks, Function<void(BlockIndex)> block_callback) const
 {
     LOCKER(m_lock);
     unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
@@ -458,22 +484,13 @@ Vector<Ext2FS::BlockIndex> Ext2FS::block_list_for_inode_impl(const ext2_inode& e
         blocks_remaining += shape.meta_blocks;
     }
 
-    Vector<BlockIndex> list;
-
     auto add_block = [&](BlockIndex bi) {
         if (blocks_remaining) {
-            list.append(bi);
+            block_callback(bi);
             --blocks_remaining;
         }
     };
 
-    if (include_block_list_blocks) {
-        // This seems like an excessive over-estimate but w/e.
-        list.ensure_capacity(blocks_remaining * 2);
-    } else {
-        list.ensure_capacity(blocks_remaining);
-    }
-
     unsigned direct_count = min(block_count, (unsigned)EXT2_NDIR_BLOCKS);
     for (unsigned i = 0; i < direct_count; ++i) {
         auto block_index = e2inode.i_block[i];
@@ -481,7 +498,7 @@ Vector<Ext2FS::BlockIndex> Ext2FS::block_list_for_inode_impl(const ext2_inode& e
     }
 
     if (!blocks_remaining)
-        return list;
+        return;
 
     // Don't need to make copy of add_block, since this capture will only
     // be called before block_list_for_inode_impl finishes.
@@ -501,7 +518,7 @@ Vector<Ext2FS::BlockIndex> Ext2FS::block_list_for_inode_impl(const ext2_inode& e
     });
 
     if (!blocks_remaining)
-        return list;
+        return;
 
     process_block_array(e2inode.i_block[EXT2_DIND_BLOCK], [&](unsigned block_index) {
         process_block_array(block_index, [&](unsigned block_index2) {
@@ -510,7 +527,7 @@ Vector<Ext2FS::BlockIndex> Ext2FS::block_list_for_inode_impl(const ext2_inode& e
     });
 
     if (!blocks_remaining)
-        return list;
+        return;
 
     process_block_array(e2inode.i_block[EXT2_TIND_BLOCK], [&](unsigned block_index) {
         process_block_array(block_index, [&](unsigned block_index2) {
@@ -519,8 +536,6 @@ Vector<Ext2FS::BlockIndex> Ext2FS::block_list_for_inode_impl(const ext2_inode& e
             });
         });
     });
-
-    return list;
 }
 
 void Ext2FS::free_inode(Ext2FSInode& inode)
@@ -564,8 +579,72 @@ void Ext2FS::flush_block_group_descriptor_table()
     write_blocks(first_block_of_bgdt, blocks_to_write, buffer);
 }
 
+void Ext2FS::trim_page_caches()
+{
+    // A page cache keeps its inode alive, so caches of inodes that are otherwise unused have
+    // to be dropped before the inode can be uncached. Inodes that are still open keep their
+    // cache, but give up its clean pages. Keep the most recently read ones around.
+    struct PageCacheCandidate {
+        NonnullRefPtr<Ext2FSInode> inode;
+        bool in_use { false };
+    };
+    struct TrimmablePageCache {
+        Ext2FSInode* inode { nullptr };
+        bool in_use { false };
+        u64 last_read_time { 0 };
+        size_t size { 0 };
+    };
+
+    Vector<PageCacheCandidate> candidates;
+    {
+        LOCKER(m_lock);
+        for (auto& it : m_inode_cache) {
+            // The inode cache and a page cache account for two references.
+            if (it.value->ref_count() < 2)
+                continue;
+            bool in_use = it.value->ref_count() > 2 || it.value->has_watchers();
+            candidates.append({ *it.value, in_use });
+        }
+    }
+
+    Vector<TrimmablePageCache> trimmable_page_caches;
+    for (auto& candidate : candidates) {
+        auto& inode = *candidate.inode;
+        auto page_cache = inode.page_cache();
+        if (!page_cache)
+            continue;
+        bool in_use = candidate.in_use || page_cache->ref_count() != 2;
+        if (!in_use && inode.m_raw_inode.i_links_count == 0) {
+            inode.drop_page_cache();
+            continue;
+        }
+        size_t size = page_cache->amount_clean();
+        if (in_use && !size)
+            continue;
+        trimmable_page_caches.append({ &inode, in_use, page_cache->last_read_time(), size });
+    }
+
+    quick_sort(trimmable_page_caches, [](auto& a, auto& b) { return a.last_read_time > b.last_read_time; });
+
+    size_t budget = (size_t)MM.user_physical_pages() * PAGE_SIZE / 8;
+    size_t total_size = 0;
+    for (auto& trimmable_page_cache : trimmable_page_caches) {
+        total_size += trimmable_page_cache.size;
+        if (total_size <= budget)
+            continue;
+        if (!trimmable_page_cache.in_use) {
+            trimmable_page_cache.inode->drop_page_cache();
+            continue;
+        }
+        if (auto page_cache = trimmable_page_cache.inode->page_cache())
+            page_cache->release_all_clean_pages();
+    }
+}
+
 void Ext2FS::flush_writes()
 {
+    trim_page_caches();
+
     LOCKER(m_lock);
     if (m_super_block_dirty) {
         flush_super_block();
@@ -613,6 +692,7 @@ Ext2FSInode::Ext2FSInode(Ext2FS& fs, unsigned index)
 
 Ext2FSInode::~Ext2FSInode()
 {
+    fs().discard_block_reservation(index());
     if (m_raw_inode.i_links_count == 0)
         fs().free_inode(*this);
 }
@@ -690,6 +770,18 @@ RefPtr<Inode> Ext2FS::get_inode(InodeIdentifier inode) const
 }
 
 ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, UserOrKernelBuffer& buffer, FileDescription* description) const
+{
+    bool allow_cache = !description || !description->is_direct();
+    return read_bytes_impl(offset, count, buffer, allow_cache);
+}
+
+ssize_t Ext2FSInode::read_bytes_for_page_cache(off_t offset, ssize_t count, UserOrKernelBuffer& buffer) const
+{
+    // The page cache keeps its own copy of file data, so don't store it in the block cache too.
+    return read_bytes_impl(offset, count, buffer, false);
+}
+
+ssize_t Ext2FSInode::read_bytes_impl(off_t offset, ssize_t count, UserOrKernelBuffer& buffer, bool allow_cache) const
 {
     Locker inode_locker(m_lock);
     ASSERT(offset >= 0);
@@ -708,22 +800,20 @@ ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, UserOrKernelBuffer&
 
     Locker fs_locker(fs().m_lock);
 
-    if (m_block_list.is_empty())
-        m_block_list = fs().block_list_for_inode(m_raw_inode);
+    if (m_block_map.is_empty())
+        m_block_map = fs().block_map_for_inode(m_raw_inode);
 
-    if (m_block_list.is_empty()) {
+    if (m_block_map.is_empty()) {
         klog() << "ext2fs: read_bytes: empty block list for inode " << index();
         return -EIO;
     }
 
-    bool allow_cache = !description || !description->is_direct();
-
     const int block_size = fs().block_size();
 
     size_t first_block_logical_index = offset / block_size;
     size_t last_block_logical_index = (offset + count) / block_size;
-    if (last_block_logical_index >= m_block_list.size())
-        last_block_logical_index = m_block_list.size() - 1;
+    if (last_block_logical_index >= m_block_map.size())
+        last_block_logical_index = m_block_map.size() - 1;
 
     int offset_into_first_block = offset % block_size;
 
@@ -735,11 +825,29 @@ ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, UserOrKernelBuffer&
 #endif
 
     for (size_t bi = first_block_logical_index; remaining_count && bi <= last_block_logical_index; ++bi) {
-        auto block_index = m_block_list[bi];
+        auto block_index = m_block_map[bi];
         ASSERT(block_index);
         size_t offset_into_block = (bi == first_block_logical_index) ? offset_into_first_block : 0;
         size_t num_bytes_to_copy = min(block_size - offset_into_block, remaining_count);
         auto buffer_offset = buffer.offset(nread);
+
+        // Hand runs of physically consecutive whole blocks to the block layer as a single batch.
+        if (offset_into_block == 0) {
+            size_t run_length = min(m_block_map.contiguous_blocks_at(bi), last_block_logical_index - bi + 1);
+            run_length = min(run_length, remaining_count / block_size);
+            if (run_length > 1) {
+                int err = fs().read_blocks(block_index, run_length, buffer_offset, allow_cache);
+                if (err < 0) {
+                    klog() << "ext2fs: read_bytes: read_blocks(" << block_index << ", " << run_length << ") failed (lbi: " << bi << ")";
+                    return err;
+                }
+                remaining_count -= run_length * block_size;
+                nread += run_length * block_size;
+                bi += run_length - 1;
+                continue;
+            }
+        }
+
         int err = fs().read_block(block_index, &buffer_offset, num_bytes_to_copy, offset_into_block, allow_cache);
         if (err < 0) {
             klog() << "ext2fs: read_bytes: read_block(" << block_index << ") failed (lbi: " << bi << ")";
@@ -752,6 +860,74 @@ ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, UserOrKernelBuffer&
     return nread;
 }
 
+void Ext2FSInode::readahead(FileDescription& description, off_t offset, size_t count)
+{
+    if (!count || !Kernel::is_regular_file(m_raw_inode.i_mode))
+        return;
+
+    auto& state = description.readahead_state();
+    off_t end = offset + count;
+    if (offset != state.next_offset) {
+        // Not a sequential read, so start over.
+        state.next_offset = end;
+        state.readahead_end = end;
+        state.window = 0;
+        return;
+    }
+
+    // The window grows for as long as the reads stay sequential.
+    state.next_offset = end;
+    state.window = state.window ? min(state.window * 2, max_readahead_window) : min_readahead_window;
+
+    // Only top up once half of what we read ahead has been consumed, so we issue large reads.
+    if (state.readahead_end - end >= static_cast<off_t>(state.window / 2))
+        return;
+    off_t readahead_start = max(state.readahead_end, end);
+    off_t readahead_end = min(end + static_cast<off_t>(state.window), static_cast<off_t>(size()));
+    if (readahead_start >= readahead_end)
+        return;
+    state.readahead_end = readahead_end;
+
+    Locker inode_locker(m_lock);
+    Locker fs_locker(fs().m_lock);
+
+    if (m_block_map.is_empty())
+        m_block_map = fs().block_map_for_inode(m_raw_inode);
+    if (m_block_map.is_empty())
+        return;
+
+    const size_t block_size = fs().block_size();
+    size_t first_block_logical_index = readahead_start / block_size;
+    size_t last_block_logical_index = min(static_cast<size_t>((readahead_end - 1) / block_size), m_block_map.size() - 1);
+
+#ifdef EXT2_VERY_DEBUG
+    dbgln("Ext2FS: Reading ahead blocks {} to {} of inode {}", first_block_logical_index, last_block_logical_index, index());
+#endif
+
+    // Read ahead runs of physically contiguous blocks we don't already have in the page cache.
+    auto page_cache = this->page_cache();
+    size_t run_start = 0;
+    size_t run_length = 0;
+    auto read_ahead_run = [&] {
+        if (run_length)
+            fs().read_ahead(m_block_map[run_start], run_length);
+        run_length = 0;
+    };
+    for (size_t bi = first_block_logical_index; bi <= last_block_logical_index; ++bi) {
+        auto block_index = m_block_map[bi];
+        if (!block_index || (page_cache && page_cache->has_page(bi * block_size / PAGE_SIZE))) {
+            read_ahead_run();
+            continue;
+        }
+        if (run_length && block_index != m_block_map[run_start] + run_length)
+            read_ahead_run();
+        if (!run_length)
+            run_start = bi;
+        ++run_length;
+    }
+    read_ahead_run();
+}
+
 KResult Ext2FSInode::resize(u64 new_size)
 {
     u64 old_size = size();
@@ -773,37 +949,47 @@ KResult Ext2FSInode::resize(u64 new_size)
             return KResult(-ENOSPC);
     }
 
-    Vector<Ext2FS::BlockIndex> block_list;
-    if (!m_block_list.is_empty())
-        block_list = m_block_list;
+    Ext2FSBlockMap block_map;
+    Vector<Ext2FS::BlockIndex> new_blocks;
+    if (!m_block_map.is_empty())
+        block_map = m_block_map;
     else
-        block_list = fs().block_list_for_inode(m_raw_inode);
+        block_map = fs().block_map_for_inode(m_raw_inode);
 
     if (blocks_needed_after > blocks_needed_before) {
-        auto new_blocks = fs().allocate_blocks(fs().group_index_from_inode(index()), blocks_needed_after - blocks_needed_before);
-        block_list.append(move(new_blocks));
+        // Try to continue right where the file ends, so it stays in as few extents as possible.
+        Ext2FS::BlockIndex goal = (!block_map.is_empty() && block_map.last()) ? block_map.last() + 1 : 0;
+        auto new_blocks_or_error = fs().allocate_blocks(fs().group_index_from_inode(index()), blocks_needed_after - blocks_needed_before, index(), goal);
+        if (new_blocks_or_error.is_error())
+            return new_blocks_or_error.error();
+        new_blocks = new_blocks_or_error.release_value();
+        block_map.append(new_blocks);
     } else if (blocks_needed_after < blocks_needed_before) {
 #ifdef EXT2_DEBUG
-        dbgln("Ext2FS: Shrinking inode {}. Old block list is {} entries:", index(), block_list.size());
-        for (auto block_index : block_list) {
-            dbgln("    # {}", block_index);
+        dbgln("Ext2FS: Shrinking inode {}. Old block map has {} extents:", index(), block_map.extents().size());
+        for (auto& extent : block_map.extents()) {
+            dbgln("    # {} x{}", extent.first_block, extent.block_count);
         }
 #endif
-        while (block_list.size() != blocks_needed_after) {
-            auto block_index = block_list.take_last();
-            if (block_index)
-                fs().set_block_allocation_state(block_index, false);
-        }
+        block_map.shrink(blocks_needed_after, [&](auto first_block, auto block_count) {
+            fs().set_block_range_allocation_state(first_block, block_count, false);
+        });
+        fs().discard_block_reservation(index());
     }
 
-    int err = fs().write_block_list_for_inode(index(), m_raw_inode, block_list);
-    if (err < 0)
-        return KResult(err);
+    if (!fs().write_block_list_for_inode(index(), m_raw_inode, block_map.to_block_list())) {
+        // We couldn't get the blocks to hold the block list, so the data blocks are of no use either.
+        fs().release_blocks(new_blocks);
+        return KResult(-ENOSPC);
+    }
 
     m_raw_inode.i_size = new_size;
     set_metadata_dirty(true);
 
-    m_block_list = move(block_list);
+    m_block_map = move(block_map);
+
+    // Drop cached pages past the new end of file, so they can't be read (or mapped) back.
+    inode_size_changed(old_size, new_size);
 
     if (new_size > old_size) {
         // If we're growing the inode, make sure we zero out all the new space.
@@ -862,18 +1048,18 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const UserOrKernel
     if (resize_result.is_error())
         return resize_result;
 
-    if (m_block_list.is_empty())
-        m_block_list = fs().block_list_for_inode(m_raw_inode);
+    if (m_block_map.is_empty())
+        m_block_map = fs().block_map_for_inode(m_raw_inode);
 
-    if (m_block_list.is_empty()) {
+    if (m_block_map.is_empty()) {
         dbgln("Ext2FSInode::write_bytes(): empty block list for inode {}", index());
         return -EIO;
     }
 
     size_t first_block_logical_index = offset / block_size;
     size_t last_block_logical_index = (offset + count) / block_size;
-    if (last_block_logical_index >= m_block_list.size())
-        last_block_logical_index = m_block_list.size() - 1;
+    if (last_block_logical_index >= m_block_map.size())
+        last_block_logical_index = m_block_map.size() - 1;
 
     size_t offset_into_first_block = offset % block_size;
 
@@ -888,11 +1074,11 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const UserOrKernel
         size_t offset_into_block = (bi == first_block_logical_index) ? offset_into_first_block : 0;
         size_t num_bytes_to_copy = min(block_size - offset_into_block, remaining_count);
 #ifdef EXT2_VERY_DEBUG
-        dbgln("Ext2FS: Writing block {} (offset_into_block: {})", m_block_list[bi], offset_into_block);
+        dbgln("Ext2FS: Writing block {} (offset_into_block: {})", m_block_map[bi], offset_into_block);
 #endif
-        int err = fs().write_block(m_block_list[bi], data.offset(nwritten), num_bytes_to_copy, offset_into_block, allow_cache);
+        int err = fs().write_block(m_block_map[bi], data.offset(nwritten), num_bytes_to_copy, offset_into_block, allow_cache);
         if (err < 0) {
-            dbgln("Ext2FS: write_block({}) failed (bi: {})", m_block_list[bi], bi);
+            dbgln("Ext2FS: write_block({}) failed (bi: {})", m_block_map[bi], bi);
             ASSERT_NOT_REACHED();
             return err;
         }
@@ -901,7 +1087,7 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const UserOrKernel
     }
 
 #ifdef EXT2_VERY_DEBUG
-    dbgln("Ext2FS: After write, i_size={}, i_blocks={} ({} blocks in list)", m_raw_inode.i_size, m_raw_inode.i_blocks, m_block_list.size());
+    dbgln("Ext2FS: After write, i_size={}, i_blocks={} ({} blocks in list)", m_raw_inode.i_size, m_raw_inode.i_blocks, m_block_map.size());
 #endif
 
     if (old_size != new_size)
@@ -1140,71 +1326,171 @@ bool Ext2FS::write_ext2_inode(unsigned inode, const ext2_inode& e2inode)
     return write_block(block_index, buffer, inode_size(), offset) >= 0;
 }
 
-Vector<Ext2FS::BlockIndex> Ext2FS::allocate_blocks(GroupIndex preferred_group_index, size_t count)
+Ext2FS::BlockIndex Ext2FS::find_free_block_run(GroupIndex preferred_group_index, BlockIndex goal, size_t wanted_length, size_t& run_length) const
+{
+    ASSERT(wanted_length);
+    auto is_available = [&](const Bitmap& block_bitmap, BlockIndex first_block_in_group, size_t bit_index) {
+        return !block_bitmap.get(bit_index) && !m_reserved_blocks.get(first_block_in_group + bit_index);
+    };
+
+    // Look for the first run that's long enough, starting at the goal, then in the preferred
+    // group and then in all the others. Fall back to the longest run we came across.
+    if (goal >= first_block_index() && goal < super_block().s_blocks_count)
+        preferred_group_index = group_index_from_block_index(goal);
+    else
+        goal = 0;
+
+    BlockIndex longest_run_start = 0;
+    size_t longest_run_length = 0;
+    for (GroupIndex i = 0; i < m_block_group_count; ++i) {
+        GroupIndex group_index = ((preferred_group_index - 1 + i) % m_block_group_count) + 1;
+        auto& bgd = group_descriptor(group_index);
+        if (!bgd.bg_free_blocks_count)
+            continue;
+
+        BlockIndex first_block_in_group = (group_index - 1) * blocks_per_group() + first_block_index();
+        size_t blocks_in_group = min(blocks_per_group(), super_block().s_blocks_count - first_block_in_group);
+        auto& cached_bitmap = const_cast<Ext2FS&>(*this).get_bitmap_block(bgd.bg_block_bitmap);
+        auto block_bitmap = cached_bitmap.bitmap(blocks_per_group());
+
+        size_t start_bit = (i == 0 && goal) ? goal - first_block_in_group : 0;
+
+        for (size_t pass = 0; pass < 2; ++pass) {
+            size_t bit_index = pass == 0 ? start_bit : 0;
+            size_t end_bit = pass == 0 ? blocks_in_group : start_bit;
+            while (bit_index < end_bit) {
+                if (!is_available(block_bitmap, first_block_in_group, bit_index)) {
+                    ++bit_index;
+                    continue;
+                }
+                size_t length = 0;
+                while (bit_index + length < blocks_in_group && length < wanted_length && is_available(block_bitmap, first_block_in_group, bit_index + length))
+                    ++length;
+                if (length == wanted_length) {
+                    run_length = length;
+                    return first_block_in_group + bit_index;
+                }
+                if (length > longest_run_length) {
+                    longest_run_start = first_block_in_group + bit_index;
+                    longest_run_length = length;
+                }
+                bit_index += length;
+            }
+        }
+    }
+
+    run_length = longest_run_length;
+    return longest_run_start;
+}
+
+void Ext2FS::discard_block_reservation(InodeIndex inode)
+{
+    LOCKER(m_lock);
+    auto it = m_block_reservations.find(inode);
+    if (it == m_block_reservations.end())
+        return;
+    auto& reservation = it->value;
+    m_reserved_blocks.set_range(reservation.start, reservation.end - reservation.start, false);
+    m_block_reservations.remove(it);
+}
+
+void Ext2FS::discard_all_block_reservations()
+{
+    LOCKER(m_lock);
+    for (auto& it : m_block_reservations)
+        m_reserved_blocks.set_range(it.value.start, it.value.end - it.value.start, false);
+    m_block_reservations.clear();
+}
+
+KResultOr<Vector<Ext2FS::BlockIndex>> Ext2FS::allocate_blocks(GroupIndex preferred_group_index, size_t count, InodeIndex owner, BlockIndex goal)
 {
     LOCKER(m_lock);
 #ifdef EXT2_DEBUG
-    dbgln("Ext2FS: allocate_blocks(preferred group: {}, count {})", preferred_group_index, count);
+    dbgln("Ext2FS: allocate_blocks(preferred group: {}, count {}, owner: {}, goal: {})", preferred_group_index, count, owner, goal);
 #endif
     if (count == 0)
-        return {};
+        return Vector<BlockIndex> {};
 
     Vector<BlockIndex> blocks;
+    blocks.ensure_capacity(count);
+
+    auto allocate_run = [&](BlockIndex first_block, size_t length) {
+        set_block_range_allocation_state(first_block, length, true);
+        for (size_t i = 0; i < length; ++i)
+            blocks.unchecked_append(first_block + i);
 #ifdef EXT2_DEBUG
-    dbgln("Ext2FS: allocate_blocks:");
+        dbgln("  allocated > {} x{}", first_block, length);
 #endif
-    blocks.ensure_capacity(count);
+    };
 
-    GroupIndex group_index = preferred_group_index;
+    // Blocks for a growing file come out of its reservation window, which we set up a bit
+    // larger than needed so the next few appends end up right behind this one.
+    auto take_from_reservation = [&] {
+        auto it = m_block_reservations.find(owner);
+        if (it == m_block_reservations.end())
+            return;
+        auto& reservation = it->value;
+        size_t length = min(count - blocks.size(), static_cast<size_t>(reservation.end - reservation.start));
+        m_reserved_blocks.set_range(reservation.start, length, false);
+        allocate_run(reservation.start, length);
+        reservation.start += length;
+        if (reservation.start == reservation.end)
+            m_block_reservations.remove(it);
+    };
 
-    if (!group_descriptor(preferred_group_index).bg_free_blocks_count) {
-        group_index = 1;
-    }
+    size_t reservation_window_length = max<size_t>(1, block_reservation_window_size / block_size());
+    bool did_discard_reservations = false;
+    if (owner)
+        take_from_reservation();
 
     while (blocks.size() < count) {
-
-        bool found_a_group = false;
-        if (group_descriptor(group_index).bg_free_blocks_count) {
-            found_a_group = true;
-        } else {
-            if (group_index == preferred_group_index)
-                group_index = 1;
-            for (; group_index <= m_block_group_count; ++group_index) {
-                if (group_descriptor(group_index).bg_free_blocks_count) {
-                    found_a_group = true;
-                    break;
-                }
+        size_t needed = count - blocks.size();
+        size_t wanted_length = owner ? max(needed, reservation_window_length) : needed;
+        if (!blocks.is_empty())
+            goal = blocks.last() + 1;
+
+        size_t run_length = 0;
+        BlockIndex first_block = find_free_block_run(preferred_group_index, goal, wanted_length, run_length);
+        if (!run_length) {
+            if (did_discard_reservations) {
+                // The free block count said there was room, but there isn't. Give back what we took.
+                dbgln("Ext2FS: allocate_blocks: out of free blocks with {} of {} allocated", blocks.size(), count);
+                release_blocks(blocks);
+                return KResult(-ENOSPC);
             }
+            // The only free blocks left are reserved for other files, take them back.
+            discard_all_block_reservations();
+            did_discard_reservations = true;
+            continue;
         }
 
-        ASSERT(found_a_group);
-        auto& bgd = group_descriptor(group_index);
-        auto& cached_bitmap = get_bitmap_block(bgd.bg_block_bitmap);
-
-        int blocks_in_group = min(blocks_per_group(), super_block().s_blocks_count);
-        auto block_bitmap = Bitmap::wrap(cached_bitmap.buffer.data(), blocks_in_group);
-
-        BlockIndex first_block_in_group = (group_index - 1) * blocks_per_group() + first_block_index();
-        size_t free_region_size = 0;
-        auto first_unset_bit_index = block_bitmap.find_longest_range_of_unset_bits(count - blocks.size(), free_region_size);
-        ASSERT(first_unset_bit_index.has_value());
-#ifdef EXT2_DEBUG
-        dbgln("Ext2FS: allocating free region of size: {} [{}]", free_region_size, group_index);
-#endif
-        for (size_t i = 0; i < free_region_size; ++i) {
-            BlockIndex block_index = (first_unset_bit_index.value() + i) + first_block_in_group;
-            set_block_allocation_state(block_index, true);
-            blocks.unchecked_append(block_index);
-#ifdef EXT2_DEBUG
-            dbgln("  allocated > {}", block_index);
-#endif
+        if (!owner) {
+            allocate_run(first_block, min(needed, run_length));
+            continue;
         }
+
+        discard_block_reservation(owner);
+        m_reserved_blocks.set_range(first_block, run_length, true);
+        m_block_reservations.set(owner, { first_block, static_cast<BlockIndex>(first_block + run_length) });
+        take_from_reservation();
     }
 
     ASSERT(blocks.size() == count);
     return blocks;
 }
 
+void Ext2FS::release_blocks(const Vector<BlockIndex>& blocks)
+{
+    LOCKER(m_lock);
+    for (size_t i = 0; i < blocks.size();) {
+        size_t run_length = 1;
+        while (i + run_length < blocks.size() && blocks[i + run_length] == blocks[i] + run_length)
+            ++run_length;
+        set_block_range_allocation_state(blocks[i], run_length, false);
+        i += run_length;
+    }
+}
+
 unsigned Ext2FS::find_a_free_inode(GroupIndex preferred_group, off_t expected_size)
 {
     ASSERT(expected_size >= 0);
@@ -1365,6 +1651,46 @@ Ext2FS::CachedBitmap& Ext2FS::get_bitmap_block(BlockIndex bitmap_block_index)
     return *m_cached_bitmaps.last();
 }
 
+void Ext2FS::set_block_range_allocation_state(BlockIndex first_block, size_t count, bool new_state)
+{
+    ASSERT(first_block != 0);
+    LOCKER(m_lock);
+
+    // Update one block group at a time.
+    while (count) {
+        GroupIndex group_index = group_index_from_block_index(first_block);
+        auto& bgd = group_descriptor(group_index);
+        BlockIndex first_block_in_group = (group_index - 1) * blocks_per_group() + first_block_index();
+        unsigned bit_index = first_block - first_block_in_group;
+        size_t length = min(count, static_cast<size_t>(blocks_per_group() - bit_index));
+
+        auto& cached_bitmap = get_bitmap_block(bgd.bg_block_bitmap);
+        auto block_bitmap = cached_bitmap.bitmap(blocks_per_group());
+#ifdef EXT2_DEBUG
+        dbgln("Ext2FS: blocks {} x{} state -> {} (in bitmap block {})", first_block, length, new_state, bgd.bg_block_bitmap);
+#endif
+        ASSERT(block_bitmap.count_in_range(bit_index, length, !new_state) == length);
+        block_bitmap.set_range(bit_index, length, new_state);
+        cached_bitmap.dirty = true;
+
+        if (new_state)
+            m_super_block.s_free_blocks_count -= length;
+        else
+            m_super_block.s_free_blocks_count += length;
+        m_super_block_dirty = true;
+
+        auto& mutable_bgd = const_cast<ext2_group_desc&>(bgd);
+        if (new_state)
+            mutable_bgd.bg_free_blocks_count -= length;
+        else
+            mutable_bgd.bg_free_blocks_count += length;
+        m_block_group_descriptors_dirty = true;
+
+        first_block += length;
+        count -= length;
+    }
+}
+
 bool Ext2FS::set_block_allocation_state(BlockIndex block_index, bool new_state)
 {
     ASSERT(block_index != 0);
@@ -1480,7 +1806,10 @@ KResultOr<NonnullRefPtr<Inode>> Ext2FS::create_inode(InodeIdentifier parent_id,
         return KResult(-ENOSPC);
     }
 
-    auto blocks = allocate_blocks(group_index_from_inode(inode_id), needed_blocks);
+    auto blocks_or_error = allocate_blocks(group_index_from_inode(inode_id), needed_blocks);
+    if (blocks_or_error.is_error())
+        return blocks_or_error.error();
+    auto blocks = blocks_or_error.release_value();
     ASSERT(blocks.size() == needed_blocks);
 
     // Looks like we're good, time to update the inode bitmap and group+global inode counters.
@@ -1508,8 +1837,11 @@ KResultOr<NonnullRefPtr<Inode>> Ext2FS::create_inode(InodeIdentifier parent_id,
     else if (is_block_device(mode))
         e2inode.i_block[1] = dev;
 
-    success = write_block_list_for_inode(inode_id, e2inode, blocks);
-    ASSERT(success);
+    if (!write_block_list_for_inode(inode_id, e2inode, blocks)) {
+        release_blocks(blocks);
+        set_inode_allocation_state(inode_id, false);
+        return KResult(-ENOSPC);
+    }
 
 #ifdef EXT2_DEBUG
     dbgln("Ext2FS: writing initial metadata for inode {}", inode_id);
@@ -1523,7 +1855,7 @@ KResultOr<NonnullRefPtr<Inode>> Ext2FS::create_inode(InodeIdentifier parent_id,
 
     auto inode = get_inode({ fsid(), inode_id });
     // If we've already computed a block list, no sense in throwing it away.
-    static_cast<Ext2FSInode&>(*inode).m_block_list = move(blocks);
+    static_cast<Ext2FSInode&>(*inode).m_block_map.append(blocks);
 
     auto result = parent_inode->add_child(*inode, name, mode);
     ASSERT(result.is_success());
@@ -29,6 +29,7 @@
 #include <AK/Bitmap.h>
 #include <AK/HashMap.h>
 #include <Kernel/FileSystem/BlockBasedFileSystem.h>
+#include <Kernel/FileSystem/Ext2FSBlockMap.h>
 #include <Kernel/FileSystem/Inode.h>
 #include <Kernel/FileSystem/ext2_fs.h>
 #include <Kernel/KBuffer.h>
@@ -59,6 +60,8 @@ public:
 private:
     // ^Inode
     virtual ssize_t read_bytes(off_t, ssize_t, UserOrKernelBuffer& buffer, FileDescription*) const override;
+    virtual ssize_t read_bytes_for_page_cache(off_t, ssize_t, UserOrKernelBuffer& buffer) const override;
+    virtual void readahead(FileDescription&, off_t, size_t) override;
     virtual InodeMetadata metadata() const override;
     virtual KResult traverse_as_directory(Function<bool(const FS::DirectoryEntryView&)>) const override;
     virtual RefPtr<Inode> lookup(StringView name) override;
@@ -77,6 +80,7 @@ private:
     virtual KResult chown(uid_t, gid_t) override;
     virtual KResult truncate(u64) override;
 
+    ssize_t read_bytes_impl(off_t, ssize_t, UserOrKernelBuffer& buffer, bool allow_cache) const;
     bool write_directory(const Vector<Ext2FSDirectoryEntry>&);
     bool populate_lookup_cache() const;
     KResult resize(u64);
@@ -87,7 +91,7 @@ private:
     const Ext2FS& fs() const;
     Ext2FSInode(Ext2FS&, unsigned index);
 
-    mutable Vector<unsigned> m_block_list;
+    mutable Ext2FSBlockMap m_block_map;
     mutable HashMap<String, unsigned> m_lookup_cache;
     ext2_inode m_raw_inode;
 };
@@ -109,6 +113,7 @@ public:
     virtual KResult prepare_to_unmount() const override;
 
     virtual bool supports_watchers() const override { return true; }
+    virtual bool supports_page_cache() const override { return true; }
 
     virtual u8 internal_file_type_to_directory_entry_type(const DirectoryEntryView& entry) const override;
 
@@ -139,20 +144,27 @@ private:
     KResultOr<NonnullRefPtr<Inode>> create_inode(InodeIdentifier parent_id, const String& name, mode_t, off_t size, dev_t, uid_t, gid_t);
     KResult create_directory(InodeIdentifier parent_inode, const String& name, mode_t, uid_t, gid_t);
     virtual void flush_writes() override;
+    void trim_page_caches();
 
     BlockIndex first_block_index() const;
     InodeIndex find_a_free_inode(GroupIndex preferred_group, off_t expected_size);
-    Vector<BlockIndex> allocate_blocks(GroupIndex preferred_group_index, size_t count);
+    KResultOr<Vector<BlockIndex>> allocate_blocks(GroupIndex preferred_group_index, size_t count, InodeIndex owner = 0, BlockIndex goal = 0);
+    void release_blocks(const Vector<BlockIndex>&);
+    BlockIndex find_free_block_run(GroupIndex preferred_group_index, BlockIndex goal, size_t wanted_length, size_t& run_length) const;
+    void discard_block_reservation(InodeIndex);
+    void discard_all_block_reservations();
     GroupIndex group_index_from_inode(InodeIndex) const;
     GroupIndex group_index_from_block_index(BlockIndex) const;
 
-    Vector<BlockIndex> block_list_for_inode_impl(const ext2_inode&, bool include_block_list_blocks = false) const;
+    void block_list_for_inode_impl(const ext2_inode&, bool include_block_list_blocks, Function<void(BlockIndex)>) const;
     Vector<BlockIndex> block_list_for_inode(const ext2_inode&, bool include_block_list_blocks = false) const;
+    Ext2FSBlockMap block_map_for_inode(const ext2_inode&) const;
     bool write_block_list_for_inode(InodeIndex, ext2_inode&, const Vector<BlockIndex>&);
 
     bool get_inode_allocation_state(InodeIndex) const;
     bool set_inode_allocation_state(InodeIndex, bool);
     bool set_block_allocation_state(BlockIndex, bool);
+    void set_block_range_allocation_state(BlockIndex first_block, size_t count, bool);
 
     void uncache_inode(InodeIndex);
     void free_inode(Ext2FSInode&);
@@ -172,6 +184,15 @@ private:
     mutable ext2_super_block m_super_block;
     mutable OwnPtr<KBuffer> m_cached_group_descriptor_table;
 
+    // Growing files get a window of free blocks set aside for them, so concurrent writers
+    // don't interleave their blocks. Reservations only live in memory.
+    struct BlockReservation {
+        BlockIndex start { 0 };
+        BlockIndex end { 0 };
+    };
+    HashMap<InodeIndex, BlockReservation> m_block_reservations;
+    Bitmap m_reserved_blocks;
+
     mutable HashMap<InodeIndex, RefPtr<Ext2FSInode>> m_inode_cache;
 
     bool m_super_block_dirty { false };
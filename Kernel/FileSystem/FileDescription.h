@@ -84,6 +84,14 @@ public:
 
     bool is_direct() const { return m_direct; }
 
+    // Tracks how sequential the reads through this description are, see Inode::readahead().
+    struct ReadaheadState {
+        off_t next_offset { 0 };
+        off_t readahead_end { 0 };
+        size_t window { 0 };
+    };
+    ReadaheadState& readahead_state() { return m_readahead_state; }
+
     bool is_directory() const { return m_is_directory; }
 
     File& file() { return *m_file; }
@@ -155,6 +163,7 @@ private:
     NonnullRefPtr<File> m_file;
 
     off_t m_current_offset { 0 };
+    ReadaheadState m_readahead_state;
 
     OwnPtr<FileDescriptionData> m_data;
 
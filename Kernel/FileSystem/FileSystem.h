@@ -60,6 +60,7 @@ public:
     virtual const char* class_name() const = 0;
     virtual NonnullRefPtr<Inode> root_inode() const = 0;
     virtual bool supports_watchers() const { return false; }
+    virtual bool supports_page_cache() const { return false; }
 
     bool is_readonly() const { return m_readonly; }
 
@@ -286,4 +286,30 @@ bool Inode::is_shared_vmobject(const SharedInodeVMObject& other) const
     return m_shared_vmobject.unsafe_ptr() == &other;
 }
 
+RefPtr<SharedInodeVMObject> Inode::ensure_page_cache()
+{
+    if (!fs().supports_page_cache() || !metadata().is_regular_file())
+        return nullptr;
+    LOCKER(m_lock);
+    if (!m_page_cache)
+        m_page_cache = SharedInodeVMObject::create_with_inode(*this);
+    return m_page_cache;
+}
+
+RefPtr<SharedInodeVMObject> Inode::page_cache() const
+{
+    LOCKER(m_lock);
+    return m_page_cache;
+}
+
+void Inode::drop_page_cache()
+{
+    // NOTE: The cache keeps a reference to us, so the FS has to break the cycle by calling this.
+    RefPtr<SharedInodeVMObject> page_cache;
+    {
+        LOCKER(m_lock);
+        page_cache = move(m_page_cache);
+    }
+}
+
 }
@@ -73,6 +73,10 @@ public:
     virtual void detach(FileDescription&) { }
     virtual void did_seek(FileDescription&, off_t) { }
     virtual ssize_t read_bytes(off_t, ssize_t, UserOrKernelBuffer& buffer, FileDescription*) const = 0;
+    virtual ssize_t read_bytes_for_page_cache(off_t offset, ssize_t count, UserOrKernelBuffer& buffer) const { return read_bytes(offset, count, buffer, nullptr); }
+    // Called before reading [offset, offset + count) through the description, to let the inode
+    // start fetching the data after it if the description is being read sequentially.
+    virtual void readahead(FileDescription&, off_t, size_t) { }
     virtual KResult traverse_as_directory(Function<bool(const FS::DirectoryEntryView&)>) const = 0;
     virtual RefPtr<Inode> lookup(StringView name) = 0;
     virtual ssize_t write_bytes(off_t, ssize_t, const UserOrKernelBuffer& data, FileDescription*) = 0;
@@ -108,6 +112,10 @@ public:
     RefPtr<SharedInodeVMObject> shared_vmobject() const;
     bool is_shared_vmobject(const SharedInodeVMObject&) const;
 
+    RefPtr<SharedInodeVMObject> ensure_page_cache();
+    RefPtr<SharedInodeVMObject> page_cache() const;
+    void drop_page_cache();
+
     static InlineLinkedList<Inode>& all_with_lock();
     static void sync();
 
@@ -140,6 +148,7 @@ private:
     FS& m_fs;
     unsigned m_index { 0 };
     WeakPtr<SharedInodeVMObject> m_shared_vmobject;
+    RefPtr<SharedInodeVMObject> m_page_cache;
     RefPtr<LocalSocket> m_socket;
     HashTable<InodeWatcher*> m_watchers;
     bool m_metadata_dirty { false };
@@ -46,7 +46,14 @@ InodeFile::~InodeFile()
 
 KResultOr<size_t> InodeFile::read(FileDescription& description, size_t offset, UserOrKernelBuffer& buffer, size_t count)
 {
-    ssize_t nread = m_inode->read_bytes(offset, count, buffer, &description);
+    if (!description.is_direct())
+        m_inode->readahead(description, offset, count);
+
+    ssize_t nread;
+    if (auto page_cache = !description.is_direct() ? m_inode->ensure_page_cache() : nullptr)
+        nread = page_cache->read_bytes(offset, count, buffer);
+    else
+        nread = m_inode->read_bytes(offset, count, buffer, &description);
     if (nread > 0) {
         Thread::current()->did_file_read(nread);
         evaluate_block_conditions();
@@ -319,32 +319,32 @@ static bool procfs$pid_vm(InodeIdentifier identifier, KBufferBuilder& builder)
     {
         ScopedSpinLock lock(process->get_lock());
         for (auto& region : process->regions()) {
-            if (!region.is_user_accessible() && !Process::current()->is_superuser())
+            if (!region->is_user_accessible() && !Process::current()->is_superuser())
                 continue;
             auto region_object = array.add_object();
-            region_object.add("readable", region.is_readable());
-            region_object.add("writable", region.is_writable());
-            region_object.add("executable", region.is_executable());
-            region_object.add("stack", region.is_stack());
-            region_object.add("shared", region.is_shared());
-            region_object.add("user_accessible", region.is_user_accessible());
-            region_object.add("purgeable", region.vmobject().is_anonymous());
-            if (region.vmobject().is_anonymous()) {
-                region_object.add("volatile", static_cast<const AnonymousVMObject&>(region.vmobject()).is_any_volatile());
+            region_object.add("readable", region->is_readable());
+            region_object.add("writable", region->is_writable());
+            region_object.add("executable", region->is_executable());
+            region_object.add("stack", region->is_stack());
+            region_object.add("shared", region->is_shared());
+            region_object.add("user_accessible", region->is_user_accessible());
+            region_object.add("purgeable", region->vmobject().is_anonymous());
+            if (region->vmobject().is_anonymous()) {
+                region_object.add("volatile", static_cast<const AnonymousVMObject&>(region->vmobject()).is_any_volatile());
             }
-            region_object.add("cacheable", region.is_cacheable());
-            region_object.add("kernel", region.is_kernel());
-            region_object.add("address", region.vaddr().get());
-            region_object.add("size", region.size());
-            region_object.add("amount_resident", region.amount_resident());
-            region_object.add("amount_dirty", region.amount_dirty());
-            region_object.add("cow_pages", region.cow_pages());
-            region_object.add("name", region.name());
-            region_object.add("vmobject", region.vmobject().class_name());
+            region_object.add("cacheable", region->is_cacheable());
+            region_object.add("kernel", region->is_kernel());
+            region_object.add("address", region->vaddr().get());
+            region_object.add("size", region->size());
+            region_object.add("amount_resident", region->amount_resident());
+            region_object.add("amount_dirty", region->amount_dirty());
+            region_object.add("cow_pages", region->cow_pages());
+            region_object.add("name", region->name());
+            region_object.add("vmobject", region->vmobject().class_name());
 
             StringBuilder pagemap_builder;
-            for (size_t i = 0; i < region.page_count(); ++i) {
-                auto* page = region.physical_page(i);
+            for (size_t i = 0; i < region->page_count(); ++i) {
+                auto* page = region->physical_page(i);
                 if (!page)
                     pagemap_builder.append('N');
                 else if (page->is_shared_zero_page() || page->is_lazy_committed_page())
@@ -491,6 +491,8 @@ static bool procfs$net_adapters(InodeIdentifier, KBufferBuilder& builder)
         obj.add("bytes_in", adapter.bytes_in());
         obj.add("packets_out", adapter.packets_out());
         obj.add("bytes_out", adapter.bytes_out());
+        obj.add("packets_dropped", adapter.packets_dropped());
+        obj.add("checksum_offload", adapter.has_transport_checksum_offload());
         obj.add("link_up", adapter.link_up());
         obj.add("mtu", adapter.mtu());
     });
@@ -527,6 +529,12 @@ static bool procfs$net_tcp(InodeIdentifier, KBufferBuilder& builder)
         obj.add("bytes_in", socket.bytes_in());
         obj.add("packets_out", socket.packets_out());
         obj.add("bytes_out", socket.bytes_out());
+        obj.add("send_window", socket.send_window());
+        obj.add("congestion_window", socket.congestion_window());
+        obj.add("slow_start_threshold", socket.slow_start_threshold());
+        obj.add("congestion_control", socket.congestion_control_algorithm());
+        obj.add("retransmission_timeout", socket.retransmission_timeout());
+        obj.add("retransmissions", socket.retransmissions());
     });
     array.finish();
     return true;
@@ -573,19 +581,19 @@ static bool procfs$pid_vmobjects(InodeIdentifier identifier, KBufferBuilder& bui
         ScopedSpinLock lock(process->get_lock());
         for (auto& region : process->regions()) {
             builder.appendf("%x -- %x    %x    %s\n",
-                region.vaddr().get(),
-                region.vaddr().offset(region.size() - 1).get(),
-                region.size(),
-                region.name().characters());
+                region->vaddr().get(),
+                region->vaddr().offset(region->size() - 1).get(),
+                region->size(),
+                region->name().characters());
             builder.appendf("VMO: %s @ %x(%u)\n",
-                region.vmobject().is_anonymous() ? "anonymous" : "file-backed",
-                &region.vmobject(),
-                region.vmobject().ref_count());
-            for (size_t i = 0; i < region.vmobject().page_count(); ++i) {
-                auto& physical_page = region.vmobject().physical_pages()[i];
+                region->vmobject().is_anonymous() ? "anonymous" : "file-backed",
+                &region->vmobject(),
+                region->vmobject().ref_count());
+            for (size_t i = 0; i < region->vmobject().page_count(); ++i) {
+                auto& physical_page = region->vmobject().physical_pages()[i];
                 bool should_cow = false;
-                if (i >= region.first_page_index() && i <= region.last_page_index())
-                    should_cow = region.should_cow(i - region.first_page_index());
+                if (i >= region->first_page_index() && i <= region->last_page_index())
+                    should_cow = region->should_cow(i - region->first_page_index());
                 builder.appendf("P%x%s(%u) ",
                     physical_page ? physical_page->paddr().get() : 0,
                     should_cow ? "!" : "",
@@ -28,6 +28,7 @@
 
 namespace Kernel {
 
+class AsyncBlockDeviceRequest;
 class BlockDevice;
 class CharacterDevice;
 class CoreDump;
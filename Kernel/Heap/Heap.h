@@ -68,11 +68,25 @@ public:
         return needed_chunks * CHUNK_SIZE + (needed_chunks + 7) / 8;
     }
 
-    void* allocate(size_t size)
+    static size_t chunks_needed_for(size_t size)
     {
         // We need space for the AllocationHeader at the head of the block.
-        size_t real_size = size + sizeof(AllocationHeader);
-        size_t chunks_needed = (real_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        return (size + sizeof(AllocationHeader) + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    }
+
+    static size_t usable_size_for_chunks(size_t chunks)
+    {
+        return chunks * CHUNK_SIZE - sizeof(AllocationHeader);
+    }
+
+    static size_t allocation_size_in_chunks(const void* ptr)
+    {
+        return ((const AllocationHeader*)((const u8*)ptr - sizeof(AllocationHeader)))->allocation_size_in_chunks;
+    }
+
+    void* allocate(size_t size)
+    {
+        size_t chunks_needed = chunks_needed_for(size);
 
         if (chunks_needed > free_chunks())
             return nullptr;
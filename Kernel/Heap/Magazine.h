@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/Assertions.h>
+#include <AK/Types.h>
+#include <Kernel/Arch/i386/CPU.h>
+
+namespace Kernel {
+
+// A magazine is a small per-CPU stack of free objects that sits in front of a shared
+// allocator, so most allocations and frees don't have to touch any shared state.
+// Magazines must only be used by their own processor with interrupts disabled.
+template<size_t capacity>
+class Magazine {
+public:
+    static constexpr size_t batch_size = capacity / 2;
+
+    bool is_empty() const { return m_count == 0; }
+    bool is_full() const { return m_count == capacity; }
+    size_t size() const { return m_count; }
+
+    void push(void* object)
+    {
+        ASSERT(!is_full());
+        m_objects[m_count++] = object;
+    }
+
+    void* pop()
+    {
+        ASSERT(!is_empty());
+        return m_objects[--m_count];
+    }
+
+private:
+    size_t m_count { 0 };
+    void* m_objects[capacity];
+};
+
+// Per-CPU data in the heap is indexed by processor id.
+static constexpr size_t heap_max_processors = 32;
+
+template<typename T>
+ALWAYS_INLINE T* per_cpu_heap_data(T (&data)[heap_max_processors])
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (!Processor::is_initialized())
+        return nullptr;
+    auto id = Processor::current().id();
+    if (id >= heap_max_processors)
+        return nullptr;
+    return &data[id];
+}
+
+}
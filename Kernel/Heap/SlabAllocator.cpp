@@ -26,6 +26,7 @@
 
 #include <AK/Assertions.h>
 #include <AK/Memory.h>
+#include <Kernel/Heap/Magazine.h>
 #include <Kernel/Heap/SlabAllocator.h>
 #include <Kernel/Heap/kmalloc.h>
 #include <Kernel/SpinLock.h>
@@ -42,16 +43,7 @@ public:
 
     void init(size_t size)
     {
-        m_base = kmalloc_eternal(size);
-        m_end = (u8*)m_base + size;
-        FreeSlab* slabs = (FreeSlab*)m_base;
-        m_slab_count = size / templated_slab_size;
-        for (size_t i = 1; i < m_slab_count; ++i) {
-            slabs[i].next = &slabs[i - 1];
-        }
-        slabs[0].next = nullptr;
-        m_freelist = &slabs[m_slab_count - 1];
-        m_num_allocated = 0;
+        add_slabs(kmalloc_eternal(size), size);
     }
 
     constexpr size_t slab_size() const { return templated_slab_size; }
@@ -59,56 +51,55 @@ public:
 
     void* alloc()
     {
-        FreeSlab* free_slab;
+        void* ptr;
         {
-            // We want to avoid being swapped out in the middle of this
-            ScopedCritical critical;
-            FreeSlab* next_free;
-            free_slab = m_freelist.load(AK::memory_order_consume);
-            do {
-                if (!free_slab)
-                    return kmalloc(slab_size());
-                // It's possible another processor is doing the same thing at
-                // the same time, so next_free *can* be a bogus pointer. However,
-                // in that case compare_exchange_strong would fail and we would
-                // try again.
-                next_free = free_slab->next;
-            } while (!m_freelist.compare_exchange_strong(free_slab, next_free, AK::memory_order_acq_rel));
-
-            m_num_allocated++;
+            InterruptDisabler disabler;
+            auto* magazine = per_cpu_heap_data(m_magazines);
+            if (magazine && !magazine->is_empty())
+                ptr = magazine->pop();
+            else
+                ptr = alloc_slow(magazine);
         }
 
 #ifdef SANITIZE_SLABS
-        memset(free_slab, SLAB_ALLOC_SCRUB_BYTE, slab_size());
+        memset(ptr, SLAB_ALLOC_SCRUB_BYTE, slab_size());
 #endif
-        return free_slab;
+        return ptr;
     }
 
     void dealloc(void* ptr)
     {
         ASSERT(ptr);
-        if (ptr < m_base || ptr >= m_end) {
-            kfree(ptr);
-            return;
-        }
-        FreeSlab* free_slab = (FreeSlab*)ptr;
 #ifdef SANITIZE_SLABS
         if (slab_size() > sizeof(FreeSlab*))
-            memset(free_slab->padding, SLAB_DEALLOC_SCRUB_BYTE, sizeof(FreeSlab::padding));
+            memset(((FreeSlab*)ptr)->padding, SLAB_DEALLOC_SCRUB_BYTE, sizeof(FreeSlab::padding));
 #endif
 
-        // We want to avoid being swapped out in the middle of this
-        ScopedCritical critical;
-        FreeSlab* next_free = m_freelist.load(AK::memory_order_consume);
-        do {
-            free_slab->next = next_free;
-        } while (!m_freelist.compare_exchange_strong(next_free, free_slab, AK::memory_order_acq_rel));
+        InterruptDisabler disabler;
+        auto* magazine = per_cpu_heap_data(m_magazines);
+        if (magazine && !magazine->is_full()) {
+            magazine->push(ptr);
+            return;
+        }
 
-        m_num_allocated--;
+        // Hand half a magazine back to the shared freelist at once, so the next few frees are cheap again.
+        ScopedSpinLock lock(m_lock);
+        push_free_slab((FreeSlab*)ptr);
+        if (magazine) {
+            for (size_t i = 0; i < SlabMagazine::batch_size; ++i)
+                push_free_slab((FreeSlab*)magazine->pop());
+        }
     }
 
-    size_t num_allocated() const { return m_num_allocated; }
-    size_t num_free() const { return m_slab_count - m_num_allocated; }
+    size_t num_allocated() const { return m_slab_count - num_free(); }
+    size_t num_free() const
+    {
+        // NOTE: Slabs sitting in a magazine are free, too.
+        size_t num_free = m_num_free;
+        for (auto& magazine : m_magazines)
+            num_free += magazine.size();
+        return num_free;
+    }
 
 private:
     struct FreeSlab {
@@ -116,11 +107,67 @@ private:
         char padding[templated_slab_size - sizeof(FreeSlab*)];
     };
 
-    Atomic<FreeSlab*> m_freelist { nullptr };
-    Atomic<ssize_t, AK::MemoryOrder::memory_order_relaxed> m_num_allocated;
-    size_t m_slab_count;
-    void* m_base { nullptr };
-    void* m_end { nullptr };
+    static constexpr size_t magazine_capacity = 32;
+    // When we run out of slabs, we grow by this much at once.
+    static constexpr size_t growth_size = 64 * KiB;
+
+    typedef Magazine<magazine_capacity> SlabMagazine;
+
+    void push_free_slab(FreeSlab* free_slab)
+    {
+        ASSERT(m_lock.is_locked());
+        free_slab->next = m_freelist;
+        m_freelist = free_slab;
+        ++m_num_free;
+    }
+
+    FreeSlab* pop_free_slab()
+    {
+        ASSERT(m_lock.is_locked());
+        auto* free_slab = m_freelist;
+        if (free_slab) {
+            m_freelist = free_slab->next;
+            --m_num_free;
+        }
+        return free_slab;
+    }
+
+    void add_slabs(void* memory, size_t size)
+    {
+        FreeSlab* slabs = (FreeSlab*)memory;
+        size_t count = size / templated_slab_size;
+        ScopedSpinLock lock(m_lock);
+        for (size_t i = 0; i < count; ++i)
+            push_free_slab(&slabs[i]);
+        m_slab_count += count;
+    }
+
+    void* alloc_slow(SlabMagazine* magazine)
+    {
+        for (;;) {
+            {
+                // Take a whole batch off the shared freelist while we have the lock.
+                ScopedSpinLock lock(m_lock);
+                if (auto* free_slab = pop_free_slab()) {
+                    if (magazine) {
+                        for (size_t i = 0; i < SlabMagazine::batch_size && m_freelist && !magazine->is_full(); ++i)
+                            magazine->push(pop_free_slab());
+                    }
+                    return free_slab;
+                }
+            }
+
+            // NOTE: We can't call kmalloc() with m_lock held, since growing the kmalloc heap
+            //       may allocate a Region, which comes from the slab allocator.
+            add_slabs(kmalloc(growth_size), growth_size);
+        }
+    }
+
+    SpinLock<u8> m_lock;
+    FreeSlab* m_freelist { nullptr };
+    size_t m_num_free { 0 };
+    size_t m_slab_count { 0 };
+    SlabMagazine m_magazines[heap_max_processors];
 
     static_assert(sizeof(FreeSlab) == templated_slab_size);
 };
@@ -178,9 +225,8 @@ void slab_dealloc(void* ptr, size_t slab_size)
 void slab_alloc_stats(Function<void(size_t slab_size, size_t allocated, size_t free)> callback)
 {
     for_each_allocator([&](auto& allocator) {
-        auto num_allocated = allocator.num_allocated();
-        auto num_free = allocator.slab_count() - num_allocated;
-        callback(allocator.slab_size(), num_allocated, num_free);
+        auto num_free = allocator.num_free();
+        callback(allocator.slab_size(), allocator.slab_count() - num_free, num_free);
     });
 }
 
@@ -36,6 +36,7 @@
 #include <AK/Types.h>
 #include <Kernel/Arch/i386/CPU.h>
 #include <Kernel/Heap/Heap.h>
+#include <Kernel/Heap/Magazine.h>
 #include <Kernel/Heap/kmalloc.h>
 #include <Kernel/KSyms.h>
 #include <Kernel/Process.h>
@@ -236,31 +237,105 @@ void* kmalloc_eternal(size_t size)
     return ptr;
 }
 
-void* kmalloc_impl(size_t size)
-{
-    ScopedSpinLock lock(s_lock);
-    ++g_kmalloc_call_count;
+// Small allocations are cached in per-CPU magazines, one for each size in chunks,
+// so that most kmalloc() and kfree() calls don't have to take s_lock at all.
+// Objects sitting in a magazine still count as allocated in the heap statistics.
+static constexpr size_t kmalloc_magazine_max_chunks = 8;
+typedef Magazine<32> KmallocMagazine;
+typedef KmallocGlobalHeap::HeapType::HeapType KmallocChunkHeap;
+
+struct KmallocPerCPUData {
+    KmallocMagazine magazines[kmalloc_magazine_max_chunks];
+    size_t kmalloc_call_count { 0 };
+    size_t kfree_call_count { 0 };
+};
 
-    if (g_dump_kmalloc_stacks && Kernel::g_kernel_symbols_available) {
-        dbgln("kmalloc({})", size);
-        Kernel::dump_backtrace();
-    }
+static KmallocPerCPUData s_kmalloc_per_cpu_data[heap_max_processors];
 
+static void* kmalloc_from_heap(size_t size)
+{
+    ASSERT(s_lock.is_locked());
     void* ptr = g_kmalloc_global->m_heap.allocate(size);
     if (!ptr) {
         klog() << "kmalloc(): PANIC! Out of memory (no suitable block for size " << size << ")";
         Kernel::dump_backtrace();
         Processor::halt();
     }
+    return ptr;
+}
 
+static void* kmalloc_from_magazine(KmallocPerCPUData& data, size_t chunks)
+{
+    auto& magazine = data.magazines[chunks - 1];
+    if (magazine.is_empty()) {
+        // Refill half the magazine while we're holding the lock anyway.
+        size_t size = KmallocChunkHeap::usable_size_for_chunks(chunks);
+        // NOTE: Growing the heap may end up allocating from this very magazine, so check its size every time.
+        ScopedSpinLock lock(s_lock);
+        while (magazine.size() < KmallocMagazine::batch_size)
+            magazine.push(kmalloc_from_heap(size));
+    }
+    void* ptr = magazine.pop();
+#ifdef SANITIZE_KMALLOC
+    __builtin_memset(ptr, KMALLOC_SCRUB_BYTE, KmallocChunkHeap::usable_size_for_chunks(chunks));
+#endif
     return ptr;
 }
 
+static void kfree_to_magazine(KmallocPerCPUData& data, void* ptr, size_t chunks)
+{
+#ifdef SANITIZE_KMALLOC
+    __builtin_memset(ptr, KFREE_SCRUB_BYTE, KmallocChunkHeap::usable_size_for_chunks(chunks));
+#endif
+    auto& magazine = data.magazines[chunks - 1];
+    if (magazine.is_full()) {
+        // Return half the magazine to the heap in one go.
+        ScopedSpinLock lock(s_lock);
+        while (magazine.size() > KmallocMagazine::batch_size)
+            g_kmalloc_global->m_heap.deallocate(magazine.pop());
+    }
+    magazine.push(ptr);
+}
+
+void* kmalloc_impl(size_t size)
+{
+    if (!g_dump_kmalloc_stacks) {
+        size_t chunks = KmallocChunkHeap::chunks_needed_for(size);
+        if (chunks <= kmalloc_magazine_max_chunks) {
+            InterruptDisabler disabler;
+            if (auto* data = per_cpu_heap_data(s_kmalloc_per_cpu_data)) {
+                ++data->kmalloc_call_count;
+                return kmalloc_from_magazine(*data, chunks);
+            }
+        }
+    }
+
+    ScopedSpinLock lock(s_lock);
+    ++g_kmalloc_call_count;
+
+    if (g_dump_kmalloc_stacks && Kernel::g_kernel_symbols_available) {
+        dbgln("kmalloc({})", size);
+        Kernel::dump_backtrace();
+    }
+
+    return kmalloc_from_heap(size);
+}
+
 void kfree(void* ptr)
 {
     if (!ptr)
         return;
 
+    size_t chunks = KmallocChunkHeap::allocation_size_in_chunks(ptr);
+    if (chunks <= kmalloc_magazine_max_chunks) {
+        InterruptDisabler disabler;
+        if (auto* data = per_cpu_heap_data(s_kmalloc_per_cpu_data)) {
+            ++data->kfree_call_count;
+            kfree_to_magazine(*data, ptr, chunks);
+            return;
+        }
+    }
+
     ScopedSpinLock lock(s_lock);
     ++g_kfree_call_count;
 
@@ -291,4 +366,8 @@ void get_kmalloc_stats(kmalloc_stats& stats)
     stats.bytes_eternal = g_kmalloc_bytes_eternal;
     stats.kmalloc_call_count = g_kmalloc_call_count;
     stats.kfree_call_count = g_kfree_call_count;
+    for (auto& data : s_kmalloc_per_cpu_data) {
+        stats.kmalloc_call_count += data.kmalloc_call_count;
+        stats.kfree_call_count += data.kfree_call_count;
+    }
 }
@@ -59,6 +59,7 @@ namespace Kernel {
 #define REG_RADV 0x282C             // RX Int. Absolute Delay Timer
 #define REG_RSRPD 0x2C00            // RX Small Packet Detect Interrupt
 #define REG_TIPG 0x0410             // Transmit Inter Packet Gap
+#define REG_RXCSUM 0x5000           // RX Checksum Control
 #define ECTRL_SLU 0x40              //set link up
 #define RCTL_EN (1 << 1)            // Receiver Enable
 #define RCTL_SBP (1 << 2)           // Store Bad Packets
@@ -101,6 +102,18 @@ namespace Kernel {
 #define CMD_VLE (1 << 6)  // VLAN Packet Enable
 #define CMD_IDE (1 << 7)  // Interrupt Delay Enable
 
+// RXCSUM Register
+
+#define RXCSUM_IPOFL (1 << 8) // IP Checksum Offload Enable
+#define RXCSUM_TUOFL (1 << 9) // TCP/UDP Checksum Offload Enable
+
+// RX Descriptor Status and Errors
+
+#define RSTA_DD (1 << 0)    // Descriptor Done
+#define RSTA_IXSM (1 << 2)  // Ignore Checksum Indication
+#define RSTA_TCPCS (1 << 5) // TCP/UDP Checksum Calculated
+#define RERR_TCPE (1 << 5)  // TCP/UDP Checksum Error
+
 // TCTL Register
 
 #define TCTL_EN (1 << 1)      // Transmit Enable
@@ -142,6 +155,14 @@ namespace Kernel {
 #define INTERRUPT_SRPD (1 << 16)
 // clang-format on
 
+// Receive interrupts are masked while a poll is scheduled, and unmasked again once the ring has been drained.
+static constexpr u32 rx_interrupts = INTERRUPT_RXT0 | INTERRUPT_RXO | INTERRUPT_RXDMT0;
+
+// The interrupt throttling interval is in units of 256ns, this caps us at ~8000 interrupts per second.
+// Since receive interrupts stay masked while we're polling, this mostly bounds the latency of the first
+// frame after the adapter went idle.
+static constexpr u32 interrupt_throttling_interval = 488;
+
 // https://www.intel.com/content/dam/doc/manual/pci-pci-x-family-gbe-controllers-software-dev-manual.pdf Section 5.2
 static bool is_valid_device_id(u16 device_id)
 {
@@ -224,13 +245,15 @@ E1000NetworkAdapter::E1000NetworkAdapter(PCI::Address address, u8 irq)
     u32 flags = in32(REG_CTRL);
     out32(REG_CTRL, flags | ECTRL_SLU);
 
-    out32(REG_INTERRUPT_RATE, 6000); // Interrupt rate of 1.536 milliseconds
+    out32(REG_INTERRUPT_RATE, interrupt_throttling_interval);
+    // Don't delay receive interrupts any further, the throttling takes care of coalescing them.
+    out32(REG_RDTR, 0);
+    out32(REG_RADV, 0);
 
     initialize_rx_descriptors();
     initialize_tx_descriptors();
 
-    out32(REG_INTERRUPT_MASK_SET, 0x1f6dc);
-    out32(REG_INTERRUPT_MASK_SET, INTERRUPT_LSC | INTERRUPT_RXT0);
+    out32(REG_INTERRUPT_MASK_SET, INTERRUPT_LSC | INTERRUPT_TXDW | rx_interrupts);
     in32(REG_INTERRUPT_CAUSE_READ);
 
     enable_irq();
@@ -242,26 +265,33 @@ E1000NetworkAdapter::~E1000NetworkAdapter()
 
 void E1000NetworkAdapter::handle_irq(const RegisterState&)
 {
-    out32(REG_INTERRUPT_MASK_CLEAR, 0xffffffff);
-
     u32 status = in32(REG_INTERRUPT_CAUSE_READ);
 
     m_entropy_source.add_random_event(status);
 
-    if (status & 4) {
+    if (status & INTERRUPT_LSC) {
         u32 flags = in32(REG_CTRL);
         out32(REG_CTRL, flags | ECTRL_SLU);
     }
-    if (status & 0x80) {
-        receive();
+    if (status & rx_interrupts) {
+        // Leave the ring to the NetworkTask, and don't bother us again until it has been drained.
+        out32(REG_INTERRUPT_MASK_CLEAR, rx_interrupts);
+        schedule_poll();
     }
-    if (status & 0x10) {
-        // Threshold OK?
-    }
-
-    m_wait_queue.wake_all();
+    if (status & INTERRUPT_TXDW)
+        m_wait_queue.wake_all();
+}
 
-    out32(REG_INTERRUPT_MASK_SET, INTERRUPT_LSC | INTERRUPT_RXT0 | INTERRUPT_RXO);
+size_t E1000NetworkAdapter::poll(size_t budget)
+{
+    size_t received = receive(budget);
+    if (received < budget) {
+        // The ring is empty. If another frame arrived in the meantime, the cause bit
+        // is still set and unmasking raises the interrupt right away.
+        complete_poll();
+        out32(REG_INTERRUPT_MASK_SET, rx_interrupts);
+    }
+    return received;
 }
 
 void E1000NetworkAdapter::detect_eeprom()
@@ -320,13 +350,17 @@ bool E1000NetworkAdapter::link_up()
 
 void E1000NetworkAdapter::initialize_rx_descriptors()
 {
-    auto* rx_descriptors = (e1000_tx_desc*)m_rx_descriptors_region->vaddr().as_ptr();
+    // The card DMAs straight into buffers taken from a physically contiguous pool,
+    // which are then handed up the stack as-is instead of being copied out.
+    bool created = create_packet_buffer_pool(rx_buffer_size, number_of_rx_buffers, PacketBufferPool::Contiguous::Yes);
+    ASSERT(created);
+
+    auto* rx_descriptors = (e1000_rx_desc*)m_rx_descriptors_region->vaddr().as_ptr();
     for (size_t i = 0; i < number_of_rx_descriptors; ++i) {
         auto& descriptor = rx_descriptors[i];
-        auto region = MM.allocate_contiguous_kernel_region(8192, "E1000 RX buffer", Region::Access::Read | Region::Access::Write);
-        ASSERT(region);
-        m_rx_buffers_regions.append(region.release_nonnull());
-        descriptor.addr = m_rx_buffers_regions[i].physical_page(0)->paddr().get();
+        m_rx_buffers[i] = packet_buffer_pool()->try_take();
+        ASSERT(m_rx_buffers[i]);
+        descriptor.addr = m_rx_buffers[i]->physical_address().get();
         descriptor.status = 0;
     }
 
@@ -336,19 +370,23 @@ void E1000NetworkAdapter::initialize_rx_descriptors()
     out32(REG_RXDESCHEAD, 0);
     out32(REG_RXDESCTAIL, number_of_rx_descriptors - 1);
 
-    out32(REG_RCTRL, RCTL_EN | RCTL_SBP | RCTL_UPE | RCTL_MPE | RCTL_LBM_NONE | RTCL_RDMTS_HALF | RCTL_BAM | RCTL_SECRC | RCTL_BSIZE_8192);
+    // Have the card check TCP/UDP checksums for us.
+    out32(REG_RXCSUM, in32(REG_RXCSUM) | RXCSUM_TUOFL);
+
+    out32(REG_RCTRL, RCTL_EN | RCTL_SBP | RCTL_UPE | RCTL_MPE | RCTL_LBM_NONE | RTCL_RDMTS_HALF | RCTL_BAM | RCTL_SECRC | RCTL_BSIZE_2048);
 }
 
 void E1000NetworkAdapter::initialize_tx_descriptors()
 {
+    m_tx_buffers_region = MM.allocate_contiguous_kernel_region(number_of_tx_descriptors * tx_buffer_size, "E1000 TX buffers", Region::Access::Read | Region::Access::Write);
+    ASSERT(m_tx_buffers_region);
     auto* tx_descriptors = (e1000_tx_desc*)m_tx_descriptors_region->vaddr().as_ptr();
     for (size_t i = 0; i < number_of_tx_descriptors; ++i) {
         auto& descriptor = tx_descriptors[i];
-        auto region = MM.allocate_contiguous_kernel_region(8192, "E1000 TX buffer", Region::Access::Read | Region::Access::Write);
-        ASSERT(region);
-        m_tx_buffers_regions.append(region.release_nonnull());
-        descriptor.addr = m_tx_buffers_regions[i].physical_page(0)->paddr().get();
+        descriptor.addr = m_tx_buffers_region->physical_page(0)->paddr().offset(i * tx_buffer_size).get();
         descriptor.cmd = 0;
+        // Every descriptor starts out available.
+        descriptor.status = TSTA_DD;
     }
 
     out32(REG_TXDESCLO, m_tx_descriptors_region->physical_page(0)->paddr().get());
@@ -359,6 +397,9 @@ void E1000NetworkAdapter::initialize_tx_descriptors()
 
     out32(REG_TCTRL, in32(REG_TCTRL) | TCTL_EN | TCTL_PSP);
     out32(REG_TIPG, 0x0060200A);
+
+    // The legacy descriptors can insert one checksum, which we use for TCP/UDP.
+    set_transport_checksum_offload(true);
 }
 
 void E1000NetworkAdapter::out8(u16 address, u8 data)
@@ -432,59 +473,86 @@ u32 E1000NetworkAdapter::in32(u16 address)
 
 void E1000NetworkAdapter::send_raw(ReadonlyBytes payload)
 {
-    disable_irq();
+    transmit(payload, {});
+}
+
+void E1000NetworkAdapter::send_raw_with_checksum_offload(ReadonlyBytes payload, size_t checksum_start, size_t checksum_offset)
+{
+    ASSERT(checksum_start <= 0xff && checksum_offset <= 0xff);
+    transmit(payload, ChecksumOffload { (u8)checksum_start, (u8)checksum_offset });
+}
+
+void E1000NetworkAdapter::transmit(ReadonlyBytes payload, Optional<ChecksumOffload> checksum_offload)
+{
+    LOCKER(m_tx_lock);
     size_t tx_current = in32(REG_TXDESCTAIL) % number_of_tx_descriptors;
+    size_t tx_next = (tx_current + 1) % number_of_tx_descriptors;
 #ifdef E1000_DEBUG
     klog() << "E1000: Sending packet (" << payload.size() << " bytes)";
 #endif
     auto* tx_descriptors = (e1000_tx_desc*)m_tx_descriptors_region->vaddr().as_ptr();
+    // We don't wait for each packet to go out, only for the ring to have room again.
+    // The tail may never catch up with the head, so one descriptor always stays unused.
+    while (!(tx_descriptors[tx_next].status & TSTA_DD))
+        m_wait_queue.wait_on({}, "E1000NetworkAdapter");
+
     auto& descriptor = tx_descriptors[tx_current];
-    ASSERT(payload.size() <= 8192);
-    auto* vptr = (void*)m_tx_buffers_regions[tx_current].vaddr().as_ptr();
-    memcpy(vptr, payload.data(), payload.size());
+    ASSERT(payload.size() <= tx_buffer_size);
+    memcpy(m_tx_buffers_region->vaddr().offset(tx_current * tx_buffer_size).as_ptr(), payload.data(), payload.size());
     descriptor.length = payload.size();
     descriptor.status = 0;
-    descriptor.cmd = CMD_EOP | CMD_IFCS | CMD_RS;
-#ifdef E1000_DEBUG
-    klog() << "E1000: Using tx descriptor " << tx_current << " (head is at " << in32(REG_TXDESCHEAD) << ")";
-#endif
-    tx_current = (tx_current + 1) % number_of_tx_descriptors;
-    cli();
-    enable_irq();
-    out32(REG_TXDESCTAIL, tx_current);
-    for (;;) {
-        if (descriptor.status) {
-            sti();
-            break;
-        }
-        m_wait_queue.wait_on({}, "E1000NetworkAdapter");
+    if (checksum_offload.has_value()) {
+        descriptor.css = checksum_offload.value().start;
+        descriptor.cso = checksum_offload.value().offset;
+        descriptor.cmd = CMD_EOP | CMD_IFCS | CMD_RS | CMD_IC;
+    } else {
+        descriptor.css = 0;
+        descriptor.cso = 0;
+        descriptor.cmd = CMD_EOP | CMD_IFCS | CMD_RS;
     }
 #ifdef E1000_DEBUG
-    dbgln("E1000: Sent packet, status is now {:#02x}!", (u8)descriptor.status);
+    klog() << "E1000: Using tx descriptor " << tx_current << " (head is at " << in32(REG_TXDESCHEAD) << ")";
 #endif
+    out32(REG_TXDESCTAIL, tx_next);
 }
 
-void E1000NetworkAdapter::receive()
+size_t E1000NetworkAdapter::receive(size_t budget)
 {
-    auto* rx_descriptors = (e1000_tx_desc*)m_rx_descriptors_region->vaddr().as_ptr();
-    u32 rx_current;
-    for (;;) {
-        rx_current = in32(REG_RXDESCTAIL) % number_of_rx_descriptors;
-        if (rx_current == (in32(REG_RXDESCHEAD) % number_of_rx_descriptors))
-            return;
-        rx_current = (rx_current + 1) % number_of_rx_descriptors;
-        if (!(rx_descriptors[rx_current].status & 1))
+    auto* rx_descriptors = (e1000_rx_desc*)m_rx_descriptors_region->vaddr().as_ptr();
+    u32 rx_tail = in32(REG_RXDESCTAIL) % number_of_rx_descriptors;
+    size_t received = 0;
+    while (received < budget) {
+        u32 rx_current = (rx_tail + 1) % number_of_rx_descriptors;
+        auto status = rx_descriptors[rx_current].status;
+        if (!(status & RSTA_DD))
             break;
-        auto* buffer = m_rx_buffers_regions[rx_current].vaddr().as_ptr();
+        // If the card found the checksum to be bad, we check it again ourselves and drop the packet then.
+        bool checksum_verified = !(status & RSTA_IXSM) && (status & RSTA_TCPCS) && !(rx_descriptors[rx_current].errors & RERR_TCPE);
+        auto& buffer = m_rx_buffers[rx_current];
         u16 length = rx_descriptors[rx_current].length;
-        ASSERT(length <= 8192);
+        ASSERT(length <= rx_buffer_size);
 #ifdef E1000_DEBUG
-        klog() << "E1000: Received 1 packet @ " << buffer << " (" << length << ") bytes!";
+        klog() << "E1000: Received 1 packet @ " << buffer->data() << " (" << length << ") bytes!";
 #endif
-        did_receive({ buffer, length });
+        // Hand the filled buffer up and give the descriptor a fresh one. If the pool
+        // is exhausted, copy the packet out instead and keep the buffer on the ring.
+        if (auto replacement = packet_buffer_pool()->try_take()) {
+            buffer->set_size(length);
+            buffer->set_transport_checksum_verified(checksum_verified);
+            did_receive(buffer.release_nonnull());
+            buffer = move(replacement);
+            rx_descriptors[rx_current].addr = buffer->physical_address().get();
+        } else {
+            did_receive(ReadonlyBytes { buffer->data(), length }, checksum_verified);
+        }
         rx_descriptors[rx_current].status = 0;
-        out32(REG_RXDESCTAIL, rx_current);
+        rx_tail = rx_current;
+        ++received;
     }
+    // Give all the descriptors we've processed back to the card at once.
+    if (received)
+        out32(REG_RXDESCTAIL, rx_tail);
+    return received;
 }
 
 }
@@ -27,6 +27,7 @@
 #pragma once
 
 #include <AK/NonnullOwnPtrVector.h>
+#include <AK/Optional.h>
 #include <AK/OwnPtr.h>
 #include <Kernel/IO.h>
 #include <Kernel/Interrupts/IRQHandler.h>
@@ -46,10 +47,13 @@ public:
     virtual ~E1000NetworkAdapter() override;
 
     virtual void send_raw(ReadonlyBytes) override;
+    virtual void send_raw_with_checksum_offload(ReadonlyBytes, size_t checksum_start, size_t checksum_offset) override;
     virtual bool link_up() override;
 
     virtual const char* purpose() const override { return class_name(); }
 
+    virtual size_t poll(size_t budget) override;
+
 private:
     virtual void handle_irq(const RegisterState&) override;
     virtual const char* class_name() const override { return "E1000NetworkAdapter"; }
@@ -90,23 +94,33 @@ private:
     u16 in16(u16 address);
     u32 in32(u16 address);
 
-    void receive();
+    size_t receive(size_t budget);
+
+    struct ChecksumOffload {
+        u8 start { 0 };
+        u8 offset { 0 };
+    };
+    void transmit(ReadonlyBytes, Optional<ChecksumOffload>);
+
+    static const size_t number_of_rx_descriptors = 256;
+    static const size_t number_of_tx_descriptors = 64;
+    static const size_t rx_buffer_size = 2048;
+    static const size_t tx_buffer_size = 2048;
+    static const size_t number_of_rx_buffers = 512;
 
     IOAddress m_io_base;
     VirtualAddress m_mmio_base;
     OwnPtr<Region> m_rx_descriptors_region;
     OwnPtr<Region> m_tx_descriptors_region;
-    NonnullOwnPtrVector<Region> m_rx_buffers_regions;
-    NonnullOwnPtrVector<Region> m_tx_buffers_regions;
+    RefPtr<PacketBuffer> m_rx_buffers[number_of_rx_descriptors];
+    OwnPtr<Region> m_tx_buffers_region;
     OwnPtr<Region> m_mmio_region;
     u8 m_interrupt_line { 0 };
     bool m_has_eeprom { false };
     bool m_use_mmio { false };
     EntropySource m_entropy_source;
 
-    static const size_t number_of_rx_descriptors = 32;
-    static const size_t number_of_tx_descriptors = 8;
-
+    Lock m_tx_lock { "E1000NetworkAdapter TX" };
     WaitQueue m_wait_queue;
 };
 }
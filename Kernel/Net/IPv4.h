@@ -29,6 +29,7 @@
 #include <AK/Assertions.h>
 #include <AK/Endian.h>
 #include <AK/IPv4Address.h>
+#include <AK/InternetChecksum.h>
 #include <AK/String.h>
 #include <AK/Types.h>
 
@@ -127,17 +128,8 @@ const LogStream& operator<<(const LogStream& stream, const IPv4Packet& packet);
 
 inline NetworkOrdered<u16> internet_checksum(const void* ptr, size_t count)
 {
-    u32 checksum = 0;
-    auto* w = (const u16*)ptr;
-    while (count > 1) {
-        checksum += AK::convert_between_host_and_network_endian(*w++);
-        if (checksum & 0x80000000)
-            checksum = (checksum & 0xffff) | (checksum >> 16);
-        count -= 2;
-    }
-    while (checksum >> 16)
-        checksum = (checksum & 0xffff) + (checksum >> 16);
-    return ~checksum & 0xffff;
+    // AK hands us the checksum as it's laid out in memory, NetworkOrdered wants it in host order.
+    return AK::convert_between_host_and_network_endian(AK::internet_checksum(ptr, count));
 }
 
 }
@@ -66,14 +66,12 @@ KResultOr<NonnullRefPtr<Socket>> IPv4Socket::create(int type, int protocol)
 
 IPv4Socket::IPv4Socket(int type, int protocol)
     : Socket(AF_INET, type, protocol)
+    , m_receive_buffer(type == SOCK_STREAM ? stream_receive_buffer_size : packet_receive_buffer_size)
 {
 #ifdef IPV4_SOCKET_DEBUG
     dbg() << "IPv4Socket{" << this << "} created with type=" << type << ", protocol=" << protocol;
 #endif
     m_buffer_mode = type == SOCK_STREAM ? BufferMode::Bytes : BufferMode::Packets;
-    if (m_buffer_mode == BufferMode::Bytes) {
-        m_scratch_buffer = KBuffer::create_with_size(65536);
-    }
     LOCKER(all_sockets().lock());
     all_sockets().resource().set(this);
 }
@@ -195,9 +193,9 @@ int IPv4Socket::allocate_local_port_if_needed()
     return port;
 }
 
-KResultOr<size_t> IPv4Socket::sendto(FileDescription&, const UserOrKernelBuffer& data, size_t data_length, [[maybe_unused]] int flags, Userspace<const sockaddr*> addr, socklen_t addr_length)
+KResultOr<size_t> IPv4Socket::sendto(FileDescription& description, const UserOrKernelBuffer& data, size_t data_length, [[maybe_unused]] int flags, Userspace<const sockaddr*> addr, socklen_t addr_length)
 {
-    LOCKER(lock());
+    Locker locker(lock());
 
     if (addr && addr_length != sizeof(sockaddr_in))
         return KResult(-EINVAL);
@@ -238,6 +236,26 @@ KResultOr<size_t> IPv4Socket::sendto(FileDescription&, const UserOrKernelBuffer&
         return data_length;
     }
 
+    while (!protocol_has_send_space()) {
+        if (protocol_is_disconnected())
+            return KResult(-EPIPE);
+        if (!description.is_blocking())
+            return KResult(-EAGAIN);
+
+        locker.unlock();
+        auto unblocked_flags = Thread::FileDescriptionBlocker::BlockFlags::None;
+        auto res = Thread::current()->block<Thread::WriteBlocker>({}, description, unblocked_flags);
+        locker.lock();
+
+        if (!((u32)unblocked_flags & ((u32)Thread::FileDescriptionBlocker::BlockFlags::Write | (u32)Thread::FileDescriptionBlocker::BlockFlags::Exception))) {
+            if (res.was_interrupted())
+                return KResult(-EINTR);
+
+            // Unblocked due to timeout.
+            return KResult(-EAGAIN);
+        }
+    }
+
     auto nsent_or_error = protocol_send(data, data_length);
     if (!nsent_or_error.is_error())
         Thread::current()->did_ipv4_socket_write(nsent_or_error.value());
@@ -273,6 +291,8 @@ KResultOr<size_t> IPv4Socket::receive_byte_buffered(FileDescription& description
         Thread::current()->did_ipv4_socket_read((size_t)nreceived);
 
     set_can_read(!m_receive_buffer.is_empty());
+    if (nreceived > 0)
+        protocol_did_consume_receive_buffer();
     return nreceived;
 }
 
@@ -294,11 +314,11 @@ KResultOr<size_t> IPv4Socket::receive_packet_buffered(FileDescription& descripti
             packet = m_receive_queue.take_first();
             set_can_read(!m_receive_queue.is_empty());
 #ifdef IPV4_SOCKET_DEBUG
-            dbg() << "IPv4Socket(" << this << "): recvfrom without blocking " << packet.data.value().size() << " bytes, packets in queue: " << m_receive_queue.size();
+            dbg() << "IPv4Socket(" << this << "): recvfrom without blocking " << packet.data.size() << " bytes, packets in queue: " << m_receive_queue.size();
 #endif
         }
     }
-    if (!packet.data.has_value()) {
+    if (!packet.buffer) {
         if (protocol_is_disconnected()) {
             dbgln("IPv4Socket({}) is protocol-disconnected, returning 0 in recvfrom!", this);
             return 0;
@@ -321,10 +341,10 @@ KResultOr<size_t> IPv4Socket::receive_packet_buffered(FileDescription& descripti
         packet = m_receive_queue.take_first();
         set_can_read(!m_receive_queue.is_empty());
 #ifdef IPV4_SOCKET_DEBUG
-        dbg() << "IPv4Socket(" << this << "): recvfrom with blocking " << packet.data.value().size() << " bytes, packets in queue: " << m_receive_queue.size();
+        dbg() << "IPv4Socket(" << this << "): recvfrom with blocking " << packet.data.size() << " bytes, packets in queue: " << m_receive_queue.size();
 #endif
     }
-    ASSERT(packet.data.has_value());
+    ASSERT(packet.buffer);
 
     packet_timestamp = packet.timestamp;
 
@@ -348,13 +368,13 @@ KResultOr<size_t> IPv4Socket::receive_packet_buffered(FileDescription& descripti
     }
 
     if (type() == SOCK_RAW) {
-        size_t bytes_written = min(packet.data.value().size(), buffer_length);
-        if (!buffer.write(packet.data.value().data(), bytes_written))
+        size_t bytes_written = min(packet.data.size(), buffer_length);
+        if (!buffer.write(packet.data.data(), bytes_written))
             return KResult(-EFAULT);
         return bytes_written;
     }
 
-    return protocol_receive(ReadonlyBytes { packet.data.value().data(), packet.data.value().size() }, buffer, buffer_length, flags);
+    return protocol_receive(packet.data, buffer, buffer_length, flags);
 }
 
 KResultOr<size_t> IPv4Socket::recvfrom(FileDescription& description, UserOrKernelBuffer& buffer, size_t buffer_length, int flags, Userspace<sockaddr*> user_addr, Userspace<socklen_t*> user_addr_length, timeval& packet_timestamp)
@@ -382,27 +402,26 @@ KResultOr<size_t> IPv4Socket::recvfrom(FileDescription& description, UserOrKerne
     return nreceived;
 }
 
-bool IPv4Socket::did_receive(const IPv4Address& source_address, u16 source_port, KBuffer&& packet, const timeval& packet_timestamp)
+bool IPv4Socket::did_receive(const IPv4Address& source_address, u16 source_port, PacketBuffer& buffer, ReadonlyBytes raw_ipv4_packet)
 {
     LOCKER(lock());
 
     if (is_shut_down_for_reading())
         return false;
 
-    auto packet_size = packet.size();
+    ASSERT(raw_ipv4_packet.data() >= buffer.data() && raw_ipv4_packet.data() + raw_ipv4_packet.size() <= buffer.data() + buffer.size());
+    auto packet_size = raw_ipv4_packet.size();
 
     if (buffer_mode() == BufferMode::Bytes) {
-        size_t space_in_receive_buffer = m_receive_buffer.space_for_writing();
-        if (packet_size > space_in_receive_buffer) {
+        // This is the only copy we make, straight from the packet into the receive buffer.
+        auto payload = protocol_payload(raw_ipv4_packet);
+        // NOTE: Only the payload has to fit, the headers don't end up in the receive buffer.
+        if (payload.size() > m_receive_buffer.space_for_writing()) {
             dbgln("IPv4Socket({}): did_receive refusing packet since buffer is full.", this);
             ASSERT(m_can_read);
             return false;
         }
-        auto scratch_buffer = UserOrKernelBuffer::for_kernel_buffer(m_scratch_buffer.value().data());
-        auto nreceived_or_error = protocol_receive(ReadonlyBytes { packet.data(), packet.size() }, scratch_buffer, m_scratch_buffer.value().size(), 0);
-        if (nreceived_or_error.is_error())
-            return false;
-        ssize_t nwritten = m_receive_buffer.write(scratch_buffer, nreceived_or_error.value());
+        ssize_t nwritten = m_receive_buffer.write(UserOrKernelBuffer::for_kernel_buffer(const_cast<u8*>(payload.data())), payload.size());
         if (nwritten < 0)
             return false;
         set_can_read(!m_receive_buffer.is_empty());
@@ -411,7 +430,15 @@ bool IPv4Socket::did_receive(const IPv4Address& source_address, u16 source_port,
             dbgln("IPv4Socket({}): did_receive refusing packet since queue is full.", this);
             return false;
         }
-        m_receive_queue.append({ source_address, source_port, packet_timestamp, move(packet) });
+        // Datagrams stay in the packet buffer they arrived in until they're read.
+        RefPtr<PacketBuffer> retained_buffer = buffer;
+        if (buffer.is_pool_running_low()) {
+            retained_buffer = PacketBuffer::try_create_unpooled_copy(raw_ipv4_packet, buffer.timestamp());
+            if (!retained_buffer)
+                return false;
+            raw_ipv4_packet = retained_buffer->bytes();
+        }
+        m_receive_queue.append({ source_address, source_port, buffer.timestamp(), move(retained_buffer), raw_ipv4_packet });
         set_can_read(true);
     }
     m_bytes_received += packet_size;
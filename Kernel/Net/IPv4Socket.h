@@ -29,10 +29,10 @@
 #include <AK/HashMap.h>
 #include <AK/SinglyLinkedListWithCount.h>
 #include <Kernel/DoubleBuffer.h>
-#include <Kernel/KBuffer.h>
 #include <Kernel/Lock.h>
 #include <Kernel/Net/IPv4.h>
 #include <Kernel/Net/IPv4SocketTuple.h>
+#include <Kernel/Net/PacketBuffer.h>
 #include <Kernel/Net/Socket.h>
 
 namespace Kernel {
@@ -63,7 +63,8 @@ public:
 
     virtual int ioctl(FileDescription&, unsigned request, FlatPtr arg) override;
 
-    bool did_receive(const IPv4Address& peer_address, u16 peer_port, KBuffer&&, const timeval&);
+    // The raw IPv4 packet has to point into the PacketBuffer, which the socket may hold on to.
+    bool did_receive(const IPv4Address& peer_address, u16 peer_port, PacketBuffer&, ReadonlyBytes raw_ipv4_packet);
 
     const IPv4Address& local_address() const { return m_local_address; }
     u16 local_port() const { return m_local_port; }
@@ -95,13 +96,22 @@ protected:
     virtual KResult protocol_bind() { return KSuccess; }
     virtual KResult protocol_listen() { return KSuccess; }
     virtual KResultOr<size_t> protocol_receive(ReadonlyBytes /* raw_ipv4_packet */, UserOrKernelBuffer&, size_t, int) { return -ENOTIMPL; }
+    // Stream sockets return the part of a packet that goes into the receive buffer.
+    virtual ReadonlyBytes protocol_payload(ReadonlyBytes /* raw_ipv4_packet */) const { return {}; }
     virtual KResultOr<size_t> protocol_send(const UserOrKernelBuffer&, size_t) { return -ENOTIMPL; }
     virtual KResult protocol_connect(FileDescription&, ShouldBlock) { return KSuccess; }
     virtual int protocol_allocate_local_port() { return 0; }
     virtual bool protocol_is_disconnected() const { return false; }
+    virtual bool protocol_has_send_space() const { return true; }
 
     virtual void shut_down_for_reading() override;
 
+    // Called after reading from the receive buffer of a stream socket made some room in it.
+    virtual void protocol_did_consume_receive_buffer() { }
+
+    size_t receive_buffer_space() const { return m_receive_buffer.space_for_writing(); }
+    size_t receive_buffer_capacity() const { return m_receive_buffer.capacity(); }
+
     void set_local_address(IPv4Address address) { m_local_address = address; }
     void set_peer_address(IPv4Address address) { m_peer_address = address; }
 
@@ -120,13 +130,17 @@ private:
         IPv4Address peer_address;
         u16 peer_port;
         timeval timestamp;
-        Optional<KBuffer> data;
+        RefPtr<PacketBuffer> buffer;
+        ReadonlyBytes data;
     };
 
     SinglyLinkedListWithCount<ReceivedPacket> m_receive_queue;
 
     DoubleBuffer m_receive_buffer;
 
+    static constexpr size_t stream_receive_buffer_size = 128 * KiB;
+    static constexpr size_t packet_receive_buffer_size = 64 * KiB;
+
     u16 m_local_port { 0 };
     u16 m_peer_port { 0 };
 
@@ -138,7 +152,6 @@ private:
 
     BufferMode m_buffer_mode { BufferMode::Packets };
 
-    Optional<KBuffer> m_scratch_buffer;
 };
 
 }
@@ -101,11 +101,38 @@ void NetworkAdapter::send(const MACAddress& destination, const ARPPacket& packet
     send_raw({ (const u8*)eth, size_in_bytes });
 }
 
-int NetworkAdapter::send_ipv4(const MACAddress& destination_mac, const IPv4Address& destination_ipv4, IPv4Protocol protocol, const UserOrKernelBuffer& payload, size_t payload_size, u8 ttl)
+static size_t transport_checksum_offset(IPv4Protocol protocol)
+{
+    switch (protocol) {
+    case IPv4Protocol::TCP:
+        return 16;
+    case IPv4Protocol::UDP:
+        return 6;
+    default:
+        ASSERT_NOT_REACHED();
+    }
+}
+
+static void finish_transport_checksum(IPv4Protocol protocol, u8* payload, size_t payload_size)
+{
+    // The pseudo-header sum is already in the checksum field, so summing up the payload finishes it.
+    u16 checksum = AK::internet_checksum(payload, payload_size);
+    memcpy(payload + transport_checksum_offset(protocol), &checksum, sizeof(checksum));
+}
+
+int NetworkAdapter::send_ipv4(const MACAddress& destination_mac, const IPv4Address& destination_ipv4, IPv4Protocol protocol, const UserOrKernelBuffer& payload, size_t payload_size, u8 ttl, TransportChecksum transport_checksum)
 {
     size_t ipv4_packet_size = sizeof(IPv4Packet) + payload_size;
-    if (ipv4_packet_size > mtu())
-        return send_ipv4_fragmented(destination_mac, destination_ipv4, protocol, payload, payload_size, ttl);
+    if (ipv4_packet_size > mtu()) {
+        if (transport_checksum == TransportChecksum::Complete)
+            return send_ipv4_fragmented(destination_mac, destination_ipv4, protocol, payload, payload_size, ttl);
+        // Fragments can't be checksummed by the hardware, so finish the checksum before splitting the packet up.
+        auto complete_payload = ByteBuffer::create_uninitialized(payload_size);
+        if (!payload.read(complete_payload.data(), payload_size))
+            return -EFAULT;
+        finish_transport_checksum(protocol, complete_payload.data(), payload_size);
+        return send_ipv4_fragmented(destination_mac, destination_ipv4, protocol, UserOrKernelBuffer::for_kernel_buffer(complete_payload.data()), payload_size, ttl);
+    }
 
     size_t ethernet_frame_size = sizeof(EthernetFrameHeader) + sizeof(IPv4Packet) + payload_size;
     auto buffer = ByteBuffer::create_zeroed(ethernet_frame_size);
@@ -128,6 +155,16 @@ int NetworkAdapter::send_ipv4(const MACAddress& destination_mac, const IPv4Addre
 
     if (!payload.read(ipv4.payload(), payload_size))
         return -EFAULT;
+
+    if (transport_checksum == TransportChecksum::Partial) {
+        if (m_transport_checksum_offload) {
+            size_t checksum_start = sizeof(EthernetFrameHeader) + sizeof(IPv4Packet);
+            send_raw_with_checksum_offload({ (const u8*)&eth, ethernet_frame_size }, checksum_start, checksum_start + transport_checksum_offset(protocol));
+            return 0;
+        }
+        finish_transport_checksum(protocol, (u8*)ipv4.payload(), payload_size);
+    }
+
     send_raw({ (const u8*)&eth, ethernet_frame_size });
     return 0;
 }
@@ -172,49 +209,73 @@ int NetworkAdapter::send_ipv4_fragmented(const MACAddress& destination_mac, cons
     return 0;
 }
 
-void NetworkAdapter::did_receive(ReadonlyBytes payload)
+bool NetworkAdapter::create_packet_buffer_pool(size_t buffer_size, size_t buffer_count, PacketBufferPool::Contiguous contiguous)
+{
+    StringBuilder builder;
+    builder.append(class_name());
+    builder.append(" packet buffers");
+    m_packet_buffer_pool = PacketBufferPool::try_create(builder.string_view(), buffer_size, buffer_count, contiguous);
+    return m_packet_buffer_pool;
+}
+
+void NetworkAdapter::did_receive(ReadonlyBytes payload, bool transport_checksum_verified)
 {
     InterruptDisabler disabler;
-    m_packets_in++;
-    m_bytes_in += payload.size();
-
-    Optional<KBuffer> buffer;
-
-    if (m_unused_packet_buffers.is_empty()) {
-        buffer = KBuffer::copy(payload.data(), payload.size());
-    } else {
-        buffer = m_unused_packet_buffers.take_first();
-        --m_unused_packet_buffers_count;
-        if (payload.size() <= buffer.value().size()) {
-            memcpy(buffer.value().data(), payload.data(), payload.size());
-            buffer.value().set_size(payload.size());
-        } else {
-            buffer = KBuffer::copy(payload.data(), payload.size());
-        }
+
+    if (!m_packet_buffer_pool || m_packet_buffer_pool->buffer_size() < payload.size()) {
+        // The MTU can change, so make sure the buffers are big enough for the largest frame we can get.
+        // Adapters with a huge MTU (like the loopback adapter) get fewer buffers.
+        size_t buffer_size = max((size_t)mtu(), payload.size()) + sizeof(EthernetFrameHeader);
+        size_t buffer_count = max(min(1 * MiB / buffer_size, (size_t)64), (size_t)16);
+        if (!create_packet_buffer_pool(buffer_size, buffer_count, PacketBufferPool::Contiguous::No))
+            klog() << "NetworkAdapter: Couldn't create packet buffer pool for " << name();
+    }
+
+    RefPtr<PacketBuffer> buffer;
+    if (m_packet_buffer_pool && m_packet_buffer_pool->buffer_size() >= payload.size())
+        buffer = m_packet_buffer_pool->try_take();
+    if (!buffer)
+        buffer = PacketBuffer::try_create_unpooled(payload.size());
+    if (!buffer) {
+        did_drop_packet();
+        return;
     }
 
-    m_packet_queue.append({ buffer.value(), kgettimeofday() });
+    memcpy(buffer->data(), payload.data(), payload.size());
+    buffer->set_size(payload.size());
+    buffer->set_transport_checksum_verified(transport_checksum_verified);
+    did_receive(buffer.release_nonnull());
+}
+
+void NetworkAdapter::did_receive(NonnullRefPtr<PacketBuffer> buffer)
+{
+    InterruptDisabler disabler;
+    m_packets_in++;
+    m_bytes_in += buffer->size();
+
+    buffer->set_timestamp(kgettimeofday());
+    m_packet_queue.append(move(buffer));
 
     if (on_receive)
         on_receive();
 }
 
-size_t NetworkAdapter::dequeue_packet(u8* buffer, size_t buffer_size, timeval& packet_timestamp)
+size_t NetworkAdapter::dequeue_packets(Vector<NonnullRefPtr<PacketBuffer>>& packets, size_t max_count)
 {
     InterruptDisabler disabler;
-    if (m_packet_queue.is_empty())
-        return 0;
-    auto packet_with_timestamp = m_packet_queue.take_first();
-    packet_timestamp = packet_with_timestamp.timestamp;
-    auto packet = move(packet_with_timestamp.packet);
-    size_t packet_size = packet.size();
-    ASSERT(packet_size <= buffer_size);
-    memcpy(buffer, packet.data(), packet_size);
-    if (m_unused_packet_buffers_count < 100) {
-        m_unused_packet_buffers.append(packet);
-        ++m_unused_packet_buffers_count;
+    size_t count = 0;
+    while (count < max_count && !m_packet_queue.is_empty()) {
+        packets.append(m_packet_queue.take_first());
+        ++count;
     }
-    return packet_size;
+    return count;
+}
+
+void NetworkAdapter::schedule_poll()
+{
+    m_poll_scheduled.store(true, AK::MemoryOrder::memory_order_release);
+    if (on_receive)
+        on_receive();
 }
 
 void NetworkAdapter::set_ipv4_address(const IPv4Address& address)
@@ -26,23 +26,33 @@
 
 #pragma once
 
+#include <AK/Atomic.h>
 #include <AK/ByteBuffer.h>
 #include <AK/Function.h>
 #include <AK/MACAddress.h>
 #include <AK/SinglyLinkedList.h>
 #include <AK/Types.h>
+#include <AK/Vector.h>
 #include <AK/WeakPtr.h>
 #include <AK/Weakable.h>
 #include <Kernel/KBuffer.h>
 #include <Kernel/Net/ARP.h>
 #include <Kernel/Net/ICMP.h>
 #include <Kernel/Net/IPv4.h>
+#include <Kernel/Net/PacketBuffer.h>
 #include <Kernel/UserOrKernelBuffer.h>
 
 namespace Kernel {
 
 class NetworkAdapter;
 
+enum class TransportChecksum {
+    Complete,
+    // The checksum field of the TCP/UDP header only holds the sum of the pseudo-header,
+    // and the adapter has to finish the checksum, in hardware if it can.
+    Partial,
+};
+
 class NetworkAdapter : public RefCounted<NetworkAdapter> {
 public:
     static void for_each(Function<void(NetworkAdapter&)>);
@@ -59,18 +69,28 @@ public:
     IPv4Address ipv4_gateway() const { return m_ipv4_gateway; }
     virtual bool link_up() { return false; }
 
+    bool has_transport_checksum_offload() const { return m_transport_checksum_offload; }
+
     void set_ipv4_address(const IPv4Address&);
     void set_ipv4_netmask(const IPv4Address&);
     void set_ipv4_gateway(const IPv4Address&);
 
     void send(const MACAddress&, const ARPPacket&);
-    int send_ipv4(const MACAddress&, const IPv4Address&, IPv4Protocol, const UserOrKernelBuffer& payload, size_t payload_size, u8 ttl);
+    int send_ipv4(const MACAddress&, const IPv4Address&, IPv4Protocol, const UserOrKernelBuffer& payload, size_t payload_size, u8 ttl, TransportChecksum = TransportChecksum::Complete);
     int send_ipv4_fragmented(const MACAddress&, const IPv4Address&, IPv4Protocol, const UserOrKernelBuffer& payload, size_t payload_size, u8 ttl);
 
-    size_t dequeue_packet(u8* buffer, size_t buffer_size, timeval& packet_timestamp);
+    // Moves up to max_count queued packets into the given vector, returns how many were moved.
+    size_t dequeue_packets(Vector<NonnullRefPtr<PacketBuffer>>&, size_t max_count);
 
     bool has_queued_packets() const { return !m_packet_queue.is_empty(); }
 
+    // NAPI-style receive: an adapter that supports polling masks its receive interrupt and
+    // schedules a poll instead of pulling frames off its ring in the IRQ handler. The NetworkTask
+    // then calls poll() with a budget of frames, and the adapter completes the poll and unmasks
+    // the interrupt once its ring has been drained.
+    bool is_poll_scheduled() const { return m_poll_scheduled.load(AK::MemoryOrder::memory_order_acquire); }
+    virtual size_t poll(size_t /* budget */) { return 0; }
+
     u32 mtu() const { return m_mtu; }
     void set_mtu(u32 mtu) { m_mtu = mtu; }
 
@@ -78,6 +98,7 @@ public:
     u32 bytes_in() const { return m_bytes_in; }
     u32 packets_out() const { return m_packets_out; }
     u32 bytes_out() const { return m_bytes_out; }
+    u32 packets_dropped() const { return m_packets_dropped; }
 
     Function<void()> on_receive;
 
@@ -86,7 +107,23 @@ protected:
     void set_interface_name(const StringView& basename);
     void set_mac_address(const MACAddress& mac_address) { m_mac_address = mac_address; }
     virtual void send_raw(ReadonlyBytes) = 0;
-    void did_receive(ReadonlyBytes);
+
+    // Adapters that can compute TCP/UDP checksums in hardware enable the offload, and then get
+    // frames with a partial checksum here: the checksum is computed from checksum_start to the end
+    // of the frame, and stored at checksum_offset.
+    void set_transport_checksum_offload(bool offload) { m_transport_checksum_offload = offload; }
+    virtual void send_raw_with_checksum_offload(ReadonlyBytes, size_t /* checksum_start */, size_t /* checksum_offset */) { ASSERT_NOT_REACHED(); }
+
+    // Adapters that can receive straight into a PacketBuffer should set up a pool of their own,
+    // and hand the filled buffers to did_receive(). Everyone else gets copied into a buffer
+    // from a default pool.
+    bool create_packet_buffer_pool(size_t buffer_size, size_t buffer_count, PacketBufferPool::Contiguous);
+    PacketBufferPool* packet_buffer_pool() { return m_packet_buffer_pool.ptr(); }
+    void did_receive(ReadonlyBytes, bool transport_checksum_verified = false);
+    void did_receive(NonnullRefPtr<PacketBuffer>);
+    void did_drop_packet() { ++m_packets_dropped; }
+    void schedule_poll();
+    void complete_poll() { m_poll_scheduled.store(false, AK::MemoryOrder::memory_order_release); }
 
 private:
     MACAddress m_mac_address;
@@ -94,20 +131,17 @@ private:
     IPv4Address m_ipv4_netmask;
     IPv4Address m_ipv4_gateway;
 
-    struct PacketWithTimestamp {
-        KBuffer packet;
-        timeval timestamp;
-    };
-
-    SinglyLinkedList<PacketWithTimestamp> m_packet_queue;
-    SinglyLinkedList<KBuffer> m_unused_packet_buffers;
-    size_t m_unused_packet_buffers_count { 0 };
+    RefPtr<PacketBufferPool> m_packet_buffer_pool;
+    SinglyLinkedList<NonnullRefPtr<PacketBuffer>> m_packet_queue;
+    Atomic<bool> m_poll_scheduled { false };
     String m_name;
     u32 m_packets_in { 0 };
     u32 m_bytes_in { 0 };
     u32 m_packets_out { 0 };
     u32 m_bytes_out { 0 };
+    u32 m_packets_dropped { 0 };
     u32 m_mtu { 1500 };
+    bool m_transport_checksum_offload { false };
 };
 
 }
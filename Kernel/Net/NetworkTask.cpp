@@ -51,25 +51,42 @@
 
 namespace Kernel {
 
+static void handle_packet(PacketBuffer&);
 static void handle_arp(const EthernetFrameHeader&, size_t frame_size);
-static void handle_ipv4(const EthernetFrameHeader&, size_t frame_size, const timeval& packet_timestamp);
-static void handle_icmp(const EthernetFrameHeader&, const IPv4Packet&, const timeval& packet_timestamp);
-static void handle_udp(const IPv4Packet&, const timeval& packet_timestamp);
-static void handle_tcp(const IPv4Packet&, const timeval& packet_timestamp);
+static void handle_ipv4(const EthernetFrameHeader&, size_t frame_size, PacketBuffer&);
+static void handle_icmp(const EthernetFrameHeader&, const IPv4Packet&, PacketBuffer&);
+static void handle_udp(const IPv4Packet&, PacketBuffer&);
+static void handle_tcp(const IPv4Packet&, PacketBuffer&);
+
+// How many frames we take from an adapter per wakeup.
+static constexpr size_t receive_batch_size = 64;
+
+static ReadonlyBytes raw_ipv4_packet(const IPv4Packet& packet)
+{
+    return { (const u8*)&packet, sizeof(IPv4Packet) + packet.payload_size() };
+}
 
 [[noreturn]] static void NetworkTask_main(void*);
 
+static WaitQueue* s_packet_wait_queue;
+
 void NetworkTask::spawn()
 {
     RefPtr<Thread> thread;
     Process::create_kernel_process(thread, "NetworkTask", NetworkTask_main, nullptr);
 }
 
+void NetworkTask::wake()
+{
+    if (s_packet_wait_queue)
+        s_packet_wait_queue->wake_all();
+}
+
 void NetworkTask_main(void*)
 {
     WaitQueue packet_wait_queue;
+    s_packet_wait_queue = &packet_wait_queue;
     u8 octet = 15;
-    int pending_packets = 0;
     NetworkAdapter::for_each([&](auto& adapter) {
         if (String(adapter.class_name()) == "LoopbackAdapter") {
             adapter.set_ipv4_address({ 127, 0, 0, 1 });
@@ -84,82 +101,91 @@ void NetworkTask_main(void*)
         klog() << "NetworkTask: " << adapter.class_name() << " network adapter found: hw=" << adapter.mac_address().to_string().characters() << " address=" << adapter.ipv4_address().to_string().characters() << " netmask=" << adapter.ipv4_netmask().to_string().characters() << " gateway=" << adapter.ipv4_gateway().to_string().characters();
 
         adapter.on_receive = [&]() {
-            pending_packets++;
             packet_wait_queue.wake_all();
         };
     });
 
-    auto dequeue_packet = [&pending_packets](u8* buffer, size_t buffer_size, timeval& packet_timestamp) -> size_t {
-        if (pending_packets == 0)
-            return 0;
-        size_t packet_size = 0;
+    // Every wakeup drains as much as we can: adapters that have a poll scheduled get to pull
+    // up to a budget's worth of frames off their rings, and then we take all the queued
+    // packets in one go and run them through the protocol handlers as a batch.
+    Vector<NonnullRefPtr<PacketBuffer>> packets;
+    packets.ensure_capacity(receive_batch_size);
+
+    klog() << "NetworkTask: Enter main loop.";
+    for (;;) {
+        TCPSocket::handle_expired_retransmit_timers();
+
+        bool has_pending_poll = false;
         NetworkAdapter::for_each([&](auto& adapter) {
-            if (packet_size || !adapter.has_queued_packets())
-                return;
-            packet_size = adapter.dequeue_packet(buffer, buffer_size, packet_timestamp);
-            pending_packets--;
+            if (adapter.is_poll_scheduled()) {
+                adapter.poll(receive_batch_size);
+                has_pending_poll |= adapter.is_poll_scheduled();
+            }
+            [[maybe_unused]] size_t dequeued = adapter.dequeue_packets(packets, receive_batch_size);
 #ifdef NETWORK_TASK_DEBUG
-            klog() << "NetworkTask: Dequeued packet from " << adapter.name().characters() << " (" << packet_size << " bytes)";
+            if (dequeued)
+                klog() << "NetworkTask: Dequeued " << dequeued << " packets from " << adapter.name().characters();
 #endif
         });
-        return packet_size;
-    };
-
-    size_t buffer_size = 64 * KiB;
-    auto buffer_region = MM.allocate_kernel_region(buffer_size, "Kernel Packet Buffer", Region::Access::Read | Region::Access::Write);
-    auto buffer = (u8*)buffer_region->vaddr().get();
-    timeval packet_timestamp;
 
-    klog() << "NetworkTask: Enter main loop.";
-    for (;;) {
-        size_t packet_size = dequeue_packet(buffer, buffer_size, packet_timestamp);
-        if (!packet_size) {
-            packet_wait_queue.wait_on({}, "NetworkTask");
-            continue;
-        }
-        if (packet_size < sizeof(EthernetFrameHeader)) {
-            klog() << "NetworkTask: Packet is too small to be an Ethernet packet! (" << packet_size << ")";
+        if (packets.is_empty()) {
+            if (!has_pending_poll)
+                packet_wait_queue.wait_on({}, "NetworkTask");
             continue;
         }
-        auto& eth = *(const EthernetFrameHeader*)buffer;
+
+        for (auto& packet : packets)
+            handle_packet(packet);
+        packets.clear_with_capacity();
+    }
+}
+
+void handle_packet(PacketBuffer& packet)
+{
+    size_t packet_size = packet.size();
+    auto* buffer = packet.data();
+    if (packet_size < sizeof(EthernetFrameHeader)) {
+        klog() << "NetworkTask: Packet is too small to be an Ethernet packet! (" << packet_size << ")";
+        return;
+    }
+    auto& eth = *(const EthernetFrameHeader*)buffer;
 #ifdef ETHERNET_DEBUG
-        dbgln("NetworkTask: From {} to {}, ether_type={:#04x}, packet_size={}", eth.source().to_string(), eth.destination().to_string(), eth.ether_type(), packet_size);
+    dbgln("NetworkTask: From {} to {}, ether_type={:#04x}, packet_size={}", eth.source().to_string(), eth.destination().to_string(), eth.ether_type(), packet_size);
 #endif
 
 #ifdef ETHERNET_VERY_DEBUG
-        for (size_t i = 0; i < packet_size; i++) {
-            klog() << String::format("%#02x", buffer[i]);
-
-            switch (i % 16) {
-            case 7:
-                klog() << "  ";
-                break;
-            case 15:
-                klog() << "";
-                break;
-            default:
-                klog() << " ";
-                break;
-            }
-        }
-
-        klog() << "";
-#endif
+    for (size_t i = 0; i < packet_size; i++) {
+        klog() << String::format("%#02x", buffer[i]);
 
-        switch (eth.ether_type()) {
-        case EtherType::ARP:
-            handle_arp(eth, packet_size);
+        switch (i % 16) {
+        case 7:
+            klog() << "  ";
             break;
-        case EtherType::IPv4:
-            handle_ipv4(eth, packet_size, packet_timestamp);
-            break;
-        case EtherType::IPv6:
-            // ignore
+        case 15:
+            klog() << "";
             break;
         default:
-            klog() << "NetworkTask: Unknown ethernet type 0x" << String::format("%x", eth.ether_type());
+            klog() << " ";
+            break;
         }
     }
+
+    klog() << "";
+#endif
+
+    switch (eth.ether_type()) {
+    case EtherType::ARP:
+        handle_arp(eth, packet_size);
+        break;
+    case EtherType::IPv4:
+        handle_ipv4(eth, packet_size, packet);
+        break;
+    case EtherType::IPv6:
+        // ignore
+        break;
+    default:
+        klog() << "NetworkTask: Unknown ethernet type 0x" << String::format("%x", eth.ether_type());
+    }
 }
 
 void handle_arp(const EthernetFrameHeader& eth, size_t frame_size)
@@ -213,7 +239,7 @@ void handle_arp(const EthernetFrameHeader& eth, size_t frame_size)
     }
 }
 
-void handle_ipv4(const EthernetFrameHeader& eth, size_t frame_size, const timeval& packet_timestamp)
+void handle_ipv4(const EthernetFrameHeader& eth, size_t frame_size, PacketBuffer& buffer)
 {
     constexpr size_t minimum_ipv4_frame_size = sizeof(EthernetFrameHeader) + sizeof(IPv4Packet);
     if (frame_size < minimum_ipv4_frame_size) {
@@ -239,18 +265,18 @@ void handle_ipv4(const EthernetFrameHeader& eth, size_t frame_size, const timeva
 
     switch ((IPv4Protocol)packet.protocol()) {
     case IPv4Protocol::ICMP:
-        return handle_icmp(eth, packet, packet_timestamp);
+        return handle_icmp(eth, packet, buffer);
     case IPv4Protocol::UDP:
-        return handle_udp(packet, packet_timestamp);
+        return handle_udp(packet, buffer);
     case IPv4Protocol::TCP:
-        return handle_tcp(packet, packet_timestamp);
+        return handle_tcp(packet, buffer);
     default:
         klog() << "handle_ipv4: Unhandled protocol " << packet.protocol();
         break;
     }
 }
 
-void handle_icmp(const EthernetFrameHeader& eth, const IPv4Packet& ipv4_packet, const timeval& packet_timestamp)
+void handle_icmp(const EthernetFrameHeader& eth, const IPv4Packet& ipv4_packet, PacketBuffer& packet_buffer)
 {
     auto& icmp_header = *static_cast<const ICMPHeader*>(ipv4_packet.payload());
 #ifdef ICMP_DEBUG
@@ -263,7 +289,7 @@ void handle_icmp(const EthernetFrameHeader& eth, const IPv4Packet& ipv4_packet,
             LOCKER(socket->lock());
             if (socket->protocol() != (unsigned)IPv4Protocol::ICMP)
                 continue;
-            socket->did_receive(ipv4_packet.source(), 0, KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()), packet_timestamp);
+            socket->did_receive(ipv4_packet.source(), 0, packet_buffer, raw_ipv4_packet(ipv4_packet));
         }
     }
 
@@ -294,7 +320,7 @@ void handle_icmp(const EthernetFrameHeader& eth, const IPv4Packet& ipv4_packet,
     }
 }
 
-void handle_udp(const IPv4Packet& ipv4_packet, const timeval& packet_timestamp)
+void handle_udp(const IPv4Packet& ipv4_packet, PacketBuffer& packet_buffer)
 {
     if (ipv4_packet.payload_size() < sizeof(UDPPacket)) {
         klog() << "handle_udp: Packet too small (" << ipv4_packet.payload_size() << ", need " << sizeof(UDPPacket) << ")";
@@ -320,10 +346,10 @@ void handle_udp(const IPv4Packet& ipv4_packet, const timeval& packet_timestamp)
 
     ASSERT(socket->type() == SOCK_DGRAM);
     ASSERT(socket->local_port() == udp_packet.destination_port());
-    socket->did_receive(ipv4_packet.source(), udp_packet.source_port(), KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()), packet_timestamp);
+    socket->did_receive(ipv4_packet.source(), udp_packet.source_port(), packet_buffer, raw_ipv4_packet(ipv4_packet));
 }
 
-void handle_tcp(const IPv4Packet& ipv4_packet, const timeval& packet_timestamp)
+void handle_tcp(const IPv4Packet& ipv4_packet, PacketBuffer& packet_buffer)
 {
     if (ipv4_packet.payload_size() < sizeof(TCPPacket)) {
         klog() << "handle_tcp: IPv4 payload is too small to be a TCP packet (" << ipv4_packet.payload_size() << ", need " << sizeof(TCPPacket) << ")";
@@ -343,6 +369,11 @@ void handle_tcp(const IPv4Packet& ipv4_packet, const timeval& packet_timestamp)
         return;
     }
 
+    if (!packet_buffer.is_transport_checksum_verified() && !TCPSocket::is_tcp_checksum_valid(ipv4_packet.source(), ipv4_packet.destination(), tcp_packet, ipv4_packet.payload_size())) {
+        dbgln("handle_tcp: Dropping packet with bad checksum from {}:{}", ipv4_packet.source().to_string(), tcp_packet.source_port());
+        return;
+    }
+
     size_t payload_size = ipv4_packet.payload_size() - tcp_packet.header_size();
 
 #ifdef TCP_DEBUG
@@ -434,6 +465,7 @@ void handle_tcp(const IPv4Packet& ipv4_packet, const timeval& packet_timestamp)
 #endif
             client->set_sequence_number(1000);
             client->set_ack_number(tcp_packet.sequence_number() + payload_size + 1);
+            client->process_syn_options(tcp_packet);
             [[maybe_unused]] auto rc2 = client->send_tcp_packet(TCPFlags::SYN | TCPFlags::ACK);
             client->set_state(TCPSocket::State::SynReceived);
             return;
@@ -582,7 +614,7 @@ void handle_tcp(const IPv4Packet& ipv4_packet, const timeval& packet_timestamp)
     case TCPSocket::State::Established:
         if (tcp_packet.has_fin()) {
             if (payload_size != 0)
-                socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()), packet_timestamp);
+                socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), packet_buffer, raw_ipv4_packet(ipv4_packet));
 
             socket->set_ack_number(tcp_packet.sequence_number() + payload_size + 1);
             unused_rc = socket->send_tcp_packet(TCPFlags::ACK);
@@ -591,16 +623,8 @@ void handle_tcp(const IPv4Packet& ipv4_packet, const timeval& packet_timestamp)
             return;
         }
 
-        socket->set_ack_number(tcp_packet.sequence_number() + payload_size);
-
-#ifdef TCP_DEBUG
-        klog() << "Got packet with ack_no=" << tcp_packet.ack_number() << ", seq_no=" << tcp_packet.sequence_number() << ", payload_size=" << payload_size << ", acking it with new ack_no=" << socket->ack_number() << ", seq_no=" << socket->sequence_number();
-#endif
-
-        if (payload_size) {
-            if (socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()), packet_timestamp))
-                unused_rc = socket->send_tcp_packet(TCPFlags::ACK);
-        }
+        if (payload_size)
+            socket->receive_segment(packet_buffer, ipv4_packet, tcp_packet, payload_size);
     }
 }
 
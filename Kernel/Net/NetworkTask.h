@@ -30,5 +30,8 @@ namespace Kernel {
 class NetworkTask {
 public:
     static void spawn();
+
+    // Wakes up the NetworkTask, so it can take care of expired TCP retransmission timers.
+    static void wake();
 };
 }
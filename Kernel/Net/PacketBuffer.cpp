@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Kernel/Heap/kmalloc.h>
+#include <Kernel/StdLib.h>
+#include <Kernel/Net/PacketBuffer.h>
+#include <Kernel/VM/MemoryManager.h>
+
+namespace Kernel {
+
+RefPtr<PacketBuffer> PacketBuffer::try_create_unpooled(size_t capacity)
+{
+    auto* data = (u8*)kmalloc(capacity);
+    if (!data)
+        return nullptr;
+    return adopt(*new PacketBuffer(nullptr, data, capacity));
+}
+
+RefPtr<PacketBuffer> PacketBuffer::try_create_unpooled_copy(ReadonlyBytes bytes, const timeval& timestamp)
+{
+    auto buffer = try_create_unpooled(bytes.size());
+    if (!buffer)
+        return nullptr;
+    memcpy(buffer->data(), bytes.data(), bytes.size());
+    buffer->set_size(bytes.size());
+    buffer->set_timestamp(timestamp);
+    return buffer;
+}
+
+PacketBuffer::PacketBuffer(PacketBufferPool* pool, u8* data, size_t capacity)
+    : m_pool(pool)
+    , m_data(data)
+    , m_capacity(capacity)
+{
+}
+
+PacketBuffer::~PacketBuffer()
+{
+    if (m_pool)
+        m_pool->release(m_data);
+    else
+        kfree(m_data);
+}
+
+bool PacketBuffer::is_pool_running_low() const
+{
+    return m_pool && m_pool->free_buffer_count() < m_pool->buffer_count() / 4;
+}
+
+PhysicalAddress PacketBuffer::physical_address() const
+{
+    ASSERT(m_pool);
+    return m_pool->physical_address_of(m_data);
+}
+
+RefPtr<PacketBufferPool> PacketBufferPool::try_create(const StringView& name, size_t buffer_size, size_t buffer_count, Contiguous contiguous)
+{
+    ASSERT(buffer_size >= sizeof(FreeBuffer));
+    buffer_size = round_up_to_power_of_two(buffer_size, 16);
+    size_t region_size = PAGE_ROUND_UP(buffer_size * buffer_count);
+    OwnPtr<Region> region;
+    if (contiguous == Contiguous::Yes)
+        region = MM.allocate_contiguous_kernel_region(region_size, name, Region::Access::Read | Region::Access::Write);
+    else
+        region = MM.allocate_kernel_region(region_size, name, Region::Access::Read | Region::Access::Write, false, AllocationStrategy::AllocateNow);
+    if (!region)
+        return nullptr;
+    return adopt(*new PacketBufferPool(region.release_nonnull(), buffer_size, buffer_count, contiguous));
+}
+
+PacketBufferPool::PacketBufferPool(NonnullOwnPtr<Region>&& region, size_t buffer_size, size_t buffer_count, Contiguous contiguous)
+    : m_region(move(region))
+    , m_buffer_size(buffer_size)
+    , m_buffer_count(buffer_count)
+    , m_contiguous(contiguous)
+{
+    for (size_t i = buffer_count; i > 0; --i)
+        release(m_region->vaddr().offset((i - 1) * buffer_size).as_ptr());
+}
+
+RefPtr<PacketBuffer> PacketBufferPool::try_take()
+{
+    u8* data;
+    {
+        ScopedSpinLock lock(m_lock);
+        if (!m_free_buffers)
+            return nullptr;
+        data = (u8*)m_free_buffers;
+        m_free_buffers = m_free_buffers->next;
+        --m_free_buffer_count;
+    }
+    return adopt(*new PacketBuffer(this, data, m_buffer_size));
+}
+
+void PacketBufferPool::release(u8* data)
+{
+    ASSERT(data >= m_region->vaddr().as_ptr() && data < m_region->vaddr().offset(m_buffer_size * m_buffer_count).as_ptr());
+    auto* buffer = (FreeBuffer*)data;
+    ScopedSpinLock lock(m_lock);
+    buffer->next = m_free_buffers;
+    m_free_buffers = buffer;
+    ++m_free_buffer_count;
+}
+
+PhysicalAddress PacketBufferPool::physical_address_of(const u8* data) const
+{
+    ASSERT(is_physically_contiguous());
+    return m_region->physical_page(0)->paddr().offset(data - m_region->vaddr().as_ptr());
+}
+
+}
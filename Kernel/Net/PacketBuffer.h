@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// PacketBuffer: A reference-counted network packet, along the lines of BSD's mbuf.
+//
+// Network adapters receive frames straight into PacketBuffers, and the network stack passes
+// them on by reference, all the way to the receive queue of a socket. The buffers usually come
+// from the adapter's PacketBufferPool, and go back to it once the last reference is gone.
+// If the pool runs dry, a PacketBuffer can also be backed by kmalloc() memory.
+
+#include <AK/Assertions.h>
+#include <AK/OwnPtr.h>
+#include <AK/RefCounted.h>
+#include <AK/RefPtr.h>
+#include <AK/Span.h>
+#include <AK/StringView.h>
+#include <Kernel/PhysicalAddress.h>
+#include <Kernel/SpinLock.h>
+#include <Kernel/UnixTypes.h>
+#include <Kernel/VM/Region.h>
+
+namespace Kernel {
+
+class PacketBufferPool;
+
+class PacketBuffer : public RefCounted<PacketBuffer> {
+    friend class PacketBufferPool;
+
+public:
+    static RefPtr<PacketBuffer> try_create_unpooled(size_t capacity);
+    static RefPtr<PacketBuffer> try_create_unpooled_copy(ReadonlyBytes, const timeval& timestamp);
+    ~PacketBuffer();
+
+    u8* data() { return m_data; }
+    const u8* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_capacity; }
+    ReadonlyBytes bytes() const { return { m_data, m_size }; }
+
+    void set_size(size_t size)
+    {
+        ASSERT(size <= m_capacity);
+        m_size = size;
+    }
+
+    const timeval& timestamp() const { return m_timestamp; }
+    void set_timestamp(const timeval& timestamp) { m_timestamp = timestamp; }
+
+    // Set when the adapter already checked the TCP/UDP checksum, so we don't have to.
+    bool is_transport_checksum_verified() const { return m_transport_checksum_verified; }
+    void set_transport_checksum_verified(bool verified) { m_transport_checksum_verified = verified; }
+
+    // Only valid for buffers from a physically contiguous pool, for handing them to a device.
+    PhysicalAddress physical_address() const;
+    bool is_pooled() const { return m_pool; }
+
+    // Whoever holds on to a received packet for a while (like a socket's receive queue) should
+    // keep a copy instead once this returns true, so the adapter doesn't run out of buffers.
+    bool is_pool_running_low() const;
+
+private:
+    PacketBuffer(PacketBufferPool*, u8* data, size_t capacity);
+
+    RefPtr<PacketBufferPool> m_pool;
+    u8* m_data { nullptr };
+    size_t m_capacity { 0 };
+    size_t m_size { 0 };
+    timeval m_timestamp {};
+    bool m_transport_checksum_verified { false };
+};
+
+class PacketBufferPool : public RefCounted<PacketBufferPool> {
+    friend class PacketBuffer;
+
+public:
+    enum class Contiguous {
+        No,
+        Yes,
+    };
+
+    static RefPtr<PacketBufferPool> try_create(const StringView& name, size_t buffer_size, size_t buffer_count, Contiguous = Contiguous::No);
+
+    // Returns nullptr if all buffers are in use.
+    RefPtr<PacketBuffer> try_take();
+
+    size_t buffer_size() const { return m_buffer_size; }
+    size_t buffer_count() const { return m_buffer_count; }
+    size_t free_buffer_count() const { return m_free_buffer_count; }
+    bool is_physically_contiguous() const { return m_contiguous == Contiguous::Yes; }
+
+private:
+    PacketBufferPool(NonnullOwnPtr<Region>&&, size_t buffer_size, size_t buffer_count, Contiguous);
+
+    void release(u8* data);
+    PhysicalAddress physical_address_of(const u8* data) const;
+
+    // Free buffers are linked together through their first bytes.
+    struct FreeBuffer {
+        FreeBuffer* next;
+    };
+
+    NonnullOwnPtr<Region> m_region;
+    size_t m_buffer_size { 0 };
+    size_t m_buffer_count { 0 };
+    Contiguous m_contiguous { Contiguous::No };
+
+    mutable SpinLock<u8> m_lock;
+    FreeBuffer* m_free_buffers { nullptr };
+    size_t m_free_buffer_count { 0 };
+};
+
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/HashFunctions.h>
+#include <AK/HashMap.h>
+#include <AK/Traits.h>
+#include <Kernel/Lock.h>
+
+namespace Kernel {
+
+// A hash table that is split into independently locked buckets, so that lookups
+// and updates of unrelated keys don't contend on a single lock.
+template<typename Key, typename Value, size_t bucket_count = 64>
+class SocketTable {
+public:
+    using Bucket = Lockable<HashMap<Key, Value>>;
+
+    Bucket& bucket_for(const Key& key)
+    {
+        // The HashMap inside a bucket uses the same hash, so mix it up a bit to keep
+        // all the keys in one bucket from landing in the same slots there as well.
+        return m_buckets[int_hash(Traits<Key>::hash(key)) % bucket_count];
+    }
+
+    template<typename Callback>
+    void for_each(Callback callback)
+    {
+        for (auto& bucket : m_buckets) {
+            LOCKER(bucket.lock(), Lock::Mode::Shared);
+            for (auto& it : bucket.resource())
+                callback(it.key, it.value);
+        }
+    }
+
+    // Returns false if there already was an entry for the key.
+    bool try_set(const Key& key, Value value)
+    {
+        auto& bucket = bucket_for(key);
+        LOCKER(bucket.lock());
+        if (bucket.resource().contains(key))
+            return false;
+        bucket.resource().set(key, move(value));
+        return true;
+    }
+
+    void set(const Key& key, Value value)
+    {
+        auto& bucket = bucket_for(key);
+        LOCKER(bucket.lock());
+        bucket.resource().set(key, move(value));
+    }
+
+    void remove(const Key& key)
+    {
+        auto& bucket = bucket_for(key);
+        LOCKER(bucket.lock());
+        bucket.resource().remove(key);
+    }
+
+private:
+    Bucket m_buckets[bucket_count];
+};
+
+}
@@ -26,6 +26,7 @@
 
 #pragma once
 
+#include <AK/Span.h>
 #include <Kernel/Net/IPv4.h>
 
 namespace Kernel {
@@ -41,6 +42,29 @@ struct TCPFlags {
     };
 };
 
+enum class TCPOptionKind : u8 {
+    End = 0,
+    NoOperation = 1,
+    MaximumSegmentSize = 2,
+    WindowScale = 3,
+    SACKPermitted = 4,
+    SACK = 5,
+};
+
+// RFC 7323: The largest window scale shift we can use.
+static constexpr u8 tcp_max_window_scale = 14;
+
+// Sequence numbers wrap around, so they have to be compared modulo 2^32.
+inline bool tcp_sequence_less_than(u32 a, u32 b)
+{
+    return (i32)(a - b) < 0;
+}
+
+inline bool tcp_sequence_less_than_or_equal(u32 a, u32 b)
+{
+    return (i32)(a - b) <= 0;
+}
+
 class [[gnu::packed]] TCPPacket {
 public:
     TCPPacket() = default;
@@ -80,6 +104,31 @@ public:
     u16 urgent() const { return m_urgent; }
     void set_urgent(u16 urgent) { m_urgent = urgent; }
 
+    // Calls the callback with the kind and the data of every option in the header.
+    // Parsing stops at the first malformed option.
+    template<typename Callback>
+    void for_each_option(Callback callback) const
+    {
+        auto* options = (const u8*)this + sizeof(TCPPacket);
+        size_t options_size = header_size() > sizeof(TCPPacket) ? header_size() - sizeof(TCPPacket) : 0;
+        for (size_t i = 0; i < options_size;) {
+            auto kind = (TCPOptionKind)options[i];
+            if (kind == TCPOptionKind::End)
+                return;
+            if (kind == TCPOptionKind::NoOperation) {
+                ++i;
+                continue;
+            }
+            if (i + 1 >= options_size)
+                return;
+            u8 length = options[i + 1];
+            if (length < 2 || i + length > options_size)
+                return;
+            callback(kind, ReadonlyBytes { options + i + 2, (size_t)length - 2 });
+            i += length;
+        }
+    }
+
     const void* payload() const { return ((const u8*)this) + header_size(); }
     void* payload() { return ((u8*)this) + header_size(); }
 
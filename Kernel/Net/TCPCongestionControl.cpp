@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/Assertions.h>
+#include <AK/NumericLimits.h>
+#include <AK/StdLibExtras.h>
+#include <Kernel/Net/TCP.h>
+#include <Kernel/Net/TCPCongestionControl.h>
+#include <Kernel/Time/TimeManagement.h>
+
+//#define TCP_CONGESTION_DEBUG
+
+namespace Kernel {
+
+// CUBIC's multiplicative decrease factor (beta) is 0.7 and its scaling constant (C) is 0.4.
+// Since we can't use floating point in the kernel, these show up as fractions below.
+// We also clamp the time in the cubic function, so it can't overflow.
+static constexpr u64 cubic_limit_ms = 60000;
+
+static u64 cube_root(u64 value)
+{
+    // Bitwise integer cube root, from Hacker's Delight.
+    u64 root = 0;
+    for (int shift = 63; shift >= 0; shift -= 3) {
+        root += root;
+        u64 b = 3 * root * (root + 1) + 1;
+        if ((value >> shift) >= b) {
+            value -= b << shift;
+            ++root;
+        }
+    }
+    return root;
+}
+
+TCPCongestionControl::TCPCongestionControl(Algorithm algorithm)
+    : m_algorithm(algorithm)
+    , m_slow_start_threshold(NumericLimits<size_t>::max())
+{
+    set_maximum_segment_size(m_maximum_segment_size);
+}
+
+void TCPCongestionControl::set_maximum_segment_size(size_t maximum_segment_size)
+{
+    ASSERT(maximum_segment_size);
+    bool is_initial_window = m_congestion_window == 0 || m_congestion_window == min(4 * m_maximum_segment_size, max(2 * m_maximum_segment_size, (size_t)4380));
+    m_maximum_segment_size = maximum_segment_size;
+    // RFC 3390: The initial window is up to four segments.
+    if (is_initial_window)
+        m_congestion_window = min(4 * m_maximum_segment_size, max(2 * m_maximum_segment_size, (size_t)4380));
+}
+
+bool TCPCongestionControl::did_receive_ack(size_t bytes_acknowledged, u32 ack_number)
+{
+    m_duplicate_ack_count = 0;
+
+    if (m_in_fast_recovery) {
+        if (tcp_sequence_less_than(ack_number, m_recovery_point)) {
+            // RFC 6582, 3.2 step 5: Partial acknowledgement. Deflate the window by the amount of new data
+            // acknowledged, add back one segment if that was at least a segment, and retransmit.
+            if (bytes_acknowledged >= m_congestion_window)
+                m_congestion_window = m_maximum_segment_size;
+            else
+                m_congestion_window -= bytes_acknowledged;
+            if (bytes_acknowledged >= m_maximum_segment_size)
+                m_congestion_window += m_maximum_segment_size;
+            return true;
+        }
+
+        // Full acknowledgement, we're done recovering.
+        m_in_fast_recovery = false;
+        m_congestion_window = m_slow_start_threshold;
+#ifdef TCP_CONGESTION_DEBUG
+        dbgln("TCPCongestionControl: Leaving fast recovery, cwnd={}", m_congestion_window);
+#endif
+        return false;
+    }
+
+    if (m_congestion_window < m_slow_start_threshold) {
+        m_congestion_window += min(bytes_acknowledged, m_maximum_segment_size);
+        return false;
+    }
+
+    grow_in_congestion_avoidance(bytes_acknowledged);
+    return false;
+}
+
+bool TCPCongestionControl::did_receive_duplicate_ack(size_t bytes_in_flight, u32 highest_sequence_number_sent)
+{
+    if (m_in_fast_recovery) {
+        // Every duplicate ACK means another segment has left the network.
+        m_congestion_window += m_maximum_segment_size;
+        return false;
+    }
+
+    if (++m_duplicate_ack_count < 3)
+        return false;
+
+    m_slow_start_threshold = window_after_loss(bytes_in_flight);
+    m_congestion_window = m_slow_start_threshold + 3 * m_maximum_segment_size;
+    m_recovery_point = highest_sequence_number_sent;
+    m_in_fast_recovery = true;
+#ifdef TCP_CONGESTION_DEBUG
+    dbgln("TCPCongestionControl: Entering fast recovery, ssthresh={}, recovery_point={}", m_slow_start_threshold, m_recovery_point);
+#endif
+    return true;
+}
+
+void TCPCongestionControl::did_time_out(size_t bytes_in_flight)
+{
+    m_slow_start_threshold = window_after_loss(bytes_in_flight);
+    m_congestion_window = m_maximum_segment_size;
+    m_duplicate_ack_count = 0;
+    m_in_fast_recovery = false;
+#ifdef TCP_CONGESTION_DEBUG
+    dbgln("TCPCongestionControl: Retransmission timeout, ssthresh={}", m_slow_start_threshold);
+#endif
+}
+
+size_t TCPCongestionControl::window_after_loss(size_t bytes_in_flight)
+{
+    if (m_algorithm == Algorithm::NewReno)
+        return max(bytes_in_flight / 2, 2 * m_maximum_segment_size);
+
+    // Fast convergence: If we lost a packet before reaching the last maximum,
+    // release some bandwidth for newer flows.
+    size_t window = m_congestion_window;
+    if (window < m_last_max_window)
+        m_max_window = window * 17 / 20;
+    else
+        m_max_window = window;
+    m_last_max_window = window;
+    m_epoch_start_ms = 0;
+    return max(window * 7 / 10, 2 * m_maximum_segment_size);
+}
+
+size_t TCPCongestionControl::cubic_target_window(u64 now_ms)
+{
+    if (!m_epoch_start_ms) {
+        m_epoch_start_ms = max(now_ms, (u64)1);
+        if (m_congestion_window < m_max_window) {
+            // K = cbrt((W_max - cwnd) / C), in seconds with windows in segments.
+            u64 missing_window = m_max_window - m_congestion_window;
+            m_time_to_origin_ms = cube_root(missing_window * 2500000000ull / m_maximum_segment_size);
+            m_origin_window = m_max_window;
+        } else {
+            m_time_to_origin_ms = 0;
+            m_origin_window = m_congestion_window;
+        }
+        m_tcp_friendly_window = m_congestion_window;
+    }
+
+    i64 delta_ms = (i64)(now_ms - m_epoch_start_ms) - (i64)m_time_to_origin_ms;
+    delta_ms = clamp(delta_ms, -(i64)cubic_limit_ms, (i64)cubic_limit_ms);
+
+    // W_cubic(t) = C * (t - K)^3 + W_max
+    i64 offset = (delta_ms * delta_ms * delta_ms / 1000) * 4 * (i64)m_maximum_segment_size / 10000000;
+    i64 target = (i64)m_origin_window + offset;
+    if (target < (i64)m_maximum_segment_size)
+        return m_maximum_segment_size;
+    if (target > (i64)NumericLimits<size_t>::max())
+        return NumericLimits<size_t>::max();
+    return (size_t)target;
+}
+
+void TCPCongestionControl::grow_in_congestion_avoidance(size_t bytes_acknowledged)
+{
+    if (m_algorithm == Algorithm::NewReno) {
+        // RFC 5681: Grow by about one segment per round-trip time.
+        m_congestion_window += max((u64)1, (u64)m_maximum_segment_size * bytes_acknowledged / m_congestion_window);
+        return;
+    }
+
+    size_t target = cubic_target_window(TimeManagement::the().uptime_ms());
+
+    // The TCP-friendly region: Don't grow slower than NewReno would with CUBIC's beta,
+    // which is about 3 * (1 - beta) / (1 + beta) = 9/17 segments per round-trip time.
+    m_tcp_friendly_window += max((u64)1, (u64)9 * m_maximum_segment_size * bytes_acknowledged / (17 * (u64)m_tcp_friendly_window));
+    target = max(target, m_tcp_friendly_window);
+
+    // Don't grow by more than half the window per round-trip time.
+    target = min(target, m_congestion_window + m_congestion_window / 2);
+
+    if (target > m_congestion_window)
+        m_congestion_window += max((u64)1, (u64)(target - m_congestion_window) * bytes_acknowledged / m_congestion_window);
+    else
+        m_congestion_window += max((u64)1, (u64)m_maximum_segment_size * bytes_acknowledged / (100 * (u64)m_congestion_window));
+}
+
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/Types.h>
+
+namespace Kernel {
+
+// Send-side congestion control for a TCPSocket. All windows are in bytes.
+// NewReno is implemented as per RFC 5681 and RFC 6582, CUBIC as per RFC 8312.
+// CUBIC uses NewReno's slow start and fast recovery, and only changes how the
+// window grows in congestion avoidance and how much it shrinks on loss.
+class TCPCongestionControl {
+public:
+    enum class Algorithm {
+        NewReno,
+        Cubic,
+    };
+
+    static const char* to_string(Algorithm algorithm)
+    {
+        switch (algorithm) {
+        case Algorithm::NewReno:
+            return "NewReno";
+        case Algorithm::Cubic:
+            return "CUBIC";
+        default:
+            return "None";
+        }
+    }
+
+    explicit TCPCongestionControl(Algorithm = Algorithm::Cubic);
+
+    Algorithm algorithm() const { return m_algorithm; }
+
+    size_t congestion_window() const { return m_congestion_window; }
+    size_t slow_start_threshold() const { return m_slow_start_threshold; }
+    bool is_in_fast_recovery() const { return m_in_fast_recovery; }
+
+    void set_maximum_segment_size(size_t);
+
+    // Called for every ACK that acknowledges new data. Returns true if the ACK was a partial
+    // acknowledgement during fast recovery, in which case the first unacknowledged segment
+    // should be retransmitted right away.
+    [[nodiscard]] bool did_receive_ack(size_t bytes_acknowledged, u32 ack_number);
+
+    // Returns true when the caller should do a fast retransmit of the first unacknowledged segment.
+    [[nodiscard]] bool did_receive_duplicate_ack(size_t bytes_in_flight, u32 highest_sequence_number_sent);
+
+    void did_time_out(size_t bytes_in_flight);
+
+private:
+    size_t window_after_loss(size_t bytes_in_flight);
+    void grow_in_congestion_avoidance(size_t bytes_acknowledged);
+    size_t cubic_target_window(u64 now_ms);
+
+    Algorithm m_algorithm { Algorithm::Cubic };
+    size_t m_maximum_segment_size { 536 };
+    size_t m_congestion_window { 0 };
+    size_t m_slow_start_threshold { 0 };
+
+    size_t m_duplicate_ack_count { 0 };
+    bool m_in_fast_recovery { false };
+    u32 m_recovery_point { 0 };
+
+    // CUBIC state. A zero m_epoch_start_ms means that no congestion avoidance epoch has started yet.
+    u64 m_epoch_start_ms { 0 };
+    u64 m_time_to_origin_ms { 0 };
+    size_t m_origin_window { 0 };
+    size_t m_max_window { 0 };
+    size_t m_last_max_window { 0 };
+    size_t m_tcp_friendly_window { 0 };
+};
+
+}
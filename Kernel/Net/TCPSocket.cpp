@@ -29,21 +29,37 @@
 #include <Kernel/Devices/RandomDevice.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/Net/NetworkAdapter.h>
+#include <Kernel/Net/NetworkTask.h>
 #include <Kernel/Net/Routing.h>
 #include <Kernel/Net/TCP.h>
 #include <Kernel/Net/TCPSocket.h>
 #include <Kernel/Process.h>
 #include <Kernel/Random.h>
+#include <Kernel/TimerQueue.h>
 
 //#define TCP_SOCKET_DEBUG
 
 namespace Kernel {
 
+// RFC 1122: If the peer doesn't tell us its MSS, we have to assume 536 bytes.
+static constexpr size_t default_maximum_segment_size = 536;
+static constexpr size_t minimum_maximum_segment_size = 64;
+// Larger segments don't buy us anything, even on loopback.
+static constexpr size_t maximum_segment_size_limit = 16 * KiB;
+// How much data we keep around that hasn't been acknowledged yet.
+static constexpr size_t send_buffer_size = 256 * KiB;
+// RFC 6298 recommends a minimum RTO of one second. Like most other stacks, we go lower than that.
+static constexpr u32 initial_retransmission_timeout_ms = 1000;
+static constexpr u32 minimum_retransmission_timeout_ms = 200;
+static constexpr u32 maximum_retransmission_timeout_ms = 60000;
+// How many segments that arrived after a gap we hold on to.
+static constexpr size_t max_out_of_order_segments = 64;
+
 void TCPSocket::for_each(Function<void(const TCPSocket&)> callback)
 {
-    LOCKER(sockets_by_tuple().lock(), Lock::Mode::Shared);
-    for (auto& it : sockets_by_tuple().resource())
-        callback(*it.value);
+    sockets_by_tuple().for_each([&](auto&, auto* socket) {
+        callback(*socket);
+    });
 }
 
 void TCPSocket::set_state(State new_state)
@@ -60,48 +76,46 @@ void TCPSocket::set_state(State new_state)
     if (new_state == State::Established && m_direction == Direction::Outgoing)
         m_role = Role::Connected;
 
-    if (new_state == State::Closed) {
-        LOCKER(closing_sockets().lock());
-        closing_sockets().resource().remove(tuple());
-    }
+    if (new_state == State::Closed)
+        closing_sockets().remove(tuple());
 
     if (previous_role != m_role || was_disconnected != protocol_is_disconnected())
         evaluate_block_conditions();
 }
 
-static AK::Singleton<Lockable<HashMap<IPv4SocketTuple, RefPtr<TCPSocket>>>> s_socket_closing;
+static AK::Singleton<SocketTable<IPv4SocketTuple, RefPtr<TCPSocket>>> s_socket_closing;
 
-Lockable<HashMap<IPv4SocketTuple, RefPtr<TCPSocket>>>& TCPSocket::closing_sockets()
+SocketTable<IPv4SocketTuple, RefPtr<TCPSocket>>& TCPSocket::closing_sockets()
 {
     return *s_socket_closing;
 }
 
-static AK::Singleton<Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>> s_socket_tuples;
+static AK::Singleton<SocketTable<IPv4SocketTuple, TCPSocket*>> s_socket_tuples;
 
-Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>& TCPSocket::sockets_by_tuple()
+SocketTable<IPv4SocketTuple, TCPSocket*>& TCPSocket::sockets_by_tuple()
 {
     return *s_socket_tuples;
 }
 
-RefPtr<TCPSocket> TCPSocket::from_tuple(const IPv4SocketTuple& tuple)
+static RefPtr<TCPSocket> lookup_tuple(const IPv4SocketTuple& tuple)
 {
-    LOCKER(sockets_by_tuple().lock(), Lock::Mode::Shared);
-
-    auto exact_match = sockets_by_tuple().resource().get(tuple);
-    if (exact_match.has_value())
-        return { *exact_match.value() };
+    auto& bucket = TCPSocket::sockets_by_tuple().bucket_for(tuple);
+    LOCKER(bucket.lock(), Lock::Mode::Shared);
+    auto match = bucket.resource().get(tuple);
+    if (!match.has_value())
+        return {};
+    return { *match.value() };
+}
 
-    auto address_tuple = IPv4SocketTuple(tuple.local_address(), tuple.local_port(), IPv4Address(), 0);
-    auto address_match = sockets_by_tuple().resource().get(address_tuple);
-    if (address_match.has_value())
-        return { *address_match.value() };
+RefPtr<TCPSocket> TCPSocket::from_tuple(const IPv4SocketTuple& tuple)
+{
+    if (auto exact_match = lookup_tuple(tuple))
+        return exact_match;
 
-    auto wildcard_tuple = IPv4SocketTuple(IPv4Address(), tuple.local_port(), IPv4Address(), 0);
-    auto wildcard_match = sockets_by_tuple().resource().get(wildcard_tuple);
-    if (wildcard_match.has_value())
-        return { *wildcard_match.value() };
+    if (auto address_match = lookup_tuple(IPv4SocketTuple(tuple.local_address(), tuple.local_port(), IPv4Address(), 0)))
+        return address_match;
 
-    return {};
+    return lookup_tuple(IPv4SocketTuple(IPv4Address(), tuple.local_port(), IPv4Address(), 0));
 }
 
 RefPtr<TCPSocket> TCPSocket::from_endpoints(const IPv4Address& local_address, u16 local_port, const IPv4Address& peer_address, u16 peer_port)
@@ -113,8 +127,9 @@ RefPtr<TCPSocket> TCPSocket::create_client(const IPv4Address& new_local_address,
 {
     auto tuple = IPv4SocketTuple(new_local_address, new_local_port, new_peer_address, new_peer_port);
 
-    LOCKER(sockets_by_tuple().lock());
-    if (sockets_by_tuple().resource().contains(tuple))
+    auto& bucket = sockets_by_tuple().bucket_for(tuple);
+    LOCKER(bucket.lock());
+    if (bucket.resource().contains(tuple))
         return {};
 
     auto client = TCPSocket::create(protocol());
@@ -128,7 +143,7 @@ RefPtr<TCPSocket> TCPSocket::create_client(const IPv4Address& new_local_address,
     client->set_originator(*this);
 
     m_pending_release_for_accept.set(tuple, client);
-    sockets_by_tuple().resource().set(tuple, client);
+    bucket.resource().set(tuple, client);
 
     return from_tuple(tuple);
 }
@@ -149,13 +164,16 @@ void TCPSocket::release_for_accept(RefPtr<TCPSocket> socket)
 
 TCPSocket::TCPSocket(int protocol)
     : IPv4Socket(SOCK_STREAM, protocol)
+    , m_retransmission_timeout_ms(initial_retransmission_timeout_ms)
 {
 }
 
 TCPSocket::~TCPSocket()
 {
-    LOCKER(sockets_by_tuple().lock());
-    sockets_by_tuple().resource().remove(tuple());
+    if (m_retransmit_timer)
+        TimerQueue::the().cancel_timer(m_retransmit_timer.release_nonnull());
+
+    sockets_by_tuple().remove(tuple());
 
 #ifdef TCP_SOCKET_DEBUG
     dbg() << "~TCPSocket in state " << to_string(state());
@@ -167,41 +185,130 @@ NonnullRefPtr<TCPSocket> TCPSocket::create(int protocol)
     return adopt(*new TCPSocket(protocol));
 }
 
-KResultOr<size_t> TCPSocket::protocol_receive(ReadonlyBytes raw_ipv4_packet, UserOrKernelBuffer& buffer, size_t buffer_size, [[maybe_unused]] int flags)
+ReadonlyBytes TCPSocket::protocol_payload(ReadonlyBytes raw_ipv4_packet) const
 {
     auto& ipv4_packet = *reinterpret_cast<const IPv4Packet*>(raw_ipv4_packet.data());
     auto& tcp_packet = *static_cast<const TCPPacket*>(ipv4_packet.payload());
     size_t payload_size = raw_ipv4_packet.size() - sizeof(IPv4Packet) - tcp_packet.header_size();
 #ifdef TCP_SOCKET_DEBUG
-    klog() << "payload_size " << payload_size << ", will it fit in " << buffer_size << "?";
+    klog() << "payload_size " << payload_size;
 #endif
-    ASSERT(buffer_size >= payload_size);
-    if (!buffer.write(tcp_packet.payload(), payload_size))
-        return KResult(-EFAULT);
-    return payload_size;
+    return { (const u8*)tcp_packet.payload(), payload_size };
 }
 
 KResultOr<size_t> TCPSocket::protocol_send(const UserOrKernelBuffer& data, size_t data_length)
 {
-    int err = send_tcp_packet(TCPFlags::PUSH | TCPFlags::ACK, &data, data_length);
-    if (err < 0)
-        return KResult(err);
+    size_t space = send_buffer_space();
+    if (!space)
+        return KResult(-EAGAIN);
+    data_length = min(data_length, space);
+
+    for (size_t offset = 0; offset < data_length; offset += m_send_maximum_segment_size) {
+        auto segment = data.offset(offset);
+        int err = send_tcp_packet(TCPFlags::PUSH | TCPFlags::ACK, &segment, min(m_send_maximum_segment_size, data_length - offset));
+        if (err < 0) {
+            if (offset)
+                return offset;
+            return KResult(err);
+        }
+    }
     return data_length;
 }
 
+bool TCPSocket::can_write(const FileDescription& description, size_t size) const
+{
+    return IPv4Socket::can_write(description, size) && send_buffer_space() > 0;
+}
+
+size_t TCPSocket::send_buffer_space() const
+{
+    size_t queued = m_sequence_number - m_send_unacknowledged;
+    if (queued >= send_buffer_size)
+        return 0;
+    return send_buffer_size - queued;
+}
+
+u16 TCPSocket::our_maximum_segment_size() const
+{
+    size_t mtu = 576;
+    auto routing_decision = route_to(peer_address(), local_address(), bound_interface());
+    if (!routing_decision.is_zero())
+        mtu = routing_decision.adapter->mtu();
+    return min(mtu - sizeof(IPv4Packet) - sizeof(TCPPacket), maximum_segment_size_limit);
+}
+
+u8 TCPSocket::receive_window_scale() const
+{
+    // Use the smallest shift that lets us advertise the whole receive buffer.
+    u8 shift = 0;
+    while (shift < tcp_max_window_scale && ((size_t)NumericLimits<u16>::max() << shift) < receive_buffer_capacity())
+        ++shift;
+    return shift;
+}
+
+u16 TCPSocket::advertised_window_size(bool is_syn)
+{
+    // RFC 7323: The window in a SYN segment is never scaled.
+    u8 shift = (is_syn || !m_window_scaling_enabled) ? 0 : receive_window_scale();
+    size_t window = min(receive_buffer_space() >> shift, (size_t)NumericLimits<u16>::max());
+    m_last_advertised_window = window << shift;
+    return window;
+}
+
+void TCPSocket::protocol_did_consume_receive_buffer()
+{
+    if (state() != State::Established)
+        return;
+    // Let the peer know once the window has opened up by a reasonable amount,
+    // but don't bother it with lots of tiny updates (RFC 1122, 4.2.3.3).
+    size_t threshold = min(receive_buffer_capacity() / 2, (size_t)our_maximum_segment_size());
+    if (receive_buffer_space() < m_last_advertised_window + threshold)
+        return;
+    [[maybe_unused]] auto rc = send_tcp_packet(TCPFlags::ACK);
+}
+
 int TCPSocket::send_tcp_packet(u16 flags, const UserOrKernelBuffer* payload, size_t payload_size)
 {
-    const size_t buffer_size = sizeof(TCPPacket) + payload_size;
+    // SYN segments carry our MSS, and maybe window scale and SACK-permitted options.
+    // Other segments may carry SACK blocks for the out-of-order data we're holding on to.
+    u8 options[40];
+    size_t options_size = 0;
+    if (flags & TCPFlags::SYN) {
+        u16 maximum_segment_size = our_maximum_segment_size();
+        options[options_size++] = (u8)TCPOptionKind::MaximumSegmentSize;
+        options[options_size++] = 4;
+        options[options_size++] = maximum_segment_size >> 8;
+        options[options_size++] = maximum_segment_size & 0xff;
+        // We may only send these options in a SYN-ACK if the peer sent them in its SYN.
+        if (!(flags & TCPFlags::ACK) || m_window_scaling_enabled) {
+            options[options_size++] = (u8)TCPOptionKind::NoOperation;
+            options[options_size++] = (u8)TCPOptionKind::WindowScale;
+            options[options_size++] = 3;
+            options[options_size++] = receive_window_scale();
+        }
+        if (!(flags & TCPFlags::ACK) || m_sack_permitted) {
+            options[options_size++] = (u8)TCPOptionKind::NoOperation;
+            options[options_size++] = (u8)TCPOptionKind::NoOperation;
+            options[options_size++] = (u8)TCPOptionKind::SACKPermitted;
+            options[options_size++] = 2;
+        }
+    } else if (flags & TCPFlags::ACK) {
+        options_size = write_sack_option(options, sizeof(options));
+    }
+
+    const size_t header_size = sizeof(TCPPacket) + options_size;
+    const size_t buffer_size = header_size + payload_size;
     alignas(TCPPacket) u8 buffer[buffer_size];
     new (buffer) TCPPacket;
     auto& tcp_packet = *(TCPPacket*)(buffer);
     ASSERT(local_port());
     tcp_packet.set_source_port(local_port());
     tcp_packet.set_destination_port(peer_port());
-    tcp_packet.set_window_size(1024);
+    tcp_packet.set_window_size(advertised_window_size(flags & TCPFlags::SYN));
     tcp_packet.set_sequence_number(m_sequence_number);
-    tcp_packet.set_data_offset(sizeof(TCPPacket) / sizeof(u32));
+    tcp_packet.set_data_offset(header_size / sizeof(u32));
     tcp_packet.set_flags(flags);
+    memcpy(buffer + sizeof(TCPPacket), options, options_size);
 
     if (flags & TCPFlags::ACK)
         tcp_packet.set_ack_number(m_ack_number);
@@ -209,17 +316,19 @@ int TCPSocket::send_tcp_packet(u16 flags, const UserOrKernelBuffer* payload, siz
     if (payload && !payload->read(tcp_packet.payload(), payload_size))
         return -EFAULT;
 
+    u32 first_sequence_number = m_sequence_number;
     if (flags & TCPFlags::SYN) {
         ++m_sequence_number;
     } else {
         m_sequence_number += payload_size;
     }
 
-    tcp_packet.set_checksum(compute_tcp_checksum(local_address(), peer_address(), tcp_packet, payload_size));
+    // The adapter finishes the checksum when the segment goes out, offloading it if it can.
+    tcp_packet.set_checksum(compute_partial_tcp_checksum(local_address(), peer_address(), buffer_size));
 
     if (tcp_packet.has_syn() || payload_size > 0) {
         LOCKER(m_not_acked_lock);
-        m_not_acked.append({ m_sequence_number, ByteBuffer::copy(buffer, buffer_size) });
+        m_not_acked.append({ first_sequence_number, m_sequence_number, ByteBuffer::copy(buffer, buffer_size) });
         send_outgoing_packets();
         return 0;
     }
@@ -230,7 +339,7 @@ int TCPSocket::send_tcp_packet(u16 flags, const UserOrKernelBuffer* payload, siz
     auto packet_buffer = UserOrKernelBuffer::for_kernel_buffer(buffer);
     int err = routing_decision.adapter->send_ipv4(
         routing_decision.next_hop, peer_address(), IPv4Protocol::TCP,
-        packet_buffer, buffer_size, ttl());
+        packet_buffer, buffer_size, ttl(), TransportChecksum::Partial);
     if (err < 0)
         return err;
 
@@ -244,46 +353,303 @@ void TCPSocket::send_outgoing_packets()
     auto routing_decision = route_to(peer_address(), local_address(), bound_interface());
     ASSERT(!routing_decision.is_zero());
 
-    auto now = kgettimeofday();
+    auto now_ms = TimeManagement::the().uptime_ms();
 
-    LOCKER(m_not_acked_lock, Lock::Mode::Shared);
+    LOCKER(m_not_acked_lock);
     for (auto& packet : m_not_acked) {
-        timeval diff;
-        timeval_sub(packet.tx_time, now, diff);
-        if (diff.tv_sec == 0 && diff.tv_usec <= 500000)
+        // Everything before m_send_next is in flight already. Retransmissions are driven by
+        // the retransmission timer and by loss recovery, not by new data being queued.
+        if (tcp_sequence_less_than(packet.sequence_number, m_send_next))
             continue;
-        packet.tx_time = now;
-        packet.tx_counter++;
+
+        if (packet.sacked) {
+            m_send_next = packet.ack_number;
+            if (tcp_sequence_less_than(m_send_max, m_send_next))
+                m_send_max = m_send_next;
+            continue;
+        }
+
+        // New data has to fit into both the congestion window and the peer's receive window.
+        // If nothing is in flight we always send a segment, so we notice when the window opens up again.
+        size_t window = min(m_congestion_control.congestion_window(), (size_t)m_send_window);
+        size_t in_flight = bytes_in_flight();
+        if (in_flight && in_flight + packet.sequence_length() > window)
+            break;
+        m_send_next = packet.ack_number;
+        if (tcp_sequence_less_than(m_send_max, m_send_next))
+            m_send_max = m_send_next;
+        transmit_packet(packet, routing_decision, now_ms);
+    }
+}
+
+void TCPSocket::transmit_packet(OutgoingPacket& packet, RoutingDecision& routing_decision, u64 now_ms)
+{
+    packet.tx_time_ms = now_ms;
+    if (packet.tx_counter++)
+        m_retransmissions++;
+
+    // RFC 6298, 5.1: Start the timer when sending data, unless it's running already.
+    if (!m_retransmit_deadline_ms)
+        restart_retransmit_timer();
 
 #ifdef TCP_SOCKET_DEBUG
-        auto& tcp_packet = *(TCPPacket*)(packet.buffer.data());
-        klog() << "sending tcp packet from " << local_address().to_string().characters() << ":" << local_port() << " to " << peer_address().to_string().characters() << ":" << peer_port() << " with (" << (tcp_packet.has_syn() ? "SYN " : "") << (tcp_packet.has_ack() ? "ACK " : "") << (tcp_packet.has_fin() ? "FIN " : "") << (tcp_packet.has_rst() ? "RST " : "") << ") seq_no=" << tcp_packet.sequence_number() << ", ack_no=" << tcp_packet.ack_number() << ", tx_counter=" << packet.tx_counter;
+    auto& tcp_packet = *(TCPPacket*)(packet.buffer.data());
+    klog() << "sending tcp packet from " << local_address().to_string().characters() << ":" << local_port() << " to " << peer_address().to_string().characters() << ":" << peer_port() << " with (" << (tcp_packet.has_syn() ? "SYN " : "") << (tcp_packet.has_ack() ? "ACK " : "") << (tcp_packet.has_fin() ? "FIN " : "") << (tcp_packet.has_rst() ? "RST " : "") << ") seq_no=" << tcp_packet.sequence_number() << ", ack_no=" << tcp_packet.ack_number() << ", tx_counter=" << packet.tx_counter;
 #endif
-        auto packet_buffer = UserOrKernelBuffer::for_kernel_buffer(packet.buffer.data());
-        int err = routing_decision.adapter->send_ipv4(
-            routing_decision.next_hop, peer_address(), IPv4Protocol::TCP,
-            packet_buffer, packet.buffer.size(), ttl());
-        if (err < 0) {
-            auto& tcp_packet = *(TCPPacket*)(packet.buffer.data());
-            klog() << "Error (" << err << ") sending tcp packet from " << local_address().to_string().characters() << ":" << local_port() << " to " << peer_address().to_string().characters() << ":" << peer_port() << " with (" << (tcp_packet.has_syn() ? "SYN " : "") << (tcp_packet.has_ack() ? "ACK " : "") << (tcp_packet.has_fin() ? "FIN " : "") << (tcp_packet.has_rst() ? "RST " : "") << ") seq_no=" << tcp_packet.sequence_number() << ", ack_no=" << tcp_packet.ack_number() << ", tx_counter=" << packet.tx_counter;
-        } else {
-            m_packets_out++;
-            m_bytes_out += packet.buffer.size();
+    auto packet_buffer = UserOrKernelBuffer::for_kernel_buffer(packet.buffer.data());
+    int err = routing_decision.adapter->send_ipv4(
+        routing_decision.next_hop, peer_address(), IPv4Protocol::TCP,
+        packet_buffer, packet.buffer.size(), ttl(), TransportChecksum::Partial);
+    if (err < 0) {
+        auto& tcp_packet = *(TCPPacket*)(packet.buffer.data());
+        klog() << "Error (" << err << ") sending tcp packet from " << local_address().to_string().characters() << ":" << local_port() << " to " << peer_address().to_string().characters() << ":" << peer_port() << " with (" << (tcp_packet.has_syn() ? "SYN " : "") << (tcp_packet.has_ack() ? "ACK " : "") << (tcp_packet.has_fin() ? "FIN " : "") << (tcp_packet.has_rst() ? "RST " : "") << ") seq_no=" << tcp_packet.sequence_number() << ", ack_no=" << tcp_packet.ack_number() << ", tx_counter=" << packet.tx_counter;
+    } else {
+        m_packets_out++;
+        m_bytes_out += packet.buffer.size();
+    }
+}
+
+void TCPSocket::retransmit_first_unacknowledged_packet()
+{
+    if (m_not_acked.is_empty() || !m_not_acked.first().tx_counter)
+        return;
+    auto routing_decision = route_to(peer_address(), local_address(), bound_interface());
+    if (routing_decision.is_zero())
+        return;
+    auto& packet = m_not_acked.first();
+    packet.retransmitted_in_recovery = true;
+    transmit_packet(packet, routing_decision, TimeManagement::the().uptime_ms());
+}
+
+bool TCPSocket::retransmit_next_sack_hole()
+{
+    // A segment counts as lost once the peer has selectively acknowledged data after it.
+    // We only retransmit one segment per incoming ACK, so we don't send more than leaves the network.
+    for (auto& packet : m_not_acked) {
+        if (!tcp_sequence_less_than(packet.sequence_number, m_send_next) || !tcp_sequence_less_than_or_equal(packet.ack_number, m_highest_sacked))
+            break;
+        if (packet.sacked || packet.retransmitted_in_recovery)
+            continue;
+        auto routing_decision = route_to(peer_address(), local_address(), bound_interface());
+        if (routing_decision.is_zero())
+            return false;
+        packet.retransmitted_in_recovery = true;
+        transmit_packet(packet, routing_decision, TimeManagement::the().uptime_ms());
+        return true;
+    }
+    return false;
+}
+
+void TCPSocket::update_retransmission_timeout(u32 round_trip_time_ms)
+{
+    // RFC 6298, 2.2 and 2.3. Like BSD, we keep scaled values, so we don't lose precision to the small gains.
+    if (!m_has_round_trip_time_sample) {
+        m_scaled_smoothed_round_trip_time = round_trip_time_ms << 3;
+        m_scaled_round_trip_time_variance = round_trip_time_ms << 1;
+        m_has_round_trip_time_sample = true;
+    } else {
+        i32 error = (i32)round_trip_time_ms - (i32)(m_scaled_smoothed_round_trip_time >> 3);
+        m_scaled_smoothed_round_trip_time += error;
+        if (error < 0)
+            error = -error;
+        m_scaled_round_trip_time_variance += error - (i32)(m_scaled_round_trip_time_variance >> 2);
+    }
+
+    u32 clock_granularity_ms = max(1000 / (u32)TimeManagement::the().ticks_per_second(), 1u);
+    u32 timeout = (m_scaled_smoothed_round_trip_time >> 3) + max(clock_granularity_ms, m_scaled_round_trip_time_variance);
+    m_retransmission_timeout_ms = clamp(timeout, minimum_retransmission_timeout_ms, maximum_retransmission_timeout_ms);
+}
+
+static SpinLock<u8> s_expired_retransmit_timers_lock;
+static AK::Singleton<Vector<IPv4SocketTuple>> s_expired_retransmit_timers;
+
+void TCPSocket::restart_retransmit_timer()
+{
+    m_retransmit_deadline_ms = TimeManagement::the().uptime_ms() + m_retransmission_timeout_ms;
+    // A pending timer that fires too early will be armed again, but one that fires too late has to go.
+    if (m_retransmit_timer && m_retransmit_timer_expires_ms > m_retransmit_deadline_ms)
+        TimerQueue::the().cancel_timer(m_retransmit_timer.release_nonnull());
+    if (!m_retransmit_timer)
+        arm_retransmit_timer(m_retransmit_deadline_ms);
+}
+
+void TCPSocket::arm_retransmit_timer(u64 deadline_ms)
+{
+    // Timers fire in a deferred call, where we can't take the socket lock. So we just take note of
+    // the socket, and leave the actual work to the NetworkTask. The socket may be gone by then.
+    auto on_expired = [tuple = tuple()] {
+        {
+            ScopedSpinLock lock(s_expired_retransmit_timers_lock);
+            s_expired_retransmit_timers->append(tuple);
         }
+        NetworkTask::wake();
+    };
+
+    timespec deadline { (time_t)(deadline_ms / 1000), (long)(deadline_ms % 1000) * 1000000 };
+    m_retransmit_timer = TimerQueue::the().add_timer_without_id(CLOCK_MONOTONIC_COARSE, deadline, move(on_expired));
+    m_retransmit_timer_expires_ms = deadline_ms;
+    if (!m_retransmit_timer) {
+        // The deadline has passed already.
+        ScopedSpinLock lock(s_expired_retransmit_timers_lock);
+        s_expired_retransmit_timers->append(tuple());
+        NetworkTask::wake();
     }
 }
 
+void TCPSocket::handle_expired_retransmit_timers()
+{
+    Vector<IPv4SocketTuple> tuples;
+    {
+        ScopedSpinLock lock(s_expired_retransmit_timers_lock);
+        if (s_expired_retransmit_timers->is_empty())
+            return;
+        swap(tuples, *s_expired_retransmit_timers);
+    }
+
+    for (auto& tuple : tuples) {
+        auto socket = from_tuple(tuple);
+        if (!socket || socket->tuple() != tuple)
+            continue;
+        LOCKER(socket->lock());
+        socket->retransmit_timer_expired();
+    }
+}
+
+void TCPSocket::retransmit_timer_expired()
+{
+    m_retransmit_timer = nullptr;
+    m_retransmit_timer_expires_ms = 0;
+    if (!m_retransmit_deadline_ms)
+        return;
+
+    if (TimeManagement::the().uptime_ms() < m_retransmit_deadline_ms) {
+        arm_retransmit_timer(m_retransmit_deadline_ms);
+        return;
+    }
+
+    LOCKER(m_not_acked_lock);
+    m_retransmit_deadline_ms = 0;
+    if (m_not_acked.is_empty())
+        return;
+
+#ifdef TCP_SOCKET_DEBUG
+    dbgln("TCPSocket: Retransmission timeout after {} ms, snd_una={}, snd_nxt={}, snd_max={}", m_retransmission_timeout_ms, m_send_unacknowledged, m_send_next, m_send_max);
+#endif
+
+    // RFC 6298, 5.4 - 5.6: Back off the timer, and retransmit the earliest segment.
+    m_congestion_control.did_time_out(bytes_in_flight());
+    m_retransmission_timeout_ms = min(m_retransmission_timeout_ms * 2, maximum_retransmission_timeout_ms);
+
+    // Everything that's in flight is considered lost now, and will be sent again as the congestion window
+    // opens up. RFC 2018, 8: We have to forget what the peer selectively acknowledged, it may have dropped it.
+    m_send_next = m_send_unacknowledged;
+    m_highest_sacked = m_send_unacknowledged;
+    for (auto& packet : m_not_acked) {
+        packet.sacked = false;
+        packet.retransmitted_in_recovery = false;
+    }
+    send_outgoing_packets();
+}
+
 void TCPSocket::receive_tcp_packet(const TCPPacket& packet, u16 size)
 {
-    if (packet.has_ack()) {
-        u32 ack_number = packet.ack_number();
+    if (packet.has_syn() && state() != State::Listen)
+        process_syn_options(packet);
+
+    if (packet.has_ack())
+        process_ack(packet, size - packet.header_size());
+
+    m_packets_in++;
+    m_bytes_in += packet.header_size() + size;
+}
+
+void TCPSocket::process_syn_options(const TCPPacket& packet)
+{
+    Optional<u8> window_scale;
+    size_t maximum_segment_size = default_maximum_segment_size;
+    bool sack_permitted = false;
+
+    packet.for_each_option([&](TCPOptionKind kind, ReadonlyBytes data) {
+        if (kind == TCPOptionKind::MaximumSegmentSize && data.size() == 2)
+            maximum_segment_size = (data[0] << 8) | data[1];
+        else if (kind == TCPOptionKind::WindowScale && data.size() == 1)
+            window_scale = min(data[0], tcp_max_window_scale);
+        else if (kind == TCPOptionKind::SACKPermitted)
+            sack_permitted = true;
+    });
+
+    m_window_scaling_enabled = window_scale.has_value();
+    m_send_window_scale = window_scale.value_or(0);
+    m_sack_permitted = sack_permitted;
+    m_send_maximum_segment_size = clamp(maximum_segment_size, minimum_maximum_segment_size, (size_t)our_maximum_segment_size());
+    m_congestion_control.set_maximum_segment_size(m_send_maximum_segment_size);
 
 #ifdef TCP_SOCKET_DEBUG
-        dbg() << "TCPSocket: receive_tcp_packet: " << ack_number;
+    dbgln("TCPSocket: Peer options: mss={}, window_scale={}, sack_permitted={}", maximum_segment_size, m_send_window_scale, m_sack_permitted);
 #endif
+}
 
+void TCPSocket::process_sack_option(const TCPPacket& packet)
+{
+    if (!m_sack_permitted)
+        return;
+
+    packet.for_each_option([&](TCPOptionKind kind, ReadonlyBytes data) {
+        if (kind != TCPOptionKind::SACK)
+            return;
+        for (size_t offset = 0; offset + 8 <= data.size(); offset += 8) {
+            u32 left_edge = (data[offset] << 24) | (data[offset + 1] << 16) | (data[offset + 2] << 8) | data[offset + 3];
+            u32 right_edge = (data[offset + 4] << 24) | (data[offset + 5] << 16) | (data[offset + 6] << 8) | data[offset + 7];
+            // Ignore blocks that don't make sense for what we've sent.
+            if (!tcp_sequence_less_than(left_edge, right_edge) || !tcp_sequence_less_than(m_send_unacknowledged, left_edge) || tcp_sequence_less_than(m_send_max, right_edge))
+                continue;
+            for (auto& outgoing_packet : m_not_acked) {
+                if (tcp_sequence_less_than_or_equal(right_edge, outgoing_packet.sequence_number))
+                    break;
+                if (tcp_sequence_less_than_or_equal(left_edge, outgoing_packet.sequence_number) && tcp_sequence_less_than_or_equal(outgoing_packet.ack_number, right_edge))
+                    outgoing_packet.sacked = true;
+            }
+            if (tcp_sequence_less_than(m_highest_sacked, right_edge))
+                m_highest_sacked = right_edge;
+        }
+    });
+}
+
+void TCPSocket::process_ack(const TCPPacket& packet, size_t payload_size)
+{
+    u32 ack_number = packet.ack_number();
+
+#ifdef TCP_SOCKET_DEBUG
+    dbg() << "TCPSocket: receive_tcp_packet: " << ack_number;
+#endif
+
+    LOCKER(m_not_acked_lock);
+
+    // Ignore ACKs for data we haven't even sent yet. After a retransmission timeout m_send_next
+    // has been rewound, but the peer may still acknowledge anything up to m_send_max.
+    if (tcp_sequence_less_than(m_send_max, ack_number))
+        return;
+    if (tcp_sequence_less_than(m_send_next, ack_number))
+        m_send_next = ack_number;
+
+    // RFC 7323: The window in a SYN segment is never scaled.
+    u32 window = packet.window_size();
+    if (!packet.has_syn())
+        window <<= m_send_window_scale;
+    bool window_did_change = window != m_send_window;
+    m_send_window = window;
+
+    process_sack_option(packet);
+
+    if (tcp_sequence_less_than(m_send_unacknowledged, ack_number)) {
+        size_t bytes_acknowledged = ack_number - m_send_unacknowledged;
+        m_send_unacknowledged = ack_number;
+        if (tcp_sequence_less_than(m_highest_sacked, ack_number))
+            m_highest_sacked = ack_number;
+
+        auto now_ms = TimeManagement::the().uptime_ms();
+        Optional<u32> round_trip_time_ms;
         int removed = 0;
-        LOCKER(m_not_acked_lock);
         while (!m_not_acked.is_empty()) {
             auto& packet = m_not_acked.first();
 
@@ -291,62 +657,188 @@ void TCPSocket::receive_tcp_packet(const TCPPacket& packet, u16 size)
             dbg() << "TCPSocket: iterate: " << packet.ack_number;
 #endif
 
-            if (packet.ack_number <= ack_number) {
-                m_not_acked.take_first();
-                removed++;
-            } else {
+            if (!tcp_sequence_less_than_or_equal(packet.ack_number, ack_number))
                 break;
-            }
+            // Karn's algorithm: We can't tell which transmission a retransmitted segment's ACK is for.
+            if (packet.tx_counter == 1)
+                round_trip_time_ms = now_ms - packet.tx_time_ms;
+            m_not_acked.take_first();
+            removed++;
         }
 
 #ifdef TCP_SOCKET_DEBUG
         dbg() << "TCPSocket: receive_tcp_packet acknowledged " << removed << " packets";
 #endif
+
+        if (round_trip_time_ms.has_value())
+            update_retransmission_timeout(round_trip_time_ms.value());
+
+        // RFC 6298, 5.2 and 5.3.
+        if (m_not_acked.is_empty() || m_send_max == m_send_unacknowledged)
+            m_retransmit_deadline_ms = 0;
+        else
+            restart_retransmit_timer();
+
+        if (m_congestion_control.did_receive_ack(bytes_acknowledged, ack_number)) {
+            if (!retransmit_next_sack_hole())
+                retransmit_first_unacknowledged_packet();
+        }
+
+        // We made some room in the send buffer.
+        evaluate_block_conditions();
+    } else if (ack_number == m_send_unacknowledged && bytes_in_flight() && !payload_size && !packet.has_syn() && !packet.has_fin() && !window_did_change) {
+        bool was_in_fast_recovery = m_congestion_control.is_in_fast_recovery();
+        if (m_congestion_control.did_receive_duplicate_ack(bytes_in_flight(), m_send_next)) {
+            // Fast retransmit, then let SACK information (if any) guide the rest of the recovery.
+            for (auto& outgoing_packet : m_not_acked)
+                outgoing_packet.retransmitted_in_recovery = false;
+            retransmit_first_unacknowledged_packet();
+        } else if (was_in_fast_recovery) {
+            [[maybe_unused]] auto did_retransmit = retransmit_next_sack_hole();
+        }
     }
 
-    m_packets_in++;
-    m_bytes_in += packet.header_size() + size;
+    // The window may have opened up for segments we've been holding back.
+    if (m_send_next != m_sequence_number)
+        send_outgoing_packets();
+}
+
+void TCPSocket::receive_segment(PacketBuffer& buffer, const IPv4Packet& ipv4_packet, const TCPPacket& tcp_packet, size_t payload_size)
+{
+    u32 sequence_number = tcp_packet.sequence_number();
+    ReadonlyBytes raw_ipv4_packet { (const u8*)&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size() };
+    if (sequence_number == m_ack_number) {
+        if (did_receive(ipv4_packet.source(), tcp_packet.source_port(), buffer, raw_ipv4_packet)) {
+            m_ack_number += payload_size;
+            deliver_out_of_order_segments();
+        }
+    } else if (tcp_sequence_less_than(m_ack_number, sequence_number)) {
+        queue_out_of_order_segment(buffer, raw_ipv4_packet, sequence_number, payload_size);
+    }
+
+#ifdef TCP_SOCKET_DEBUG
+    dbgln("TCPSocket: Got segment with seq_no={}, payload_size={}, acking it with ack_no={}", sequence_number, payload_size, m_ack_number);
+#endif
+
+    // Anything we couldn't take right away gets a duplicate ACK, which tells the peer where we are.
+    [[maybe_unused]] auto rc = send_tcp_packet(TCPFlags::ACK);
+}
+
+void TCPSocket::queue_out_of_order_segment(PacketBuffer& buffer, ReadonlyBytes raw_ipv4_packet, u32 sequence_number, size_t payload_size)
+{
+    u32 end = sequence_number + payload_size;
+    // Only hold on to what we can deliver once the gap is filled.
+    if (m_out_of_order_segments.size() >= max_out_of_order_segments || (size_t)(end - m_ack_number) > receive_buffer_space())
+        return;
+
+    size_t index = 0;
+    for (; index < m_out_of_order_segments.size(); ++index) {
+        auto& segment = m_out_of_order_segments[index];
+        if (tcp_sequence_less_than_or_equal(end, segment.sequence_number))
+            break;
+        // We don't bother with segments that overlap the ones we have.
+        if (tcp_sequence_less_than(sequence_number, segment.end))
+            return;
+    }
+
+    RefPtr<PacketBuffer> retained_buffer = buffer;
+    if (buffer.is_pool_running_low()) {
+        retained_buffer = PacketBuffer::try_create_unpooled_copy(raw_ipv4_packet, buffer.timestamp());
+        if (!retained_buffer)
+            return;
+        raw_ipv4_packet = retained_buffer->bytes();
+    }
+    m_out_of_order_segments.insert(index, { sequence_number, end, retained_buffer.release_nonnull(), raw_ipv4_packet });
+    m_last_out_of_order_sequence_number = sequence_number;
+}
+
+void TCPSocket::deliver_out_of_order_segments()
+{
+    while (!m_out_of_order_segments.is_empty()) {
+        auto& segment = m_out_of_order_segments.first();
+        if (tcp_sequence_less_than(m_ack_number, segment.sequence_number))
+            return;
+        if (segment.sequence_number == m_ack_number) {
+            if (!did_receive(peer_address(), peer_port(), segment.buffer, segment.raw_ipv4_packet))
+                return;
+            m_ack_number = segment.end;
+        }
+        m_out_of_order_segments.take_first();
+    }
+}
+
+size_t TCPSocket::write_sack_option(u8* options, size_t options_size) const
+{
+    if (!m_sack_permitted || m_out_of_order_segments.is_empty())
+        return 0;
+
+    // Coalesce adjacent segments into blocks. RFC 2018, 4: The first block has to contain
+    // the most recently received segment, the others should be the most recent ones after that.
+    // We simply list the remaining blocks in sequence number order.
+    struct Block {
+        u32 left_edge;
+        u32 right_edge;
+    };
+    Vector<Block, max_out_of_order_segments> blocks;
+    size_t first_block = 0;
+    for (auto& segment : m_out_of_order_segments) {
+        if (blocks.is_empty() || blocks.last().right_edge != segment.sequence_number)
+            blocks.append({ segment.sequence_number, segment.end });
+        else
+            blocks.last().right_edge = segment.end;
+        if (segment.sequence_number == m_last_out_of_order_sequence_number)
+            first_block = blocks.size() - 1;
+    }
+
+    size_t max_blocks = (options_size - 4) / 8;
+    size_t block_count = min(blocks.size(), max_blocks);
+    size_t offset = 0;
+    options[offset++] = (u8)TCPOptionKind::NoOperation;
+    options[offset++] = (u8)TCPOptionKind::NoOperation;
+    options[offset++] = (u8)TCPOptionKind::SACK;
+    options[offset++] = 2 + block_count * 8;
+    auto write_block = [&](const Block& block) {
+        for (u32 edge : { block.left_edge, block.right_edge }) {
+            options[offset++] = edge >> 24;
+            options[offset++] = edge >> 16;
+            options[offset++] = edge >> 8;
+            options[offset++] = edge;
+        }
+    };
+    write_block(blocks[first_block]);
+    for (size_t i = 0; i < blocks.size() && offset + 8 <= 4 + block_count * 8; ++i) {
+        if (i != first_block)
+            write_block(blocks[i]);
+    }
+    return offset;
 }
 
-NetworkOrdered<u16> TCPSocket::compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket& packet, u16 payload_size)
+static u64 tcp_pseudo_header_sum(const IPv4Address& source, const IPv4Address& destination, size_t tcp_length)
 {
     struct [[gnu::packed]] PseudoHeader {
         IPv4Address source;
         IPv4Address destination;
         u8 zero;
         u8 protocol;
-        NetworkOrdered<u16> payload_size;
+        NetworkOrdered<u16> tcp_length;
     };
 
-    PseudoHeader pseudo_header { source, destination, 0, (u8)IPv4Protocol::TCP, sizeof(TCPPacket) + payload_size };
+    PseudoHeader pseudo_header { source, destination, 0, (u8)IPv4Protocol::TCP, (u16)tcp_length };
+    return internet_checksum_add(&pseudo_header, sizeof(pseudo_header));
+}
 
-    u32 checksum = 0;
-    auto* w = (const NetworkOrdered<u16>*)&pseudo_header;
-    for (size_t i = 0; i < sizeof(pseudo_header) / sizeof(u16); ++i) {
-        checksum += w[i];
-        if (checksum > 0xffff)
-            checksum = (checksum >> 16) + (checksum & 0xffff);
-    }
-    w = (const NetworkOrdered<u16>*)&packet;
-    for (size_t i = 0; i < sizeof(packet) / sizeof(u16); ++i) {
-        checksum += w[i];
-        if (checksum > 0xffff)
-            checksum = (checksum >> 16) + (checksum & 0xffff);
-    }
-    ASSERT(packet.data_offset() * 4 == sizeof(TCPPacket));
-    w = (const NetworkOrdered<u16>*)packet.payload();
-    for (size_t i = 0; i < payload_size / sizeof(u16); ++i) {
-        checksum += w[i];
-        if (checksum > 0xffff)
-            checksum = (checksum >> 16) + (checksum & 0xffff);
-    }
-    if (payload_size & 1) {
-        u16 expanded_byte = ((const u8*)packet.payload())[payload_size - 1] << 8;
-        checksum += expanded_byte;
-        if (checksum > 0xffff)
-            checksum = (checksum >> 16) + (checksum & 0xffff);
-    }
-    return ~(checksum & 0xffff);
+u16 TCPSocket::compute_partial_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, size_t tcp_length)
+{
+    // NOTE: Unlike a finished checksum, this is not complemented. It's in network byte order,
+    //       so we hand it to TCPPacket::set_checksum() swapped to host order.
+    return AK::convert_between_host_and_network_endian(internet_checksum_fold(tcp_pseudo_header_sum(source, destination, tcp_length)));
+}
+
+bool TCPSocket::is_tcp_checksum_valid(const IPv4Address& source, const IPv4Address& destination, const TCPPacket& packet, size_t tcp_length)
+{
+    // Summing up a segment including its checksum gives all ones if the checksum is right.
+    auto sum = internet_checksum_add(&packet, tcp_length, tcp_pseudo_header_sum(source, destination, tcp_length));
+    return internet_checksum_fold(sum) == 0xffff;
 }
 
 KResult TCPSocket::protocol_bind()
@@ -362,10 +854,8 @@ KResult TCPSocket::protocol_bind()
 
 KResult TCPSocket::protocol_listen()
 {
-    LOCKER(sockets_by_tuple().lock());
-    if (sockets_by_tuple().resource().contains(tuple()))
+    if (!sockets_by_tuple().try_set(tuple(), this))
         return KResult(-EADDRINUSE);
-    sockets_by_tuple().resource().set(tuple(), this);
     set_direction(Direction::Passive);
     set_state(State::Listen);
     set_setup_state(SetupState::Completed);
@@ -384,7 +874,7 @@ KResult TCPSocket::protocol_connect(FileDescription& description, ShouldBlock sh
 
     allocate_local_port_if_needed();
 
-    m_sequence_number = get_good_random<u32>();
+    set_sequence_number(get_good_random<u32>());
     m_ack_number = 0;
 
     set_setup_state(SetupState::InProgress);
@@ -421,14 +911,11 @@ int TCPSocket::protocol_allocate_local_port()
     static const u16 ephemeral_port_range_size = last_ephemeral_port - first_ephemeral_port;
     u16 first_scan_port = first_ephemeral_port + get_good_random<u16>() % ephemeral_port_range_size;
 
-    LOCKER(sockets_by_tuple().lock());
     for (u16 port = first_scan_port;;) {
         IPv4SocketTuple proposed_tuple(local_address(), port, peer_address(), peer_port());
 
-        auto it = sockets_by_tuple().resource().find(proposed_tuple);
-        if (it == sockets_by_tuple().resource().end()) {
+        if (sockets_by_tuple().try_set(proposed_tuple, this)) {
             set_local_port(port);
-            sockets_by_tuple().resource().set(proposed_tuple, this);
             return port;
         }
         ++port;
@@ -481,8 +968,7 @@ KResult TCPSocket::close()
         set_state(State::LastAck);
     }
 
-    LOCKER(closing_sockets().lock());
-    closing_sockets().resource().set(tuple(), *this);
+    closing_sockets().set(tuple(), *this);
     return result;
 }
 
@@ -29,11 +29,17 @@
 #include <AK/Function.h>
 #include <AK/HashMap.h>
 #include <AK/SinglyLinkedList.h>
+#include <AK/Vector.h>
 #include <AK/WeakPtr.h>
 #include <Kernel/Net/IPv4Socket.h>
+#include <Kernel/Net/SocketTable.h>
+#include <Kernel/Net/TCPCongestionControl.h>
 
 namespace Kernel {
 
+struct RoutingDecision;
+class Timer;
+
 class TCPSocket final : public IPv4Socket {
 public:
     static void for_each(Function<void(const TCPSocket&)>);
@@ -140,23 +146,43 @@ public:
     void set_error(Error error) { m_error = error; }
 
     void set_ack_number(u32 n) { m_ack_number = n; }
-    void set_sequence_number(u32 n) { m_sequence_number = n; }
+    void set_sequence_number(u32 n)
+    {
+        m_sequence_number = n;
+        m_send_unacknowledged = n;
+        m_send_next = n;
+        m_send_max = n;
+        m_highest_sacked = n;
+    }
     u32 ack_number() const { return m_ack_number; }
     u32 sequence_number() const { return m_sequence_number; }
     u32 packets_in() const { return m_packets_in; }
     u32 bytes_in() const { return m_bytes_in; }
     u32 packets_out() const { return m_packets_out; }
     u32 bytes_out() const { return m_bytes_out; }
+    u32 send_window() const { return m_send_window; }
+    size_t congestion_window() const { return m_congestion_control.congestion_window(); }
+    size_t slow_start_threshold() const { return m_congestion_control.slow_start_threshold(); }
+    const char* congestion_control_algorithm() const { return TCPCongestionControl::to_string(m_congestion_control.algorithm()); }
+    u32 retransmission_timeout() const { return m_retransmission_timeout_ms; }
+    u32 retransmissions() const { return m_retransmissions; }
 
     [[nodiscard]] int send_tcp_packet(u16 flags, const UserOrKernelBuffer* = nullptr, size_t = 0);
     void send_outgoing_packets();
     void receive_tcp_packet(const TCPPacket&, u16 size);
+    void process_syn_options(const TCPPacket&);
+    void receive_segment(PacketBuffer&, const IPv4Packet&, const TCPPacket&, size_t payload_size);
+
+    // Called by the NetworkTask, which handles retransmission timeouts on behalf of the TimerQueue.
+    static void handle_expired_retransmit_timers();
 
-    static Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>& sockets_by_tuple();
+    static bool is_tcp_checksum_valid(const IPv4Address& source, const IPv4Address& destination, const TCPPacket&, size_t tcp_length);
+
+    static SocketTable<IPv4SocketTuple, TCPSocket*>& sockets_by_tuple();
     static RefPtr<TCPSocket> from_tuple(const IPv4SocketTuple& tuple);
     static RefPtr<TCPSocket> from_endpoints(const IPv4Address& local_address, u16 local_port, const IPv4Address& peer_address, u16 peer_port);
 
-    static Lockable<HashMap<IPv4SocketTuple, RefPtr<TCPSocket>>>& closing_sockets();
+    static SocketTable<IPv4SocketTuple, RefPtr<TCPSocket>>& closing_sockets();
 
     RefPtr<TCPSocket> create_client(const IPv4Address& local_address, u16 local_port, const IPv4Address& peer_address, u16 peer_port);
     void set_originator(TCPSocket& originator) { m_originator = originator; }
@@ -165,6 +191,7 @@ public:
     void release_for_accept(RefPtr<TCPSocket>);
 
     virtual KResult close() override;
+    virtual bool can_write(const FileDescription&, size_t) const override;
 
 protected:
     void set_direction(Direction direction) { m_direction = direction; }
@@ -173,17 +200,61 @@ private:
     explicit TCPSocket(int protocol);
     virtual const char* class_name() const override { return "TCPSocket"; }
 
-    static NetworkOrdered<u16> compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket&, u16 payload_size);
+    static u16 compute_partial_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, size_t tcp_length);
 
     virtual void shut_down_for_writing() override;
 
-    virtual KResultOr<size_t> protocol_receive(ReadonlyBytes raw_ipv4_packet, UserOrKernelBuffer& buffer, size_t buffer_size, int flags) override;
+    virtual ReadonlyBytes protocol_payload(ReadonlyBytes raw_ipv4_packet) const override;
     virtual KResultOr<size_t> protocol_send(const UserOrKernelBuffer&, size_t) override;
     virtual KResult protocol_connect(FileDescription&, ShouldBlock) override;
     virtual int protocol_allocate_local_port() override;
     virtual bool protocol_is_disconnected() const override;
+    virtual bool protocol_has_send_space() const override { return send_buffer_space() > 0; }
     virtual KResult protocol_bind() override;
     virtual KResult protocol_listen() override;
+    virtual void protocol_did_consume_receive_buffer() override;
+
+    struct OutgoingPacket {
+        u32 sequence_number { 0 };
+        u32 ack_number { 0 };
+        ByteBuffer buffer;
+        int tx_counter { 0 };
+        u64 tx_time_ms { 0 };
+        // The peer told us it has this packet, but it can't acknowledge it yet because something before it is missing.
+        bool sacked { false };
+        bool retransmitted_in_recovery { false };
+
+        // How much sequence number space this packet takes up.
+        u32 sequence_length() const { return ack_number - sequence_number; }
+    };
+
+    struct OutOfOrderSegment {
+        u32 sequence_number { 0 };
+        u32 end { 0 };
+        NonnullRefPtr<PacketBuffer> buffer;
+        ReadonlyBytes raw_ipv4_packet;
+    };
+
+    void process_ack(const TCPPacket&, size_t payload_size);
+    void process_sack_option(const TCPPacket&);
+    void transmit_packet(OutgoingPacket&, RoutingDecision&, u64 now_ms);
+    void retransmit_first_unacknowledged_packet();
+    bool retransmit_next_sack_hole();
+
+    void update_retransmission_timeout(u32 round_trip_time_ms);
+    void restart_retransmit_timer();
+    void arm_retransmit_timer(u64 deadline_ms);
+    void retransmit_timer_expired();
+
+    void queue_out_of_order_segment(PacketBuffer&, ReadonlyBytes raw_ipv4_packet, u32 sequence_number, size_t payload_size);
+    void deliver_out_of_order_segments();
+    size_t write_sack_option(u8* options, size_t options_size) const;
+
+    u16 our_maximum_segment_size() const;
+    u8 receive_window_scale() const;
+    u16 advertised_window_size(bool is_syn);
+    size_t bytes_in_flight() const { return m_send_next - m_send_unacknowledged; }
+    size_t send_buffer_space() const;
 
     WeakPtr<TCPSocket> m_originator;
     HashMap<IPv4SocketTuple, NonnullRefPtr<TCPSocket>> m_pending_release_for_accept;
@@ -198,15 +269,45 @@ private:
     u32 m_packets_out { 0 };
     u32 m_bytes_out { 0 };
 
-    struct OutgoingPacket {
-        u32 ack_number { 0 };
-        ByteBuffer buffer;
-        int tx_counter { 0 };
-        timeval tx_time { 0, 0 };
-    };
+    // The oldest sequence number that hasn't been acknowledged yet, and the next one we haven't sent yet.
+    // Everything from m_send_next up to m_sequence_number is queued, but held back by the send window.
+    // m_send_max is the highest sequence number we've ever sent; it stays put when a timeout rewinds m_send_next.
+    u32 m_send_unacknowledged { 0 };
+    u32 m_send_next { 0 };
+    u32 m_send_max { 0 };
+
+    // The receive window the peer advertised, already scaled.
+    u32 m_send_window { 0 };
+    u8 m_send_window_scale { 0 };
+    bool m_window_scaling_enabled { false };
+    size_t m_send_maximum_segment_size { 536 };
+    size_t m_last_advertised_window { 0 };
+
+    TCPCongestionControl m_congestion_control;
+
+    // RFC 2018: Whether the peer sent us a SACK-permitted option, and the highest sequence number it selectively acknowledged.
+    bool m_sack_permitted { false };
+    u32 m_highest_sacked { 0 };
+
+    // RFC 6298: The smoothed RTT is scaled by 8, the RTT variance by 4.
+    bool m_has_round_trip_time_sample { false };
+    u32 m_scaled_smoothed_round_trip_time { 0 };
+    u32 m_scaled_round_trip_time_variance { 0 };
+    u32 m_retransmission_timeout_ms { 0 };
+    u32 m_retransmissions { 0 };
+
+    // The timer isn't cancelled when the deadline moves. When it fires too early, it's armed again for the actual deadline.
+    // A deadline of zero means that the retransmission timer is stopped.
+    RefPtr<Timer> m_retransmit_timer;
+    u64 m_retransmit_timer_expires_ms { 0 };
+    u64 m_retransmit_deadline_ms { 0 };
 
     Lock m_not_acked_lock { "TCPSocket unacked packets" };
     SinglyLinkedList<OutgoingPacket> m_not_acked;
+
+    // Segments that arrived after a gap, sorted by sequence number.
+    Vector<OutOfOrderSegment> m_out_of_order_segments;
+    u32 m_last_out_of_order_sequence_number { 0 };
 };
 
 }
@@ -37,14 +37,14 @@ namespace Kernel {
 
 void UDPSocket::for_each(Function<void(const UDPSocket&)> callback)
 {
-    LOCKER(sockets_by_port().lock(), Lock::Mode::Shared);
-    for (auto it : sockets_by_port().resource())
-        callback(*it.value);
+    sockets_by_port().for_each([&](auto, auto* socket) {
+        callback(*socket);
+    });
 }
 
-static AK::Singleton<Lockable<HashMap<u16, UDPSocket*>>> s_map;
+static AK::Singleton<SocketTable<u16, UDPSocket*>> s_map;
 
-Lockable<HashMap<u16, UDPSocket*>>& UDPSocket::sockets_by_port()
+SocketTable<u16, UDPSocket*>& UDPSocket::sockets_by_port()
 {
     return *s_map;
 }
@@ -53,9 +53,10 @@ SocketHandle<UDPSocket> UDPSocket::from_port(u16 port)
 {
     RefPtr<UDPSocket> socket;
     {
-        LOCKER(sockets_by_port().lock(), Lock::Mode::Shared);
-        auto it = sockets_by_port().resource().find(port);
-        if (it == sockets_by_port().resource().end())
+        auto& bucket = sockets_by_port().bucket_for(port);
+        LOCKER(bucket.lock(), Lock::Mode::Shared);
+        auto it = bucket.resource().find(port);
+        if (it == bucket.resource().end())
             return {};
         socket = (*it).value;
         ASSERT(socket);
@@ -70,8 +71,7 @@ UDPSocket::UDPSocket(int protocol)
 
 UDPSocket::~UDPSocket()
 {
-    LOCKER(sockets_by_port().lock());
-    sockets_by_port().resource().remove(local_port());
+    sockets_by_port().remove(local_port());
 }
 
 NonnullRefPtr<UDPSocket> UDPSocket::create(int protocol)
@@ -125,12 +125,9 @@ int UDPSocket::protocol_allocate_local_port()
     static const u16 ephemeral_port_range_size = last_ephemeral_port - first_ephemeral_port;
     u16 first_scan_port = first_ephemeral_port + get_good_random<u16>() % ephemeral_port_range_size;
 
-    LOCKER(sockets_by_port().lock());
     for (u16 port = first_scan_port;;) {
-        auto it = sockets_by_port().resource().find(port);
-        if (it == sockets_by_port().resource().end()) {
+        if (sockets_by_port().try_set(port, this)) {
             set_local_port(port);
-            sockets_by_port().resource().set(port, this);
             return port;
         }
         ++port;
@@ -144,10 +141,8 @@ int UDPSocket::protocol_allocate_local_port()
 
 KResult UDPSocket::protocol_bind()
 {
-    LOCKER(sockets_by_port().lock());
-    if (sockets_by_port().resource().contains(local_port()))
+    if (!sockets_by_port().try_set(local_port(), this))
         return KResult(-EADDRINUSE);
-    sockets_by_port().resource().set(local_port(), this);
     return KSuccess;
 }
 
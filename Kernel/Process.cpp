@@ -25,7 +25,6 @@
  */
 
 #include <AK/Demangle.h>
-#include <AK/QuickSort.h>
 #include <AK/StdLibExtras.h>
 #include <AK/StringBuilder.h>
 #include <AK/Time.h>
@@ -124,8 +123,16 @@ Range Process::allocate_range(VirtualAddress vaddr, size_t size, size_t alignmen
 {
     vaddr.mask(PAGE_MASK);
     size = PAGE_ROUND_UP(size);
-    if (vaddr.is_null())
+    if (vaddr.is_null()) {
+        // Prefer giving large ranges 2 MiB alignment, so that physically
+        // contiguous memory mapped into them can use huge pages.
+        if (size >= HUGE_PAGE_SIZE && alignment < HUGE_PAGE_SIZE) {
+            auto range = page_directory().range_allocator().allocate_anywhere(size, HUGE_PAGE_SIZE);
+            if (range.is_valid())
+                return range;
+        }
         return page_directory().range_allocator().allocate_anywhere(size, alignment);
+    }
     return page_directory().range_allocator().allocate_specific(vaddr, size);
 }
 
@@ -197,18 +204,23 @@ KResultOr<Region*> Process::allocate_region_with_vmobject(VirtualAddress vaddr,
 
 bool Process::deallocate_region(Region& region)
 {
-    OwnPtr<Region> region_protector;
+    return !!take_region(region);
+}
+
+OwnPtr<Region> Process::take_region(Region& region)
+{
     ScopedSpinLock lock(m_lock);
+    ScopedSpinLock mm_lock(s_mm_lock);
 
     if (m_region_lookup_cache.region.unsafe_ptr() == &region)
         m_region_lookup_cache.region = nullptr;
-    for (size_t i = 0; i < m_regions.size(); ++i) {
-        if (&m_regions[i] == &region) {
-            region_protector = m_regions.unstable_take(i);
-            return true;
-        }
-    }
-    return false;
+    if (m_last_faulting_region.unsafe_ptr() == &region)
+        m_last_faulting_region = nullptr;
+
+    auto* found_region = m_regions.find(region.vaddr().get());
+    if (!found_region || found_region->ptr() != &region)
+        return {};
+    return m_regions.take(region.vaddr().get()).release_value();
 }
 
 Region* Process::find_region_from_range(const Range& range)
@@ -217,25 +229,24 @@ Region* Process::find_region_from_range(const Range& range)
     if (m_region_lookup_cache.range == range && m_region_lookup_cache.region)
         return m_region_lookup_cache.region.unsafe_ptr();
 
-    size_t size = PAGE_ROUND_UP(range.size());
-    for (auto& region : m_regions) {
-        if (region.vaddr() == range.base() && region.size() == size) {
-            m_region_lookup_cache.range = range;
-            m_region_lookup_cache.region = region;
-            return &region;
-        }
-    }
-    return nullptr;
+    auto* found_region = m_regions.find(range.base().get());
+    if (!found_region)
+        return nullptr;
+    auto& region = *found_region;
+    if (region->size() != PAGE_ROUND_UP(range.size()))
+        return nullptr;
+    m_region_lookup_cache.range = range;
+    m_region_lookup_cache.region = *region;
+    return region.ptr();
 }
 
 Region* Process::find_region_containing(const Range& range)
 {
     ScopedSpinLock lock(m_lock);
-    for (auto& region : m_regions) {
-        if (region.contains(range))
-            return &region;
-    }
-    return nullptr;
+    auto* candidate = m_regions.find_largest_not_above(range.base().get());
+    if (!candidate || !(*candidate)->contains(range))
+        return nullptr;
+    return candidate->ptr();
 }
 
 void Process::kill_threads_except_self()
@@ -395,16 +406,8 @@ void Process::dump_regions()
 
     ScopedSpinLock lock(m_lock);
 
-    Vector<Region*> sorted_regions;
-    sorted_regions.ensure_capacity(m_regions.size());
-    for (auto& region : m_regions)
-        sorted_regions.append(&region);
-    quick_sort(sorted_regions, [](auto& a, auto& b) {
-        return a->vaddr() < b->vaddr();
-    });
-
-    for (auto& sorted_region : sorted_regions) {
-        auto& region = *sorted_region;
+    for (auto& it : m_regions) {
+        auto& region = *it;
         klog() << String::format("%08x", region.vaddr().get()) << " -- " << String::format("%08x", region.vaddr().offset(region.size() - 1).get()) << "    " << String::format("%08zx", region.size()) << "    " << (region.is_readable() ? 'R' : ' ') << (region.is_writable() ? 'W' : ' ') << (region.is_executable() ? 'X' : ' ') << (region.is_shared() ? 'S' : ' ') << (region.is_stack() ? 'T' : ' ') << (region.vmobject().is_anonymous() ? 'A' : ' ') << "    " << region.name().characters();
     }
     MM.dump_kernel_regions();
@@ -667,10 +670,14 @@ void Process::finalize()
 
     unblock_waiters(Thread::WaitBlocker::UnblockFlags::Terminated);
 
+    RegionTree regions;
     {
         ScopedSpinLock lock(m_lock);
-        m_regions.clear();
+        ScopedSpinLock mm_lock(s_mm_lock);
+        m_last_faulting_region = nullptr;
+        regions = move(m_regions);
     }
+    regions.clear();
 
     ASSERT(ref_count() > 0);
     // WaitBlockCondition::finalize will be in charge of dropping the last
@@ -715,8 +722,8 @@ size_t Process::amount_dirty_private() const
     size_t amount = 0;
     ScopedSpinLock lock(m_lock);
     for (auto& region : m_regions) {
-        if (!region.is_shared())
-            amount += region.amount_dirty();
+        if (!region->is_shared())
+            amount += region->amount_dirty();
     }
     return amount;
 }
@@ -727,8 +734,8 @@ size_t Process::amount_clean_inode() const
     {
         ScopedSpinLock lock(m_lock);
         for (auto& region : m_regions) {
-            if (region.vmobject().is_inode())
-                vmobjects.set(&static_cast<const InodeVMObject&>(region.vmobject()));
+            if (region->vmobject().is_inode())
+                vmobjects.set(&static_cast<const InodeVMObject&>(region->vmobject()));
         }
     }
     size_t amount = 0;
@@ -742,7 +749,7 @@ size_t Process::amount_virtual() const
     size_t amount = 0;
     ScopedSpinLock lock(m_lock);
     for (auto& region : m_regions) {
-        amount += region.size();
+        amount += region->size();
     }
     return amount;
 }
@@ -753,7 +760,7 @@ size_t Process::amount_resident() const
     size_t amount = 0;
     ScopedSpinLock lock(m_lock);
     for (auto& region : m_regions) {
-        amount += region.amount_resident();
+        amount += region->amount_resident();
     }
     return amount;
 }
@@ -767,7 +774,7 @@ size_t Process::amount_shared() const
     size_t amount = 0;
     ScopedSpinLock lock(m_lock);
     for (auto& region : m_regions) {
-        amount += region.amount_shared();
+        amount += region->amount_shared();
     }
     return amount;
 }
@@ -777,8 +784,8 @@ size_t Process::amount_purgeable_volatile() const
     size_t amount = 0;
     ScopedSpinLock lock(m_lock);
     for (auto& region : m_regions) {
-        if (region.vmobject().is_anonymous() && static_cast<const AnonymousVMObject&>(region.vmobject()).is_any_volatile())
-            amount += region.amount_resident();
+        if (region->vmobject().is_anonymous() && static_cast<const AnonymousVMObject&>(region->vmobject()).is_any_volatile())
+            amount += region->amount_resident();
     }
     return amount;
 }
@@ -788,8 +795,8 @@ size_t Process::amount_purgeable_nonvolatile() const
     size_t amount = 0;
     ScopedSpinLock lock(m_lock);
     for (auto& region : m_regions) {
-        if (region.vmobject().is_anonymous() && !static_cast<const AnonymousVMObject&>(region.vmobject()).is_any_volatile())
-            amount += region.amount_resident();
+        if (region->vmobject().is_anonymous() && !static_cast<const AnonymousVMObject&>(region->vmobject()).is_any_volatile())
+            amount += region->amount_resident();
     }
     return amount;
 }
@@ -896,10 +903,10 @@ void Process::set_root_directory(const Custody& root)
 
 Region& Process::add_region(NonnullOwnPtr<Region> region)
 {
-    auto* ptr = region.ptr();
     ScopedSpinLock lock(m_lock);
-    m_regions.append(move(region));
-    return *ptr;
+    ScopedSpinLock mm_lock(s_mm_lock);
+    auto base = region->vaddr().get();
+    return *m_regions.insert(base, move(region));
 }
 
 void Process::set_tty(TTY* tty)
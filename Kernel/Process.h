@@ -31,6 +31,7 @@
 #include <AK/InlineLinkedList.h>
 #include <AK/NonnullOwnPtrVector.h>
 #include <AK/NonnullRefPtrVector.h>
+#include <AK/RedBlackTree.h>
 #include <AK/String.h>
 #include <AK/Userspace.h>
 #include <AK/WeakPtr.h>
@@ -246,6 +247,7 @@ public:
     ssize_t sys$read(int fd, Userspace<u8*>, ssize_t);
     ssize_t sys$write(int fd, const u8*, ssize_t);
     ssize_t sys$writev(int fd, Userspace<const struct iovec*> iov, int iov_count);
+    ssize_t sys$sendfile(Userspace<const Syscall::SC_sendfile_params*>);
     int sys$fstat(int fd, Userspace<stat*>);
     int sys$stat(Userspace<const Syscall::SC_stat_params*>);
     int sys$lseek(int fd, off_t, int whence);
@@ -263,6 +265,9 @@ public:
     int sys$purge(int mode);
     int sys$select(const Syscall::SC_select_params*);
     int sys$poll(Userspace<const Syscall::SC_poll_params*>);
+    int sys$epoll_create(int flags);
+    int sys$epoll_ctl(Userspace<const Syscall::SC_epoll_ctl_params*>);
+    int sys$epoll_wait(Userspace<const Syscall::SC_epoll_wait_params*>);
     ssize_t sys$get_dir_entries(int fd, void*, ssize_t);
     int sys$getcwd(Userspace<char*>, ssize_t);
     int sys$chdir(Userspace<const char*>, size_t);
@@ -282,6 +287,7 @@ public:
     int sys$ptsname(int fd, Userspace<char*>, size_t);
     pid_t sys$fork(RegisterState&);
     int sys$execve(Userspace<const Syscall::SC_execve_params*>);
+    pid_t sys$posix_spawn(Userspace<const Syscall::SC_posix_spawn_params*>);
     int sys$dup2(int old_fd, int new_fd);
     int sys$sigaction(int signum, const sigaction* act, sigaction* old_act);
     int sys$sigprocmask(int how, Userspace<const sigset_t*> set, Userspace<sigset_t*> old_set);
@@ -382,8 +388,10 @@ public:
     const TTY* tty() const { return m_tty; }
     void set_tty(TTY*);
 
+    typedef RedBlackTree<FlatPtr, NonnullOwnPtr<Region>> RegionTree;
+
     size_t region_count() const { return m_regions.size(); }
-    const NonnullOwnPtrVector<Region>& regions() const
+    const RegionTree& regions() const
     {
         ASSERT(m_lock.is_locked());
         return m_regions;
@@ -450,6 +458,7 @@ public:
     KResultOr<Region*> allocate_region_with_vmobject(const Range&, NonnullRefPtr<VMObject>, size_t offset_in_vmobject, const String& name, int prot, bool shared);
     KResultOr<Region*> allocate_region(const Range&, const String& name, int prot = PROT_READ | PROT_WRITE, AllocationStrategy strategy = AllocationStrategy::Reserve);
     bool deallocate_region(Region& region);
+    OwnPtr<Region> take_region(Region& region);
 
     Region& allocate_split_region(const Region& source_region, const Range&, size_t offset_in_vmobject);
     Vector<Region*, 2> split_region_around_range(const Region& source_region, const Range&);
@@ -530,6 +539,9 @@ private:
 
     Region& add_region(NonnullOwnPtr<Region>);
 
+    void copy_inherited_state_to(Process& child);
+    KResult apply_spawn_file_action(Process& child, const Syscall::SC_posix_spawn_file_action&);
+
     void kill_threads_except_self();
     void kill_all_threads();
     bool dump_core();
@@ -537,6 +549,8 @@ private:
 
     int do_exec(NonnullRefPtr<FileDescription> main_program_description, Vector<String> arguments, Vector<String> environment, RefPtr<FileDescription> interpreter_description, Thread*& new_main_thread, u32& prev_flags, const Elf32_Ehdr& main_program_header);
     ssize_t do_write(FileDescription&, const UserOrKernelBuffer&, size_t);
+    ssize_t sendfile_from_page_cache(FileDescription&, SharedInodeVMObject&, off_t, size_t);
+    ssize_t sendfile_through_buffer(FileDescription&, FileDescription&, off_t, size_t);
 
     KResultOr<RefPtr<FileDescription>> find_elf_interpreter_for_executable(const String& path, const Elf32_Ehdr& elf_header, int nread, size_t file_size);
 
@@ -625,12 +639,17 @@ private:
     Region* find_region_from_range(const Range&);
     Region* find_region_containing(const Range&);
 
-    NonnullOwnPtrVector<Region> m_regions;
+    // Regions are keyed by their base address so that the region containing
+    // an address can be found in O(log n) on every page fault.
+    // NOTE: The page fault path looks regions up under the MM lock, so changes to
+    //       m_regions and m_last_faulting_region hold both m_lock and s_mm_lock.
+    RegionTree m_regions;
     struct RegionLookupCache {
         Range range;
         WeakPtr<Region> region;
     };
     RegionLookupCache m_region_lookup_cache;
+    WeakPtr<Region> m_last_faulting_region;
 
     ProcessID m_ppid { 0 };
     mode_t m_umask { 022 };
@@ -24,7 +24,6 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <AK/QuickSort.h>
 #include <AK/ScopeGuard.h>
 #include <AK/TemporaryChange.h>
 #include <AK/Time.h>
@@ -62,6 +61,160 @@ void Scheduler::init_thread(Thread& thread)
     g_scheduler_data->m_nonrunnable_threads.append(thread);
 }
 
+static inline u32 thread_priority_to_ready_queue_bucket(u32 priority)
+{
+    // Maps THREAD_PRIORITY_MIN..THREAD_PRIORITY_MAX onto the ready queue
+    // buckets, with bucket 0 holding the highest priorities. Boosted
+    // priorities beyond THREAD_PRIORITY_MAX all land in bucket 0.
+    constexpr u32 priority_count = THREAD_PRIORITY_MAX - THREAD_PRIORITY_MIN + 1;
+    if (priority > THREAD_PRIORITY_MAX)
+        priority = THREAD_PRIORITY_MAX;
+    else if (priority < THREAD_PRIORITY_MIN)
+        priority = THREAD_PRIORITY_MIN;
+    auto bucket = (THREAD_PRIORITY_MAX - priority) * SchedulerData::ready_queue_buckets / priority_count;
+    ASSERT(bucket < SchedulerData::ready_queue_buckets);
+    return bucket;
+}
+
+static inline bool is_eligible_to_run_on(Thread& thread, u32 cpu)
+{
+    if ((thread.affinity() & (1u << cpu)) == 0)
+        return false;
+    // While a process is in the middle of exec, only the thread doing the exec may run.
+    if (thread.process().exec_tid() && thread.process().exec_tid() != thread.tid())
+        return false;
+    return true;
+}
+
+static u32 ready_queue_cpu_for(const Thread& thread)
+{
+    // Prefer the processor the thread last ran on, as its caches are most
+    // likely to still be warm. Otherwise pick the first one it may run on.
+    auto affinity = thread.affinity();
+    ASSERT(affinity != 0);
+    auto cpu = thread.cpu();
+    if (cpu < SchedulerData::max_processors && (affinity & (1u << cpu)))
+        return cpu;
+    return __builtin_ctz(affinity);
+}
+
+void Scheduler::queue_runnable_thread(Thread& thread)
+{
+    ASSERT(g_scheduler_lock.own_lock());
+    ASSERT(thread.state() == Thread::Runnable);
+    if (thread.m_ready_queue_bucket >= 0)
+        return;
+
+    auto cpu = ready_queue_cpu_for(thread);
+    auto bucket = thread_priority_to_ready_queue_bucket(thread.effective_priority());
+    auto& ready_queues = g_scheduler_data->m_ready_queues[cpu];
+    ready_queues.m_buckets[bucket].append(thread);
+    ready_queues.m_mask |= 1u << bucket;
+    thread.m_ready_queue_cpu = cpu;
+    thread.m_ready_queue_bucket = (int)bucket;
+}
+
+void Scheduler::dequeue_runnable_thread(Thread& thread)
+{
+    ASSERT(g_scheduler_lock.own_lock());
+    if (thread.m_ready_queue_bucket < 0)
+        return;
+
+    auto bucket = (u32)thread.m_ready_queue_bucket;
+    auto& ready_queues = g_scheduler_data->m_ready_queues[thread.m_ready_queue_cpu];
+    auto& ready_queue = ready_queues.m_buckets[bucket];
+    ready_queue.remove(thread);
+    if (ready_queue.is_empty())
+        ready_queues.m_mask &= ~(1u << bucket);
+    thread.m_ready_queue_bucket = -1;
+}
+
+void Scheduler::requeue_runnable_thread(Thread& thread)
+{
+    ASSERT(g_scheduler_lock.own_lock());
+    // The thread's priority or affinity changed, so it may belong into
+    // another bucket or onto another processor's queues now.
+    if (thread.m_ready_queue_bucket < 0)
+        return;
+    dequeue_runnable_thread(thread);
+    queue_runnable_thread(thread);
+}
+
+void SchedulerData::ProcessorReadyQueues::age_waiting_thread()
+{
+    ASSERT(g_scheduler_lock.own_lock());
+
+    // Strict priorities would let a steady stream of higher priority work
+    // starve everything below it forever (including the finalizer). So on
+    // every pick, move one waiting thread from the lowest occupied bucket up
+    // by one bucket. Threads at THREAD_PRIORITY_MIN (idle threads, background
+    // work) are meant to run only when nothing else wants to, and don't age.
+    constexpr u32 priority_count = THREAD_PRIORITY_MAX - THREAD_PRIORITY_MIN + 1;
+    constexpr u32 priorities_per_bucket = (priority_count + ready_queue_buckets - 1) / ready_queue_buckets;
+    // This runs on every pick with the scheduler lock held, so only look at a
+    // handful of threads. Those at the head of a bucket have waited longest.
+    constexpr u32 max_threads_to_examine = 4;
+    if (!m_mask)
+        return;
+    u32 highest_bucket = __builtin_ctz(m_mask);
+    u32 threads_examined = 0;
+    for (u32 bucket = ready_queue_buckets - 1; bucket > highest_bucket; --bucket) {
+        if (!(m_mask & (1u << bucket)))
+            continue;
+        for (auto& thread : m_buckets[bucket]) {
+            if (++threads_examined > max_threads_to_examine)
+                return;
+            if (thread.priority() <= THREAD_PRIORITY_MIN)
+                continue;
+            thread.m_extra_priority += priorities_per_bucket;
+            Scheduler::requeue_runnable_thread(thread);
+            return;
+        }
+    }
+}
+
+Thread* SchedulerData::ProcessorReadyQueues::find_ready_thread(u32 bucket_mask, u32 cpu)
+{
+    while (bucket_mask != 0) {
+        auto bucket = (u32)__builtin_ctz(bucket_mask);
+        for (auto& thread : m_buckets[bucket]) {
+            ASSERT(thread.state() == Thread::Runnable);
+            if (thread.is_active() || !is_eligible_to_run_on(thread, cpu))
+                continue;
+            return &thread;
+        }
+        bucket_mask &= ~(1u << bucket);
+    }
+    return nullptr;
+}
+
+Thread* SchedulerData::find_next_runnable_thread(u32 cpu)
+{
+    ASSERT(g_scheduler_lock.own_lock());
+
+    // Look at our own ready queues first, then steal from other processors
+    // if they have something of strictly higher priority waiting. Work is
+    // proportional to the number of buckets and processors, not threads.
+    auto& own_queues = m_ready_queues[cpu];
+    auto* thread = own_queues.find_ready_thread(own_queues.m_mask, cpu);
+    u32 best_bucket = thread ? (u32)thread->m_ready_queue_bucket : ready_queue_buckets;
+
+    for (u32 other_cpu = 0; other_cpu < max_processors && best_bucket > 0; other_cpu++) {
+        if (other_cpu == cpu)
+            continue;
+        auto& other_queues = m_ready_queues[other_cpu];
+        u32 higher_buckets_mask = best_bucket < ready_queue_buckets ? (1u << best_bucket) - 1 : 0xffffffff;
+        u32 bucket_mask = other_queues.m_mask & higher_buckets_mask;
+        if (!bucket_mask)
+            continue;
+        if (auto* stolen_thread = other_queues.find_ready_thread(bucket_mask, cpu)) {
+            thread = stolen_thread;
+            best_bucket = (u32)stolen_thread->m_ready_queue_bucket;
+        }
+    }
+    return thread;
+}
+
 static u32 time_slice_for(const Thread& thread)
 {
     // One time slice unit == 4ms (assuming 250 ticks/second)
@@ -154,24 +307,9 @@ bool Scheduler::pick_next()
     });
 #endif
 
-    Thread* thread_to_schedule = nullptr;
-
     auto pending_beneficiary = scheduler_data.m_pending_beneficiary.strong_ref();
-    Vector<Thread*, 128> sorted_runnables;
-    for_each_runnable([&](auto& thread) {
-        if ((thread.affinity() & (1u << Processor::current().id())) == 0)
-            return IterationDecision::Continue;
-        if (thread.state() == Thread::Running && &thread != current_thread)
-            return IterationDecision::Continue;
-        sorted_runnables.append(&thread);
-        if (&thread == pending_beneficiary) {
-            thread_to_schedule = &thread;
-            return IterationDecision::Break;
-        }
-        return IterationDecision::Continue;
-    });
-
-    if (thread_to_schedule) {
+    if (pending_beneficiary && is_eligible_to_run_on(*pending_beneficiary, Processor::current().id())
+        && (pending_beneficiary->state() == Thread::Runnable || pending_beneficiary == current_thread)) {
         // The thread we're supposed to donate to still exists
         const char* reason = scheduler_data.m_pending_donate_reason;
         scheduler_data.m_pending_beneficiary = nullptr;
@@ -182,9 +320,9 @@ bool Scheduler::pick_next()
         critical.leave();
 
 #ifdef SCHEDULER_DEBUG
-        dbg() << "Processing pending donate to " << *thread_to_schedule << " reason=" << reason;
+        dbg() << "Processing pending donate to " << *pending_beneficiary << " reason=" << reason;
 #endif
-        return donate_to_and_switch(thread_to_schedule, reason);
+        return donate_to_and_switch(pending_beneficiary.ptr(), reason);
     }
 
     // Either we're not donating or the beneficiary disappeared.
@@ -192,20 +330,16 @@ bool Scheduler::pick_next()
     scheduler_data.m_pending_beneficiary = nullptr;
     scheduler_data.m_pending_donate_reason = nullptr;
 
-    quick_sort(sorted_runnables, [](auto& a, auto& b) { return a->effective_priority() >= b->effective_priority(); });
+    g_scheduler_data->m_ready_queues[Processor::current().id()].age_waiting_thread();
+    Thread* thread_to_schedule = g_scheduler_data->find_next_runnable_thread(Processor::current().id());
 
-    for (auto* thread : sorted_runnables) {
-        if (thread->process().exec_tid() && thread->process().exec_tid() != thread->tid())
-            continue;
-
-        ASSERT(thread->state() == Thread::Runnable || thread->state() == Thread::Running);
-
-        if (!thread_to_schedule) {
-            thread->m_extra_priority = 0;
-            thread_to_schedule = thread;
-        } else {
-            thread->m_extra_priority++;
-        }
+    if (current_thread->state() == Thread::Running && current_thread != Processor::current().idle_thread()
+        && is_eligible_to_run_on(*current_thread, Processor::current().id())) {
+        // Keep running the current thread unless there's a ready thread of
+        // at least the same priority, in which case we round-robin with it.
+        auto current_bucket = thread_priority_to_ready_queue_bucket(current_thread->effective_priority());
+        if (!thread_to_schedule || (u32)thread_to_schedule->m_ready_queue_bucket > current_bucket)
+            thread_to_schedule = current_thread;
     }
 
     if (!thread_to_schedule)
@@ -219,6 +353,7 @@ bool Scheduler::pick_next()
     // but since we're still holding the scheduler lock we're still in a critical section
     critical.leave();
 
+    thread_to_schedule->m_extra_priority = 0;
     thread_to_schedule->set_ticks_left(time_slice_for(*thread_to_schedule));
     return context_switch(thread_to_schedule);
 }
@@ -78,6 +78,9 @@ public:
     static inline IterationDecision for_each_nonrunnable(Callback);
 
     static void init_thread(Thread& thread);
+    static void queue_runnable_thread(Thread&);
+    static void dequeue_runnable_thread(Thread&);
+    static void requeue_runnable_thread(Thread&);
 };
 
 }
@@ -37,6 +37,8 @@ struct StringArgument;
 String copy_string_from_user(const char*, size_t);
 String copy_string_from_user(Userspace<const char*>, size_t);
 
+[[nodiscard]] Optional<bool> user_atomic_compare_exchange_relaxed(volatile u32* var, u32& expected, u32 val);
+
 extern "C" {
 
 [[nodiscard]] bool copy_to_user(void*, const void*, size_t);
@@ -187,8 +187,8 @@ void IDEChannel::complete_current_request(AsyncDeviceRequest::RequestResult resu
 
         if (m_current_request_uses_dma) {
             if (result == AsyncDeviceRequest::Success) {
-                if (request.request_type() == AsyncBlockDeviceRequest::Read) {
-                    if (!request.write_to_buffer(request.buffer(), m_dma_buffer_page->paddr().offset(0xc0000000).as_ptr(), 512 * request.block_count())) {
+                if (request.request_type() == AsyncBlockDeviceRequest::Read && m_current_request_uses_dma_buffer) {
+                    if (!request.write_to_buffer(request.buffer(), m_dma_buffer_region->vaddr().as_ptr(), 512 * request.block_count())) {
                         request.complete(AsyncDeviceRequest::MemoryFault);
                         return;
                     }
@@ -214,8 +214,7 @@ void IDEChannel::initialize(bool force_pio)
     // Let's try to set up DMA transfers.
     PCI::enable_bus_mastering(m_parent_controller->pci_address());
     m_prdt_page = MM.allocate_supervisor_physical_page();
-    prdt().end_of_table = 0x8000;
-    m_dma_buffer_page = MM.allocate_supervisor_physical_page();
+    m_dma_buffer_region = MM.allocate_kernel_region(StorageDevice::max_transfer_size, "IDE DMA buffer", Region::Access::Read | Region::Access::Write, false, AllocationStrategy::AllocateNow);
     klog() << "IDEChannel: Bus master IDE: " << m_io_group.bus_master_base();
 }
 
@@ -364,6 +363,78 @@ void IDEChannel::detect_disks()
     }
 }
 
+bool IDEChannel::fill_prdt(VirtualAddress buffer, size_t length)
+{
+    // The bus master can only transfer whole words.
+    if ((buffer.get() & 1) || (length & 1))
+        return false;
+
+    auto* entries = prdt();
+    size_t entry_count = 0;
+    PhysicalAddress entry_base;
+    size_t entry_length = 0;
+
+    auto finish_entry = [&](bool is_last) {
+        // A size of 0 means 64 KiB.
+        entries[entry_count].offset = entry_base;
+        entries[entry_count].size = static_cast<u16>(entry_length);
+        entries[entry_count].end_of_table = is_last ? 0x8000 : 0;
+        ++entry_count;
+    };
+
+    for (size_t offset = 0; offset < length;) {
+        auto vaddr = buffer.offset(offset);
+        auto paddr = MM.physical_address_for_kernel_vaddr(vaddr);
+        if (paddr.is_null())
+            return false;
+        size_t chunk_length = min(PAGE_SIZE - (vaddr.get() & ~PAGE_MASK), length - offset);
+
+        // Physically contiguous chunks share an entry, as long as it stays
+        // within a single 64 KiB window (which also caps it at 64 KiB).
+        bool can_extend_entry = entry_length
+            && entry_base.offset(entry_length) == paddr
+            && ((entry_base.get() ^ (paddr.get() + chunk_length - 1)) & ~0xffffu) == 0;
+        if (can_extend_entry) {
+            entry_length += chunk_length;
+        } else {
+            if (entry_length) {
+                if (entry_count + 1 >= max_prdt_entries)
+                    return false;
+                finish_entry(false);
+            }
+            entry_base = paddr;
+            entry_length = chunk_length;
+        }
+        offset += chunk_length;
+    }
+
+    ASSERT(entry_length);
+    finish_entry(true);
+#ifdef PATA_DEBUG
+    dbgln("IDEChannel: PRDT for {} bytes @ {} has {} entries", length, buffer, entry_count);
+#endif
+    return true;
+}
+
+bool IDEChannel::prepare_dma_transfer(AsyncBlockDeviceRequest& request)
+{
+    size_t length = 512 * request.block_count();
+    ASSERT(length <= StorageDevice::max_transfer_size);
+
+    // Kernel buffers (like the ones the disk cache uses) can be handed to the
+    // controller directly. Anything else goes through our own DMA buffer.
+    m_current_request_uses_dma_buffer = false;
+    if (request.buffer().is_kernel_buffer() && fill_prdt(VirtualAddress(request.buffer().user_or_kernel_ptr()), length))
+        return true;
+
+    m_current_request_uses_dma_buffer = true;
+    bool filled = fill_prdt(m_dma_buffer_region->vaddr(), length);
+    ASSERT(filled);
+    if (request.request_type() == AsyncBlockDeviceRequest::Write)
+        return request.read_from_buffer(request.buffer(), m_dma_buffer_region->vaddr().as_ptr(), length);
+    return true;
+}
+
 void IDEChannel::ata_read_sectors_with_dma(bool slave_request)
 {
     auto& request = *m_current_request;
@@ -372,10 +443,10 @@ void IDEChannel::ata_read_sectors_with_dma(bool slave_request)
     dbg() << "IDEChannel::ata_read_sectors_with_dma (" << lba << " x" << request.block_count() << ")";
 #endif
 
-    prdt().offset = m_dma_buffer_page->paddr();
-    prdt().size = 512 * request.block_count();
-
-    ASSERT(prdt().size <= PAGE_SIZE);
+    if (!prepare_dma_transfer(request)) {
+        complete_current_request(AsyncDeviceRequest::MemoryFault);
+        return;
+    }
 
     // Stop bus master
     m_io_group.bus_master_base().out<u8>(0);
@@ -493,16 +564,11 @@ void IDEChannel::ata_write_sectors_with_dma(bool slave_request)
     dbg() << "IDEChannel::ata_write_sectors_with_dma (" << lba << " x" << request.block_count() << ")";
 #endif
 
-    prdt().offset = m_dma_buffer_page->paddr();
-    prdt().size = 512 * request.block_count();
-
-    if (!request.read_from_buffer(request.buffer(), m_dma_buffer_page->paddr().offset(0xc0000000).as_ptr(), 512 * request.block_count())) {
+    if (!prepare_dma_transfer(request)) {
         complete_current_request(AsyncDeviceRequest::MemoryFault);
         return;
     }
 
-    ASSERT(prdt().size <= PAGE_SIZE);
-
     // Stop bus master
     m_io_group.bus_master_base().out<u8>(0);
 
@@ -123,6 +123,9 @@ private:
     void start_request(AsyncBlockDeviceRequest&, bool, bool);
     void complete_current_request(AsyncDeviceRequest::RequestResult);
 
+    bool fill_prdt(VirtualAddress buffer, size_t length);
+    bool prepare_dma_transfer(AsyncBlockDeviceRequest&);
+
     void ata_read_sectors_with_dma(bool);
     void ata_read_sectors(bool);
     bool ata_do_read_sector();
@@ -135,9 +138,11 @@ private:
 
     volatile u8 m_device_error { 0 };
 
-    PhysicalRegionDescriptor& prdt() { return *reinterpret_cast<PhysicalRegionDescriptor*>(m_prdt_page->paddr().offset(0xc0000000).as_ptr()); }
+    static constexpr size_t max_prdt_entries = PAGE_SIZE / sizeof(PhysicalRegionDescriptor);
+
+    PhysicalRegionDescriptor* prdt() { return reinterpret_cast<PhysicalRegionDescriptor*>(m_prdt_page->paddr().offset(0xc0000000).as_ptr()); }
     RefPtr<PhysicalPage> m_prdt_page;
-    RefPtr<PhysicalPage> m_dma_buffer_page;
+    OwnPtr<Region> m_dma_buffer_region;
     Lockable<bool> m_dma_enabled;
     EntropySource m_entropy_source;
 
@@ -147,6 +152,7 @@ private:
     AsyncBlockDeviceRequest* m_current_request { nullptr };
     u32 m_current_request_block_index { 0 };
     bool m_current_request_uses_dma { false };
+    bool m_current_request_uses_dma_buffer { false };
     bool m_current_request_flushing_cache { false };
     SpinLock<u8> m_request_lock;
 
@@ -52,10 +52,25 @@ const DiskPartitionMetadata& DiskPartition::metadata() const
     return m_metadata;
 }
 
+void DiskPartition::queue_request(NonnullRefPtr<AsyncDeviceRequest> request)
+{
+    // We don't queue anything ourselves, the request is forwarded to the
+    // underlying device right away so it can be scheduled there along with
+    // requests for other partitions.
+    start_queued_request(*request);
+}
+
+void DiskPartition::process_next_queued_request(Badge<AsyncDeviceRequest>, const AsyncDeviceRequest&)
+{
+    evaluate_block_conditions();
+}
+
 void DiskPartition::start_request(AsyncBlockDeviceRequest& request)
 {
-    request.add_sub_request(m_device->make_request<AsyncBlockDeviceRequest>(request.request_type(),
+    // NOTE: add_sub_request() queues the sub-request on the underlying device.
+    auto sub_request = adopt(*new AsyncBlockDeviceRequest(*m_device, request.request_type(),
         request.block_index() + m_metadata.start_block(), request.block_count(), request.buffer(), request.buffer_size()));
+    request.add_sub_request(move(sub_request));
 }
 
 KResultOr<size_t> DiskPartition::read(FileDescription& fd, size_t offset, UserOrKernelBuffer& outbuf, size_t len)
@@ -47,6 +47,8 @@ public:
 
     // ^Device
     virtual mode_t required_mode() const override { return 0600; }
+    virtual void queue_request(NonnullRefPtr<AsyncDeviceRequest>) override;
+    virtual void process_next_queued_request(Badge<AsyncDeviceRequest>, const AsyncDeviceRequest&) override;
 
     const DiskPartitionMetadata& metadata() const;
 
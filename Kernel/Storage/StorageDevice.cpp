@@ -38,6 +38,7 @@ StorageDevice::StorageDevice(const StorageController& controller, int major, int
     , m_storage_controller(controller)
     , m_max_addressable_block(max_addressable_block)
 {
+    enable_request_merging(max_transfer_size / sector_size);
 }
 
 const char* StorageDevice::class_name() const
@@ -56,12 +57,10 @@ KResultOr<size_t> StorageDevice::read(FileDescription&, size_t offset, UserOrKer
     u16 whole_blocks = len / block_size();
     ssize_t remaining = len % block_size();
 
-    unsigned blocks_per_page = PAGE_SIZE / block_size();
+    unsigned max_blocks_per_request = max_transfer_size / block_size();
 
-    // PATAChannel will chuck a wobbly if we try to read more than PAGE_SIZE
-    // at a time, because it uses a single page for its DMA buffer.
-    if (whole_blocks >= blocks_per_page) {
-        whole_blocks = blocks_per_page;
+    if (whole_blocks >= max_blocks_per_request) {
+        whole_blocks = max_blocks_per_request;
         remaining = 0;
     }
 
@@ -123,12 +122,10 @@ KResultOr<size_t> StorageDevice::write(FileDescription&, size_t offset, const Us
     u16 whole_blocks = len / block_size();
     ssize_t remaining = len % block_size();
 
-    unsigned blocks_per_page = PAGE_SIZE / block_size();
+    unsigned max_blocks_per_request = max_transfer_size / block_size();
 
-    // PATAChannel will chuck a wobbly if we try to write more than PAGE_SIZE
-    // at a time, because it uses a single page for its DMA buffer.
-    if (whole_blocks >= blocks_per_page) {
-        whole_blocks = blocks_per_page;
+    if (whole_blocks >= max_blocks_per_request) {
+        whole_blocks = max_blocks_per_request;
         remaining = 0;
     }
 
@@ -44,6 +44,9 @@ public:
     };
 
 public:
+    // The largest transfer we hand to a controller in a single request.
+    static constexpr size_t max_transfer_size = 64 * KiB;
+
     virtual Type type() const = 0;
     virtual size_t max_addressable_block() const { return m_max_addressable_block; }
 
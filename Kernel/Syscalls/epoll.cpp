@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/Checked.h>
+#include <Kernel/FileSystem/EventPoll.h>
+#include <Kernel/FileSystem/FileDescription.h>
+#include <Kernel/Process.h>
+
+namespace Kernel {
+
+int Process::sys$epoll_create(int flags)
+{
+    REQUIRE_PROMISE(stdio);
+
+    // Reject flags other than O_CLOEXEC.
+    if ((flags & O_CLOEXEC) != flags)
+        return -EINVAL;
+
+    int fd = alloc_fd();
+    if (fd < 0)
+        return fd;
+
+    auto description_or_error = FileDescription::create(*EventPoll::create());
+    if (description_or_error.is_error())
+        return description_or_error.error();
+
+    auto description = description_or_error.release_value();
+    description->set_readable(true);
+
+    u32 fd_flags = (flags & O_CLOEXEC) ? FD_CLOEXEC : 0;
+    m_fds[fd].set(move(description), fd_flags);
+    return fd;
+}
+
+static RefPtr<FileDescription> event_poll_description(const Process& process, int epfd, int& error)
+{
+    auto description = process.file_description(epfd);
+    if (!description) {
+        error = -EBADF;
+        return nullptr;
+    }
+    if (!description->file().is_event_poll()) {
+        error = -EINVAL;
+        return nullptr;
+    }
+    return description;
+}
+
+int Process::sys$epoll_ctl(Userspace<const Syscall::SC_epoll_ctl_params*> user_params)
+{
+    REQUIRE_PROMISE(stdio);
+
+    Syscall::SC_epoll_ctl_params params;
+    if (!copy_from_user(&params, user_params))
+        return -EFAULT;
+
+    int error = 0;
+    auto epoll_description = event_poll_description(*this, params.epfd, error);
+    if (!epoll_description)
+        return error;
+    auto& event_poll = static_cast<EventPoll&>(epoll_description->file());
+
+    // The fd may already be closed, removing it only needs the fd number.
+    if (params.op == EPOLL_CTL_DEL)
+        return event_poll.remove(params.fd);
+
+    if (params.op != EPOLL_CTL_ADD && params.op != EPOLL_CTL_MOD)
+        return -EINVAL;
+
+    epoll_event event;
+    if (!copy_from_user(&event, params.event))
+        return -EFAULT;
+
+    auto description = file_description(params.fd);
+    if (!description)
+        return -EBADF;
+    // FIXME: Support nesting EventPolls. This needs loop detection, and a way
+    //        to notify an outer EventPoll without holding the inner one's locks.
+    if (description->file().is_event_poll())
+        return -EINVAL;
+
+    if (params.op == EPOLL_CTL_ADD)
+        return event_poll.add(params.fd, *description, event);
+    return event_poll.modify(params.fd, *description, event);
+}
+
+int Process::sys$epoll_wait(Userspace<const Syscall::SC_epoll_wait_params*> user_params)
+{
+    REQUIRE_PROMISE(stdio);
+
+    Syscall::SC_epoll_wait_params params;
+    if (!copy_from_user(&params, user_params))
+        return -EFAULT;
+
+    if (params.max_events <= 0)
+        return -EINVAL;
+    Checked<size_t> events_size = sizeof(epoll_event);
+    events_size *= params.max_events;
+    if (events_size.has_overflow())
+        return -EFAULT;
+
+    Thread::BlockTimeout timeout;
+    if (params.timeout) {
+        timespec timeout_copy;
+        if (!copy_from_user(&timeout_copy, params.timeout))
+            return -EFAULT;
+        timeout = Thread::BlockTimeout(false, &timeout_copy);
+    }
+
+    int error = 0;
+    auto epoll_description = event_poll_description(*this, params.epfd, error);
+    if (!epoll_description)
+        return error;
+    auto& event_poll = static_cast<EventPoll&>(epoll_description->file());
+
+    Vector<epoll_event> events;
+    auto result = event_poll.wait(events, params.max_events, timeout);
+    if (result.is_error())
+        return result.error();
+
+    if (!events.is_empty() && !copy_to_user(params.events, events.data(), events.size() * sizeof(epoll_event)))
+        return -EFAULT;
+    return events.size();
+}
+
+}
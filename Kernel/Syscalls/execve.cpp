@@ -30,6 +30,7 @@
 #include <AK/WeakPtr.h>
 #include <Kernel/FileSystem/Custody.h>
 #include <Kernel/FileSystem/FileDescription.h>
+#include <Kernel/FileSystem/VirtualFileSystem.h>
 #include <Kernel/PerformanceEventBuffer.h>
 #include <Kernel/Process.h>
 #include <Kernel/Random.h>
@@ -37,6 +38,7 @@
 #include <Kernel/VM/AllocationStrategy.h>
 #include <Kernel/VM/MemoryManager.h>
 #include <Kernel/VM/PageDirectory.h>
+#include <Kernel/VM/ProcessPagingScope.h>
 #include <Kernel/VM/Region.h>
 #include <Kernel/VM/SharedInodeVMObject.h>
 #include <LibC/limits.h>
@@ -282,7 +284,7 @@ KResultOr<Process::LoadResult> Process::load_elf_object(FileDescription& object_
 KResultOr<Process::LoadResult> Process::load(NonnullRefPtr<FileDescription> main_program_description, RefPtr<FileDescription> interpreter_description, const Elf32_Ehdr& main_program_header)
 {
     RefPtr<PageDirectory> old_page_directory;
-    NonnullOwnPtrVector<Region> old_regions;
+    RegionTree old_regions;
 
     {
         auto page_directory = PageDirectory::create_for_userspace(*this);
@@ -292,22 +294,35 @@ KResultOr<Process::LoadResult> Process::load(NonnullRefPtr<FileDescription> main
         // Need to make sure we don't swap contexts in the middle
         ScopedCritical critical;
         old_page_directory = move(m_page_directory);
-        old_regions = move(m_regions);
+        {
+            ScopedSpinLock lock(m_lock);
+            ScopedSpinLock mm_lock(s_mm_lock);
+            old_regions = move(m_regions);
+            m_last_faulting_region = nullptr;
+        }
         m_page_directory = page_directory.release_nonnull();
         MM.enter_process_paging_scope(*this);
     }
 
     ArmedScopeGuard rollback_regions_guard([&]() {
-        ASSERT(Process::current() == this);
         // Need to make sure we don't swap contexts in the middle
         ScopedCritical critical;
         // Explicitly clear m_regions *before* restoring the page directory,
         // otherwise we may silently corrupt memory!
-        m_regions.clear();
+        RegionTree new_regions;
+        {
+            ScopedSpinLock lock(m_lock);
+            ScopedSpinLock mm_lock(s_mm_lock);
+            new_regions = move(m_regions);
+            m_last_faulting_region = nullptr;
+        }
+        new_regions.clear();
         // Now that we freed the regions, revert to the original page directory
         // and restore the original regions
         m_page_directory = move(old_page_directory);
         MM.enter_process_paging_scope(*this);
+        ScopedSpinLock lock(m_lock);
+        ScopedSpinLock mm_lock(s_mm_lock);
         m_regions = move(old_regions);
     });
 
@@ -515,8 +530,21 @@ int Process::do_exec(NonnullRefPtr<FileDescription> main_program_description, Ve
     m_veil_state = VeilState::None;
     m_unveiled_paths.clear();
 
-    current_thread->set_default_signal_dispositions();
-    current_thread->clear_signals();
+    new_main_thread = nullptr;
+    if (&current_thread->process() == this) {
+        new_main_thread = current_thread;
+    } else {
+        for_each_thread([&](auto& thread) {
+            new_main_thread = &thread;
+            return IterationDecision::Break;
+        });
+    }
+    ASSERT(new_main_thread);
+
+    // NOTE: The current thread may belong to another process (e.g. the parent in
+    //       sys$posix_spawn), so reset the thread that's going to run the program.
+    new_main_thread->set_default_signal_dispositions();
+    new_main_thread->clear_signals();
 
     m_futex_queues.clear();
 
@@ -541,17 +569,6 @@ int Process::do_exec(NonnullRefPtr<FileDescription> main_program_description, Ve
         m_fds[main_program_fd].set(move(main_program_description), FD_CLOEXEC);
     }
 
-    new_main_thread = nullptr;
-    if (&current_thread->process() == this) {
-        new_main_thread = current_thread;
-    } else {
-        for_each_thread([&](auto& thread) {
-            new_main_thread = &thread;
-            return IterationDecision::Break;
-        });
-    }
-    ASSERT(new_main_thread);
-
     auto auxv = generate_auxiliary_vector(load_result.load_base, load_result.entry_eip, m_uid, m_euid, m_gid, m_egid, path, main_program_fd);
 
     // NOTE: We create the new stack before disabling interrupts since it will zero-fault
@@ -856,6 +873,29 @@ int Process::exec(String path, Vector<String> arguments, Vector<String> environm
     return 0;
 }
 
+static constexpr size_t max_posix_spawn_file_actions = 256;
+
+static bool copy_user_strings(const Syscall::StringListArgument& list, Vector<String>& output)
+{
+    if (!list.length)
+        return true;
+    Checked size = sizeof(list.strings);
+    size *= list.length;
+    if (size.has_overflow())
+        return false;
+    Vector<Syscall::StringArgument, 32> strings;
+    strings.resize(list.length);
+    if (!copy_from_user(strings.data(), list.strings, list.length * sizeof(Syscall::StringArgument)))
+        return false;
+    for (size_t i = 0; i < list.length; ++i) {
+        auto string = copy_string_from_user(strings[i]);
+        if (string.is_null())
+            return false;
+        output.append(move(string));
+    }
+    return true;
+}
+
 int Process::sys$execve(Userspace<const Syscall::SC_execve_params*> user_params)
 {
     REQUIRE_PROMISE(exec);
@@ -877,26 +917,6 @@ int Process::sys$execve(Userspace<const Syscall::SC_execve_params*> user_params)
         path = path_arg.value();
     }
 
-    auto copy_user_strings = [](const auto& list, auto& output) {
-        if (!list.length)
-            return true;
-        Checked size = sizeof(list.strings);
-        size *= list.length;
-        if (size.has_overflow())
-            return false;
-        Vector<Syscall::StringArgument, 32> strings;
-        strings.resize(list.length);
-        if (!copy_from_user(strings.data(), list.strings, list.length * sizeof(Syscall::StringArgument)))
-            return false;
-        for (size_t i = 0; i < list.length; ++i) {
-            auto string = copy_string_from_user(strings[i]);
-            if (string.is_null())
-                return false;
-            output.append(move(string));
-        }
-        return true;
-    };
-
     Vector<String> arguments;
     if (!copy_user_strings(params.arguments, arguments))
         return -EFAULT;
@@ -910,4 +930,174 @@ int Process::sys$execve(Userspace<const Syscall::SC_execve_params*> user_params)
     return rc;
 }
 
+KResult Process::apply_spawn_file_action(Process& child, const Syscall::SC_posix_spawn_file_action& action)
+{
+    using Type = Syscall::SC_posix_spawn_file_action::Type;
+    switch (action.type) {
+    case Type::Close: {
+        auto description = child.file_description(action.fd);
+        if (!description)
+            return KResult(-EBADF);
+        int rc = description->close();
+        child.m_fds[action.fd] = {};
+        return KResult(rc);
+    }
+    case Type::Dup2: {
+        auto description = child.file_description(action.fd);
+        if (!description)
+            return KResult(-EBADF);
+        if (action.fd == action.new_fd)
+            return KSuccess;
+        if (action.new_fd < 0 || action.new_fd >= m_max_open_file_descriptors)
+            return KResult(-EBADF);
+        child.m_fds[action.new_fd].set(*description);
+        return KSuccess;
+    }
+    case Type::Open: {
+        if (action.options & O_WRONLY)
+            REQUIRE_PROMISE(wpath);
+        else if (action.options & O_RDONLY)
+            REQUIRE_PROMISE(rpath);
+        if (action.options & O_CREAT)
+            REQUIRE_PROMISE(cpath);
+        if (action.options & (O_NOFOLLOW_NOERROR | O_UNLINK_INTERNAL))
+            return KResult(-EINVAL);
+        if (action.fd < 0 || action.fd >= m_max_open_file_descriptors)
+            return KResult(-EBADF);
+        auto path = get_syscall_path_argument(action.path);
+        if (path.is_error())
+            return path.error();
+        // Ignore everything except permission bits.
+        u16 mode = action.mode & 04777;
+        auto result = VFS::the().open(path.value(), action.options, mode & ~child.umask(), child.current_directory());
+        if (result.is_error())
+            return result.error();
+        auto description = result.value();
+        if (description->inode() && description->inode()->socket())
+            return KResult(-ENXIO);
+        u32 fd_flags = (action.options & O_CLOEXEC) ? FD_CLOEXEC : 0;
+        child.m_fds[action.fd].set(move(description), fd_flags);
+        return KSuccess;
+    }
+    case Type::Chdir: {
+        REQUIRE_PROMISE(rpath);
+        auto path = get_syscall_path_argument(action.path);
+        if (path.is_error())
+            return path.error();
+        auto directory_or_error = VFS::the().open_directory(path.value(), child.current_directory());
+        if (directory_or_error.is_error())
+            return directory_or_error.error();
+        child.m_cwd = *directory_or_error.value();
+        return KSuccess;
+    }
+    case Type::Fchdir: {
+        auto description = child.file_description(action.fd);
+        if (!description)
+            return KResult(-EBADF);
+        if (!description->is_directory())
+            return KResult(-ENOTDIR);
+        if (!description->metadata().may_execute(child))
+            return KResult(-EACCES);
+        child.m_cwd = description->custody();
+        return KSuccess;
+    }
+    }
+    return KResult(-EINVAL);
+}
+
+pid_t Process::sys$posix_spawn(Userspace<const Syscall::SC_posix_spawn_params*> user_params)
+{
+    REQUIRE_PROMISE(proc);
+    REQUIRE_PROMISE(exec);
+
+    // This is fork() + exec() without the fork: the child starts out with a
+    // fresh address space and the new program is loaded straight into it,
+    // so the cost doesn't depend on how much memory the parent has mapped.
+    Syscall::SC_posix_spawn_params params;
+    if (!copy_from_user(&params, user_params))
+        return -EFAULT;
+
+    if (params.arguments.length > ARG_MAX || params.environment.length > ARG_MAX)
+        return -E2BIG;
+
+    auto path = get_syscall_path_argument(params.path);
+    if (path.is_error())
+        return path.error();
+
+    Vector<String> arguments;
+    if (!copy_user_strings(params.arguments, arguments))
+        return -EFAULT;
+
+    Vector<String> environment;
+    if (!copy_user_strings(params.environment, environment))
+        return -EFAULT;
+
+    // The count comes straight from userspace, so keep the allocation below small and bounded.
+    if (params.file_actions.size > max_posix_spawn_file_actions)
+        return -E2BIG;
+    Vector<Syscall::SC_posix_spawn_file_action> file_actions;
+    if (params.file_actions.size) {
+        file_actions.resize(params.file_actions.size);
+        if (!copy_from_user(file_actions.data(), params.file_actions.data, params.file_actions.size * sizeof(Syscall::SC_posix_spawn_file_action)))
+            return -EFAULT;
+    }
+
+    // Catch the common failure (a bad path) before we build a whole process
+    // for it. If a file action changes the child's working directory, the
+    // path can only be resolved once that has happened, so leave it to exec.
+    bool file_actions_change_directory = file_actions.first_matching([](auto& action) {
+        return action.type == Syscall::SC_posix_spawn_file_action::Type::Chdir
+            || action.type == Syscall::SC_posix_spawn_file_action::Type::Fchdir;
+    }).has_value();
+    if (!file_actions_change_directory) {
+        auto executable_or_error = VFS::the().open(path.value(), O_EXEC, 0, current_directory());
+        if (executable_or_error.is_error())
+            return executable_or_error.error();
+        if (!executable_or_error.value()->inode())
+            return -ENOEXEC;
+    }
+
+    RefPtr<Thread> child_first_thread;
+    auto child = adopt(*new Process(child_first_thread, m_name, m_uid, m_gid, m_pid, false, m_cwd, m_executable, m_tty));
+    if (!child_first_thread)
+        return -ENOMEM;
+
+    // Until the child is published, a failure has to take it down again
+    // without it ever having been seen by the scheduler or by waitpid().
+    ArmedScopeGuard discard_child_guard([&] {
+        child_first_thread->discard_before_first_run();
+    });
+
+    copy_inherited_state_to(*child);
+    child_first_thread->update_signal_mask(Thread::current()->signal_mask());
+
+    for (auto& action : file_actions) {
+        auto result = apply_spawn_file_action(*child, action);
+        if (result.is_error())
+            return result;
+    }
+
+    int rc;
+    {
+        // Loading the program switches us over to the child's page directory,
+        // so make sure we come back to our own afterwards.
+        ProcessPagingScope paging_scope(*child);
+        rc = child->exec(path.value(), move(arguments), move(environment));
+    }
+    if (rc < 0)
+        return rc;
+
+    discard_child_guard.disarm();
+    {
+        ScopedSpinLock lock(g_processes_lock);
+        g_processes->prepend(child);
+    }
+
+    auto child_pid = child->pid().value();
+    // We need to leak one reference so we don't destroy the Process,
+    // which will be dropped by Process::reap
+    (void)child.leak_ref();
+    return child_pid;
+}
+
 }
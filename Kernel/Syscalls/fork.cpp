@@ -34,6 +34,21 @@
 
 namespace Kernel {
 
+void Process::copy_inherited_state_to(Process& child)
+{
+    child.m_root_directory = m_root_directory;
+    child.m_root_directory_relative_to_global_root = m_root_directory_relative_to_global_root;
+    child.m_promises = m_promises;
+    child.m_execpromises = m_execpromises;
+    child.m_veil_state = m_veil_state;
+    child.m_unveiled_paths = m_unveiled_paths.deep_copy();
+    child.m_fds = m_fds;
+    child.m_sid = m_sid;
+    child.m_pg = m_pg;
+    child.m_umask = m_umask;
+    child.m_extra_gids = m_extra_gids;
+}
+
 pid_t Process::sys$fork(RegisterState& regs)
 {
     REQUIRE_PROMISE(proc);
@@ -41,23 +56,12 @@ pid_t Process::sys$fork(RegisterState& regs)
     auto child = adopt(*new Process(child_first_thread, m_name, m_uid, m_gid, m_pid, m_is_kernel_process, m_cwd, m_executable, m_tty, this));
     if (!child_first_thread)
         return -ENOMEM;
-    child->m_root_directory = m_root_directory;
-    child->m_root_directory_relative_to_global_root = m_root_directory_relative_to_global_root;
-    child->m_promises = m_promises;
-    child->m_execpromises = m_execpromises;
-    child->m_veil_state = m_veil_state;
-    child->m_unveiled_paths = m_unveiled_paths.deep_copy();
-    child->m_fds = m_fds;
-    child->m_sid = m_sid;
-    child->m_pg = m_pg;
-    child->m_umask = m_umask;
+    copy_inherited_state_to(*child);
 
 #ifdef FORK_DEBUG
     dbg() << "fork: child=" << child;
 #endif
 
-    child->m_extra_gids = m_extra_gids;
-
     auto& child_tss = child_first_thread->m_tss;
     child_tss.eax = 0; // fork() returns 0 in the child :^)
     child_tss.ebx = regs.ebx;
@@ -86,19 +90,21 @@ pid_t Process::sys$fork(RegisterState& regs)
         ScopedSpinLock lock(m_lock);
         for (auto& region : m_regions) {
 #ifdef FORK_DEBUG
-            dbg() << "fork: cloning Region{" << &region << "} '" << region.name() << "' @ " << region.vaddr();
+            dbg() << "fork: cloning Region{" << region.ptr() << "} '" << region->name() << "' @ " << region->vaddr();
 #endif
-            auto region_clone = region.clone(*child);
+            auto region_clone = region->clone(*child);
             if (!region_clone) {
                 dbgln("fork: Cannot clone region, insufficient memory");
                 // TODO: tear down new process?
                 return -ENOMEM;
             }
 
+            // Most children exec right away, so don't spend time building page
+            // tables they'll never use. Pages get mapped as the child faults on them.
             auto& child_region = child->add_region(region_clone.release_nonnull());
-            child_region.map(child->page_directory());
+            child_region.map_on_demand(child->page_directory());
 
-            if (&region == m_master_tls_region.unsafe_ptr())
+            if (region.ptr() == m_master_tls_region.unsafe_ptr())
                 child->m_master_tls_region = child_region;
         }
 
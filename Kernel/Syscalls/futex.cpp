@@ -37,6 +37,56 @@ WaitQueue& Process::futex_queue(Userspace<const i32*> userspace_address)
     return *queue;
 }
 
+static Optional<bool> futex_wake_op_compare(u32 encoded_op, i32 old_value)
+{
+    u32 cmp = (encoded_op >> 24) & 0xf;
+    // Sign-extend the 12-bit comparison argument
+    i32 cmparg = (i32)(encoded_op << 20) >> 20;
+    switch (cmp) {
+    case FUTEX_OP_CMP_EQ:
+        return old_value == cmparg;
+    case FUTEX_OP_CMP_NE:
+        return old_value != cmparg;
+    case FUTEX_OP_CMP_LT:
+        return old_value < cmparg;
+    case FUTEX_OP_CMP_LE:
+        return old_value <= cmparg;
+    case FUTEX_OP_CMP_GT:
+        return old_value > cmparg;
+    case FUTEX_OP_CMP_GE:
+        return old_value >= cmparg;
+    default:
+        return {};
+    }
+}
+
+static Optional<i32> futex_wake_op_apply(u32 encoded_op, i32 old_value)
+{
+    u32 op = (encoded_op >> 28) & 0xf;
+    // Sign-extend the 12-bit operation argument
+    i32 oparg = (i32)(encoded_op << 8) >> 20;
+    if (op & FUTEX_OP_OPARG_SHIFT) {
+        if (oparg < 0 || oparg > 31)
+            return {};
+        oparg = 1 << oparg;
+        op &= ~FUTEX_OP_OPARG_SHIFT;
+    }
+    switch (op) {
+    case FUTEX_OP_SET:
+        return oparg;
+    case FUTEX_OP_ADD:
+        return (i32)((u32)old_value + (u32)oparg);
+    case FUTEX_OP_OR:
+        return old_value | oparg;
+    case FUTEX_OP_ANDN:
+        return old_value & ~oparg;
+    case FUTEX_OP_XOR:
+        return old_value ^ oparg;
+    default:
+        return {};
+    }
+}
+
 int Process::sys$futex(Userspace<const Syscall::SC_futex_params*> user_params)
 {
     REQUIRE_PROMISE(thread);
@@ -67,20 +117,74 @@ int Process::sys$futex(Userspace<const Syscall::SC_futex_params*> user_params)
             return -ETIMEDOUT;
         }
 
-        break;
+        return 0;
     }
     case FUTEX_WAKE:
-        if (params.val == 0)
+        if (params.val <= 0)
             return 0;
-        if (params.val == 1) {
-            futex_queue((FlatPtr)params.userspace_address).wake_one();
-        } else {
-            futex_queue((FlatPtr)params.userspace_address).wake_n(params.val);
+        if (params.val == 1)
+            return futex_queue((FlatPtr)params.userspace_address).wake_one();
+        return futex_queue((FlatPtr)params.userspace_address).wake_n(params.val);
+
+    case FUTEX_REQUEUE:
+    case FUTEX_CMP_REQUEUE: {
+        if (params.val < 0)
+            return -EINVAL;
+        if (params.futex_op == FUTEX_CMP_REQUEUE) {
+            i32 user_value;
+            if (!copy_from_user(&user_value, params.userspace_address))
+                return -EFAULT;
+            if (user_value != params.val3)
+                return -EAGAIN;
         }
-        break;
+        if (!params.userspace_address2)
+            return -EFAULT;
+
+        // Wake up to val waiters, and move up to val2 of the remaining ones
+        // over to the second futex without waking them. This lets e.g. a
+        // condition variable broadcast hand its waiters to the mutex one at
+        // a time, instead of having them all stampede for it.
+        WaitQueue& wait_queue = futex_queue((FlatPtr)params.userspace_address);
+        u32 woken = wait_queue.wake_n(params.val);
+        u32 requeued = wait_queue.requeue(futex_queue((FlatPtr)params.userspace_address2), params.val2);
+        return woken + requeued;
+    }
+    case FUTEX_WAKE_OP: {
+        if (params.val < 0)
+            return -EINVAL;
+        if (!params.userspace_address2)
+            return -EFAULT;
+        u32 encoded_op = (u32)params.val3;
+        if (!futex_wake_op_compare(encoded_op, 0).has_value())
+            return -EINVAL;
+
+        // Atomically apply the operation to the second futex word, then
+        // wake up to val waiters on the first futex and, if the old value
+        // of the second one passes the comparison, up to val2 on it too.
+        i32 old_value;
+        if (!copy_from_user(&old_value, params.userspace_address2))
+            return -EFAULT;
+        for (;;) {
+            auto new_value = futex_wake_op_apply(encoded_op, old_value);
+            if (!new_value.has_value())
+                return -EINVAL;
+            u32 expected = (u32)old_value;
+            auto did_exchange = user_atomic_compare_exchange_relaxed((volatile u32*)params.userspace_address2, expected, (u32)new_value.value());
+            if (!did_exchange.has_value())
+                return -EFAULT;
+            if (did_exchange.value())
+                break;
+            old_value = (i32)expected;
+        }
+
+        u32 woken = futex_queue((FlatPtr)params.userspace_address).wake_n(params.val);
+        if (futex_wake_op_compare(encoded_op, old_value).value())
+            woken += futex_queue((FlatPtr)params.userspace_address2).wake_n(params.val2);
+        return woken;
+    }
     }
 
-    return 0;
+    return -ENOSYS;
 }
 
 }
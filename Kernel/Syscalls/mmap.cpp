@@ -27,6 +27,7 @@
 #include <AK/WeakPtr.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/Process.h>
+#include <Kernel/VM/AnonymousVMObject.h>
 #include <Kernel/VM/PageDirectory.h>
 #include <Kernel/VM/PrivateInodeVMObject.h>
 #include <Kernel/VM/Region.h>
@@ -119,6 +120,7 @@ void* Process::sys$mmap(Userspace<const Syscall::SC_mmap_params*> user_params)
     bool map_stack = flags & MAP_STACK;
     bool map_fixed = flags & MAP_FIXED;
     bool map_noreserve = flags & MAP_NORESERVE;
+    bool map_huge = flags & MAP_HUGETLB;
 
     if (map_shared && map_private)
         return (void*)-EINVAL;
@@ -132,6 +134,14 @@ void* Process::sys$mmap(Userspace<const Syscall::SC_mmap_params*> user_params)
     if (map_stack && (!map_private || !map_anonymous))
         return (void*)-EINVAL;
 
+    if (map_huge) {
+        // Huge pages are allocated up front, so they can't be combined with
+        // lazily allocated memory.
+        if (!map_anonymous || map_noreserve || map_stack)
+            return (void*)-EINVAL;
+        alignment = max(alignment, (size_t)HUGE_PAGE_SIZE);
+    }
+
     Region* region = nullptr;
     Optional<Range> range;
     if (map_noreserve || map_anonymous) {
@@ -140,7 +150,15 @@ void* Process::sys$mmap(Userspace<const Syscall::SC_mmap_params*> user_params)
             return (void*)-ENOMEM;
     }
 
-    if (map_anonymous) {
+    if (map_huge) {
+        auto vmobject = AnonymousVMObject::create_with_huge_pages(range.value().size());
+        if (!vmobject)
+            return (void*)-ENOMEM;
+        auto region_or_error = allocate_region_with_vmobject(range.value(), vmobject.release_nonnull(), 0, !name.is_null() ? name : "mmap (huge)", prot, map_shared);
+        if (region_or_error.is_error())
+            return (void*)region_or_error.error().error();
+        region = region_or_error.value();
+    } else if (map_anonymous) {
         auto strategy = map_noreserve ? AllocationStrategy::None : AllocationStrategy::Reserve;
         auto region_or_error = allocate_region(range.value(), !name.is_null() ? name : "mmap", prot, strategy);
         if (region_or_error.is_error() && (!map_fixed && addr != 0))
@@ -236,19 +254,24 @@ int Process::sys$mprotect(void* addr, size_t size, int prot)
             return -EACCES;
         }
 
+        // Take the old region out of the region tree first, since one of the
+        // replacement regions may start at the same address.
+        auto region = take_region(*old_region);
+        ASSERT(region);
+
         // This vector is the region(s) adjacent to our range.
         // We need to allocate a new region for the range we wanted to change permission bits on.
-        auto adjacent_regions = split_region_around_range(*old_region, range_to_mprotect);
+        auto adjacent_regions = split_region_around_range(*region, range_to_mprotect);
 
-        size_t new_range_offset_in_vmobject = old_region->offset_in_vmobject() + (range_to_mprotect.base().get() - old_region->range().base().get());
-        auto& new_region = allocate_split_region(*old_region, range_to_mprotect, new_range_offset_in_vmobject);
+        size_t new_range_offset_in_vmobject = region->offset_in_vmobject() + (range_to_mprotect.base().get() - region->range().base().get());
+        auto& new_region = allocate_split_region(*region, range_to_mprotect, new_range_offset_in_vmobject);
         new_region.set_readable(prot & PROT_READ);
         new_region.set_writable(prot & PROT_WRITE);
         new_region.set_executable(prot & PROT_EXEC);
 
         // Unmap the old region here, specifying that we *don't* want the VM deallocated.
-        old_region->unmap(Region::ShouldDeallocateVirtualMemoryRange::No);
-        deallocate_region(*old_region);
+        region->unmap(Region::ShouldDeallocateVirtualMemoryRange::No);
+        region = nullptr;
 
         // Map the new regions using our page directory (they were just allocated and don't have one).
         for (auto* adjacent_region : adjacent_regions) {
@@ -397,11 +420,16 @@ int Process::sys$munmap(void* addr, size_t size)
         if (!old_region->is_mmap())
             return -EPERM;
 
-        auto new_regions = split_region_around_range(*old_region, range_to_unmap);
+        // Take the old region out of the region tree first, since one of the
+        // replacement regions may start at the same address.
+        auto region = take_region(*old_region);
+        ASSERT(region);
+
+        auto new_regions = split_region_around_range(*region, range_to_unmap);
 
         // We manually unmap the old region here, specifying that we *don't* want the VM deallocated.
-        old_region->unmap(Region::ShouldDeallocateVirtualMemoryRange::No);
-        deallocate_region(*old_region);
+        region->unmap(Region::ShouldDeallocateVirtualMemoryRange::No);
+        region = nullptr;
 
         // Instead we give back the unwanted VM manually.
         page_directory().range_allocator().deallocate(range_to_unmap);
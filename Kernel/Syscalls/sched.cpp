@@ -132,7 +132,12 @@ int Process::sys$set_process_boost(pid_t pid, int amount)
         return -ESRCH;
     if (!is_superuser() && process->uid() != euid())
         return -EPERM;
+    ScopedSpinLock scheduler_lock(g_scheduler_lock);
     process->m_priority_boost = amount;
+    process->for_each_thread([](Thread& thread) {
+        Scheduler::requeue_runnable_thread(thread);
+        return IterationDecision::Continue;
+    });
     return 0;
 }
 
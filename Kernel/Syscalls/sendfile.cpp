@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/Checked.h>
+#include <AK/NumericLimits.h>
+#include <Kernel/FileSystem/FileDescription.h>
+#include <Kernel/FileSystem/Inode.h>
+#include <Kernel/KBuffer.h>
+#include <Kernel/Process.h>
+#include <Kernel/VM/AnonymousVMObject.h>
+#include <Kernel/VM/MemoryManager.h>
+#include <Kernel/VM/SharedInodeVMObject.h>
+
+namespace Kernel {
+
+// How much data we move per write to the output description.
+static constexpr size_t sendfile_chunk_size = 16 * PAGE_SIZE;
+
+ssize_t Process::sendfile_from_page_cache(FileDescription& out_description, SharedInodeVMObject& page_cache, off_t offset, size_t count)
+{
+    size_t size = page_cache.inode().size();
+    if (static_cast<size_t>(offset) >= size)
+        return 0;
+    size_t remaining = min(count, size - offset);
+
+    // The cached pages are mapped into a kernel window and written out from
+    // there, so the data never goes through userspace or a bounce buffer.
+    auto window = AnonymousVMObject::create_with_size(sendfile_chunk_size, AllocationStrategy::None);
+    if (!window)
+        return -ENOMEM;
+    auto region = MM.allocate_kernel_region_with_vmobject(*window, sendfile_chunk_size, "sendfile", Region::Access::Read);
+    if (!region)
+        return -ENOMEM;
+
+    size_t nsent = 0;
+    while (nsent < remaining) {
+        size_t position = offset + nsent;
+        size_t first_page_index = position / PAGE_SIZE;
+        size_t offset_in_window = position % PAGE_SIZE;
+        size_t bytes_to_send = min(remaining - nsent, sendfile_chunk_size - offset_in_window);
+        size_t page_count = ceil_div(offset_in_window + bytes_to_send, PAGE_SIZE);
+
+        for (size_t i = 0; i < page_count; ++i) {
+            auto page_or_error = page_cache.fetch_page(first_page_index + i);
+            if (page_or_error.is_error()) {
+                if (i == 0) {
+                    if (nsent > 0)
+                        return nsent;
+                    return page_or_error.error();
+                }
+                bytes_to_send = i * PAGE_SIZE - offset_in_window;
+                break;
+            }
+            // The window holds a reference, so the page can't go away while
+            // we're sending it, even if the page cache gets trimmed.
+            window->physical_pages()[i] = page_or_error.release_value();
+        }
+        region->remap();
+
+        auto buffer = UserOrKernelBuffer::for_kernel_buffer(region->vaddr().offset(offset_in_window).as_ptr());
+        ssize_t nwritten = do_write(out_description, buffer, bytes_to_send);
+        if (nwritten < 0) {
+            if (nsent > 0)
+                return nsent;
+            return nwritten;
+        }
+        nsent += nwritten;
+        if (static_cast<size_t>(nwritten) < bytes_to_send)
+            break;
+    }
+    return nsent;
+}
+
+ssize_t Process::sendfile_through_buffer(FileDescription& out_description, FileDescription& in_description, off_t offset, size_t count)
+{
+    auto buffer = KBuffer::try_create_with_size(sendfile_chunk_size, Region::Access::Read | Region::Access::Write, "sendfile");
+    if (!buffer)
+        return -ENOMEM;
+
+    size_t nsent = 0;
+    while (nsent < count) {
+        auto kernel_buffer = UserOrKernelBuffer::for_kernel_buffer(buffer->data());
+        auto nread_or_error = in_description.file().read(in_description, offset + nsent, kernel_buffer, min(count - nsent, buffer->size()));
+        if (nread_or_error.is_error()) {
+            if (nsent > 0)
+                return nsent;
+            return nread_or_error.error();
+        }
+        size_t nread = nread_or_error.value();
+        if (nread == 0)
+            break;
+
+        ssize_t nwritten = do_write(out_description, kernel_buffer, nread);
+        if (nwritten < 0) {
+            if (nsent > 0)
+                return nsent;
+            return nwritten;
+        }
+        nsent += nwritten;
+        if (static_cast<size_t>(nwritten) < nread)
+            break;
+    }
+    return nsent;
+}
+
+ssize_t Process::sys$sendfile(Userspace<const Syscall::SC_sendfile_params*> user_params)
+{
+    REQUIRE_PROMISE(stdio);
+
+    Syscall::SC_sendfile_params params;
+    if (!copy_from_user(&params, user_params))
+        return -EFAULT;
+
+    auto out_description = file_description(params.out_fd);
+    if (!out_description || !out_description->is_writable())
+        return -EBADF;
+    auto in_description = file_description(params.in_fd);
+    if (!in_description || !in_description->is_readable())
+        return -EBADF;
+    if (in_description->is_directory())
+        return -EISDIR;
+    // We only support inputs that can be read at an arbitrary offset. That way,
+    // nothing gets lost if the output accepts less than we've read.
+    if (!in_description->file().is_seekable())
+        return -EINVAL;
+
+    off_t offset;
+    if (params.offset) {
+        if (!copy_from_user(&offset, params.offset))
+            return -EFAULT;
+        if (offset < 0)
+            return -EINVAL;
+    } else {
+        offset = in_description->offset();
+    }
+
+    size_t count = min(params.count, static_cast<size_t>(NumericLimits<ssize_t>::max()));
+    Checked<off_t> end_offset = offset;
+    end_offset += count;
+    if (end_offset.has_overflow())
+        count = NumericLimits<off_t>::max() - offset;
+    if (count == 0)
+        return 0;
+
+    RefPtr<SharedInodeVMObject> page_cache;
+    auto* inode = in_description->inode();
+    if (inode && !in_description->is_direct())
+        page_cache = inode->ensure_page_cache();
+
+    ssize_t nsent;
+    if (page_cache) {
+        inode->readahead(*in_description, offset, count);
+        nsent = sendfile_from_page_cache(*out_description, *page_cache, offset, count);
+    } else {
+        nsent = sendfile_through_buffer(*out_description, *in_description, offset, count);
+    }
+    if (nsent <= 0)
+        return nsent;
+
+    Thread::current()->did_file_read(nsent);
+    off_t new_offset = offset + nsent;
+    if (params.offset) {
+        if (!copy_to_user(params.offset, &new_offset))
+            return -EFAULT;
+    } else {
+        in_description->seek(new_offset, SEEK_SET);
+    }
+    return nsent;
+}
+
+}
@@ -24,6 +24,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <AK/Singleton.h>
 #include <Kernel/FileSystem/VirtualFileSystem.h>
 #include <Kernel/Process.h>
 #include <Kernel/Tasks/SyncTask.h>
@@ -31,6 +32,8 @@
 
 namespace Kernel {
 
+static AK::Singleton<WaitQueue> s_wait_queue;
+
 void SyncTask::spawn()
 {
     RefPtr<Thread> syncd_thread;
@@ -38,9 +41,15 @@ void SyncTask::spawn()
         dbgln("SyncTask is running");
         for (;;) {
             VFS::the().sync();
-            Thread::current()->sleep({ 1, 0 });
+            timeval timeout { 1, 0 };
+            (void)s_wait_queue->wait_on(Thread::BlockTimeout(false, &timeout), "SyncTask");
         }
     });
 }
 
+void SyncTask::wake()
+{
+    s_wait_queue->wake_all();
+}
+
 }
@@ -30,5 +30,8 @@ namespace Kernel {
 class SyncTask {
 public:
     static void spawn();
+
+    // Makes the task sync right away instead of waiting for its next period.
+    static void wake();
 };
 }
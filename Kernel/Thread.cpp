@@ -134,6 +134,7 @@ Thread::~Thread()
         // the middle of being destroyed.
         ScopedSpinLock lock(g_scheduler_lock);
         g_scheduler_data->thread_list_for_state(m_state).remove(*this);
+        Scheduler::dequeue_runnable_thread(*this);
     }
 }
 
@@ -383,6 +384,22 @@ void Thread::finalize()
     drop_thread_count(false);
 }
 
+void Thread::discard_before_first_run()
+{
+    // Undo what the constructor did for a thread that was never scheduled,
+    // e.g. the first thread of a posix_spawn() child whose exec failed.
+    // There's nothing to finalize and nobody to notify, so don't go through
+    // the finalizer (which would SIGCHLD the parent of a process that never
+    // existed as far as userspace is concerned).
+    ASSERT(state() == Thread::State::Invalid);
+    kfree_aligned(m_fpu_state);
+    m_fpu_state = nullptr;
+    drop_thread_count(true);
+
+    // Drop the reference the constructor took on behalf of the finalizer.
+    unref();
+}
+
 void Thread::drop_thread_count(bool initializing_first_thread)
 {
     auto thread_cnt_before = m_process->m_thread_count.fetch_sub(1, AK::MemoryOrder::memory_order_acq_rel);
@@ -884,6 +901,27 @@ RefPtr<Thread> Thread::clone(Process& process)
     return clone;
 }
 
+void Thread::set_priority(u32 priority)
+{
+    ScopedSpinLock lock(g_scheduler_lock);
+    m_priority = priority;
+    Scheduler::requeue_runnable_thread(*this);
+}
+
+void Thread::set_priority_boost(u32 boost)
+{
+    ScopedSpinLock lock(g_scheduler_lock);
+    m_priority_boost = boost;
+    Scheduler::requeue_runnable_thread(*this);
+}
+
+void Thread::set_affinity(u32 affinity)
+{
+    ScopedSpinLock lock(g_scheduler_lock);
+    m_cpu_affinity = affinity;
+    Scheduler::requeue_runnable_thread(*this);
+}
+
 void Thread::set_state(State new_state, u8 stop_signal)
 {
     State previous_state;
@@ -968,6 +1006,11 @@ void Thread::update_state_for_thread(Thread::State previous_state)
         previous_list.remove(*this);
     }
 
+    if (state() == Runnable)
+        Scheduler::queue_runnable_thread(*this);
+    else if (previous_state == Runnable)
+        Scheduler::dequeue_runnable_thread(*this);
+
     if (list.contains(*this))
         return;
 
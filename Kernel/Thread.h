@@ -99,10 +99,10 @@ public:
     ThreadID tid() const { return m_tid; }
     ProcessID pid() const;
 
-    void set_priority(u32 p) { m_priority = p; }
+    void set_priority(u32);
     u32 priority() const { return m_priority; }
 
-    void set_priority_boost(u32 boost) { m_priority_boost = boost; }
+    void set_priority_boost(u32);
     u32 priority_boost() const { return m_priority_boost; }
 
     u32 effective_priority() const;
@@ -144,6 +144,7 @@ public:
     }
 
     void finalize();
+    void discard_before_first_run();
 
     enum State : u8 {
         Invalid = 0,
@@ -352,6 +353,8 @@ public:
         mutable RecursiveSpinLock m_lock;
 
     private:
+        friend class BlockCondition;
+
         BlockCondition* m_block_condition { nullptr };
         void* m_block_data { nullptr };
         Thread* m_blocked_thread { nullptr };
@@ -383,11 +386,11 @@ public:
             return true;
         }
 
-        void remove_blocker(Blocker& blocker, void* data)
+        bool remove_blocker(Blocker& blocker, void* data)
         {
             ScopedSpinLock lock(m_lock);
             // NOTE: it's possible that the blocker is no longer present
-            m_blockers.remove_first_matching([&](auto& info) {
+            return m_blockers.remove_first_matching([&](auto& info) {
                 return info.blocker == &blocker && info.data == data;
             });
         }
@@ -419,6 +422,28 @@ public:
             return did_unblock;
         }
 
+        // Moves up to max_count blockers (in the order they were added)
+        // over to another block condition without unblocking them.
+        size_t move_blockers_to(BlockCondition& other, size_t max_count)
+        {
+            if (&other == this || max_count == 0)
+                return 0;
+            // Always take the two locks in the same order
+            auto& first_lock = this < &other ? m_lock : other.m_lock;
+            auto& second_lock = this < &other ? other.m_lock : m_lock;
+            ScopedSpinLock lock1(first_lock);
+            ScopedSpinLock lock2(second_lock);
+            size_t count = min(max_count, m_blockers.size());
+            for (size_t i = 0; i < count; i++) {
+                auto info = m_blockers.take_first();
+                // NOTE: The blocker's destructor re-checks m_block_condition
+                // if it didn't find itself, so we don't need its lock here.
+                info.blocker->m_block_condition = &other;
+                other.m_blockers.append(info);
+            }
+            return count;
+        }
+
         virtual bool should_add_blocker(Blocker&, void*) { return true; }
 
         SpinLock<u8> m_lock;
@@ -502,6 +527,11 @@ public:
 
         virtual bool unblock(bool, void*) = 0;
 
+        // Blockers that stay registered with a file without holding a reference to the
+        // description they're interested in hear about it here before it goes away.
+        // Returning true removes the blocker from the block condition.
+        virtual bool description_will_be_destroyed(FileDescription&) { return false; }
+
     protected:
         bool m_should_block { true };
     };
@@ -701,7 +731,7 @@ public:
     u32 cpu() const { return m_cpu.load(AK::MemoryOrder::memory_order_consume); }
     void set_cpu(u32 cpu) { m_cpu.store(cpu, AK::MemoryOrder::memory_order_release); }
     u32 affinity() const { return m_cpu_affinity; }
-    void set_affinity(u32 affinity) { m_cpu_affinity = affinity; }
+    void set_affinity(u32);
 
     u32 stack_ptr() const { return m_tss.esp; }
 
@@ -1078,6 +1108,9 @@ public:
 
 private:
     IntrusiveListNode m_runnable_list_node;
+    IntrusiveListNode m_ready_queue_node;
+    int m_ready_queue_bucket { -1 };
+    u32 m_ready_queue_cpu { 0 };
 
 private:
     friend struct SchedulerData;
@@ -1198,8 +1231,10 @@ private:
     State m_state { Invalid };
     String m_name;
     u32 m_priority { THREAD_PRIORITY_NORMAL };
-    u32 m_extra_priority { 0 };
     u32 m_priority_boost { 0 };
+    // Raised while the thread waits in a ready queue, so lower priority threads
+    // eventually get to run too. Reset whenever the thread is scheduled.
+    u32 m_extra_priority { 0 };
 
     State m_stop_state { Invalid };
 
@@ -1257,9 +1292,27 @@ const LogStream& operator<<(const LogStream&, const Thread&);
 
 struct SchedulerData {
     typedef IntrusiveList<Thread, &Thread::m_runnable_list_node> ThreadList;
+    typedef IntrusiveList<Thread, &Thread::m_ready_queue_node> ReadyQueue;
+
+    // Each processor has its own set of FIFO ready queues, one per priority
+    // bucket. Bucket 0 holds the highest priority threads, and a bit is set
+    // in m_mask for every bucket that isn't empty.
+    static constexpr u32 ready_queue_buckets = 32;
+    static constexpr u32 max_processors = 32;
+
+    struct ProcessorReadyQueues {
+        Thread* find_ready_thread(u32 bucket_mask, u32 cpu);
+        void age_waiting_thread();
+
+        u32 m_mask { 0 };
+        ReadyQueue m_buckets[ready_queue_buckets];
+    };
 
     ThreadList m_runnable_threads;
     ThreadList m_nonrunnable_threads;
+    ProcessorReadyQueues m_ready_queues[max_processors];
+
+    Thread* find_next_runnable_thread(u32 cpu);
 
     bool has_thread(Thread& thread) const
     {
@@ -48,8 +48,14 @@ bool Thread::Blocker::set_block_condition(Thread::BlockCondition& block_conditio
 Thread::Blocker::~Blocker()
 {
     ScopedSpinLock lock(m_lock);
-    if (m_block_condition)
-        m_block_condition->remove_blocker(*this, m_block_data);
+    while (auto* block_condition = m_block_condition) {
+        if (block_condition->remove_blocker(*this, m_block_data))
+            break;
+        // We may have been moved to another block condition (e.g. by a
+        // futex requeue) while we were trying to remove ourselves.
+        if (block_condition == m_block_condition)
+            break;
+    }
 }
 
 void Thread::Blocker::begin_blocking(Badge<Thread>)
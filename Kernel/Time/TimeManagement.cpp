@@ -391,7 +391,10 @@ void TimeManagement::increment_time_since_boot()
 
 void TimeManagement::system_timer_tick(const RegisterState& regs)
 {
-    if (Processor::current().in_irq() <= 1) {
+    // Only the BSP turns the timer wheel. The other processors would just
+    // contend for the timer queue lock, and this way their ticks are only
+    // needed for scheduling.
+    if (Processor::current().id() == 0 && Processor::current().in_irq() <= 1) {
         // Don't expire timers while handling IRQs
         TimerQueue::the().fire();
     }
@@ -87,6 +87,15 @@ TimerQueue& TimerQueue::the()
 TimerQueue::TimerQueue()
 {
     m_ticks_per_second = TimeManagement::the().ticks_per_second();
+    ASSERT(m_ticks_per_second > 0);
+    m_ns_per_tick = 1'000'000'000ull / m_ticks_per_second;
+    m_timer_queue_monotonic.current_tick = current_tick(m_timer_queue_monotonic);
+    m_timer_queue_realtime.current_tick = current_tick(m_timer_queue_realtime);
+}
+
+u64 TimerQueue::current_tick(const Queue& queue) const
+{
+    return time_to_ns(TimeManagement::the().current_time(queue.clock_id).value()) / m_ns_per_tick;
 }
 
 RefPtr<Timer> TimerQueue::add_timer_without_id(clockid_t clock_id, const timespec& deadline, Function<void()>&& callback)
@@ -119,32 +128,50 @@ TimerId TimerQueue::add_timer(NonnullRefPtr<Timer>&& timer)
 
 void TimerQueue::add_timer_locked(NonnullRefPtr<Timer> timer)
 {
-    u64 timer_expiration = timer->m_expires;
-
     ASSERT(!timer->is_queued());
 
     auto& queue = queue_for_timer(*timer);
-    if (queue.list.is_empty()) {
-        queue.list.append(&timer.leak_ref());
-        queue.next_timer_due = timer_expiration;
-    } else {
-        Timer* following_timer = nullptr;
-        queue.list.for_each([&](Timer& t) {
-            if (t.m_expires > timer_expiration) {
-                following_timer = &t;
-                return IterationDecision::Break;
-            }
-            return IterationDecision::Continue;
-        });
-        if (following_timer) {
-            bool next_timer_needs_update = queue.list.head() == following_timer;
-            queue.list.insert_before(following_timer, &timer.leak_ref());
-            if (next_timer_needs_update)
-                queue.next_timer_due = timer_expiration;
-        } else {
-            queue.list.append(&timer.leak_ref());
-        }
+    if (queue.timer_count == 0) {
+        // Nothing is waiting for the wheel to turn, so we can just skip
+        // ahead instead of catching up with the ticks we missed.
+        queue.current_tick = current_tick(queue);
+    }
+    queue.timer_count++;
+    insert_into_wheel(queue, timer.leak_ref());
+}
+
+void TimerQueue::insert_into_wheel(Queue& queue, Timer& timer)
+{
+    ASSERT(g_timerqueue_lock.is_locked());
+
+    // The first tick at which the timer may fire.
+    u64 tick = (timer.m_expires + m_ns_per_tick - 1) / m_ns_per_tick;
+    if (tick < queue.current_tick)
+        tick = queue.current_tick;
+
+    u64 delta = tick - queue.current_tick;
+    if (timer.is_coarse() && delta >= 16) {
+        // Timers on the coarse clocks don't need to be precise, so allow them
+        // to fire up to ~6% late. Rounding up to a power of two lets timers
+        // that expire around the same time share a slot and fire together.
+        u64 granularity = 1ull << (63 - __builtin_clzll(delta / 16));
+        tick = (tick + granularity - 1) & ~(granularity - 1);
+        delta = tick - queue.current_tick;
+    }
+
+    size_t level = 0;
+    while (level < wheel_levels - 1 && delta >= (1ull << (wheel_bits * (level + 1))))
+        level++;
+    if (delta >= (1ull << (wheel_bits * wheel_levels))) {
+        // Too far into the future. Park it in the last slot we can reach,
+        // it'll be put back into the right place when that slot cascades.
+        tick = queue.current_tick + (1ull << (wheel_bits * wheel_levels)) - 1;
     }
+
+    auto& slot = queue.wheel[level][(tick >> (wheel_bits * level)) & (wheel_slots - 1)];
+    slot.append(&timer);
+    timer.m_wheel_slot = &slot;
+    timer.set_queued(true);
 }
 
 TimerId TimerQueue::add_timer(clockid_t clock_id, timeval& deadline, Function<void()>&& callback)
@@ -154,29 +181,28 @@ TimerId TimerQueue::add_timer(clockid_t clock_id, timeval& deadline, Function<vo
     return add_timer(adopt(*new Timer(clock_id, time_to_ns(expires), move(callback))));
 }
 
+Timer* TimerQueue::find_timer_locked(Queue& queue, TimerId id)
+{
+    for (auto& level : queue.wheel) {
+        for (auto& slot : level) {
+            for (auto& timer : slot) {
+                if (timer.m_id == id)
+                    return &timer;
+            }
+        }
+    }
+    return nullptr;
+}
+
 bool TimerQueue::cancel_timer(TimerId id)
 {
-    Timer* found_timer = nullptr;
-    Queue* timer_queue = nullptr;
+    Queue* timer_queue = &m_timer_queue_monotonic;
 
     ScopedSpinLock lock(g_timerqueue_lock);
-    if (m_timer_queue_monotonic.list.for_each([&](Timer& timer) {
-            if (timer.m_id == id) {
-                found_timer = &timer;
-                timer_queue = &m_timer_queue_monotonic;
-                return IterationDecision::Break;
-            }
-            return IterationDecision::Continue;
-        })
-        != IterationDecision::Break) {
-        m_timer_queue_realtime.list.for_each([&](Timer& timer) {
-            if (timer.m_id == id) {
-                found_timer = &timer;
-                timer_queue = &m_timer_queue_realtime;
-                return IterationDecision::Break;
-            }
-            return IterationDecision::Continue;
-        });
+    Timer* found_timer = find_timer_locked(m_timer_queue_monotonic, id);
+    if (!found_timer) {
+        timer_queue = &m_timer_queue_realtime;
+        found_timer = find_timer_locked(m_timer_queue_realtime, id);
     }
 
     if (!found_timer) {
@@ -202,8 +228,6 @@ bool TimerQueue::cancel_timer(TimerId id)
         return false;
     }
 
-    ASSERT(found_timer);
-    ASSERT(timer_queue);
     remove_timer_locked(*timer_queue, *found_timer);
     return true;
 }
@@ -212,7 +236,7 @@ bool TimerQueue::cancel_timer(Timer& timer)
 {
     auto& timer_queue = queue_for_timer(timer);
     ScopedSpinLock lock(g_timerqueue_lock);
-    if (!timer_queue.list.contains_slow(&timer)) {
+    if (!timer.is_queued()) {
         // The timer may be executing right now, if it is then it should
         // be in m_timers_executing. If it is then release the lock
         // briefly to allow it to finish by removing itself
@@ -238,68 +262,105 @@ bool TimerQueue::cancel_timer(Timer& timer)
 
 void TimerQueue::remove_timer_locked(Queue& queue, Timer& timer)
 {
-    bool was_next_timer = (queue.list.head() == &timer);
-    queue.list.remove(&timer);
+    ASSERT(timer.m_wheel_slot);
+    timer.m_wheel_slot->remove(&timer);
+    timer.m_wheel_slot = nullptr;
     timer.set_queued(false);
+    queue.timer_count--;
     auto now = timer.now(false);
     if (timer.m_expires > now)
         timer.m_remaining = timer.m_expires - now;
 
-    if (was_next_timer)
-        update_next_timer_due(queue);
     // Whenever we remove a timer that was still queued (but hasn't been
     // fired) we added a reference to it. So, when removing it from the
     // queue we need to drop that reference.
     timer.unref();
 }
 
-void TimerQueue::fire()
+void TimerQueue::rebuild_wheel(Queue& queue)
 {
-    ScopedSpinLock lock(g_timerqueue_lock);
+    InlineLinkedList<Timer> timers;
+    for (auto& level : queue.wheel) {
+        for (auto& slot : level)
+            timers.append(slot);
+    }
+    queue.current_tick = current_tick(queue);
+    while (auto* timer = timers.remove_head())
+        insert_into_wheel(queue, *timer);
+}
 
-    auto fire_timers = [&](Queue& queue) {
-        auto* timer = queue.list.head();
-        ASSERT(timer);
-        ASSERT(queue.next_timer_due == timer->m_expires);
+void TimerQueue::fire_timers_in_slot(ScopedSpinLock<SpinLock<u8>>& lock, Queue& queue, InlineLinkedList<Timer>& slot)
+{
+    while (auto* timer = slot.remove_head()) {
+        timer->m_wheel_slot = nullptr;
+        if (timer->now(true) < timer->m_expires) {
+            // Not due yet, this happens if the clock was set back or if
+            // the timer was parked here because it was too far out.
+            insert_into_wheel(queue, *timer);
+            continue;
+        }
 
-        while (timer && timer->now(true) > timer->m_expires) {
-            queue.list.remove(timer);
-            timer->set_queued(false);
+        timer->set_queued(false);
+        queue.timer_count--;
+        m_timers_executing.append(timer);
 
-            m_timers_executing.append(timer);
+        lock.unlock();
 
-            update_next_timer_due(queue);
+        // Defer executing the timer outside of the irq handler
+        Processor::current().deferred_call_queue([this, timer]() {
+            timer->m_callback();
+            ScopedSpinLock lock(g_timerqueue_lock);
+            m_timers_executing.remove(timer);
+            // Drop the reference we added when queueing the timer
+            timer->unref();
+        });
 
-            lock.unlock();
+        lock.lock();
+    }
+}
 
-            // Defer executing the timer outside of the irq handler
-            Processor::current().deferred_call_queue([this, timer]() {
-                timer->m_callback();
-                ScopedSpinLock lock(g_timerqueue_lock);
-                m_timers_executing.remove(timer);
-                // Drop the reference we added when queueing the timer
-                timer->unref();
-            });
+void TimerQueue::fire_timers(ScopedSpinLock<SpinLock<u8>>& lock, Queue& queue)
+{
+    u64 now_tick = current_tick(queue);
+    if (queue.timer_count == 0) {
+        queue.current_tick = now_tick + 1;
+        return;
+    }
 
-            lock.lock();
-            timer = queue.list.head();
+    // If we fell behind by more than a full turn of the wheel (e.g. because
+    // the realtime clock was set forward), re-sorting all timers is cheaper
+    // than walking every tick in between. If the realtime clock was set back,
+    // the wheel would stand still until the clock caught up again, so the
+    // timers have to be sorted in relative to the new time as well.
+    if (now_tick >= queue.current_tick + wheel_slots || now_tick + 1 < queue.current_tick)
+        rebuild_wheel(queue);
+
+    while (queue.current_tick <= now_tick && queue.timer_count > 0) {
+        u64 tick = queue.current_tick;
+        for (size_t level = 1; level < wheel_levels; level++) {
+            if ((tick >> (wheel_bits * (level - 1))) & (wheel_slots - 1))
+                break;
+            // Pull the timers of the next slot on this level down to the levels below.
+            auto& slot = queue.wheel[level][(tick >> (wheel_bits * level)) & (wheel_slots - 1)];
+            InlineLinkedList<Timer> timers;
+            timers.append(slot);
+            while (auto* timer = timers.remove_head())
+                insert_into_wheel(queue, *timer);
         }
-    };
-
-    if (!m_timer_queue_monotonic.list.is_empty())
-        fire_timers(m_timer_queue_monotonic);
-    if (!m_timer_queue_realtime.list.is_empty())
-        fire_timers(m_timer_queue_realtime);
+        // Move on before firing, so that timers which get (re-)added in the
+        // meantime can never end up in the slot we're working on.
+        queue.current_tick = tick + 1;
+        fire_timers_in_slot(lock, queue, queue.wheel[0][tick & (wheel_slots - 1)]);
+    }
+    if (queue.timer_count == 0)
+        queue.current_tick = now_tick + 1;
 }
 
-void TimerQueue::update_next_timer_due(Queue& queue)
+void TimerQueue::fire()
 {
-    ASSERT(g_timerqueue_lock.is_locked());
-
-    if (auto* next_timer = queue.list.head())
-        queue.next_timer_due = next_timer->m_expires;
-    else
-        queue.next_timer_due = 0;
+    ScopedSpinLock lock(g_timerqueue_lock);
+    fire_timers(lock, m_timer_queue_monotonic);
+    fire_timers(lock, m_timer_queue_realtime);
 }
 
 }
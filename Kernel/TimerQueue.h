@@ -31,6 +31,7 @@
 #include <AK/NonnullRefPtr.h>
 #include <AK/OwnPtr.h>
 #include <AK/RefCounted.h>
+#include <Kernel/SpinLock.h>
 #include <Kernel/Time/TimeManagement.h>
 
 namespace Kernel {
@@ -64,6 +65,7 @@ private:
     Function<void()> m_callback;
     Timer* m_next { nullptr };
     Timer* m_prev { nullptr };
+    InlineLinkedList<Timer>* m_wheel_slot { nullptr };
     Atomic<bool, AK::MemoryOrder::memory_order_relaxed> m_queued { false };
 
     bool operator<(const Timer& rhs) const
@@ -80,6 +82,7 @@ private:
     }
     bool is_queued() const { return m_queued; }
     void set_queued(bool queued) { m_queued = queued; }
+    bool is_coarse() const { return m_clock_id == CLOCK_MONOTONIC_COARSE || m_clock_id == CLOCK_REALTIME_COARSE; }
     u64 now(bool) const;
 };
 
@@ -102,13 +105,35 @@ public:
     void fire();
 
 private:
+    // Each queue is a hierarchical timing wheel. Level 0 has one slot per
+    // tick, and each slot on the levels above covers wheel_slots times as
+    // many ticks as one on the level below it. A timer is put directly into
+    // the slot for its expiration tick, on the lowest level that reaches
+    // that far ahead, so adding and cancelling timers is O(1). Whenever a
+    // level wraps around, the next slot of the level above is cascaded down.
+    static constexpr size_t wheel_bits = 6;
+    static constexpr size_t wheel_slots = 1 << wheel_bits;
+    static constexpr size_t wheel_levels = 5;
+
     struct Queue {
-        InlineLinkedList<Timer> list;
-        u64 next_timer_due { 0 };
+        explicit Queue(clockid_t clock_id)
+            : clock_id(clock_id)
+        {
+        }
+
+        const clockid_t clock_id;
+        InlineLinkedList<Timer> wheel[wheel_levels][wheel_slots];
+        u64 current_tick { 0 }; // All ticks before this one have been processed
+        size_t timer_count { 0 };
     };
     void remove_timer_locked(Queue&, Timer&);
-    void update_next_timer_due(Queue&);
     void add_timer_locked(NonnullRefPtr<Timer>);
+    void insert_into_wheel(Queue&, Timer&);
+    void fire_timers(ScopedSpinLock<SpinLock<u8>>&, Queue&);
+    void fire_timers_in_slot(ScopedSpinLock<SpinLock<u8>>&, Queue&, InlineLinkedList<Timer>&);
+    void rebuild_wheel(Queue&);
+    u64 current_tick(const Queue&) const;
+    Timer* find_timer_locked(Queue&, TimerId);
 
     Queue& queue_for_timer(Timer& timer)
     {
@@ -127,8 +152,9 @@ private:
 
     u64 m_timer_id_count { 0 };
     u64 m_ticks_per_second { 0 };
-    Queue m_timer_queue_monotonic;
-    Queue m_timer_queue_realtime;
+    u64 m_ns_per_tick { 0 };
+    Queue m_timer_queue_monotonic { CLOCK_MONOTONIC_COARSE };
+    Queue m_timer_queue_realtime { CLOCK_REALTIME_COARSE };
     InlineLinkedList<Timer> m_timers_executing;
 };
 
@@ -82,6 +82,29 @@ RefPtr<AnonymousVMObject> AnonymousVMObject::create_with_size(size_t size, Alloc
     return adopt(*new AnonymousVMObject(size, commit));
 }
 
+RefPtr<AnonymousVMObject> AnonymousVMObject::create_with_huge_pages(size_t size)
+{
+    // Back the object with physically contiguous, 2 MiB aligned runs of pages,
+    // so that regions mapping it at a 2 MiB aligned address can use huge pages.
+    // Whatever doesn't fill a whole huge page gets regular pages.
+    size_t page_count = ceil_div(size, PAGE_SIZE);
+    if (!MM.commit_user_physical_pages(page_count))
+        return {};
+    auto vmobject = adopt(*new AnonymousVMObject(size, AllocationStrategy::None));
+    constexpr size_t pages_per_huge_page = HUGE_PAGE_SIZE / PAGE_SIZE;
+    size_t page_index = 0;
+    for (; page_index + pages_per_huge_page <= page_count; page_index += pages_per_huge_page) {
+        auto physical_pages = MM.allocate_committed_contiguous_user_physical_pages(pages_per_huge_page, HUGE_PAGE_SIZE);
+        if (physical_pages.is_empty())
+            break;
+        for (size_t i = 0; i < pages_per_huge_page; ++i)
+            vmobject->physical_pages()[page_index + i] = physical_pages[i];
+    }
+    for (; page_index < page_count; ++page_index)
+        vmobject->physical_pages()[page_index] = MM.allocate_committed_user_physical_page(MemoryManager::ShouldZeroFill::Yes);
+    return vmobject;
+}
+
 NonnullRefPtr<AnonymousVMObject> AnonymousVMObject::create_with_physical_page(PhysicalPage& page)
 {
     return adopt(*new AnonymousVMObject(page));
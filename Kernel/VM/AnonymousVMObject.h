@@ -41,6 +41,7 @@ public:
     virtual ~AnonymousVMObject() override;
 
     static RefPtr<AnonymousVMObject> create_with_size(size_t, AllocationStrategy);
+    static RefPtr<AnonymousVMObject> create_with_huge_pages(size_t);
     static RefPtr<AnonymousVMObject> create_for_physical_range(PhysicalAddress paddr, size_t size);
     static NonnullRefPtr<AnonymousVMObject> create_with_physical_page(PhysicalPage& page);
     virtual RefPtr<VMObject> clone() override;
@@ -28,6 +28,7 @@
 #include <Kernel/VM/InodeVMObject.h>
 #include <Kernel/VM/MemoryManager.h>
 #include <Kernel/VM/Region.h>
+#include <Kernel/VM/SharedInodeVMObject.h>
 
 namespace Kernel {
 
@@ -76,12 +77,25 @@ void InodeVMObject::inode_size_changed(Badge<Inode>, size_t old_size, size_t new
 {
     dbgln("VMObject::inode_size_changed: ({}:{}) {} -> {}", m_inode->fsid(), m_inode->index(), old_size, new_size);
 
-    InterruptDisabler disabler;
-
     auto new_page_count = PAGE_ROUND_UP(new_size) / PAGE_SIZE;
-    m_physical_pages.resize(new_page_count);
+    RefPtr<PhysicalPage> partial_page;
+    {
+        ScopedSpinLock lock(m_lock);
+        ++m_contents_generation;
+        m_physical_pages.resize(new_page_count);
+        m_dirty_pages.grow(new_page_count, false);
+        if (new_size < old_size && new_size % PAGE_SIZE)
+            partial_page = m_physical_pages[new_page_count - 1];
+    }
 
-    m_dirty_pages.grow(new_page_count, false);
+    // Whatever was past the new end of file has to read back as zeroes if the file grows again.
+    if (partial_page && !partial_page->is_shared_zero_page() && !partial_page->is_lazy_committed_page()) {
+        size_t offset_in_page = new_size % PAGE_SIZE;
+        InterruptDisabler disabler;
+        u8* page_ptr = MM.quickmap_page(*partial_page);
+        memset(page_ptr + offset_in_page, 0, PAGE_SIZE - offset_in_page);
+        MM.unquickmap_page();
+    }
 
     // FIXME: Consolidate with inode_contents_changed() so we only do a single walk.
     for_each_region([](auto& region) {
@@ -89,48 +103,47 @@ void InodeVMObject::inode_size_changed(Badge<Inode>, size_t old_size, size_t new
     });
 }
 
-void InodeVMObject::inode_contents_changed(Badge<Inode>, off_t offset, [[maybe_unused]] ssize_t size, [[maybe_unused]] const UserOrKernelBuffer& data)
+void InodeVMObject::inode_contents_changed(Badge<Inode>, off_t offset, ssize_t size, const UserOrKernelBuffer& data)
 {
-    InterruptDisabler disabler;
     ASSERT(offset >= 0);
 
-    // FIXME: Only invalidate the parts that actually changed.
-    for (auto& physical_page : m_physical_pages)
-        physical_page = nullptr;
-
-#if 0
-    size_t current_offset = offset;
-    size_t remaining_bytes = size;
-    const u8* data_ptr = data;
-
-    auto to_page_index = [] (size_t offset) -> size_t {
-        return offset / PAGE_SIZE;
-    };
-
-    if (current_offset & PAGE_MASK) {
-        size_t page_index = to_page_index(current_offset);
-        size_t bytes_to_copy = min(size, PAGE_SIZE - (current_offset & PAGE_MASK));
-        if (m_physical_pages[page_index]) {
-            auto* ptr = MM.quickmap_page(*m_physical_pages[page_index]);
-            memcpy(ptr, data_ptr, bytes_to_copy);
-            MM.unquickmap_page();
-        }
-        current_offset += bytes_to_copy;
-        data += bytes_to_copy;
-        remaining_bytes -= bytes_to_copy;
+    // Update the pages we have in place, so that mappings and readers see the new
+    // contents without having to read them back from the inode.
+    Vector<RefPtr<PhysicalPage>> pages;
+    size_t first_page_index = offset / PAGE_SIZE;
+    {
+        ScopedSpinLock lock(m_lock);
+        ++m_contents_generation;
+        for (size_t i = first_page_index; i < page_count() && i * PAGE_SIZE < static_cast<size_t>(offset + size); ++i)
+            pages.append(m_physical_pages[i]);
     }
 
-    for (size_t page_index = to_page_index(current_offset); page_index < m_physical_pages.size(); ++page_index) {
-        size_t bytes_to_copy = PAGE_SIZE - (current_offset & PAGE_MASK);
-        if (m_physical_pages[page_index]) {
-            auto* ptr = MM.quickmap_page(*m_physical_pages[page_index]);
-            memcpy(ptr, data_ptr, bytes_to_copy);
-            MM.unquickmap_page();
+    u8 page_buffer[PAGE_SIZE];
+    size_t nupdated = 0;
+    bool dropped_any_pages = false;
+    for (size_t i = 0; i < pages.size(); ++i) {
+        size_t offset_in_page = (offset + nupdated) % PAGE_SIZE;
+        size_t bytes_to_copy = min(PAGE_SIZE - offset_in_page, size - nupdated);
+        auto& page = pages[i];
+        if (page && !page->is_shared_zero_page() && !page->is_lazy_committed_page()) {
+            if (!data.read(page_buffer, nupdated, bytes_to_copy)) {
+                // We can't tell what was written, so forget about the page.
+                ScopedSpinLock lock(m_lock);
+                if (first_page_index + i < page_count() && m_physical_pages[first_page_index + i] == page)
+                    m_physical_pages[first_page_index + i] = nullptr;
+                dropped_any_pages = true;
+            } else {
+                InterruptDisabler disabler;
+                u8* dest_ptr = MM.quickmap_page(*page);
+                memcpy(dest_ptr + offset_in_page, page_buffer, bytes_to_copy);
+                MM.unquickmap_page();
+            }
         }
-        current_offset += bytes_to_copy;
-        data += bytes_to_copy;
+        nupdated += bytes_to_copy;
     }
-#endif
+
+    if (!dropped_any_pages)
+        return;
 
     // FIXME: Consolidate with inode_size_changed() so we only do a single walk.
     for_each_region([](auto& region) {
@@ -138,6 +151,78 @@ void InodeVMObject::inode_contents_changed(Badge<Inode>, off_t offset, [[maybe_u
     });
 }
 
+KResultOr<NonnullRefPtr<PhysicalPage>> InodeVMObject::page_in(size_t page_index)
+{
+    ASSERT(m_paging_lock.is_locked());
+    for (;;) {
+        u32 generation;
+        {
+            ScopedSpinLock lock(m_lock);
+            if (page_index >= page_count())
+                return KResult(-EINVAL);
+            if (auto& page = m_physical_pages[page_index])
+                return *page;
+            generation = m_contents_generation;
+        }
+
+        auto page_or_error = read_page_from_inode(page_index);
+        if (page_or_error.is_error())
+            return page_or_error.error();
+
+        ScopedSpinLock lock(m_lock);
+        if (page_index >= page_count())
+            return KResult(-EINVAL);
+        // The inode was written to while we were reading it, our data may be stale.
+        if (generation != m_contents_generation)
+            continue;
+        m_physical_pages[page_index] = page_or_error.value();
+        return page_or_error.release_value();
+    }
+}
+
+bool InodeVMObject::has_page(size_t page_index) const
+{
+    ScopedSpinLock lock(m_lock);
+    return page_index < page_count() && m_physical_pages[page_index];
+}
+
+KResultOr<NonnullRefPtr<PhysicalPage>> InodeVMObject::read_page_from_inode(size_t page_index)
+{
+    u8 page_buffer[PAGE_SIZE];
+
+    // Private mappings start out as a copy of the page cache, if the inode has one.
+    RefPtr<SharedInodeVMObject> page_cache;
+    if (!is_shared_inode())
+        page_cache = m_inode->ensure_page_cache();
+
+    if (page_cache) {
+        auto cached_page_or_error = page_cache->fetch_page(page_index);
+        if (cached_page_or_error.is_error())
+            return cached_page_or_error.error();
+        InterruptDisabler disabler;
+        memcpy(page_buffer, MM.quickmap_page(cached_page_or_error.value()), PAGE_SIZE);
+        MM.unquickmap_page();
+    } else {
+        auto buffer = UserOrKernelBuffer::for_kernel_buffer(page_buffer);
+        auto nread = m_inode->read_bytes_for_page_cache(page_index * PAGE_SIZE, PAGE_SIZE, buffer);
+        if (nread < 0)
+            return KResult(nread);
+        if (nread < PAGE_SIZE) {
+            // If we read less than a page, zero out the rest to avoid leaking uninitialized data.
+            memset(page_buffer + nread, 0, PAGE_SIZE - nread);
+        }
+    }
+
+    auto page = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::No);
+    if (page.is_null())
+        return KResult(-ENOMEM);
+
+    InterruptDisabler disabler;
+    memcpy(MM.quickmap_page(*page), page_buffer, PAGE_SIZE);
+    MM.unquickmap_page();
+    return page.release_nonnull();
+}
+
 int InodeVMObject::release_all_clean_pages()
 {
     LOCKER(m_paging_lock);
@@ -27,6 +27,7 @@
 #pragma once
 
 #include <AK/Bitmap.h>
+#include <Kernel/KResult.h>
 #include <Kernel/UnixTypes.h>
 #include <Kernel/VM/VMObject.h>
 
@@ -50,6 +51,11 @@ public:
     u32 writable_mappings() const;
     u32 executable_mappings() const;
 
+    // Returns the page at the given index, reading it in from the inode if needed.
+    // The caller must hold the paging lock.
+    KResultOr<NonnullRefPtr<PhysicalPage>> page_in(size_t page_index);
+    bool has_page(size_t page_index) const;
+
 protected:
     explicit InodeVMObject(Inode&, size_t);
     explicit InodeVMObject(const InodeVMObject&);
@@ -62,8 +68,13 @@ protected:
 
     int release_all_clean_pages_impl();
 
+    KResultOr<NonnullRefPtr<PhysicalPage>> read_page_from_inode(size_t page_index);
+
     NonnullRefPtr<Inode> m_inode;
     Bitmap m_dirty_pages;
+    // Bumped (under m_lock) whenever the inode's contents change, so that page_in()
+    // can tell if the data it read is already stale.
+    u32 m_contents_generation { 0 };
 };
 
 }
@@ -34,6 +34,7 @@
 #include <Kernel/Multiboot.h>
 #include <Kernel/Process.h>
 #include <Kernel/StdLib.h>
+#include <Kernel/Tasks/PageZeroingTask.h>
 #include <Kernel/VM/AnonymousVMObject.h>
 #include <Kernel/VM/ContiguousVMObject.h>
 #include <Kernel/VM/MemoryManager.h>
@@ -203,6 +204,18 @@ void MemoryManager::parse_memory_map()
     m_user_physical_pages_uncommitted = m_user_physical_pages.load();
 }
 
+PageDirectoryEntry* MemoryManager::pde(PageDirectory& page_directory, VirtualAddress vaddr)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(s_mm_lock.own_lock());
+    ASSERT(page_directory.get_lock().own_lock());
+    u32 page_directory_table_index = (vaddr.get() >> 30) & 0x3;
+    u32 page_directory_index = (vaddr.get() >> 21) & 0x1ff;
+
+    auto* pd = quickmap_pd(page_directory, page_directory_table_index);
+    return &pd[page_directory_index];
+}
+
 PageTableEntry* MemoryManager::pte(PageDirectory& page_directory, VirtualAddress vaddr)
 {
     ASSERT_INTERRUPTS_DISABLED();
@@ -214,7 +227,7 @@ PageTableEntry* MemoryManager::pte(PageDirectory& page_directory, VirtualAddress
 
     auto* pd = quickmap_pd(const_cast<PageDirectory&>(page_directory), page_directory_table_index);
     const PageDirectoryEntry& pde = pd[page_directory_index];
-    if (!pde.is_present())
+    if (!pde.is_present() || pde.is_huge())
         return nullptr;
 
     return &quickmap_pt(PhysicalAddress((FlatPtr)pde.page_table_base()))[page_table_index];
@@ -231,7 +244,8 @@ PageTableEntry* MemoryManager::ensure_pte(PageDirectory& page_directory, Virtual
 
     auto* pd = quickmap_pd(page_directory, page_directory_table_index);
     PageDirectoryEntry& pde = pd[page_directory_index];
-    if (!pde.is_present()) {
+    if (!pde.is_present() || pde.is_huge()) {
+        bool is_splitting_huge_page = pde.is_present();
         bool did_purge = false;
         auto page_table = allocate_user_physical_page(ShouldZeroFill::Yes, &did_purge);
         if (!page_table) {
@@ -245,7 +259,24 @@ PageTableEntry* MemoryManager::ensure_pte(PageDirectory& page_directory, Virtual
             pd = quickmap_pd(page_directory, page_directory_table_index);
             ASSERT(&pde == &pd[page_directory_index]); // Sanity check
 
-            ASSERT(!pde.is_present()); // Should have not changed
+            ASSERT(pde.is_present() == is_splitting_huge_page); // Should have not changed
+        }
+        if (is_splitting_huge_page) {
+            // Someone wants to change a single page inside a huge page, so break it
+            // up into a page table that maps the same memory with regular pages.
+            auto* page_table_entries = quickmap_pt(page_table->paddr());
+            for (u32 i = 0; i <= 0x1ff; i++) {
+                auto& pte = page_table_entries[i];
+                pte.set_physical_page_base(pde.huge_page_base() + i * PAGE_SIZE);
+                pte.set_present(true);
+                pte.set_writable(pde.is_writable());
+                pte.set_user_allowed(pde.is_user_allowed());
+                pte.set_write_through(pde.is_write_through());
+                pte.set_cache_disabled(pde.is_cache_disabled());
+                pte.set_global(pde.is_global());
+                pte.set_execute_disabled(pde.is_execute_disabled());
+            }
+            pde.clear();
         }
         pde.set_page_table_base(page_table->paddr().get());
         pde.set_user_allowed(true);
@@ -256,11 +287,40 @@ PageTableEntry* MemoryManager::ensure_pte(PageDirectory& page_directory, Virtual
         // This allows us to release the page table entry when no longer needed
         auto result = page_directory.m_page_tables.set(vaddr.get() & ~0x1fffff, move(page_table));
         ASSERT(result == AK::HashSetResult::InsertedNewEntry);
+        if (is_splitting_huge_page)
+            flush_tlb(&page_directory, VirtualAddress(vaddr.get() & ~0x1fffff), 0x200);
     }
 
     return &quickmap_pt(PhysicalAddress((FlatPtr)pde.page_table_base()))[page_table_index];
 }
 
+PageDirectoryEntry* MemoryManager::ensure_huge_pde(PageDirectory& page_directory, VirtualAddress vaddr)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(s_mm_lock.own_lock());
+    ASSERT(page_directory.get_lock().own_lock());
+    ASSERT(!(vaddr.get() & (HUGE_PAGE_SIZE - 1)));
+    u32 page_directory_table_index = (vaddr.get() >> 30) & 0x3;
+    u32 page_directory_index = (vaddr.get() >> 21) & 0x1ff;
+
+    auto* pd = quickmap_pd(page_directory, page_directory_table_index);
+    PageDirectoryEntry& pde = pd[page_directory_index];
+    if (pde.is_present() && !pde.is_huge()) {
+        // The caller is about to map all of the memory covered by this page
+        // table with a single huge page, so the page table can go. We only
+        // do this for page tables we allocated ourselves, not the ones that
+        // were set up during boot.
+        if (!page_directory.m_page_tables.contains(vaddr.get()))
+            return nullptr;
+        pde.clear();
+        // Processors may have cached the old page directory entry, so get rid
+        // of it before the page table is freed.
+        flush_tlb(&page_directory, vaddr, HUGE_PAGE_SIZE / PAGE_SIZE);
+        page_directory.m_page_tables.remove(vaddr.get());
+    }
+    return &pde;
+}
+
 void MemoryManager::release_pte(PageDirectory& page_directory, VirtualAddress vaddr, bool is_last_release)
 {
     ASSERT_INTERRUPTS_DISABLED();
@@ -272,7 +332,11 @@ void MemoryManager::release_pte(PageDirectory& page_directory, VirtualAddress va
 
     auto* pd = quickmap_pd(page_directory, page_directory_table_index);
     PageDirectoryEntry& pde = pd[page_directory_index];
-    if (pde.is_present()) {
+    if (pde.is_present() && pde.is_huge()) {
+        // Regions only use huge pages for 2 MiB chunks they cover entirely,
+        // so the whole huge page goes away together with the region.
+        pde.clear();
+    } else if (pde.is_present()) {
         auto* page_table = quickmap_pt(PhysicalAddress((FlatPtr)pde.page_table_base()));
         auto& pte = page_table[page_table_index];
         pte.clear();
@@ -320,13 +384,30 @@ Region* MemoryManager::kernel_region_from_vaddr(VirtualAddress vaddr)
 
 Region* MemoryManager::user_region_from_vaddr(Process& process, VirtualAddress vaddr)
 {
+    // NOTE: The region tree and the cached region only change with s_mm_lock held (see
+    //       Process::add_region() and take_region()), so both stay valid for as long as the
+    //       caller holds it. Taking the process lock here would invert the lock order.
     ScopedSpinLock lock(s_mm_lock);
-    // FIXME: Use a binary search tree (maybe red/black?) or some other more appropriate data structure!
-    for (auto& region : process.m_regions) {
-        if (region.contains(vaddr))
-            return &region;
-    }
-    return nullptr;
+    // Consecutive faults tend to hit the same region, so check the last one first.
+    if (auto* region = process.m_last_faulting_region.unsafe_ptr(); region && region->contains(vaddr))
+        return region;
+    auto* candidate = process.m_regions.find_largest_not_above(vaddr.get());
+    if (!candidate || !(*candidate)->contains(vaddr))
+        return nullptr;
+    process.m_last_faulting_region = *candidate->ptr();
+    return candidate->ptr();
+}
+
+PhysicalAddress MemoryManager::physical_address_for_kernel_vaddr(VirtualAddress vaddr)
+{
+    ScopedSpinLock lock(s_mm_lock);
+    auto* region = kernel_region_from_vaddr(vaddr);
+    if (!region)
+        return {};
+    auto* page = region->physical_page(region->page_index_from_address(vaddr));
+    if (!page || page->is_shared_zero_page() || page->is_lazy_committed_page())
+        return {};
+    return page->paddr().offset(vaddr.get() & ~PAGE_MASK);
 }
 
 Region* MemoryManager::find_region_from_vaddr(Process& process, VirtualAddress vaddr)
@@ -407,7 +488,13 @@ OwnPtr<Region> MemoryManager::allocate_kernel_region(PhysicalAddress paddr, size
 {
     ASSERT(!(size % PAGE_SIZE));
     ScopedSpinLock lock(s_mm_lock);
-    auto range = kernel_page_directory().range_allocator().allocate_anywhere(size);
+    Range range;
+    // Give large, suitably aligned physical ranges (like framebuffers) a
+    // virtual range that allows mapping them with huge pages.
+    if (size >= HUGE_PAGE_SIZE && !(paddr.get() & (HUGE_PAGE_SIZE - 1)))
+        range = kernel_page_directory().range_allocator().allocate_anywhere(size, HUGE_PAGE_SIZE);
+    if (!range.is_valid())
+        range = kernel_page_directory().range_allocator().allocate_anywhere(size);
     if (!range.is_valid())
         return {};
     auto vmobject = AnonymousVMObject::create_for_physical_range(paddr, size);
@@ -502,7 +589,32 @@ void MemoryManager::deallocate_user_physical_page(const PhysicalPage& page)
     ASSERT_NOT_REACHED();
 }
 
-RefPtr<PhysicalPage> MemoryManager::find_free_user_physical_page(bool committed)
+RefPtr<PhysicalPage> MemoryManager::take_free_user_physical_page_from_regions()
+{
+    ASSERT(s_mm_lock.is_locked());
+    for (auto& region : m_user_physical_regions) {
+        auto page = region.take_free_page(false);
+        if (!page.is_null())
+            return page;
+    }
+    return {};
+}
+
+RefPtr<PhysicalPage> MemoryManager::take_zeroed_page_from_pool()
+{
+    ASSERT(s_mm_lock.is_locked());
+    if (m_zeroed_page_count == 0)
+        return {};
+    auto page = move(m_zeroed_pages[--m_zeroed_page_count]);
+    if (m_zeroed_page_count == zeroed_page_pool_low_water) {
+        // We're most likely holding a bunch of locks right now, so don't
+        // poke the scheduler until we've left the critical section.
+        Processor::deferred_call_queue(PageZeroingTask::wake);
+    }
+    return page;
+}
+
+RefPtr<PhysicalPage> MemoryManager::find_free_user_physical_page(bool committed, ShouldZeroFill should_zero_fill, bool& page_is_zeroed)
 {
     ASSERT(s_mm_lock.is_locked());
     RefPtr<PhysicalPage> page;
@@ -516,13 +628,24 @@ RefPtr<PhysicalPage> MemoryManager::find_free_user_physical_page(bool committed)
             return {};
         m_user_physical_pages_uncommitted--;
     }
-    for (auto& region : m_user_physical_regions) {
-        page = region.take_free_page(false);
-        if (!page.is_null()) {
-            ++m_user_physical_pages_used;
-            break;
+
+    page_is_zeroed = false;
+    if (should_zero_fill == ShouldZeroFill::Yes)
+        page = take_zeroed_page_from_pool();
+    if (!page.is_null()) {
+        page_is_zeroed = true;
+    } else {
+        page = take_free_user_physical_page_from_regions();
+        if (page.is_null()) {
+            // Pages sitting in the zeroed pool are still free pages, so
+            // hand those out rather than failing.
+            page = take_zeroed_page_from_pool();
+            page_is_zeroed = !page.is_null();
         }
     }
+
+    if (!page.is_null())
+        ++m_user_physical_pages_used;
     ASSERT(!committed || !page.is_null());
     return page;
 }
@@ -530,8 +653,9 @@ RefPtr<PhysicalPage> MemoryManager::find_free_user_physical_page(bool committed)
 NonnullRefPtr<PhysicalPage> MemoryManager::allocate_committed_user_physical_page(ShouldZeroFill should_zero_fill)
 {
     ScopedSpinLock lock(s_mm_lock);
-    auto page = find_free_user_physical_page(true);
-    if (should_zero_fill == ShouldZeroFill::Yes) {
+    bool page_is_zeroed;
+    auto page = find_free_user_physical_page(true, should_zero_fill, page_is_zeroed);
+    if (should_zero_fill == ShouldZeroFill::Yes && !page_is_zeroed) {
         auto* ptr = quickmap_page(*page);
         memset(ptr, 0, PAGE_SIZE);
         unquickmap_page();
@@ -542,7 +666,8 @@ NonnullRefPtr<PhysicalPage> MemoryManager::allocate_committed_user_physical_page
 RefPtr<PhysicalPage> MemoryManager::allocate_user_physical_page(ShouldZeroFill should_zero_fill, bool* did_purge)
 {
     ScopedSpinLock lock(s_mm_lock);
-    auto page = find_free_user_physical_page(false);
+    bool page_is_zeroed;
+    auto page = find_free_user_physical_page(false, should_zero_fill, page_is_zeroed);
     bool purged_pages = false;
 
     if (!page) {
@@ -554,7 +679,7 @@ RefPtr<PhysicalPage> MemoryManager::allocate_user_physical_page(ShouldZeroFill s
             int purged_page_count = static_cast<AnonymousVMObject&>(vmobject).purge_with_interrupts_disabled({});
             if (purged_page_count) {
                 klog() << "MM: Purge saved the day! Purged " << purged_page_count << " pages from AnonymousVMObject{" << &vmobject << "}";
-                page = find_free_user_physical_page(false);
+                page = find_free_user_physical_page(false, should_zero_fill, page_is_zeroed);
                 purged_pages = true;
                 ASSERT(page);
                 return IterationDecision::Break;
@@ -568,7 +693,7 @@ RefPtr<PhysicalPage> MemoryManager::allocate_user_physical_page(ShouldZeroFill s
         }
     }
 
-    if (should_zero_fill == ShouldZeroFill::Yes) {
+    if (should_zero_fill == ShouldZeroFill::Yes && !page_is_zeroed) {
         auto* ptr = quickmap_page(*page);
         memset(ptr, 0, PAGE_SIZE);
         unquickmap_page();
@@ -579,6 +704,108 @@ RefPtr<PhysicalPage> MemoryManager::allocate_user_physical_page(ShouldZeroFill s
     return page;
 }
 
+static void zero_page_with_nontemporal_stores(u8* page)
+{
+    // movnti writes around the cache, so zeroing pages ahead of time doesn't
+    // evict the working set of whatever else is running on this CPU. It only
+    // needs SSE2 support, not the SSE register state.
+    FlatPtr ptr = (FlatPtr)page;
+    size_t count = PAGE_SIZE / 32;
+    asm volatile(
+        "xor %%eax, %%eax\n"
+        "1:\n"
+        "movnti %%eax, 0(%[ptr])\n"
+        "movnti %%eax, 4(%[ptr])\n"
+        "movnti %%eax, 8(%[ptr])\n"
+        "movnti %%eax, 12(%[ptr])\n"
+        "movnti %%eax, 16(%[ptr])\n"
+        "movnti %%eax, 20(%[ptr])\n"
+        "movnti %%eax, 24(%[ptr])\n"
+        "movnti %%eax, 28(%[ptr])\n"
+        "add $32, %[ptr]\n"
+        "dec %[count]\n"
+        "jnz 1b\n"
+        "sfence\n"
+        : [ptr] "+r"(ptr), [count] "+r"(count)
+        :
+        : "eax", "memory", "cc");
+}
+
+NonnullRefPtrVector<PhysicalPage> MemoryManager::take_committed_contiguous_user_physical_pages(size_t count, size_t physical_alignment)
+{
+    ScopedSpinLock lock(s_mm_lock);
+    ASSERT(m_user_physical_pages_committed >= count);
+    NonnullRefPtrVector<PhysicalPage> physical_pages;
+    for (auto& region : m_user_physical_regions) {
+        physical_pages = region.take_contiguous_free_pages(count, false, physical_alignment);
+        if (!physical_pages.is_empty())
+            break;
+    }
+    // Unlike single committed pages, there's no guarantee that we can find
+    // a suitable run of pages. Callers have to fall back to regular pages.
+    if (physical_pages.is_empty())
+        return {};
+
+    m_user_physical_pages_committed -= count;
+    m_user_physical_pages_used += count;
+    return physical_pages;
+}
+
+NonnullRefPtrVector<PhysicalPage> MemoryManager::allocate_committed_contiguous_user_physical_pages(size_t count, size_t physical_alignment)
+{
+    auto physical_pages = take_committed_contiguous_user_physical_pages(count, physical_alignment);
+
+    // Zeroing a whole huge page takes a while, so don't do it with s_mm_lock held.
+    // Nobody else can get at these pages yet. Interrupts are only disabled while
+    // one page is quickmapped.
+    bool use_nontemporal_stores = Processor::current().has_feature(CPUFeature::SSE2);
+    for (auto& page : physical_pages) {
+        InterruptDisabler disabler;
+        auto* ptr = quickmap_page(page);
+        if (use_nontemporal_stores)
+            zero_page_with_nontemporal_stores(ptr);
+        else
+            fast_u32_fill((u32*)ptr, 0, PAGE_SIZE / sizeof(u32));
+        unquickmap_page();
+    }
+    return physical_pages;
+}
+
+void MemoryManager::refill_zeroed_page_pool()
+{
+    bool use_nontemporal_stores = Processor::current().has_feature(CPUFeature::SSE2);
+    for (;;) {
+        RefPtr<PhysicalPage> page;
+        {
+            ScopedSpinLock lock(s_mm_lock);
+            if (m_zeroed_page_count == zeroed_page_pool_capacity || m_user_physical_pages_uncommitted == 0)
+                return;
+            page = take_free_user_physical_page_from_regions();
+            if (page.is_null())
+                return;
+            // While we're zeroing this page it can't be found by anyone else,
+            // so hold it back from the uncommitted count until it's in the pool.
+            m_user_physical_pages_uncommitted--;
+        }
+
+        {
+            // Only the quickmap slot is held while zeroing, not s_mm_lock.
+            InterruptDisabler disabler;
+            auto* ptr = quickmap_page(*page);
+            if (use_nontemporal_stores)
+                zero_page_with_nontemporal_stores(ptr);
+            else
+                fast_u32_fill((u32*)ptr, 0, PAGE_SIZE / sizeof(u32));
+            unquickmap_page();
+        }
+
+        ScopedSpinLock lock(s_mm_lock);
+        ASSERT(m_zeroed_page_count < zeroed_page_pool_capacity);
+        m_zeroed_pages[m_zeroed_page_count++] = move(page);
+        m_user_physical_pages_uncommitted++;
+    }
+}
+
 void MemoryManager::deallocate_supervisor_physical_page(const PhysicalPage& page)
 {
     ScopedSpinLock lock(s_mm_lock);
@@ -85,7 +85,9 @@ class MemoryManager {
     friend class PhysicalPage;
     friend class PhysicalRegion;
     friend class AnonymousVMObject;
+    friend class InodeVMObject;
     friend class Region;
+    friend class SharedInodeVMObject;
     friend class VMObject;
     friend OwnPtr<KBuffer> procfs$mm(InodeIdentifier);
     friend OwnPtr<KBuffer> procfs$memstat(InodeIdentifier);
@@ -116,11 +118,15 @@ public:
     void uncommit_user_physical_pages(size_t);
     NonnullRefPtr<PhysicalPage> allocate_committed_user_physical_page(ShouldZeroFill = ShouldZeroFill::Yes);
     RefPtr<PhysicalPage> allocate_user_physical_page(ShouldZeroFill = ShouldZeroFill::Yes, bool* did_purge = nullptr);
+    NonnullRefPtrVector<PhysicalPage> allocate_committed_contiguous_user_physical_pages(size_t count, size_t physical_alignment);
     RefPtr<PhysicalPage> allocate_supervisor_physical_page();
     NonnullRefPtrVector<PhysicalPage> allocate_contiguous_supervisor_physical_pages(size_t size);
     void deallocate_user_physical_page(const PhysicalPage&);
     void deallocate_supervisor_physical_page(const PhysicalPage&);
 
+    // Tops up the pool of pre-zeroed user pages. Called by the PageZeroingTask.
+    void refill_zeroed_page_pool();
+
     OwnPtr<Region> allocate_contiguous_kernel_region(size_t, const StringView& name, u8 access, bool user_accessible = false, bool cacheable = true);
     OwnPtr<Region> allocate_kernel_region(size_t, const StringView& name, u8 access, bool user_accessible = false, AllocationStrategy strategy = AllocationStrategy::Reserve, bool cacheable = true);
     OwnPtr<Region> allocate_kernel_region(PhysicalAddress, size_t, const StringView& name, u8 access, bool user_accessible = false, bool cacheable = true);
@@ -159,6 +165,9 @@ public:
     static Region* find_region_from_vaddr(Process&, VirtualAddress);
     static const Region* find_region_from_vaddr(const Process&, VirtualAddress);
 
+    // Returns a null address if vaddr isn't inside a kernel region backed by a real physical page.
+    static PhysicalAddress physical_address_for_kernel_vaddr(VirtualAddress);
+
     void dump_kernel_regions();
 
     PhysicalPage& shared_zero_page() { return *m_shared_zero_page; }
@@ -193,15 +202,20 @@ private:
 
     static Region* find_region_from_vaddr(VirtualAddress);
 
-    RefPtr<PhysicalPage> find_free_user_physical_page(bool);
+    RefPtr<PhysicalPage> find_free_user_physical_page(bool committed, ShouldZeroFill, bool& page_is_zeroed);
+    RefPtr<PhysicalPage> take_free_user_physical_page_from_regions();
+    NonnullRefPtrVector<PhysicalPage> take_committed_contiguous_user_physical_pages(size_t count, size_t physical_alignment);
+    RefPtr<PhysicalPage> take_zeroed_page_from_pool();
     u8* quickmap_page(PhysicalPage&);
     void unquickmap_page();
 
     PageDirectoryEntry* quickmap_pd(PageDirectory&, size_t pdpt_index);
     PageTableEntry* quickmap_pt(PhysicalAddress);
 
+    PageDirectoryEntry* pde(PageDirectory&, VirtualAddress);
     PageTableEntry* pte(PageDirectory&, VirtualAddress);
     PageTableEntry* ensure_pte(PageDirectory&, VirtualAddress);
+    PageDirectoryEntry* ensure_huge_pde(PageDirectory&, VirtualAddress);
     void release_pte(PageDirectory&, VirtualAddress, bool);
 
     RefPtr<PageDirectory> m_kernel_page_directory;
@@ -217,6 +231,13 @@ private:
     Atomic<unsigned, AK::MemoryOrder::memory_order_relaxed> m_super_physical_pages { 0 };
     Atomic<unsigned, AK::MemoryOrder::memory_order_relaxed> m_super_physical_pages_used { 0 };
 
+    // Free user pages that have already been zeroed in the background.
+    // They are still counted as free (and uncommitted) pages.
+    static constexpr size_t zeroed_page_pool_capacity = 256;
+    static constexpr size_t zeroed_page_pool_low_water = zeroed_page_pool_capacity / 2;
+    RefPtr<PhysicalPage> m_zeroed_pages[zeroed_page_pool_capacity];
+    size_t m_zeroed_page_count { 0 };
+
     NonnullRefPtrVector<PhysicalRegion> m_user_physical_regions;
     NonnullRefPtrVector<PhysicalRegion> m_super_physical_regions;
 
@@ -151,8 +151,10 @@ PageDirectory::PageDirectory(Process& process, const RangeAllocator* parent_rang
 PageDirectory::~PageDirectory()
 {
     ScopedSpinLock lock(s_mm_lock);
-    if (m_process)
+    if (m_process) {
         cr3_map().remove(cr3());
+        Processor::stop_using_page_directory(cr3());
+    }
 }
 
 }
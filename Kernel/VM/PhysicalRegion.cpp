@@ -24,12 +24,11 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <AK/Bitmap.h>
 #include <AK/NonnullRefPtr.h>
 #include <AK/RefPtr.h>
 #include <AK/Vector.h>
+#include <Kernel/Arch/i386/CPU.h>
 #include <Kernel/Assertions.h>
-#include <Kernel/Random.h>
 #include <Kernel/VM/PhysicalPage.h>
 #include <Kernel/VM/PhysicalRegion.h>
 
@@ -43,7 +42,6 @@ NonnullRefPtr<PhysicalRegion> PhysicalRegion::create(PhysicalAddress lower, Phys
 PhysicalRegion::PhysicalRegion(PhysicalAddress lower, PhysicalAddress upper)
     : m_lower(lower)
     , m_upper(upper)
-    , m_bitmap(Bitmap::create())
 {
 }
 
@@ -60,127 +58,220 @@ unsigned PhysicalRegion::finalize_capacity()
     ASSERT(!m_pages);
 
     m_pages = (m_upper.get() - m_lower.get()) / PAGE_SIZE;
-    m_bitmap.grow(m_pages, false);
+
+    for (size_t order = 0; order <= max_order; order++) {
+        auto& buddy_order = m_orders[order];
+        size_t words = ceil_div(block_count(order), (size_t)32);
+        buddy_order.bits.resize(words);
+        buddy_order.summary.resize(ceil_div(words, (size_t)32));
+        for (auto& word : buddy_order.bits)
+            word = 0;
+        for (auto& word : buddy_order.summary)
+            word = 0;
+    }
+
+    // Everything starts out free, as blocks that are as large as possible.
+    m_used = m_pages;
+    free_range(0, m_pages);
 
     return size();
 }
 
-NonnullRefPtrVector<PhysicalPage> PhysicalRegion::take_contiguous_free_pages(size_t count, bool supervisor)
+void PhysicalRegion::set_block_free(size_t order, size_t index)
 {
-    ASSERT(m_pages);
-    ASSERT(m_used != m_pages);
-
-    NonnullRefPtrVector<PhysicalPage> physical_pages;
-    physical_pages.ensure_capacity(count);
-
-    auto first_contiguous_page = find_contiguous_free_pages(count);
+    auto& buddy_order = m_orders[order];
+    auto& word = buddy_order.bits[index / 32];
+    ASSERT(!(word & (1u << (index % 32))));
+    word |= 1u << (index % 32);
+    buddy_order.summary[index / 1024] |= 1u << ((index / 32) % 32);
+    buddy_order.free_count++;
+}
 
-    for (size_t index = 0; index < count; index++)
-        physical_pages.append(PhysicalPage::create(m_lower.offset(PAGE_SIZE * (index + first_contiguous_page)), supervisor));
-    return physical_pages;
+void PhysicalRegion::set_block_used(size_t order, size_t index)
+{
+    auto& buddy_order = m_orders[order];
+    auto& word = buddy_order.bits[index / 32];
+    ASSERT(word & (1u << (index % 32)));
+    word &= ~(1u << (index % 32));
+    if (!word)
+        buddy_order.summary[index / 1024] &= ~(1u << ((index / 32) % 32));
+    buddy_order.free_count--;
 }
 
-unsigned PhysicalRegion::find_contiguous_free_pages(size_t count)
+bool PhysicalRegion::is_block_free(size_t order, size_t index) const
 {
-    ASSERT(count != 0);
-    // search from the last page we allocated
-    auto range = find_and_allocate_contiguous_range(count);
-    ASSERT(range.has_value());
-    return range.value();
+    return m_orders[order].bits[index / 32] & (1u << (index % 32));
 }
 
-Optional<unsigned> PhysicalRegion::find_one_free_page()
+Optional<size_t> PhysicalRegion::find_free_block(size_t order) const
 {
-    if (m_used == m_pages) {
-        // We know we don't have any free pages, no need to check the bitmap
-        // Check if we can draw one from the return queue
-        if (m_recently_returned.size() > 0) {
-            u8 index = get_fast_random<u8>() % m_recently_returned.size();
-            Checked<FlatPtr> local_offset = m_recently_returned[index].get();
-            local_offset -= m_lower.get();
-            m_recently_returned.remove(index);
-            ASSERT(!local_offset.has_overflow());
-            ASSERT(local_offset.value() < (FlatPtr)(m_pages * PAGE_SIZE));
-            return local_offset.value() / PAGE_SIZE;
-        }
+    auto& buddy_order = m_orders[order];
+    if (!buddy_order.free_count)
         return {};
+    for (size_t i = 0; i < buddy_order.summary.size(); i++) {
+        if (auto summary_word = buddy_order.summary[i]) {
+            size_t word_index = i * 32 + __builtin_ctz(summary_word);
+            return word_index * 32 + __builtin_ctz(buddy_order.bits[word_index]);
+        }
     }
-    auto free_index = m_bitmap.find_one_anywhere_unset(m_free_hint);
-    if (!free_index.has_value())
+    ASSERT_NOT_REACHED();
+}
+
+Optional<unsigned> PhysicalRegion::allocate_block(size_t order)
+{
+    ASSERT(order <= max_order);
+    // Take the smallest free block that is large enough...
+    size_t block_order = order;
+    Optional<size_t> index;
+    for (; block_order <= max_order; block_order++) {
+        index = find_free_block(block_order);
+        if (index.has_value())
+            break;
+    }
+    if (!index.has_value())
         return {};
 
-    auto page_index = free_index.value();
-    m_bitmap.set(page_index, true);
-    m_used++;
-    m_free_hint = free_index.value() + 1; // Just a guess
-    if (m_free_hint >= m_bitmap.size())
-        m_free_hint = 0;
-    return page_index;
+    // ...and split it up until it has the size we want, putting the
+    // upper halves back onto the free lists.
+    size_t block_index = index.value();
+    set_block_used(block_order, block_index);
+    while (block_order > order) {
+        block_order--;
+        block_index *= 2;
+        set_block_free(block_order, block_index + 1);
+    }
+    m_used += 1u << order;
+    return block_index << order;
 }
 
-Optional<unsigned> PhysicalRegion::find_and_allocate_contiguous_range(size_t count)
+void PhysicalRegion::free_block(unsigned page_index, size_t order)
 {
-    ASSERT(count != 0);
-    size_t found_pages_count = 0;
-    auto first_index = m_bitmap.find_longest_range_of_unset_bits(count, found_pages_count);
-    if (!first_index.has_value())
-        return {};
+    ASSERT(!(page_index & ((1u << order) - 1)));
+    ASSERT(m_used >= (1u << order));
+    m_used -= 1u << order;
 
-    auto page = first_index.value();
-    if (count == found_pages_count) {
-        m_bitmap.set_range<true>(page, count);
-        m_used += count;
-        m_free_hint = first_index.value() + count + 1; // Just a guess
-        if (m_free_hint >= m_bitmap.size())
-            m_free_hint = 0;
-        return page;
+    size_t block_index = page_index >> order;
+    while (order < max_order) {
+        size_t buddy_index = block_index ^ 1;
+        if (buddy_index >= block_count(order) || !is_block_free(order, buddy_index))
+            break;
+        // Our buddy is free too, merge the two and try again one level up.
+        set_block_used(order, buddy_index);
+        block_index /= 2;
+        order++;
     }
-    return {};
+    set_block_free(order, block_index);
 }
 
-RefPtr<PhysicalPage> PhysicalRegion::take_free_page(bool supervisor)
+void PhysicalRegion::free_range(unsigned page_index, size_t count)
+{
+    // Free the range in the largest naturally aligned blocks that fit.
+    unsigned end = page_index + count;
+    while (page_index < end) {
+        size_t order = page_index ? min((size_t)__builtin_ctz(page_index), max_order) : max_order;
+        while (page_index + (1u << order) > end)
+            order--;
+        free_block(page_index, order);
+        page_index += 1u << order;
+    }
+}
+
+PhysicalRegion::HotList& PhysicalRegion::hot_list_for_current_processor()
+{
+    u32 cpu = Processor::current().id();
+    if (cpu >= m_hot_lists.size())
+        m_hot_lists.resize(cpu + 1);
+    return m_hot_lists[cpu];
+}
+
+NonnullRefPtrVector<PhysicalPage> PhysicalRegion::take_contiguous_free_pages(size_t count, bool supervisor, size_t physical_alignment)
 {
     ASSERT(m_pages);
+    ASSERT(count != 0);
+    ASSERT(physical_alignment >= PAGE_SIZE && !(physical_alignment & (physical_alignment - 1)));
+
+    // Buddy blocks are only aligned relative to the start of the region.
+    // If the region itself isn't aligned as requested, take a block that
+    // is large enough to contain an aligned run of pages somewhere inside.
+    size_t alignment_in_pages = physical_alignment / PAGE_SIZE;
+    bool region_is_aligned = !((m_lower.get() / PAGE_SIZE) & (alignment_in_pages - 1));
+    size_t pages_needed = region_is_aligned ? max(count, alignment_in_pages) : count + alignment_in_pages - 1;
 
-    auto free_index = find_one_free_page();
-    if (!free_index.has_value())
-        return nullptr;
+    size_t order = 0;
+    while ((1u << order) < pages_needed)
+        order++;
+    if (order > max_order)
+        return {};
 
-    return PhysicalPage::create(m_lower.offset(free_index.value() * PAGE_SIZE), supervisor);
+    auto first_page = allocate_block(order);
+    if (!first_page.has_value())
+        return {};
+
+    // Give back the parts of the block we don't need.
+    size_t block_size = 1u << order;
+    size_t misalignment = (m_lower.get() / PAGE_SIZE + first_page.value()) & (alignment_in_pages - 1);
+    size_t head = misalignment ? alignment_in_pages - misalignment : 0;
+    if (head)
+        free_range(first_page.value(), head);
+    if (block_size > head + count)
+        free_range(first_page.value() + head + count, block_size - head - count);
+
+    NonnullRefPtrVector<PhysicalPage> physical_pages;
+    physical_pages.ensure_capacity(count);
+    for (size_t index = 0; index < count; index++)
+        physical_pages.append(PhysicalPage::create(m_lower.offset(PAGE_SIZE * (index + head + first_page.value())), supervisor));
+    return physical_pages;
 }
 
-void PhysicalRegion::free_page_at(PhysicalAddress addr)
+RefPtr<PhysicalPage> PhysicalRegion::take_free_page(bool supervisor)
 {
     ASSERT(m_pages);
 
-    if (m_used == 0) {
-        ASSERT_NOT_REACHED();
+    auto& hot_list = hot_list_for_current_processor();
+    if (hot_list.count == 0) {
+        // Refill the hot list with a batch of pages, so that we don't have
+        // to go to the buddy allocator for every single page.
+        while (hot_list.count < hot_list_batch) {
+            auto page_index = allocate_block(0);
+            if (!page_index.has_value())
+                break;
+            hot_list.pages[hot_list.count++] = page_index.value();
+            m_hot_pages++;
+        }
+        if (hot_list.count == 0)
+            return nullptr;
     }
 
-    Checked<FlatPtr> local_offset = addr.get();
-    local_offset -= m_lower.get();
-    ASSERT(!local_offset.has_overflow());
-    ASSERT(local_offset.value() < (FlatPtr)(m_pages * PAGE_SIZE));
-
-    auto page = local_offset.value() / PAGE_SIZE;
-    m_bitmap.set(page, false);
-    m_free_hint = page; // We know we can find one here for sure
-    m_used--;
+    m_hot_pages--;
+    auto page_index = hot_list.pages[--hot_list.count];
+    return PhysicalPage::create(m_lower.offset(page_index * PAGE_SIZE), supervisor);
 }
 
 void PhysicalRegion::return_page(const PhysicalPage& page)
 {
-    auto returned_count = m_recently_returned.size();
-    if (returned_count >= m_recently_returned.capacity()) {
-        // Return queue is full, pick a random entry and free that page
-        // and replace the entry with this page
-        auto& entry = m_recently_returned[get_fast_random<u8>()];
-        free_page_at(entry);
-        entry = page.paddr();
-    } else {
-        // Still filling the return queue, just append it
-        m_recently_returned.append(page.paddr());
+    ASSERT(m_pages);
+
+    Checked<FlatPtr> local_offset = page.paddr().get();
+    local_offset -= m_lower.get();
+    ASSERT(!local_offset.has_overflow());
+    ASSERT(local_offset.value() < (FlatPtr)(m_pages * PAGE_SIZE));
+    unsigned page_index = local_offset.value() / PAGE_SIZE;
+    ASSERT(!is_block_free(0, page_index));
+    ASSERT(used() > 0);
+
+    auto& hot_list = hot_list_for_current_processor();
+    if (hot_list.count == hot_list_capacity) {
+        // Hand the older half of the hot list back to the buddy allocator.
+        // The pages we just freed are the most likely ones to still be cached.
+        for (size_t i = 0; i < hot_list_batch; i++)
+            free_block(hot_list.pages[i], 0);
+        m_hot_pages -= hot_list_batch;
+        for (size_t i = hot_list_batch; i < hot_list_capacity; i++)
+            hot_list.pages[i - hot_list_batch] = hot_list.pages[i];
+        hot_list.count -= hot_list_batch;
     }
+    hot_list.pages[hot_list.count++] = page_index;
+    m_hot_pages++;
 }
 
 }
@@ -26,14 +26,19 @@
 
 #pragma once
 
-#include <AK/Bitmap.h>
 #include <AK/NonnullRefPtrVector.h>
 #include <AK/Optional.h>
 #include <AK/RefCounted.h>
+#include <AK/Vector.h>
 #include <Kernel/VM/PhysicalPage.h>
 
 namespace Kernel {
 
+// A PhysicalRegion hands out its pages with a binary buddy allocator: free
+// memory is kept as naturally aligned blocks of 2^order pages, and a freed
+// block is merged with its buddy whenever that one is free as well. Single
+// pages are additionally cached in small per-CPU hot lists, so most order-0
+// allocations and frees never have to touch the buddy lists at all.
 class PhysicalRegion : public RefCounted<PhysicalRegion> {
     AK_MAKE_ETERNAL
 
@@ -47,29 +52,53 @@ public:
     PhysicalAddress lower() const { return m_lower; }
     PhysicalAddress upper() const { return m_upper; }
     unsigned size() const { return m_pages; }
-    unsigned used() const { return m_used - m_recently_returned.size(); }
-    unsigned free() const { return m_pages - m_used + m_recently_returned.size(); }
+    unsigned used() const { return m_used - m_hot_pages; }
+    unsigned free() const { return m_pages - used(); }
     bool contains(const PhysicalPage& page) const { return page.paddr() >= m_lower && page.paddr() <= m_upper; }
 
     RefPtr<PhysicalPage> take_free_page(bool supervisor);
-    NonnullRefPtrVector<PhysicalPage> take_contiguous_free_pages(size_t count, bool supervisor);
+    NonnullRefPtrVector<PhysicalPage> take_contiguous_free_pages(size_t count, bool supervisor, size_t physical_alignment = PAGE_SIZE);
     void return_page(const PhysicalPage& page);
 
 private:
-    unsigned find_contiguous_free_pages(size_t count);
-    Optional<unsigned> find_and_allocate_contiguous_range(size_t count);
-    Optional<unsigned> find_one_free_page();
-    void free_page_at(PhysicalAddress addr);
+    static constexpr size_t max_order = 10; // 4 MiB
+    static constexpr size_t hot_list_capacity = 32;
+    static constexpr size_t hot_list_batch = hot_list_capacity / 2;
+
+    // The free blocks of one order, as a bitmap with a summary bitmap on top
+    // (one bit per non-zero word), so that finding a free block only has to
+    // look at a handful of words.
+    struct BuddyOrder {
+        Vector<u32> bits;
+        Vector<u32> summary;
+        size_t free_count { 0 };
+    };
+
+    struct HotList {
+        unsigned pages[hot_list_capacity];
+        size_t count { 0 };
+    };
+
+    Optional<unsigned> allocate_block(size_t order);
+    void free_block(unsigned page_index, size_t order);
+    void free_range(unsigned page_index, size_t count);
+    HotList& hot_list_for_current_processor();
+
+    void set_block_free(size_t order, size_t index);
+    void set_block_used(size_t order, size_t index);
+    bool is_block_free(size_t order, size_t index) const;
+    Optional<size_t> find_free_block(size_t order) const;
+    size_t block_count(size_t order) const { return m_pages >> order; }
 
     PhysicalRegion(PhysicalAddress lower, PhysicalAddress upper);
 
     PhysicalAddress m_lower;
     PhysicalAddress m_upper;
     unsigned m_pages { 0 };
-    unsigned m_used { 0 };
-    Bitmap m_bitmap;
-    size_t m_free_hint { 0 };
-    Vector<PhysicalAddress, 256> m_recently_returned;
+    unsigned m_used { 0 }; // Pages that are not in the buddy allocator, including the hot lists
+    unsigned m_hot_pages { 0 };
+    BuddyOrder m_orders[max_order + 1];
+    Vector<HotList> m_hot_lists;
 };
 
 }
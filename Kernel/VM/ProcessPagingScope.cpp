@@ -32,7 +32,9 @@ namespace Kernel {
 ProcessPagingScope::ProcessPagingScope(Process& process)
 {
     ASSERT(Thread::current() != nullptr);
-    m_previous_cr3 = read_cr3();
+    // Kernel threads may be running on a borrowed page directory, so go back
+    // to the thread's own one afterwards, not to whatever is loaded right now.
+    m_previous_cr3 = Thread::current()->tss().cr3;
     MM.enter_process_paging_scope(process);
 }
 
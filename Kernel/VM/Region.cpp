@@ -129,7 +129,7 @@ OwnPtr<Region> Region::clone(Process& new_owner)
         return {};
 
     // Set up a COW region. The parent (this) region becomes COW as well!
-    remap();
+    write_protect_for_cow();
     auto clone_region = Region::create_user_accessible(&new_owner, m_range, vmobject_clone.release_nonnull(), m_offset_in_vmobject, m_name, m_access);
     if (m_vmobject->is_anonymous())
         clone_region->copy_purgeable_page_ranges(*this);
@@ -289,6 +289,47 @@ bool Region::map_individual_page_impl(size_t page_index)
     return true;
 }
 
+bool Region::can_map_huge_page(size_t page_index) const
+{
+    constexpr size_t pages_per_huge_page = HUGE_PAGE_SIZE / PAGE_SIZE;
+    if (vaddr_from_page_index(page_index).get() & (HUGE_PAGE_SIZE - 1))
+        return false;
+    if (page_index + pages_per_huge_page > page_count())
+        return false;
+    if (!is_readable() && !is_writable())
+        return false;
+    auto* first_page = physical_page(page_index);
+    if (!first_page || (first_page->paddr().get() & (HUGE_PAGE_SIZE - 1)))
+        return false;
+    // All pages have to be physically contiguous and mapped the same way.
+    for (size_t i = 0; i < pages_per_huge_page; ++i) {
+        auto* page = physical_page(page_index + i);
+        if (!page || page->paddr() != first_page->paddr().offset(i * PAGE_SIZE))
+            return false;
+        if (page->is_shared_zero_page() || page->is_lazy_committed_page() || should_cow(page_index + i))
+            return false;
+    }
+    return true;
+}
+
+bool Region::map_huge_page_impl(size_t page_index)
+{
+    ASSERT(m_page_directory->get_lock().own_lock());
+    auto* pde = MM.ensure_huge_pde(*m_page_directory, vaddr_from_page_index(page_index));
+    if (!pde)
+        return false;
+    pde->clear();
+    pde->set_page_table_base(physical_page(page_index)->paddr().get());
+    pde->set_huge(true);
+    pde->set_cache_disabled(!m_cacheable);
+    pde->set_present(true);
+    pde->set_writable(is_writable());
+    if (Processor::current().has_feature(CPUFeature::NX))
+        pde->set_execute_disabled(!is_executable());
+    pde->set_user_allowed(is_user_accessible());
+    return true;
+}
+
 bool Region::do_remap_vmobject_page_range(size_t page_index, size_t page_count)
 {
     bool success = true;
@@ -390,20 +431,89 @@ bool Region::map(PageDirectory& page_directory)
 {
     ScopedSpinLock lock(s_mm_lock);
     ScopedSpinLock page_lock(page_directory.get_lock());
+    // If this region wasn't mapped before, there are no old entries for it in
+    // any TLB. Whoever unmapped this range last has already flushed it, and
+    // processors never cache non-present entries.
+    bool is_remap = m_page_directory;
     set_page_directory(page_directory);
     size_t page_index = 0;
     while (page_index < page_count()) {
+        if (can_map_huge_page(page_index) && map_huge_page_impl(page_index)) {
+            page_index += HUGE_PAGE_SIZE / PAGE_SIZE;
+            continue;
+        }
         if (!map_individual_page_impl(page_index))
             break;
         ++page_index;
     }
     if (page_index > 0) {
-        MM.flush_tlb(m_page_directory, vaddr(), page_index);
+        if (is_remap)
+            MM.flush_tlb(m_page_directory, vaddr(), page_index);
         return page_index == page_count();
     }
     return false;
 }
 
+void Region::map_on_demand(PageDirectory& page_directory)
+{
+    // Don't touch any page tables yet. handle_fault() maps each page
+    // (and a few of its neighbours) the first time it's accessed.
+    ScopedSpinLock lock(s_mm_lock);
+    set_page_directory(page_directory);
+}
+
+void Region::write_protect_for_cow()
+{
+    ASSERT(s_mm_lock.own_lock());
+    ASSERT(m_page_directory);
+    // Only writable anonymous memory can have COW pages. Everything else
+    // would be mapped exactly the same way again.
+    if (!is_writable() || !vmobject().is_anonymous())
+        return;
+    ScopedSpinLock page_lock(m_page_directory->get_lock());
+    constexpr size_t pages_per_page_table = HUGE_PAGE_SIZE / PAGE_SIZE;
+    size_t page_index = 0;
+    while (page_index < page_count()) {
+        auto page_vaddr = vaddr_from_page_index(page_index);
+        size_t pages_left_in_table = pages_per_page_table - ((page_vaddr.get() / PAGE_SIZE) % pages_per_page_table);
+        size_t end = min(page_index + pages_left_in_table, page_count());
+        auto* pde = MM.pde(*m_page_directory, page_vaddr);
+        if (pde->is_present() && pde->is_huge()) {
+            // A huge page is only ever used for a whole aligned 2 MiB chunk,
+            // so write-protecting the PDE covers exactly these pages. The
+            // first COW fault splits it up again.
+            pde->set_writable(false);
+        } else if (pde->is_present()) {
+            auto* page_table = MM.quickmap_pt(PhysicalAddress((FlatPtr)pde->page_table_base()));
+            size_t first_pte_index = (page_vaddr.get() >> 12) & 0x1ff;
+            for (size_t i = 0; i < end - page_index; ++i)
+                page_table[first_pte_index + i].set_writable(false);
+        }
+        page_index = end;
+    }
+    MM.flush_tlb(m_page_directory, vaddr(), page_count());
+}
+
+void Region::map_around(size_t page_index)
+{
+    ASSERT(s_mm_lock.own_lock());
+    ASSERT(m_page_directory);
+    constexpr size_t fault_around_pages = 16;
+    ScopedSpinLock page_lock(m_page_directory->get_lock());
+    size_t first = page_index & ~(fault_around_pages - 1);
+    size_t end = min(first + fault_around_pages, page_count());
+    for (size_t i = first; i < end; ++i) {
+        if (i == page_index || !physical_page(i))
+            continue;
+        // Only fill in entries that aren't present, so there is never
+        // anything to flush.
+        auto* pte = MM.pte(*m_page_directory, vaddr_from_page_index(i));
+        if (!pte || pte->is_present())
+            continue;
+        map_individual_page_impl(i);
+    }
+}
+
 void Region::remap()
 {
     ASSERT(m_page_directory);
@@ -437,6 +547,12 @@ PageFaultResponse Region::handle_fault(const PageFault& fault)
             remap_vmobject_page(page_index_in_vmobject);
             return PageFaultResponse::Continue;
         }
+        if (!page_slot.is_null()) {
+#ifdef PAGE_FAULT_DEBUG
+            dbg() << "NP(unmapped) fault in Region{" << this << "}[" << page_index_in_region << "]";
+#endif
+            return handle_unmapped_page_fault(page_index_in_region, fault.is_write());
+        }
 #ifdef MAP_SHARED_ZERO_PAGE_LAZILY
         if (fault.is_read()) {
             page_slot = MM.shared_zero_page();
@@ -513,6 +629,26 @@ PageFaultResponse Region::handle_zero_fault(size_t page_index_in_region)
     return PageFaultResponse::Continue;
 }
 
+PageFaultResponse Region::handle_unmapped_page_fault(size_t page_index_in_region, bool is_write)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+
+    auto page_index_in_vmobject = translate_to_vmobject_page(page_index_in_region);
+    if (!remap_vmobject_page(page_index_in_vmobject))
+        return PageFaultResponse::OutOfMemory;
+    map_around(page_index_in_region);
+
+    // The page is mapped read-only if it's still shared. Break the sharing
+    // now instead of taking a second fault right after returning.
+    if (is_write && should_cow(page_index_in_region)) {
+        auto* phys_page = physical_page(page_index_in_region);
+        if (phys_page->is_shared_zero_page() || phys_page->is_lazy_committed_page())
+            return handle_zero_fault(page_index_in_region);
+        return handle_cow_fault(page_index_in_region);
+    }
+    return PageFaultResponse::Continue;
+}
+
 PageFaultResponse Region::handle_cow_fault(size_t page_index_in_region)
 {
     ASSERT_INTERRUPTS_DISABLED();
@@ -559,39 +695,15 @@ PageFaultResponse Region::handle_inode_fault(size_t page_index_in_region)
     if (current_thread)
         current_thread->did_inode_fault();
 
-    u8 page_buffer[PAGE_SIZE];
-    auto& inode = inode_vmobject.inode();
-    auto buffer = UserOrKernelBuffer::for_kernel_buffer(page_buffer);
-    auto nread = inode.read_bytes(page_index_in_vmobject * PAGE_SIZE, PAGE_SIZE, buffer, nullptr);
-    if (nread < 0) {
-        klog() << "MM: handle_inode_fault had error (" << nread << ") while reading!";
-        return PageFaultResponse::ShouldCrash;
-    }
-    if (nread < PAGE_SIZE) {
-        // If we read less than a page, zero out the rest to avoid leaking uninitialized data.
-        memset(page_buffer + nread, 0, PAGE_SIZE - nread);
-    }
-
-    vmobject_physical_page_entry = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::No);
-    if (vmobject_physical_page_entry.is_null()) {
-        klog() << "MM: handle_inode_fault was unable to allocate a physical page";
-        return PageFaultResponse::OutOfMemory;
-    }
-
-    u8* dest_ptr = MM.quickmap_page(*vmobject_physical_page_entry);
-    {
-        void* fault_at;
-        if (!safe_memcpy(dest_ptr, page_buffer, PAGE_SIZE, fault_at)) {
-            if ((u8*)fault_at >= dest_ptr && (u8*)fault_at <= dest_ptr + PAGE_SIZE)
-                dbgln("      >> inode fault: error copying data to {}/{}, failed at {}",
-                    vmobject_physical_page_entry->paddr(),
-                    VirtualAddress(dest_ptr),
-                    VirtualAddress(fault_at));
-            else
-                ASSERT_NOT_REACHED();
+    auto page_or_error = inode_vmobject.page_in(page_index_in_vmobject);
+    if (page_or_error.is_error()) {
+        if (page_or_error.error() == -ENOMEM) {
+            klog() << "MM: handle_inode_fault was unable to allocate a physical page";
+            return PageFaultResponse::OutOfMemory;
         }
+        klog() << "MM: handle_inode_fault had error (" << page_or_error.error() << ") while reading!";
+        return PageFaultResponse::ShouldCrash;
     }
-    MM.unquickmap_page();
 
     remap_vmobject_page(page_index_in_vmobject);
     return PageFaultResponse::Continue;
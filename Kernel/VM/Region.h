@@ -212,6 +212,7 @@ public:
 
     void set_page_directory(PageDirectory&);
     bool map(PageDirectory&);
+    void map_on_demand(PageDirectory&);
     enum class ShouldDeallocateVirtualMemoryRange {
         No,
         Yes,
@@ -258,8 +259,14 @@ private:
     PageFaultResponse handle_cow_fault(size_t page_index);
     PageFaultResponse handle_inode_fault(size_t page_index);
     PageFaultResponse handle_zero_fault(size_t page_index);
+    PageFaultResponse handle_unmapped_page_fault(size_t page_index, bool is_write);
+
+    void write_protect_for_cow();
+    void map_around(size_t page_index);
 
     bool map_individual_page_impl(size_t page_index);
+    bool can_map_huge_page(size_t page_index) const;
+    bool map_huge_page_impl(size_t page_index);
 
     void register_purgeable_page_ranges();
     void unregister_purgeable_page_ranges();
@@ -25,6 +25,7 @@
  */
 
 #include <Kernel/FileSystem/Inode.h>
+#include <Kernel/Time/TimeManagement.h>
 #include <Kernel/VM/MemoryManager.h>
 #include <Kernel/VM/Region.h>
 #include <Kernel/VM/SharedInodeVMObject.h>
@@ -56,4 +57,57 @@ SharedInodeVMObject::SharedInodeVMObject(const SharedInodeVMObject& other)
 {
 }
 
+KResultOr<NonnullRefPtr<PhysicalPage>> SharedInodeVMObject::fetch_page(size_t page_index)
+{
+    m_last_read_time = TimeManagement::the().uptime_ms();
+    LOCKER(m_paging_lock);
+    return page_in(page_index);
+}
+
+ssize_t SharedInodeVMObject::read_bytes(off_t offset, ssize_t count, UserOrKernelBuffer& buffer)
+{
+    ASSERT(offset >= 0);
+    ASSERT(count >= 0);
+
+    size_t size = inode().size();
+    if (static_cast<size_t>(offset) >= size)
+        return 0;
+    size_t remaining = min(static_cast<size_t>(count), size - offset);
+
+    u8 page_buffer[PAGE_SIZE];
+    size_t nread = 0;
+    while (nread < remaining) {
+        size_t position = offset + nread;
+        size_t offset_in_page = position % PAGE_SIZE;
+        size_t bytes_to_copy = min(PAGE_SIZE - offset_in_page, remaining - nread);
+
+        auto page_or_error = fetch_page(position / PAGE_SIZE);
+        if (page_or_error.is_error()) {
+            if (nread > 0)
+                break;
+            return page_or_error.error();
+        }
+
+        // NOTE: We can't fault in user memory while the page is quickmapped, so
+        //       copies to user buffers go through page_buffer.
+        bool is_kernel_buffer = buffer.is_kernel_buffer();
+        bool copied = true;
+        {
+            InterruptDisabler disabler;
+            const u8* page_data = MM.quickmap_page(page_or_error.value()) + offset_in_page;
+            if (is_kernel_buffer)
+                copied = buffer.write(page_data, nread, bytes_to_copy);
+            else
+                memcpy(page_buffer, page_data, bytes_to_copy);
+            MM.unquickmap_page();
+        }
+        if (!is_kernel_buffer)
+            copied = buffer.write(page_buffer, nread, bytes_to_copy);
+        if (!copied)
+            return -EFAULT;
+        nread += bytes_to_copy;
+    }
+    return nread;
+}
+
 }
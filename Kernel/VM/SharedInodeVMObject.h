@@ -39,6 +39,12 @@ public:
     static NonnullRefPtr<SharedInodeVMObject> create_with_inode(Inode&);
     virtual RefPtr<VMObject> clone() override;
 
+    // The shared VMObject of an inode doubles as its page cache, which read() is served from as well.
+    KResultOr<NonnullRefPtr<PhysicalPage>> fetch_page(size_t page_index);
+    ssize_t read_bytes(off_t, ssize_t, UserOrKernelBuffer&);
+
+    u64 last_read_time() const { return m_last_read_time; }
+
 private:
     virtual bool is_shared_inode() const override { return true; }
 
@@ -48,6 +54,8 @@ private:
     virtual const char* class_name() const override { return "SharedInodeVMObject"; }
 
     SharedInodeVMObject& operator=(const SharedInodeVMObject&) = delete;
+
+    u64 m_last_read_time { 0 };
 };
 
 }
@@ -34,9 +34,10 @@ namespace Kernel {
 
 class WaitQueue : public Thread::BlockCondition {
 public:
-    void wake_one();
-    void wake_n(u32 wake_count);
-    void wake_all();
+    u32 wake_one();
+    u32 wake_n(u32 wake_count);
+    u32 wake_all();
+    u32 requeue(WaitQueue& target, u32 requeue_count);
 
     template<class... Args>
     Thread::BlockResult wait_on(const Thread::BlockTimeout& timeout, Args&&... args)
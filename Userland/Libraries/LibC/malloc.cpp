@@ -24,6 +24,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <AK/Atomic.h>
 #include <AK/InlineLinkedList.h>
 #include <AK/LogStream.h>
 #include <AK/ScopedValueRollback.h>
@@ -38,11 +39,13 @@
 #include <sys/internals.h>
 #include <sys/mman.h>
 
-// FIXME: Thread safety.
-
 //#define MALLOC_DEBUG
 #define RECYCLE_BIG_ALLOCATIONS
 
+#ifndef NO_TLS
+#    define MALLOC_THREAD_CACHE
+#endif
+
 #define PAGE_ROUND_UP(x) ((((size_t)(x)) + PAGE_SIZE - 1) & (~(PAGE_SIZE - 1)))
 
 ALWAYS_INLINE static void ue_notify_malloc(const void* ptr, size_t size)
@@ -60,12 +63,6 @@ ALWAYS_INLINE static void ue_notify_realloc(const void* ptr, size_t size)
     send_secret_data_to_userspace_emulator(3, size, (FlatPtr)ptr);
 }
 
-static LibThread::Lock& malloc_lock()
-{
-    static u32 lock_storage[sizeof(LibThread::Lock) / sizeof(u32)];
-    return *reinterpret_cast<LibThread::Lock*>(&lock_storage);
-}
-
 constexpr size_t number_of_chunked_blocks_to_keep_around_per_size_class = 4;
 constexpr size_t number_of_big_blocks_to_keep_around_per_size_class = 8;
 
@@ -74,39 +71,46 @@ static bool s_scrub_malloc = true;
 static bool s_scrub_free = true;
 static bool s_profiling = false;
 
+// These are only ever looked at by serenity_dump_malloc_stats(), so we don't need them to be ordered.
+typedef Atomic<size_t, AK::memory_order_relaxed> MallocStatCounter;
+
 struct MallocStats {
-    size_t number_of_malloc_calls;
+    MallocStatCounter number_of_malloc_calls;
 
-    size_t number_of_big_allocator_hits;
-    size_t number_of_big_allocator_purge_hits;
-    size_t number_of_big_allocs;
+    MallocStatCounter number_of_big_allocator_hits;
+    MallocStatCounter number_of_big_allocator_purge_hits;
+    MallocStatCounter number_of_big_allocs;
 
-    size_t number_of_empty_block_hits;
-    size_t number_of_empty_block_purge_hits;
-    size_t number_of_block_allocs;
-    size_t number_of_blocks_full;
+    MallocStatCounter number_of_empty_block_hits;
+    MallocStatCounter number_of_empty_block_purge_hits;
+    MallocStatCounter number_of_block_allocs;
+    MallocStatCounter number_of_blocks_full;
 
-    size_t number_of_free_calls;
+    MallocStatCounter number_of_free_calls;
 
-    size_t number_of_big_allocator_keeps;
-    size_t number_of_big_allocator_frees;
+    MallocStatCounter number_of_big_allocator_keeps;
+    MallocStatCounter number_of_big_allocator_frees;
 
-    size_t number_of_freed_full_blocks;
-    size_t number_of_keeps;
-    size_t number_of_frees;
+    MallocStatCounter number_of_freed_full_blocks;
+    MallocStatCounter number_of_keeps;
+    MallocStatCounter number_of_frees;
 };
 static MallocStats g_malloc_stats = {};
 
+// Each size class has its own lock, so threads allocating different sizes don't contend.
 struct Allocator {
+    LibThread::Lock lock;
     size_t size { 0 };
     size_t block_count { 0 };
     size_t empty_block_count { 0 };
     ChunkedBlock* empty_blocks[number_of_chunked_blocks_to_keep_around_per_size_class] { nullptr };
+    // Every block in usable_blocks has at least one free chunk, so we can always allocate from the head.
     InlineLinkedList<ChunkedBlock> usable_blocks;
     InlineLinkedList<ChunkedBlock> full_blocks;
 };
 
 struct BigAllocator {
+    LibThread::Lock lock;
     Vector<BigAllocationBlock*, number_of_big_blocks_to_keep_around_per_size_class> blocks;
 };
 
@@ -150,6 +154,29 @@ static BigAllocator* big_allocator_for_size(size_t size)
 }
 #endif
 
+#ifdef MALLOC_THREAD_CACHE
+// Every thread keeps a small stack of free chunks for each of the smallest size classes.
+// Most small allocations and frees are served from it without taking any lock.
+constexpr size_t number_of_thread_cached_size_classes = 6; // Up to 256 bytes.
+constexpr size_t thread_cache_capacity = 32;
+constexpr size_t thread_cache_batch_size = thread_cache_capacity / 2;
+
+struct ThreadCacheBin {
+    size_t count;
+    void* chunks[thread_cache_capacity];
+};
+
+static __thread ThreadCacheBin s_thread_cache[number_of_thread_cached_size_classes];
+
+static ThreadCacheBin* thread_cache_bin_for(const Allocator& allocator)
+{
+    size_t size_class = &allocator - allocators();
+    if (size_class >= number_of_thread_cached_size_classes)
+        return nullptr;
+    return &s_thread_cache[size_class];
+}
+#endif
+
 extern "C" {
 
 static void* os_alloc(size_t size, const char* name)
@@ -165,65 +192,13 @@ static void os_free(void* ptr, size_t size)
     assert(rc == 0);
 }
 
-static void* malloc_impl(size_t size)
+static void* allocate_chunk(Allocator& allocator, size_t good_size)
 {
-    LOCKER(malloc_lock());
+    ChunkedBlock* block = allocator.usable_blocks.head();
 
-    if (s_log_malloc)
-        dbgprintf("LibC: malloc(%zu)\n", size);
-
-    if (!size)
-        return nullptr;
-
-    g_malloc_stats.number_of_malloc_calls++;
-
-    size_t good_size;
-    auto* allocator = allocator_for_size(size, good_size);
-
-    if (!allocator) {
-        size_t real_size = round_up_to_power_of_two(sizeof(BigAllocationBlock) + size, ChunkedBlock::block_size);
-#ifdef RECYCLE_BIG_ALLOCATIONS
-        if (auto* allocator = big_allocator_for_size(real_size)) {
-            if (!allocator->blocks.is_empty()) {
-                g_malloc_stats.number_of_big_allocator_hits++;
-                auto* block = allocator->blocks.take_last();
-                int rc = madvise(block, real_size, MADV_SET_NONVOLATILE);
-                bool this_block_was_purged = rc == 1;
-                if (rc < 0) {
-                    perror("madvise");
-                    ASSERT_NOT_REACHED();
-                }
-                if (mprotect(block, real_size, PROT_READ | PROT_WRITE) < 0) {
-                    perror("mprotect");
-                    ASSERT_NOT_REACHED();
-                }
-                if (this_block_was_purged) {
-                    g_malloc_stats.number_of_big_allocator_purge_hits++;
-                    new (block) BigAllocationBlock(real_size);
-                }
-
-                ue_notify_malloc(&block->m_slot[0], size);
-                return &block->m_slot[0];
-            }
-        }
-#endif
-        g_malloc_stats.number_of_big_allocs++;
-        auto* block = (BigAllocationBlock*)os_alloc(real_size, "malloc: BigAllocationBlock");
-        new (block) BigAllocationBlock(real_size);
-        ue_notify_malloc(&block->m_slot[0], size);
-        return &block->m_slot[0];
-    }
-
-    ChunkedBlock* block = nullptr;
-
-    for (block = allocator->usable_blocks.head(); block; block = block->next()) {
-        if (block->free_chunks())
-            break;
-    }
-
-    if (!block && allocator->empty_block_count) {
+    if (!block && allocator.empty_block_count) {
         g_malloc_stats.number_of_empty_block_hits++;
-        block = allocator->empty_blocks[--allocator->empty_block_count];
+        block = allocator.empty_blocks[--allocator.empty_block_count];
         int rc = madvise(block, ChunkedBlock::block_size, MADV_SET_NONVOLATILE);
         bool this_block_was_purged = rc == 1;
         if (rc < 0) {
@@ -239,7 +214,7 @@ static void* malloc_impl(size_t size)
             g_malloc_stats.number_of_empty_block_purge_hits++;
             new (block) ChunkedBlock(good_size);
         }
-        allocator->usable_blocks.append(block);
+        allocator.usable_blocks.prepend(block);
     }
 
     if (!block) {
@@ -248,10 +223,11 @@ static void* malloc_impl(size_t size)
         snprintf(buffer, sizeof(buffer), "malloc: ChunkedBlock(%zu)", good_size);
         block = (ChunkedBlock*)os_alloc(ChunkedBlock::block_size, buffer);
         new (block) ChunkedBlock(good_size);
-        allocator->usable_blocks.append(block);
-        ++allocator->block_count;
+        allocator.usable_blocks.prepend(block);
+        ++allocator.block_count;
     }
 
+    ASSERT(!block->is_full());
     --block->m_free_chunks;
     void* ptr = block->m_freelist;
     ASSERT(ptr);
@@ -261,15 +237,129 @@ static void* malloc_impl(size_t size)
 #ifdef MALLOC_DEBUG
         dbgprintf("Block %p is now full in size class %zu\n", block, good_size);
 #endif
-        allocator->usable_blocks.remove(block);
-        allocator->full_blocks.append(block);
+        allocator.usable_blocks.remove(block);
+        allocator.full_blocks.append(block);
     }
 #ifdef MALLOC_DEBUG
     dbgprintf("LibC: allocated %p (chunk in block %p, size %zu)\n", ptr, block, block->bytes_per_chunk());
 #endif
+    return ptr;
+}
+
+static void free_chunk(Allocator& allocator, void* ptr)
+{
+    auto* block = (ChunkedBlock*)((FlatPtr)ptr & ChunkedBlock::block_mask);
+    ASSERT(block->m_magic == MAGIC_PAGE_HEADER);
+    ASSERT(block->m_size == allocator.size);
+
+    auto* entry = (FreelistEntry*)ptr;
+    entry->next = block->m_freelist;
+    block->m_freelist = entry;
+
+    if (block->is_full()) {
+#ifdef MALLOC_DEBUG
+        dbgprintf("Block %p no longer full in size class %zu\n", block, allocator.size);
+#endif
+        g_malloc_stats.number_of_freed_full_blocks++;
+        allocator.full_blocks.remove(block);
+        allocator.usable_blocks.prepend(block);
+    }
+
+    ++block->m_free_chunks;
+
+    if (!block->used_chunks()) {
+        if (allocator.block_count < number_of_chunked_blocks_to_keep_around_per_size_class) {
+#ifdef MALLOC_DEBUG
+            dbgprintf("Keeping block %p around for size class %zu\n", block, allocator.size);
+#endif
+            g_malloc_stats.number_of_keeps++;
+            allocator.usable_blocks.remove(block);
+            allocator.empty_blocks[allocator.empty_block_count++] = block;
+            mprotect(block, ChunkedBlock::block_size, PROT_NONE);
+            madvise(block, ChunkedBlock::block_size, MADV_SET_VOLATILE);
+            return;
+        }
+#ifdef MALLOC_DEBUG
+        dbgprintf("Releasing block %p for size class %zu\n", block, allocator.size);
+#endif
+        g_malloc_stats.number_of_frees++;
+        allocator.usable_blocks.remove(block);
+        --allocator.block_count;
+        os_free(block, ChunkedBlock::block_size);
+    }
+}
+
+static void* big_malloc_impl(size_t size)
+{
+    size_t real_size = round_up_to_power_of_two(sizeof(BigAllocationBlock) + size, ChunkedBlock::block_size);
+#ifdef RECYCLE_BIG_ALLOCATIONS
+    if (auto* allocator = big_allocator_for_size(real_size)) {
+        LOCKER(allocator->lock);
+        if (!allocator->blocks.is_empty()) {
+            g_malloc_stats.number_of_big_allocator_hits++;
+            auto* block = allocator->blocks.take_last();
+            int rc = madvise(block, real_size, MADV_SET_NONVOLATILE);
+            bool this_block_was_purged = rc == 1;
+            if (rc < 0) {
+                perror("madvise");
+                ASSERT_NOT_REACHED();
+            }
+            if (mprotect(block, real_size, PROT_READ | PROT_WRITE) < 0) {
+                perror("mprotect");
+                ASSERT_NOT_REACHED();
+            }
+            if (this_block_was_purged) {
+                g_malloc_stats.number_of_big_allocator_purge_hits++;
+                new (block) BigAllocationBlock(real_size);
+            }
+
+            ue_notify_malloc(&block->m_slot[0], size);
+            return &block->m_slot[0];
+        }
+    }
+#endif
+    g_malloc_stats.number_of_big_allocs++;
+    auto* block = (BigAllocationBlock*)os_alloc(real_size, "malloc: BigAllocationBlock");
+    new (block) BigAllocationBlock(real_size);
+    ue_notify_malloc(&block->m_slot[0], size);
+    return &block->m_slot[0];
+}
+
+static void* malloc_impl(size_t size)
+{
+    if (s_log_malloc)
+        dbgprintf("LibC: malloc(%zu)\n", size);
+
+    if (!size)
+        return nullptr;
+
+    g_malloc_stats.number_of_malloc_calls++;
+
+    size_t good_size;
+    auto* allocator = allocator_for_size(size, good_size);
+
+    if (!allocator)
+        return big_malloc_impl(size);
+
+    void* ptr = nullptr;
+#ifdef MALLOC_THREAD_CACHE
+    if (auto* bin = thread_cache_bin_for(*allocator)) {
+        if (!bin->count) {
+            // Grab a whole batch of chunks while we hold the lock.
+            LOCKER(allocator->lock);
+            while (bin->count < thread_cache_batch_size)
+                bin->chunks[bin->count++] = allocate_chunk(*allocator, good_size);
+        }
+        ptr = bin->chunks[--bin->count];
+    }
+#endif
+    if (!ptr) {
+        LOCKER(allocator->lock);
+        ptr = allocate_chunk(*allocator, good_size);
+    }
 
     if (s_scrub_malloc)
-        memset(ptr, MALLOC_SCRUB_BYTE, block->m_size);
+        memset(ptr, MALLOC_SCRUB_BYTE, good_size);
 
     ue_notify_malloc(ptr, size);
     return ptr;
@@ -284,8 +374,6 @@ static void free_impl(void* ptr)
 
     g_malloc_stats.number_of_free_calls++;
 
-    LOCKER(malloc_lock());
-
     void* block_base = (void*)((FlatPtr)ptr & ChunkedBlock::ChunkedBlock::block_mask);
     size_t magic = *(size_t*)block_base;
 
@@ -293,6 +381,7 @@ static void free_impl(void* ptr)
         auto* block = (BigAllocationBlock*)block_base;
 #ifdef RECYCLE_BIG_ALLOCATIONS
         if (auto* allocator = big_allocator_for_size(block->m_size)) {
+            LOCKER(allocator->lock);
             if (allocator->blocks.size() < number_of_big_blocks_to_keep_around_per_size_class) {
                 g_malloc_stats.number_of_big_allocator_keeps++;
                 allocator->blocks.append(block);
@@ -324,45 +413,26 @@ static void free_impl(void* ptr)
     if (s_scrub_free)
         memset(ptr, FREE_SCRUB_BYTE, block->bytes_per_chunk());
 
-    auto* entry = (FreelistEntry*)ptr;
-    entry->next = block->m_freelist;
-    block->m_freelist = entry;
-
-    if (block->is_full()) {
-        size_t good_size;
-        auto* allocator = allocator_for_size(block->m_size, good_size);
-#ifdef MALLOC_DEBUG
-        dbgprintf("Block %p no longer full in size class %zu\n", block, good_size);
-#endif
-        g_malloc_stats.number_of_freed_full_blocks++;
-        allocator->full_blocks.remove(block);
-        allocator->usable_blocks.prepend(block);
-    }
-
-    ++block->m_free_chunks;
-
-    if (!block->used_chunks()) {
-        size_t good_size;
-        auto* allocator = allocator_for_size(block->m_size, good_size);
-        if (allocator->block_count < number_of_chunked_blocks_to_keep_around_per_size_class) {
-#ifdef MALLOC_DEBUG
-            dbgprintf("Keeping block %p around for size class %zu\n", block, good_size);
-#endif
-            g_malloc_stats.number_of_keeps++;
-            allocator->usable_blocks.remove(block);
-            allocator->empty_blocks[allocator->empty_block_count++] = block;
-            mprotect(block, ChunkedBlock::block_size, PROT_NONE);
-            madvise(block, ChunkedBlock::block_size, MADV_SET_VOLATILE);
-            return;
+    // NOTE: The block header doesn't change while one of its chunks is allocated, so we can look at it without a lock.
+    size_t good_size;
+    auto* allocator = allocator_for_size(block->m_size, good_size);
+    ASSERT(allocator);
+
+#ifdef MALLOC_THREAD_CACHE
+    if (auto* bin = thread_cache_bin_for(*allocator)) {
+        if (bin->count == thread_cache_capacity) {
+            // Give half of the cached chunks back at once.
+            LOCKER(allocator->lock);
+            while (bin->count > thread_cache_batch_size)
+                free_chunk(*allocator, bin->chunks[--bin->count]);
         }
-#ifdef MALLOC_DEBUG
-        dbgprintf("Releasing block %p for size class %zu\n", block, good_size);
-#endif
-        g_malloc_stats.number_of_frees++;
-        allocator->usable_blocks.remove(block);
-        --allocator->block_count;
-        os_free(block, ChunkedBlock::block_size);
+        bin->chunks[bin->count++] = ptr;
+        return;
     }
+#endif
+
+    LOCKER(allocator->lock);
+    free_chunk(*allocator, ptr);
 }
 
 [[gnu::flatten]] void* malloc(size_t size)
@@ -394,7 +464,6 @@ size_t malloc_size(void* ptr)
 {
     if (!ptr)
         return 0;
-    LOCKER(malloc_lock());
     void* page_base = (void*)((FlatPtr)ptr & ChunkedBlock::block_mask);
     auto* header = (const CommonHeader*)page_base;
     auto size = header->m_size;
@@ -412,7 +481,6 @@ void* realloc(void* ptr, size_t size)
     if (!size)
         return nullptr;
 
-    LOCKER(malloc_lock());
     auto existing_allocation_size = malloc_size(ptr);
 
     if (size <= existing_allocation_size) {
@@ -427,9 +495,23 @@ void* realloc(void* ptr, size_t size)
     return new_ptr;
 }
 
+void __malloc_thread_exit()
+{
+#ifdef MALLOC_THREAD_CACHE
+    for (size_t i = 0; i < number_of_thread_cached_size_classes; ++i) {
+        auto& bin = s_thread_cache[i];
+        if (!bin.count)
+            continue;
+        auto& allocator = allocators()[i];
+        LOCKER(allocator.lock);
+        while (bin.count)
+            free_chunk(allocator, bin.chunks[--bin.count]);
+    }
+#endif
+}
+
 void __malloc_init()
 {
-    new (&malloc_lock()) LibThread::Lock();
     if (getenv("LIBC_NOSCRUB_MALLOC"))
         s_scrub_malloc = false;
     if (getenv("LIBC_NOSCRUB_FREE"))
@@ -449,24 +531,24 @@ void __malloc_init()
 
 void serenity_dump_malloc_stats()
 {
-    dbgln("# malloc() calls: {}", g_malloc_stats.number_of_malloc_calls);
+    dbgln("# malloc() calls: {}", g_malloc_stats.number_of_malloc_calls.load());
     dbgln();
-    dbgln("big alloc hits: {}", g_malloc_stats.number_of_big_allocator_hits);
-    dbgln("big alloc hits that were purged: {}", g_malloc_stats.number_of_big_allocator_purge_hits);
-    dbgln("big allocs: {}", g_malloc_stats.number_of_big_allocs);
+    dbgln("big alloc hits: {}", g_malloc_stats.number_of_big_allocator_hits.load());
+    dbgln("big alloc hits that were purged: {}", g_malloc_stats.number_of_big_allocator_purge_hits.load());
+    dbgln("big allocs: {}", g_malloc_stats.number_of_big_allocs.load());
     dbgln();
-    dbgln("empty block hits: {}", g_malloc_stats.number_of_empty_block_hits);
-    dbgln("empty block hits that were purged: {}", g_malloc_stats.number_of_empty_block_purge_hits);
-    dbgln("block allocs: {}", g_malloc_stats.number_of_block_allocs);
-    dbgln("filled blocks: {}", g_malloc_stats.number_of_blocks_full);
+    dbgln("empty block hits: {}", g_malloc_stats.number_of_empty_block_hits.load());
+    dbgln("empty block hits that were purged: {}", g_malloc_stats.number_of_empty_block_purge_hits.load());
+    dbgln("block allocs: {}", g_malloc_stats.number_of_block_allocs.load());
+    dbgln("filled blocks: {}", g_malloc_stats.number_of_blocks_full.load());
     dbgln();
-    dbgln("# free() calls: {}", g_malloc_stats.number_of_free_calls);
+    dbgln("# free() calls: {}", g_malloc_stats.number_of_free_calls.load());
     dbgln();
-    dbgln("big alloc keeps: {}", g_malloc_stats.number_of_big_allocator_keeps);
-    dbgln("big alloc frees: {}", g_malloc_stats.number_of_big_allocator_frees);
+    dbgln("big alloc keeps: {}", g_malloc_stats.number_of_big_allocator_keeps.load());
+    dbgln("big alloc frees: {}", g_malloc_stats.number_of_big_allocator_frees.load());
     dbgln();
-    dbgln("full block frees: {}", g_malloc_stats.number_of_freed_full_blocks);
-    dbgln("number of keeps: {}", g_malloc_stats.number_of_keeps);
-    dbgln("number of frees: {}", g_malloc_stats.number_of_frees);
+    dbgln("full block frees: {}", g_malloc_stats.number_of_freed_full_blocks.load());
+    dbgln("number of keeps: {}", g_malloc_stats.number_of_keeps.load());
+    dbgln("number of frees: {}", g_malloc_stats.number_of_frees.load());
 }
 }
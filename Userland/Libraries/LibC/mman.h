@@ -37,6 +37,7 @@
 #define MAP_ANON MAP_ANONYMOUS
 #define MAP_STACK 0x40
 #define MAP_NORESERVE 0x80
+#define MAP_HUGETLB 0x100
 
 #define PROT_READ 0x1
 #define PROT_WRITE 0x2
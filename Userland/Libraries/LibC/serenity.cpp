@@ -72,9 +72,17 @@ int set_process_boost(pid_t tid, int amount)
     __RETURN_WITH_ERRNO(rc, rc, -1);
 }
 
-int futex(int32_t* userspace_address, int futex_op, int32_t value, const struct timespec* timeout)
-{
-    Syscall::SC_futex_params params { userspace_address, futex_op, value, timeout };
+int futex(int32_t* userspace_address, int futex_op, int32_t value, const struct timespec* timeout, int32_t* userspace_address2, int32_t value3)
+{
+    Syscall::SC_futex_params params { userspace_address, futex_op, value, timeout, 0, userspace_address2, value3 };
+    switch (futex_op) {
+    case FUTEX_REQUEUE:
+    case FUTEX_CMP_REQUEUE:
+    case FUTEX_WAKE_OP:
+        params.timeout = nullptr;
+        params.val2 = (uint32_t)(uintptr_t)timeout;
+        break;
+    }
     int rc = syscall(SC_futex, &params);
     __RETURN_WITH_ERRNO(rc, rc, -1);
 }
@@ -34,21 +34,51 @@
 
 #include <spawn.h>
 
-#include <AK/Function.h>
+#include <AK/String.h>
 #include <AK/Vector.h>
+#include <Kernel/API/Syscall.h>
+#include <alloca.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 struct posix_spawn_file_actions_state {
-    Vector<Function<int()>, 4> actions;
+    Vector<Syscall::SC_posix_spawn_file_action, 4> actions;
+    // Keeps the path strings referenced by the actions alive.
+    Vector<String, 4> paths;
 };
 
 extern "C" {
 
+static int apply_file_action(const Syscall::SC_posix_spawn_file_action& action)
+{
+    using Type = Syscall::SC_posix_spawn_file_action::Type;
+    switch (action.type) {
+    case Type::Close:
+        return close(action.fd);
+    case Type::Dup2:
+        return dup2(action.fd, action.new_fd);
+    case Type::Open: {
+        int opened_fd = open(action.path.characters, action.options, action.mode);
+        if (opened_fd < 0 || opened_fd == action.fd)
+            return opened_fd;
+        if (int rc = dup2(opened_fd, action.fd); rc < 0)
+            return rc;
+        return close(opened_fd);
+    }
+    case Type::Chdir:
+        return chdir(action.path.characters);
+    case Type::Fchdir:
+        return fchdir(action.fd);
+    }
+    ASSERT_NOT_REACHED();
+}
+
 [[noreturn]] static void posix_spawn_child(const char* path, const posix_spawn_file_actions_t* file_actions, const posix_spawnattr_t* attr, char* const argv[], char* const envp[], int (*exec)(const char*, char* const[], char* const[]))
 {
     if (attr) {
@@ -107,7 +137,7 @@ extern "C" {
 
     if (file_actions) {
         for (const auto& action : file_actions->state->actions) {
-            if (action() < 0) {
+            if (apply_file_action(action) < 0) {
                 perror("posix_spawn file action");
                 _exit(127);
             }
@@ -119,8 +149,48 @@ extern "C" {
     _exit(127);
 }
 
+// Without any attributes to apply, the kernel can create the child and load the
+// program into it directly, without ever copying our address space.
+static int posix_spawn_in_kernel(pid_t* out_pid, const char* path, const posix_spawn_file_actions_t* file_actions, char* const argv[], char* const envp[])
+{
+    size_t arg_count = 0;
+    for (size_t i = 0; argv[i]; ++i)
+        ++arg_count;
+
+    size_t env_count = 0;
+    for (size_t i = 0; envp[i]; ++i)
+        ++env_count;
+
+    auto copy_strings = [&](auto& vec, size_t count, auto& output) {
+        output.length = count;
+        for (size_t i = 0; vec[i]; ++i) {
+            output.strings[i].characters = vec[i];
+            output.strings[i].length = strlen(vec[i]);
+        }
+    };
+
+    Syscall::SC_posix_spawn_params params;
+    params.arguments.strings = (Syscall::StringArgument*)alloca(arg_count * sizeof(Syscall::StringArgument));
+    params.environment.strings = (Syscall::StringArgument*)alloca(env_count * sizeof(Syscall::StringArgument));
+
+    params.path = { path, strlen(path) };
+    copy_strings(argv, arg_count, params.arguments);
+    copy_strings(envp, env_count, params.environment);
+    if (file_actions)
+        params.file_actions = { file_actions->state->actions.data(), file_actions->state->actions.size() };
+
+    int rc = syscall(SC_posix_spawn, &params);
+    if (rc < 0)
+        return -rc;
+    *out_pid = rc;
+    return 0;
+}
+
 int posix_spawn(pid_t* out_pid, const char* path, const posix_spawn_file_actions_t* file_actions, const posix_spawnattr_t* attr, char* const argv[], char* const envp[])
 {
+    if (!attr || !attr->flags)
+        return posix_spawn_in_kernel(out_pid, path, file_actions, argv, envp);
+
     pid_t child_pid = fork();
     if (child_pid < 0)
         return errno;
@@ -135,6 +205,22 @@ int posix_spawn(pid_t* out_pid, const char* path, const posix_spawn_file_actions
 
 int posix_spawnp(pid_t* out_pid, const char* path, const posix_spawn_file_actions_t* file_actions, const posix_spawnattr_t* attr, char* const argv[], char* const envp[])
 {
+    if (!attr || !attr->flags) {
+        if (strchr(path, '/'))
+            return posix_spawn_in_kernel(out_pid, path, file_actions, argv, envp);
+
+        String search_path = getenv("PATH");
+        if (search_path.is_empty())
+            search_path = "/bin:/usr/bin";
+        for (auto& part : search_path.split(':')) {
+            auto candidate = String::format("%s/%s", part.characters(), path);
+            int rc = posix_spawn_in_kernel(out_pid, candidate.characters(), file_actions, argv, envp);
+            if (rc != ENOENT)
+                return rc;
+        }
+        return ENOENT;
+    }
+
     pid_t child_pid = fork();
     if (child_pid < 0)
         return errno;
@@ -149,38 +235,35 @@ int posix_spawnp(pid_t* out_pid, const char* path, const posix_spawn_file_action
 
 int posix_spawn_file_actions_addchdir(posix_spawn_file_actions_t* actions, const char* path)
 {
-    actions->state->actions.append([path]() { return chdir(path); });
+    auto& state = *actions->state;
+    state.paths.append(path);
+    state.actions.append({ Syscall::SC_posix_spawn_file_action::Type::Chdir, -1, -1, { state.paths.last().characters(), state.paths.last().length() }, 0, 0 });
     return 0;
 }
 
 int posix_spawn_file_actions_addfchdir(posix_spawn_file_actions_t* actions, int fd)
 {
-    actions->state->actions.append([fd]() { return fchdir(fd); });
+    actions->state->actions.append({ Syscall::SC_posix_spawn_file_action::Type::Fchdir, fd, -1, {}, 0, 0 });
     return 0;
 }
 
 int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t* actions, int fd)
 {
-    actions->state->actions.append([fd]() { return close(fd); });
+    actions->state->actions.append({ Syscall::SC_posix_spawn_file_action::Type::Close, fd, -1, {}, 0, 0 });
     return 0;
 }
 
 int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t* actions, int old_fd, int new_fd)
 {
-    actions->state->actions.append([old_fd, new_fd]() { return dup2(old_fd, new_fd); });
+    actions->state->actions.append({ Syscall::SC_posix_spawn_file_action::Type::Dup2, old_fd, new_fd, {}, 0, 0 });
     return 0;
 }
 
 int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t* actions, int want_fd, const char* path, int flags, mode_t mode)
 {
-    actions->state->actions.append([want_fd, path, flags, mode]() {
-        int opened_fd = open(path, flags, mode);
-        if (opened_fd < 0 || opened_fd == want_fd)
-            return opened_fd;
-        if (int rc = dup2(opened_fd, want_fd); rc < 0)
-            return rc;
-        return close(opened_fd);
-    });
+    auto& state = *actions->state;
+    state.paths.append(path);
+    state.actions.append({ Syscall::SC_posix_spawn_file_action::Type::Open, want_fd, -1, { state.paths.last().characters(), state.paths.last().length() }, flags, (u16)mode });
     return 0;
 }
 
@@ -96,10 +96,17 @@ typedef struct __pthread_cond_t {
     int32_t value;
     uint32_t previous;
     int clockid; // clockid_t
+    pthread_mutex_t* mutex;
 } pthread_cond_t;
 
-typedef void* pthread_rwlock_t;
-typedef void* pthread_rwlockatrr_t;
+typedef struct __pthread_rwlock_t {
+    uint32_t state;
+    uint32_t readers_waiting;
+    uint32_t writers_waiting;
+    uint32_t writer_wake_counter;
+} pthread_rwlock_t;
+
+typedef void* pthread_rwlockattr_t;
 typedef void* pthread_spinlock_t;
 typedef struct __pthread_condattr_t {
     int clockid; // clockid_t
@@ -54,6 +54,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#ifdef __serenity__
+#    include <sys/epoll.h>
+#endif
+
 //#define EVENTLOOP_DEBUG
 //#define DEFERRED_INVOKE_DEBUG
 
@@ -81,8 +85,12 @@ static EventLoop* s_main_event_loop;
 static Vector<EventLoop*>* s_event_loop_stack;
 static NeverDestroyed<IDAllocator> s_id_allocator;
 static HashMap<int, NonnullOwnPtr<EventLoopTimer>>* s_timers;
-static HashTable<Notifier*>* s_notifiers;
+static HashMap<int, Vector<Notifier*, 1>>* s_notifiers;
 int EventLoop::s_wake_pipe_fds[2];
+#ifdef __serenity__
+static int s_epoll_fd = -1;
+static constexpr size_t max_epoll_events_per_wait = 64;
+#endif
 static RefPtr<LocalServer> s_rpc_server;
 HashMap<int, RefPtr<RPCClient>> s_rpc_clients;
 
@@ -278,13 +286,53 @@ private:
     int m_client_id { -1 };
 };
 
+#ifdef __serenity__
+static u32 epoll_events_for(const Vector<Notifier*, 1>& notifiers)
+{
+    u32 events = 0;
+    for (auto* notifier : notifiers) {
+        if (notifier->event_mask() & Notifier::Read)
+            events |= EPOLLIN;
+        if (notifier->event_mask() & Notifier::Write)
+            events |= EPOLLOUT;
+        if (notifier->event_mask() & Notifier::Exceptional)
+            ASSERT_NOT_REACHED();
+    }
+    return events;
+}
+
+// Tell the kernel about the combined event mask of all notifiers for this fd.
+static void update_epoll_interest(int fd, bool was_watched)
+{
+    if (s_epoll_fd < 0)
+        return;
+
+    auto it = s_notifiers->find(fd);
+    if (it == s_notifiers->end()) {
+        // This fails harmlessly if the fd has already been closed.
+        epoll_ctl(s_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        return;
+    }
+
+    epoll_event event {};
+    event.events = epoll_events_for(it->value);
+    event.data.fd = fd;
+    int rc = epoll_ctl(s_epoll_fd, was_watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event);
+    // The fd may have been closed and reused since we last told the kernel about it.
+    if (rc < 0 && (errno == ENOENT || errno == EEXIST))
+        rc = epoll_ctl(s_epoll_fd, errno == ENOENT ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event);
+    if (rc < 0)
+        perror("EventLoop: epoll_ctl");
+}
+#endif
+
 EventLoop::EventLoop()
     : m_private(make<Private>())
 {
     if (!s_event_loop_stack) {
         s_event_loop_stack = new Vector<EventLoop*>;
         s_timers = new HashMap<int, NonnullOwnPtr<EventLoopTimer>>;
-        s_notifiers = new HashTable<Notifier*>;
+        s_notifiers = new HashMap<int, Vector<Notifier*, 1>>;
     }
 
     if (!s_main_event_loop) {
@@ -299,6 +347,18 @@ EventLoop::EventLoop()
 
 #endif
         ASSERT(rc == 0);
+#ifdef __serenity__
+        s_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        ASSERT(s_epoll_fd >= 0);
+        epoll_event wake_event {};
+        wake_event.events = EPOLLIN;
+        wake_event.data.fd = s_wake_pipe_fds[0];
+        rc = epoll_ctl(s_epoll_fd, EPOLL_CTL_ADD, s_wake_pipe_fds[0], &wake_event);
+        ASSERT(rc == 0);
+        // Pick up notifiers that were registered while we had no epoll instance, e.g. after a fork.
+        for (auto& it : *s_notifiers)
+            update_epoll_interest(it.key, false);
+#endif
         s_event_loop_stack->append(this);
 
 #ifdef __serenity__
@@ -602,6 +662,11 @@ void EventLoop::notify_forked(ForkEvent event)
         s_event_loop_stack->clear();
         s_timers->clear();
         s_notifiers->clear();
+#ifdef __serenity__
+        // The epoll instance is shared with the parent, don't touch its interest set.
+        close(s_epoll_fd);
+        s_epoll_fd = -1;
+#endif
         if (auto* info = signals_info<false>()) {
             info->signal_handlers.clear();
             info->next_signal_id = 0;
@@ -619,9 +684,14 @@ void EventLoop::notify_forked(ForkEvent event)
 
 void EventLoop::wait_for_event(WaitMode mode)
 {
+#ifdef __serenity__
+    epoll_event ready_events[max_epoll_events_per_wait];
+#else
     fd_set rfds;
     fd_set wfds;
+#endif
 retry:
+#ifndef __serenity__
     FD_ZERO(&rfds);
     FD_ZERO(&wfds);
 
@@ -635,14 +705,17 @@ retry:
     int max_fd_added = -1;
     add_fd_to_set(s_wake_pipe_fds[0], rfds);
     max_fd = max(max_fd, max_fd_added);
-    for (auto& notifier : *s_notifiers) {
-        if (notifier->event_mask() & Notifier::Read)
-            add_fd_to_set(notifier->fd(), rfds);
-        if (notifier->event_mask() & Notifier::Write)
-            add_fd_to_set(notifier->fd(), wfds);
-        if (notifier->event_mask() & Notifier::Exceptional)
-            ASSERT_NOT_REACHED();
+    for (auto& it : *s_notifiers) {
+        for (auto* notifier : it.value) {
+            if (notifier->event_mask() & Notifier::Read)
+                add_fd_to_set(notifier->fd(), rfds);
+            if (notifier->event_mask() & Notifier::Write)
+                add_fd_to_set(notifier->fd(), wfds);
+            if (notifier->event_mask() & Notifier::Exceptional)
+                ASSERT_NOT_REACHED();
+        }
     }
+#endif
 
     bool queued_events_is_empty;
     {
@@ -671,7 +744,13 @@ retry:
     }
 
 try_select_again:
+#ifdef __serenity__
+    // Round up, so we don't wake up just before the next timer is due and spin.
+    int timeout_ms = should_wait_forever ? -1 : timeout.tv_sec * 1000 + (timeout.tv_usec + 999) / 1000;
+    int marked_fd_count = epoll_wait(s_epoll_fd, ready_events, max_epoll_events_per_wait, timeout_ms);
+#else
     int marked_fd_count = select(max_fd + 1, &rfds, &wfds, nullptr, should_wait_forever ? nullptr : &timeout);
+#endif
     if (marked_fd_count < 0) {
         int saved_errno = errno;
         if (saved_errno == EINTR) {
@@ -685,7 +764,17 @@ try_select_again:
         // Blow up, similar to Core::safe_syscall.
         ASSERT_NOT_REACHED();
     }
-    if (FD_ISSET(s_wake_pipe_fds[0], &rfds)) {
+
+#ifdef __serenity__
+    bool wake_pipe_is_readable = false;
+    for (int i = 0; i < marked_fd_count; ++i) {
+        if (ready_events[i].data.fd == s_wake_pipe_fds[0])
+            wake_pipe_is_readable = true;
+    }
+#else
+    bool wake_pipe_is_readable = FD_ISSET(s_wake_pipe_fds[0], &rfds);
+#endif
+    if (wake_pipe_is_readable) {
         int wake_events[8];
         auto nread = read(s_wake_pipe_fds[0], wake_events, sizeof(wake_events));
         if (nread < 0) {
@@ -738,16 +827,34 @@ try_select_again:
     if (!marked_fd_count)
         return;
 
-    for (auto& notifier : *s_notifiers) {
-        if (FD_ISSET(notifier->fd(), &rfds)) {
-            if (notifier->event_mask() & Notifier::Event::Read)
+#ifdef __serenity__
+    // Only the fds that actually became ready are looked at, no matter how many notifiers there are.
+    for (int i = 0; i < marked_fd_count; ++i) {
+        auto& ready_event = ready_events[i];
+        auto it = s_notifiers->find(ready_event.data.fd);
+        if (it == s_notifiers->end())
+            continue;
+        for (auto* notifier : it->value) {
+            if ((ready_event.events & EPOLLIN) && (notifier->event_mask() & Notifier::Event::Read))
                 post_event(*notifier, make<NotifierReadEvent>(notifier->fd()));
-        }
-        if (FD_ISSET(notifier->fd(), &wfds)) {
-            if (notifier->event_mask() & Notifier::Event::Write)
+            if ((ready_event.events & EPOLLOUT) && (notifier->event_mask() & Notifier::Event::Write))
                 post_event(*notifier, make<NotifierWriteEvent>(notifier->fd()));
         }
     }
+#else
+    for (auto& it : *s_notifiers) {
+        for (auto* notifier : it.value) {
+            if (FD_ISSET(notifier->fd(), &rfds)) {
+                if (notifier->event_mask() & Notifier::Event::Read)
+                    post_event(*notifier, make<NotifierReadEvent>(notifier->fd()));
+            }
+            if (FD_ISSET(notifier->fd(), &wfds)) {
+                if (notifier->event_mask() & Notifier::Event::Write)
+                    post_event(*notifier, make<NotifierWriteEvent>(notifier->fd()));
+            }
+        }
+    }
+#endif
 }
 
 bool EventLoopTimer::has_expired(const timeval& now) const
@@ -810,12 +917,40 @@ bool EventLoop::unregister_timer(int timer_id)
 
 void EventLoop::register_notifier(Badge<Notifier>, Notifier& notifier)
 {
-    s_notifiers->set(&notifier);
+    auto it = s_notifiers->find(notifier.fd());
+    bool was_watched = it != s_notifiers->end();
+    if (!was_watched) {
+        s_notifiers->set(notifier.fd(), {});
+        it = s_notifiers->find(notifier.fd());
+    }
+    if (!it->value.contains_slow(&notifier))
+        it->value.append(&notifier);
+#ifdef __serenity__
+    update_epoll_interest(notifier.fd(), was_watched);
+#endif
 }
 
 void EventLoop::unregister_notifier(Badge<Notifier>, Notifier& notifier)
 {
-    s_notifiers->remove(&notifier);
+    auto it = s_notifiers->find(notifier.fd());
+    if (it == s_notifiers->end())
+        return;
+    it->value.remove_first_matching([&](auto* entry) { return entry == &notifier; });
+    if (it->value.is_empty())
+        s_notifiers->remove(it);
+#ifdef __serenity__
+    update_epoll_interest(notifier.fd(), true);
+#endif
+}
+
+void EventLoop::update_notifier(Badge<Notifier>, [[maybe_unused]] Notifier& notifier)
+{
+#ifdef __serenity__
+    auto it = s_notifiers->find(notifier.fd());
+    if (it == s_notifiers->end() || !it->value.contains_slow(&notifier))
+        return;
+    update_epoll_interest(notifier.fd(), true);
+#endif
 }
 
 void EventLoop::wake()
@@ -28,12 +28,14 @@
 #include <AK/Atomic.h>
 #include <AK/StdLibExtras.h>
 #include <Kernel/API/Syscall.h>
+#include <errno.h>
 #include <limits.h>
 #include <pthread.h>
 #include <serenity.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/internals.h>
 #include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
@@ -103,6 +105,7 @@ static int create_thread(pthread_t* thread, void* (*entry)(void*), void* argumen
 [[noreturn]] static void exit_thread(void* code)
 {
     KeyDestroyer::destroy_for_current_thread();
+    __malloc_thread_exit();
     syscall(SC_exit_thread, code);
     ASSERT_NOT_REACHED();
 }
@@ -183,31 +186,72 @@ int pthread_mutex_destroy(pthread_mutex_t*)
     return 0;
 }
 
+// The mutex lock word is a futex with three states. A locker only enters
+// the kernel after marking the mutex as contended, and an unlocker only
+// enters the kernel if it finds it marked, so uncontended lock/unlock pairs
+// never make a syscall.
+enum : u32 {
+    MUTEX_UNLOCKED = 0,
+    MUTEX_LOCKED_NO_WAITERS = 1,
+    MUTEX_LOCKED_NEED_TO_WAKE = 2,
+};
+
+// How many times to retry a held mutex before going to sleep on it.
+static constexpr int mutex_spin_count = 100;
+
+ALWAYS_INLINE static Atomic<u32>& mutex_lock_word(pthread_mutex_t* mutex)
+{
+    return reinterpret_cast<Atomic<u32>&>(mutex->lock);
+}
+
+static void mutex_lock_contended(pthread_mutex_t* mutex)
+{
+    auto& atomic = mutex_lock_word(mutex);
+    // We can't know whether anyone else is still waiting, so a mutex taken
+    // this way always stays marked as contended.
+    while (atomic.exchange(MUTEX_LOCKED_NEED_TO_WAKE, AK::memory_order_acquire) != MUTEX_UNLOCKED)
+        futex_wait(reinterpret_cast<i32*>(&mutex->lock), MUTEX_LOCKED_NEED_TO_WAKE, nullptr);
+    mutex->owner = pthread_self();
+    mutex->level = 0;
+}
+
 int pthread_mutex_lock(pthread_mutex_t* mutex)
 {
-    auto& atomic = reinterpret_cast<Atomic<u32>&>(mutex->lock);
-    pthread_t this_thread = pthread_self();
-    for (;;) {
-        u32 expected = false;
-        if (!atomic.compare_exchange_strong(expected, true, AK::memory_order_acq_rel)) {
-            if (mutex->type == PTHREAD_MUTEX_RECURSIVE && mutex->owner == this_thread) {
-                mutex->level++;
-                return 0;
-            }
-            sched_yield();
-            continue;
-        }
-        mutex->owner = this_thread;
+    auto& atomic = mutex_lock_word(mutex);
+    u32 expected = MUTEX_UNLOCKED;
+    if (atomic.compare_exchange_strong(expected, MUTEX_LOCKED_NO_WAITERS, AK::memory_order_acquire)) {
+        mutex->owner = pthread_self();
         mutex->level = 0;
         return 0;
     }
+
+    if (mutex->type == PTHREAD_MUTEX_RECURSIVE && mutex->owner == pthread_self()) {
+        mutex->level++;
+        return 0;
+    }
+
+    // Critical sections are usually short, so spin for a bit before
+    // paying for a trip into the kernel.
+    for (int i = 0; i < mutex_spin_count; i++) {
+        expected = MUTEX_UNLOCKED;
+        if (atomic.load(AK::memory_order_relaxed) == MUTEX_UNLOCKED
+            && atomic.compare_exchange_strong(expected, MUTEX_LOCKED_NO_WAITERS, AK::memory_order_acquire)) {
+            mutex->owner = pthread_self();
+            mutex->level = 0;
+            return 0;
+        }
+        asm volatile("pause");
+    }
+
+    mutex_lock_contended(mutex);
+    return 0;
 }
 
 int pthread_mutex_trylock(pthread_mutex_t* mutex)
 {
-    auto& atomic = reinterpret_cast<Atomic<u32>&>(mutex->lock);
-    u32 expected = false;
-    if (!atomic.compare_exchange_strong(expected, true, AK::memory_order_acq_rel)) {
+    auto& atomic = mutex_lock_word(mutex);
+    u32 expected = MUTEX_UNLOCKED;
+    if (!atomic.compare_exchange_strong(expected, MUTEX_LOCKED_NO_WAITERS, AK::memory_order_acquire)) {
         if (mutex->type == PTHREAD_MUTEX_RECURSIVE && mutex->owner == pthread_self()) {
             mutex->level++;
             return 0;
@@ -226,7 +270,8 @@ int pthread_mutex_unlock(pthread_mutex_t* mutex)
         return 0;
     }
     mutex->owner = 0;
-    mutex->lock = 0;
+    if (mutex_lock_word(mutex).exchange(MUTEX_UNLOCKED, AK::memory_order_release) == MUTEX_LOCKED_NEED_TO_WAKE)
+        futex_wake(reinterpret_cast<i32*>(&mutex->lock), 1);
     return 0;
 }
 
@@ -487,6 +532,7 @@ int pthread_cond_init(pthread_cond_t* cond, const pthread_condattr_t* attr)
     cond->value = 0;
     cond->previous = 0;
     cond->clockid = attr ? attr->clockid : CLOCK_MONOTONIC_COARSE;
+    cond->mutex = nullptr;
     return 0;
 }
 
@@ -499,17 +545,20 @@ static int cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct
 {
     i32 value = cond->value;
     cond->previous = value;
+    cond->mutex = mutex;
     pthread_mutex_unlock(mutex);
-    int rc = futex(&cond->value, FUTEX_WAIT, value, abstime);
-    pthread_mutex_lock(mutex);
-    return rc;
+    int rc = futex_wait(&cond->value, value, abstime);
+    bool did_timeout = rc < 0 && errno == ETIMEDOUT;
+    // pthread_cond_broadcast() may have moved us over to the mutex futex,
+    // with more waiters queued up behind us. Take the mutex the contended
+    // way so that our unlock hands it on to the next one of them.
+    mutex_lock_contended(mutex);
+    return did_timeout ? ETIMEDOUT : 0;
 }
 
 int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
 {
-    int rc = cond_wait(cond, mutex, nullptr);
-    ASSERT(rc == 0);
-    return 0;
+    return cond_wait(cond, mutex, nullptr);
 }
 
 int pthread_condattr_init(pthread_condattr_t* attr)
@@ -538,8 +587,7 @@ int pthread_cond_signal(pthread_cond_t* cond)
 {
     u32 value = cond->previous + 1;
     cond->value = value;
-    int rc = futex(&cond->value, FUTEX_WAKE, 1, nullptr);
-    ASSERT(rc == 0);
+    futex_wake(&cond->value, 1);
     return 0;
 }
 
@@ -547,8 +595,163 @@ int pthread_cond_broadcast(pthread_cond_t* cond)
 {
     u32 value = cond->previous + 1;
     cond->value = value;
-    int rc = futex(&cond->value, FUTEX_WAKE, INT32_MAX, nullptr);
-    ASSERT(rc == 0);
+    auto* mutex = cond->mutex;
+    if (!mutex) {
+        futex_wake(&cond->value, INT32_MAX);
+        return 0;
+    }
+    // Only one of the waiters could get the mutex anyway, so wake just that
+    // one and move the rest over to the mutex, where its unlock (and theirs)
+    // will wake them one at a time.
+    futex(&cond->value, FUTEX_REQUEUE, 1, (const struct timespec*)INT32_MAX, reinterpret_cast<i32*>(&mutex->lock), 0);
+    return 0;
+}
+
+// The rwlock state word holds the number of readers, or RWLOCK_WRITE_LOCKED
+// while a writer holds the lock. Readers sleep on the state word itself,
+// writers sleep on writer_wake_counter so that they can be woken one at a
+// time. Readers are preferred (a reader only ever waits for a writer that
+// actually holds the lock), so that recursive read locking can't deadlock.
+static constexpr u32 RWLOCK_WRITE_LOCKED = 1u << 31;
+static constexpr u32 RWLOCK_READER_MASK = ~RWLOCK_WRITE_LOCKED;
+
+int pthread_rwlock_init(pthread_rwlock_t* rwlock, const pthread_rwlockattr_t*)
+{
+    rwlock->state = 0;
+    rwlock->readers_waiting = 0;
+    rwlock->writers_waiting = 0;
+    rwlock->writer_wake_counter = 0;
+    return 0;
+}
+
+int pthread_rwlock_destroy(pthread_rwlock_t* rwlock)
+{
+    if (rwlock->state != 0)
+        return EBUSY;
+    return 0;
+}
+
+static int rwlock_rdlock(pthread_rwlock_t* rwlock, bool try_only, const struct timespec* abstime)
+{
+    auto& state = reinterpret_cast<Atomic<u32>&>(rwlock->state);
+    auto& readers_waiting = reinterpret_cast<Atomic<u32>&>(rwlock->readers_waiting);
+    for (;;) {
+        u32 current = state.load(AK::memory_order_relaxed);
+        if (!(current & RWLOCK_WRITE_LOCKED)) {
+            if ((current & RWLOCK_READER_MASK) == RWLOCK_READER_MASK)
+                return EAGAIN;
+            if (state.compare_exchange_strong(current, current + 1, AK::memory_order_acquire))
+                return 0;
+            continue;
+        }
+        if (try_only)
+            return EBUSY;
+        readers_waiting++;
+        int rc = futex_wait(reinterpret_cast<i32*>(&rwlock->state), current, abstime);
+        bool did_timeout = rc < 0 && errno == ETIMEDOUT;
+        readers_waiting--;
+        if (did_timeout)
+            return ETIMEDOUT;
+    }
+}
+
+static int rwlock_wrlock(pthread_rwlock_t* rwlock, bool try_only, const struct timespec* abstime)
+{
+    auto& state = reinterpret_cast<Atomic<u32>&>(rwlock->state);
+    auto& writers_waiting = reinterpret_cast<Atomic<u32>&>(rwlock->writers_waiting);
+    auto& writer_wake_counter = reinterpret_cast<Atomic<u32>&>(rwlock->writer_wake_counter);
+    for (;;) {
+        u32 expected = 0;
+        if (state.compare_exchange_strong(expected, RWLOCK_WRITE_LOCKED, AK::memory_order_acquire))
+            return 0;
+        if (try_only)
+            return EBUSY;
+        // Sample the wake counter before announcing ourselves, so that an
+        // unlock that happens after our last look at the state will change
+        // it and keep us from going to sleep.
+        u32 wake_counter = writer_wake_counter.load();
+        writers_waiting++;
+        int rc = 0;
+        if (state.load() != 0)
+            rc = futex_wait(reinterpret_cast<i32*>(&rwlock->writer_wake_counter), wake_counter, abstime);
+        bool did_timeout = rc < 0 && errno == ETIMEDOUT;
+        writers_waiting--;
+        if (did_timeout) {
+            // We may have been picked by an unlock just as we timed out, so
+            // pass the wakeup on to the next writer if the lock is free.
+            if (state.load() == 0 && writers_waiting.load() != 0) {
+                writer_wake_counter++;
+                futex_wake(reinterpret_cast<i32*>(&rwlock->writer_wake_counter), 1);
+            }
+            return ETIMEDOUT;
+        }
+    }
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t* rwlock)
+{
+    return rwlock_rdlock(rwlock, false, nullptr);
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t* rwlock)
+{
+    return rwlock_rdlock(rwlock, true, nullptr);
+}
+
+int pthread_rwlock_timedrdlock(pthread_rwlock_t* rwlock, const struct timespec* abstime)
+{
+    return rwlock_rdlock(rwlock, false, abstime);
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t* rwlock)
+{
+    return rwlock_wrlock(rwlock, false, nullptr);
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t* rwlock)
+{
+    return rwlock_wrlock(rwlock, true, nullptr);
+}
+
+int pthread_rwlock_timedwrlock(pthread_rwlock_t* rwlock, const struct timespec* abstime)
+{
+    return rwlock_wrlock(rwlock, false, abstime);
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t* rwlock)
+{
+    auto& state = reinterpret_cast<Atomic<u32>&>(rwlock->state);
+    auto& readers_waiting = reinterpret_cast<Atomic<u32>&>(rwlock->readers_waiting);
+    auto& writers_waiting = reinterpret_cast<Atomic<u32>&>(rwlock->writers_waiting);
+    auto& writer_wake_counter = reinterpret_cast<Atomic<u32>&>(rwlock->writer_wake_counter);
+
+    u32 current = state.load(AK::memory_order_relaxed);
+    if (current == 0)
+        return EPERM;
+
+    if (current & RWLOCK_WRITE_LOCKED) {
+        state.store(0, AK::memory_order_release);
+        if (readers_waiting.load() != 0)
+            futex_wake(reinterpret_cast<i32*>(&rwlock->state), INT32_MAX);
+    } else if (state.fetch_sub(1, AK::memory_order_release) != 1) {
+        // There are still other readers holding the lock.
+        return 0;
+    }
+
+    if (writers_waiting.load() != 0) {
+        writer_wake_counter++;
+        futex_wake(reinterpret_cast<i32*>(&rwlock->writer_wake_counter), 1);
+    }
+    return 0;
+}
+
+int pthread_rwlockattr_init(pthread_rwlockattr_t*)
+{
+    return 0;
+}
+
+int pthread_rwlockattr_destroy(pthread_rwlockattr_t*)
+{
     return 0;
 }
 
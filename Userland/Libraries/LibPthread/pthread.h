@@ -82,9 +82,13 @@ int pthread_setschedparam(pthread_t thread, int policy, const struct sched_param
     {                                  \
         0, 0, 0, PTHREAD_MUTEX_DEFAULT \
     }
-#define PTHREAD_COND_INITIALIZER     \
-    {                                \
-        0, 0, CLOCK_MONOTONIC_COARSE \
+#define PTHREAD_COND_INITIALIZER        \
+    {                                   \
+        0, 0, CLOCK_MONOTONIC_COARSE, 0 \
+    }
+#define PTHREAD_RWLOCK_INITIALIZER \
+    {                              \
+        0, 0, 0, 0                 \
     }
 
 #define PTHREAD_KEYS_MAX 64
@@ -102,6 +106,18 @@ int pthread_condattr_destroy(pthread_condattr_t*);
 int pthread_cond_destroy(pthread_cond_t*);
 int pthread_cond_timedwait(pthread_cond_t*, pthread_mutex_t*, const struct timespec*);
 
+int pthread_rwlock_init(pthread_rwlock_t*, const pthread_rwlockattr_t*);
+int pthread_rwlock_destroy(pthread_rwlock_t*);
+int pthread_rwlock_rdlock(pthread_rwlock_t*);
+int pthread_rwlock_tryrdlock(pthread_rwlock_t*);
+int pthread_rwlock_timedrdlock(pthread_rwlock_t*, const struct timespec*);
+int pthread_rwlock_wrlock(pthread_rwlock_t*);
+int pthread_rwlock_trywrlock(pthread_rwlock_t*);
+int pthread_rwlock_timedwrlock(pthread_rwlock_t*, const struct timespec*);
+int pthread_rwlock_unlock(pthread_rwlock_t*);
+int pthread_rwlockattr_init(pthread_rwlockattr_t*);
+int pthread_rwlockattr_destroy(pthread_rwlockattr_t*);
+
 #define PTHREAD_CANCEL_ENABLE 1
 #define PTHREAD_CANCEL_DISABLE 2
 
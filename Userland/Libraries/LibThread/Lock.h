@@ -31,6 +31,7 @@
 #    include <AK/Assertions.h>
 #    include <AK/Atomic.h>
 #    include <AK/Types.h>
+#    include <serenity.h>
 #    include <unistd.h>
 
 namespace LibThread {
@@ -44,6 +45,8 @@ public:
     void unlock();
 
 private:
+    // Futex word: 0 = unlocked, 1 = locked, 2 = locked and maybe contended.
+    Atomic<i32> m_state { 0 };
     Atomic<pid_t> m_holder { 0 };
     u32 m_level { 0 };
 };
@@ -70,24 +73,27 @@ ALWAYS_INLINE void Lock::lock()
         ++m_level;
         return;
     }
-    for (;;) {
-        int expected = 0;
-        if (m_holder.compare_exchange_strong(expected, tid, AK::memory_order_acq_rel)) {
-            m_level = 1;
-            return;
-        }
-        donate(expected);
+    i32 expected = 0;
+    if (!m_state.compare_exchange_strong(expected, 1, AK::memory_order_acquire)) {
+        while (m_state.exchange(2, AK::memory_order_acquire) != 0)
+            futex_wait(const_cast<i32*>(m_state.ptr()), 2, nullptr);
     }
+    m_holder.store(tid, AK::memory_order_relaxed);
+    m_level = 1;
 }
 
 inline void Lock::unlock()
 {
     ASSERT(m_holder == gettid());
     ASSERT(m_level);
-    if (m_level == 1)
-        m_holder.store(0, AK::memory_order_release);
-    else
+    if (m_level == 1) {
+        m_level = 0;
+        m_holder.store(0, AK::memory_order_relaxed);
+        if (m_state.exchange(0, AK::memory_order_release) == 2)
+            futex_wake(const_cast<i32*>(m_state.ptr()), 1);
+    } else {
         --m_level;
+    }
 }
 
 #    define LOCKER(lock) LibThread::Locker locker(lock)
@@ -36,6 +36,7 @@
 #include <LibCore/MimeData.h>
 #include <LibHTTP/HttpRequest.h>
 #include <stdio.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
@@ -125,10 +126,10 @@ void Client::handle_request(ReadonlyBytes raw_request)
         return;
     }
 
-    send_response(file->read_all(), request, Core::guess_mime_type_based_on_filename(real_path));
+    send_file_response(*file, request, Core::guess_mime_type_based_on_filename(real_path));
 }
 
-void Client::send_response(StringView response, const HTTP::HttpRequest& request, const String& content_type)
+void Client::send_response_header(const String& content_type)
 {
     StringBuilder builder;
     builder.append("HTTP/1.0 200 OK\r\n");
@@ -139,11 +140,42 @@ void Client::send_response(StringView response, const HTTP::HttpRequest& request
     builder.append("\r\n");
 
     m_socket->write(builder.to_string());
+}
+
+void Client::send_response(StringView response, const HTTP::HttpRequest& request, const String& content_type)
+{
+    send_response_header(content_type);
     m_socket->write(response);
 
     log_response(200, request);
 }
 
+void Client::send_file_response(Core::File& file, const HTTP::HttpRequest& request, const String& content_type)
+{
+    struct stat file_stat;
+    if (fstat(file.fd(), &file_stat) < 0) {
+        perror("fstat");
+        send_error_response(500, "Internal server error!", request);
+        return;
+    }
+
+    send_response_header(content_type);
+
+    // Let the kernel copy the file into the socket straight from the page cache.
+    off_t offset = 0;
+    while (offset < file_stat.st_size) {
+        ssize_t nsent = sendfile(m_socket->fd(), file.fd(), &offset, file_stat.st_size - offset);
+        if (nsent < 0) {
+            perror("sendfile");
+            break;
+        }
+        if (nsent == 0)
+            break;
+    }
+
+    log_response(200, request);
+}
+
 void Client::send_redirect(StringView redirect_path, const HTTP::HttpRequest& request)
 {
     StringBuilder builder;
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+static int wait_for_events(int epfd, epoll_event* events, int max_events)
+{
+    int rc = epoll_wait(epfd, events, max_events, 0);
+    if (rc < 0)
+        perror("epoll_wait");
+    return rc;
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.u32 = 42;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &event) < 0) {
+        perror("epoll_ctl");
+        return 1;
+    }
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &event) == 0 || errno != EEXIST) {
+        fprintf(stderr, "adding the same fd twice should fail with EEXIST\n");
+        return 1;
+    }
+
+    epoll_event events[4];
+    if (wait_for_events(epfd, events, 4) != 0) {
+        fprintf(stderr, "empty pipe reported as readable\n");
+        return 1;
+    }
+
+    char byte = 'x';
+    if (write(fds[1], &byte, 1) != 1) {
+        perror("write");
+        return 1;
+    }
+    if (wait_for_events(epfd, events, 4) != 1 || !(events[0].events & EPOLLIN) || events[0].data.u32 != 42) {
+        fprintf(stderr, "pipe with data not reported as readable\n");
+        return 1;
+    }
+
+    // Level-triggered: still readable until the data is consumed.
+    if (wait_for_events(epfd, events, 4) != 1) {
+        fprintf(stderr, "level-triggered watch not reported again\n");
+        return 1;
+    }
+    if (read(fds[0], &byte, 1) != 1) {
+        perror("read");
+        return 1;
+    }
+    if (wait_for_events(epfd, events, 4) != 0) {
+        fprintf(stderr, "drained pipe reported as readable\n");
+        return 1;
+    }
+
+    // Closing the only fd for the read end must really close it, even though it's
+    // still in the set, and the watch has to go away with it.
+    if (write(fds[1], &byte, 1) != 1) {
+        perror("write");
+        return 1;
+    }
+    close(fds[0]);
+    if (write(fds[1], &byte, 1) >= 0 || errno != EPIPE) {
+        fprintf(stderr, "read end was kept open by the epoll set\n");
+        return 1;
+    }
+    if (wait_for_events(epfd, events, 4) != 0) {
+        fprintf(stderr, "closed fd still reported\n");
+        return 1;
+    }
+
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static bool expect_no_children(const char* what)
+{
+    int status;
+    if (waitpid(-1, &status, WNOHANG) >= 0 || errno != ECHILD) {
+        fprintf(stderr, "%s left a child process behind\n", what);
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    pid_t pid;
+    char* argv[] = { const_cast<char*>("true"), nullptr };
+    char* envp[] = { nullptr };
+
+    int rc = posix_spawn(&pid, "/this/does/not/exist", nullptr, nullptr, argv, envp);
+    if (rc != ENOENT) {
+        fprintf(stderr, "spawning a nonexistent path: expected ENOENT, got %s\n", strerror(rc));
+        return 1;
+    }
+    if (!expect_no_children("spawning a nonexistent path"))
+        return 1;
+
+    posix_spawn_file_actions_t file_actions;
+    posix_spawn_file_actions_init(&file_actions);
+    posix_spawn_file_actions_addopen(&file_actions, 0, "/this/does/not/exist", O_RDONLY, 0);
+    rc = posix_spawn(&pid, "/bin/true", &file_actions, nullptr, argv, envp);
+    posix_spawn_file_actions_destroy(&file_actions);
+    if (rc != ENOENT) {
+        fprintf(stderr, "failing addopen: expected ENOENT, got %s\n", strerror(rc));
+        return 1;
+    }
+    if (!expect_no_children("failing addopen"))
+        return 1;
+
+    rc = posix_spawn(&pid, "/bin/true", nullptr, nullptr, argv, envp);
+    if (rc != 0) {
+        fprintf(stderr, "spawning /bin/true: %s\n", strerror(rc));
+        return 1;
+    }
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "/bin/true didn't exit cleanly\n");
+        return 1;
+    }
+
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/InternetChecksum.h>
+#include <AK/String.h>
+#include <AK/Types.h>
+#include <AK/Vector.h>
+#include <LibCore/ElapsedTimer.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Compares the internet checksum (RFC 1071) in AK, which adds up 32-bit words in an
+// unrolled loop, with the 16-bit word at a time loop the kernel used to have.
+
+static u16 checksum_16bit_words(const void* ptr, size_t count)
+{
+    u32 checksum = 0;
+    auto* w = (const u16*)ptr;
+    while (count > 1) {
+        checksum += AK::convert_between_host_and_network_endian(*w++);
+        if (checksum & 0x80000000)
+            checksum = (checksum & 0xffff) | (checksum >> 16);
+        count -= 2;
+    }
+    if (count)
+        checksum += *(const u8*)w << 8;
+    while (checksum >> 16)
+        checksum = (checksum & 0xffff) + (checksum >> 16);
+    return AK::convert_between_host_and_network_endian((u16)~checksum);
+}
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: checksum_benchmark [-h] [-n total_megabytes] [-s size1,size2,...]\n");
+    exit(rc);
+}
+
+template<typename Callback>
+static u64 run(const char* name, size_t size, size_t iterations, Callback callback)
+{
+    static u8 buffer[65536];
+    for (size_t i = 0; i < sizeof(buffer); ++i)
+        buffer[i] = i * 31;
+
+    volatile u16 result = 0;
+    Core::ElapsedTimer timer;
+    timer.start();
+    for (size_t i = 0; i < iterations; ++i)
+        result = callback(buffer, size);
+    u64 elapsed_ms = max(timer.elapsed(), 1);
+
+    u64 total_bytes = (u64)size * iterations;
+    printf("%-8s size=%-6zu time=%llums throughput=%lluMiB/s checksum=%04x\n",
+        name, size, elapsed_ms, total_bytes * 1000 / elapsed_ms / MiB, (u16)result);
+    return elapsed_ms;
+}
+
+int main(int argc, char** argv)
+{
+    size_t total_megabytes = 256;
+    Vector<size_t> sizes;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hn:s:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 'n':
+            total_megabytes = atoi(optarg);
+            break;
+        case 's':
+            for (auto size : String(optarg).split(','))
+                sizes.append(atoi(size.characters()));
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    if (!total_megabytes)
+        exit_with_usage(1);
+
+    if (sizes.is_empty())
+        sizes = { 20, 64, 576, 1460, 9000, 65536 };
+
+    for (auto size : sizes) {
+        if (!size || size > 65536)
+            exit_with_usage(1);
+        size_t iterations = max((u64)total_megabytes * MiB / size, (u64)1);
+        u64 old_ms = run("16-bit", size, iterations, checksum_16bit_words);
+        u64 new_ms = run("32-bit", size, iterations, [](auto* data, size_t count) { return AK::internet_checksum(data, count); });
+        printf("speedup=%llu.%02llux\n", old_ms / new_ms, old_ms * 100 / new_ms % 100);
+    }
+    return 0;
+}
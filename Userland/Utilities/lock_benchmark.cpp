@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/String.h>
+#include <AK/Types.h>
+#include <AK/Vector.h>
+#include <LibCore/ElapsedTimer.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Measures how pthread mutexes, rwlocks and condition variables hold up
+// under contention. Every thread hammers the same lock, doing a configurable
+// amount of work inside and outside of the critical section.
+
+enum class Mode {
+    Mutex,
+    RWLock,
+    Cond,
+};
+
+struct Worker {
+    pthread_t thread;
+    u64 elapsed_ms;
+};
+
+static Mode s_mode = Mode::Mutex;
+static size_t s_operations = 100000;
+static size_t s_work = 16;
+static size_t s_read_percent = 90;
+
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t s_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+static volatile u64 s_shared_counter;
+static u64 s_generation;
+static size_t s_arrived;
+static size_t s_thread_count;
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: lock_benchmark [-h] [-m mutex|rwlock|cond] [-n operations_per_thread] [-t thread_count1,thread_count2,...] [-w work] [-r read_percent]\n");
+    exit(rc);
+}
+
+static void do_work(size_t amount)
+{
+    for (size_t i = 0; i < amount; ++i)
+        asm volatile("" ::: "memory");
+}
+
+// Every thread waits on the condition variable until all of them have
+// arrived, and the last one to arrive wakes everybody up with a broadcast.
+// This is where waking up all waiters at once used to hurt the most.
+static void barrier_wait()
+{
+    pthread_mutex_lock(&s_mutex);
+    u64 generation = s_generation;
+    if (++s_arrived == s_thread_count) {
+        s_arrived = 0;
+        s_generation++;
+        pthread_cond_broadcast(&s_cond);
+    } else {
+        while (generation == s_generation)
+            pthread_cond_wait(&s_cond, &s_mutex);
+    }
+    pthread_mutex_unlock(&s_mutex);
+}
+
+static void* run_worker(void* argument)
+{
+    auto& worker = *(Worker*)argument;
+    u32 random_state = (u32)(FlatPtr)&worker;
+    auto next_random = [&] {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        return random_state;
+    };
+
+    Core::ElapsedTimer timer;
+    timer.start();
+    for (size_t i = 0; i < s_operations; ++i) {
+        switch (s_mode) {
+        case Mode::Mutex:
+            pthread_mutex_lock(&s_mutex);
+            s_shared_counter = s_shared_counter + 1;
+            do_work(s_work);
+            pthread_mutex_unlock(&s_mutex);
+            break;
+        case Mode::RWLock:
+            if (next_random() % 100 < s_read_percent) {
+                pthread_rwlock_rdlock(&s_rwlock);
+                (void)s_shared_counter;
+                do_work(s_work);
+            } else {
+                pthread_rwlock_wrlock(&s_rwlock);
+                s_shared_counter = s_shared_counter + 1;
+                do_work(s_work);
+            }
+            pthread_rwlock_unlock(&s_rwlock);
+            break;
+        case Mode::Cond:
+            barrier_wait();
+            break;
+        }
+        do_work(s_work);
+    }
+    worker.elapsed_ms = timer.elapsed();
+    return nullptr;
+}
+
+int main(int argc, char** argv)
+{
+    Vector<size_t> thread_counts;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hm:n:t:w:r:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 'm':
+            if (!strcmp(optarg, "mutex"))
+                s_mode = Mode::Mutex;
+            else if (!strcmp(optarg, "rwlock"))
+                s_mode = Mode::RWLock;
+            else if (!strcmp(optarg, "cond"))
+                s_mode = Mode::Cond;
+            else
+                exit_with_usage(1);
+            break;
+        case 'n':
+            s_operations = atoi(optarg);
+            break;
+        case 't':
+            for (auto count : String(optarg).split(','))
+                thread_counts.append(atoi(count.characters()));
+            break;
+        case 'w':
+            s_work = atoi(optarg);
+            break;
+        case 'r':
+            s_read_percent = atoi(optarg);
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    if (s_read_percent > 100)
+        exit_with_usage(1);
+
+    if (thread_counts.is_empty())
+        thread_counts = { 1, 2, 4, 8 };
+
+    for (auto thread_count : thread_counts) {
+        if (!thread_count)
+            continue;
+
+        s_thread_count = thread_count;
+        s_arrived = 0;
+        s_shared_counter = 0;
+
+        Vector<Worker> workers;
+        workers.resize(thread_count);
+
+        Core::ElapsedTimer timer;
+        timer.start();
+        for (auto& worker : workers) {
+            if (int rc = pthread_create(&worker.thread, nullptr, run_worker, &worker); rc != 0) {
+                fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+                return 1;
+            }
+        }
+        u64 slowest_thread_ms = 0;
+        for (auto& worker : workers) {
+            pthread_join(worker.thread, nullptr);
+            slowest_thread_ms = max(slowest_thread_ms, worker.elapsed_ms);
+        }
+        u64 elapsed_ms = max(timer.elapsed(), 1);
+
+        u64 total_operations = (u64)s_operations * thread_count;
+        printf("threads=%zu operations=%llu time=%llums ops_per_sec=%llu slowest_thread=%llums\n",
+            thread_count, total_operations, elapsed_ms, total_operations * 1000 / elapsed_ms, slowest_thread_ms);
+    }
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/String.h>
+#include <AK/Types.h>
+#include <AK/Vector.h>
+#include <LibCore/ElapsedTimer.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Measures malloc() and free() throughput with a varying number of threads.
+// Every thread keeps a window of live allocations and keeps replacing random
+// entries in it, which is roughly what a busy program with short-lived objects does.
+
+static constexpr size_t live_allocations_per_thread = 256;
+
+struct Worker {
+    pthread_t thread;
+    size_t operations;
+    size_t min_size;
+    size_t max_size;
+    u64 elapsed_ms;
+};
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: malloc_benchmark [-h] [-n operations_per_thread] [-t thread_count1,thread_count2,...] [-s min_size] [-S max_size]\n");
+    exit(rc);
+}
+
+static void* run_worker(void* argument)
+{
+    auto& worker = *(Worker*)argument;
+    void* live[live_allocations_per_thread] = {};
+    u32 random_state = (u32)(FlatPtr)&worker;
+    auto next_random = [&] {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        return random_state;
+    };
+
+    Core::ElapsedTimer timer;
+    timer.start();
+    for (size_t i = 0; i < worker.operations; ++i) {
+        auto& slot = live[next_random() % live_allocations_per_thread];
+        free(slot);
+        size_t size = worker.min_size + next_random() % (worker.max_size - worker.min_size + 1);
+        slot = malloc(size);
+        // Touch the allocation, so the benchmark isn't too far removed from reality.
+        *(volatile u8*)slot = 0;
+    }
+    for (auto* ptr : live)
+        free(ptr);
+    worker.elapsed_ms = timer.elapsed();
+    return nullptr;
+}
+
+int main(int argc, char** argv)
+{
+    size_t operations = 1000000;
+    size_t min_size = 8;
+    size_t max_size = 256;
+    Vector<size_t> thread_counts;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hn:t:s:S:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 'n':
+            operations = atoi(optarg);
+            break;
+        case 't':
+            for (auto count : String(optarg).split(','))
+                thread_counts.append(atoi(count.characters()));
+            break;
+        case 's':
+            min_size = atoi(optarg);
+            break;
+        case 'S':
+            max_size = atoi(optarg);
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    if (!min_size || max_size < min_size)
+        exit_with_usage(1);
+
+    if (thread_counts.is_empty())
+        thread_counts = { 1, 2, 4, 8 };
+
+    for (auto thread_count : thread_counts) {
+        if (!thread_count)
+            continue;
+
+        Vector<Worker> workers;
+        workers.resize(thread_count);
+
+        Core::ElapsedTimer timer;
+        timer.start();
+        for (auto& worker : workers) {
+            worker.operations = operations;
+            worker.min_size = min_size;
+            worker.max_size = max_size;
+            if (int rc = pthread_create(&worker.thread, nullptr, run_worker, &worker); rc != 0) {
+                fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+                return 1;
+            }
+        }
+        u64 slowest_thread_ms = 0;
+        for (auto& worker : workers) {
+            pthread_join(worker.thread, nullptr);
+            slowest_thread_ms = max(slowest_thread_ms, worker.elapsed_ms);
+        }
+        u64 elapsed_ms = max(timer.elapsed(), 1);
+
+        u64 total_operations = (u64)operations * thread_count;
+        printf("threads=%zu operations=%llu time=%llums ops_per_sec=%llu slowest_thread=%llums\n",
+            thread_count, total_operations, elapsed_ms, total_operations * 1000 / elapsed_ms, slowest_thread_ms);
+    }
+
+    return 0;
+}
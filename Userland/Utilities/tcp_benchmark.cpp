@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2021, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/ByteBuffer.h>
+#include <AK/Types.h>
+#include <LibCore/ElapsedTimer.h>
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Measures TCP throughput. By default, both ends run in this process and talk over
+// the loopback adapter. To measure a real network adapter, run "tcp_benchmark -l"
+// on one machine and "tcp_benchmark -c <address>" on the other.
+
+static constexpr u16 default_port = 8123;
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: tcp_benchmark [-h] [-l | -c address] [-p port] [-s total_size_in_mib] [-b write_size_in_kib]\n");
+    exit(rc);
+}
+
+static void print_result(const char* what, u64 bytes, u64 elapsed_ms)
+{
+    elapsed_ms = max(elapsed_ms, (u64)1);
+    printf("%s %llu bytes in %llums: %llu KiB/s\n", what, bytes, elapsed_ms, bytes * 1000 / elapsed_ms / KiB);
+}
+
+static int listen_on(const char* address, u16 port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    int option = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+
+    sockaddr_in sin {};
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = address ? inet_addr(address) : INADDR_ANY;
+    if (bind(fd, (const sockaddr*)&sin, sizeof(sin)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, 1) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int connect_to(const char* address, u16 port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    sockaddr_in sin {};
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = inet_addr(address);
+    if (connect(fd, (const sockaddr*)&sin, sizeof(sin)) < 0) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Accepts a single connection and reads from it until the peer closes it.
+static void* run_sink(void* argument)
+{
+    int listen_fd = (int)(FlatPtr)argument;
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+        perror("accept");
+        return nullptr;
+    }
+
+    u8 buffer[64 * KiB];
+    u64 total_received = 0;
+    Core::ElapsedTimer timer;
+    timer.start();
+    for (;;) {
+        ssize_t nread = read(fd, buffer, sizeof(buffer));
+        if (nread < 0) {
+            perror("read");
+            break;
+        }
+        if (nread == 0)
+            break;
+        total_received += nread;
+    }
+    print_result("Received", total_received, timer.elapsed());
+    close(fd);
+    return nullptr;
+}
+
+static int run_source(int fd, u64 total_size, size_t write_size)
+{
+    auto buffer = ByteBuffer::create_zeroed(write_size);
+    u64 total_sent = 0;
+    Core::ElapsedTimer timer;
+    timer.start();
+    while (total_sent < total_size) {
+        ssize_t nwritten = write(fd, buffer.data(), min((u64)write_size, total_size - total_sent));
+        if (nwritten < 0) {
+            perror("write");
+            return 1;
+        }
+        total_sent += nwritten;
+    }
+    print_result("Sent", total_sent, timer.elapsed());
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    bool listen_only = false;
+    const char* remote_address = nullptr;
+    u16 port = default_port;
+    u64 total_size = 64 * MiB;
+    size_t write_size = 64 * KiB;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hlc:p:s:b:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 'l':
+            listen_only = true;
+            break;
+        case 'c':
+            remote_address = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 's':
+            total_size = (u64)atoi(optarg) * MiB;
+            break;
+        case 'b':
+            write_size = (size_t)atoi(optarg) * KiB;
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    if ((listen_only && remote_address) || !total_size || !write_size)
+        exit_with_usage(1);
+
+    if (listen_only) {
+        int listen_fd = listen_on(nullptr, port);
+        if (listen_fd < 0)
+            return 1;
+        for (;;)
+            run_sink((void*)(FlatPtr)listen_fd);
+    }
+
+    if (remote_address) {
+        int fd = connect_to(remote_address, port);
+        if (fd < 0)
+            return 1;
+        int rc = run_source(fd, total_size, write_size);
+        close(fd);
+        return rc;
+    }
+
+    int listen_fd = listen_on("127.0.0.1", port);
+    if (listen_fd < 0)
+        return 1;
+
+    pthread_t sink_thread;
+    if (int rc = pthread_create(&sink_thread, nullptr, run_sink, (void*)(FlatPtr)listen_fd); rc != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+        return 1;
+    }
+
+    int fd = connect_to("127.0.0.1", port);
+    if (fd < 0)
+        return 1;
+    int rc = run_source(fd, total_size, write_size);
+    close(fd);
+    pthread_join(sink_thread, nullptr);
+    close(listen_fd);
+    return rc;
+}